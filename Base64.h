@@ -0,0 +1,231 @@
+﻿#pragma once
+// VSTHost.cpp と tests/Base64Test.cpp で共有する
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#if !defined(VSTHOST_HAS_SSE4) && (defined(__AVX__) || defined(__SSE4_1__))
+#include <immintrin.h>
+#define VSTHOST_HAS_SSE4 1
+#endif
+#if !defined(VSTHOST_HAS_AVX2) && defined(__AVX2__)
+#define VSTHOST_HAS_AVX2 1
+#endif
+
+// --- base64 ---
+// 状態の受け渡しで使う。出力先は呼び出し側が用意する (改行は入れない)。
+// AVX2 / SSE4.1 でコンパイルした場合は 24 / 12 バイトずつまとめて変換し、残りと空白を含む部分は 1 文字ずつ処理する
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+// 文字 -> 6bit の値。値以外は kSpace / kPadding / kInvalid
+struct Base64DecodeTable
+{
+    enum : uint8_t
+    {
+        kSpace = 64,
+        kPadding = 65,
+        kInvalid = 255
+    };
+    uint8_t values[256];
+    Base64DecodeTable()
+    {
+        memset(values, kInvalid, sizeof(values));
+        for (uint8_t i = 0; i < 64; ++i)
+            values[(uint8_t)BASE64_ALPHABET[i]] = i;
+        values[' '] = values['\t'] = values['\r'] = values['\n'] = kSpace;
+        values['='] = kPadding;
+    }
+};
+static const Base64DecodeTable BASE64_DECODE_TABLE;
+inline size_t Base64EncodedLength(size_t bytes) { return (bytes + 2) / 3 * 4; }
+// 空白を含む場合は実際の長さより大きくなる
+inline size_t Base64DecodedMaxLength(size_t chars) { return (chars + 3) / 4 * 3; }
+#if defined(VSTHOST_HAS_SSE4)
+// 6bit の値 (0〜63) を 16 個ずつ文字にする
+static inline __m128i Base64EncodeLookup(__m128i indices)
+{
+    // 0〜25 -> 13、26〜51 -> 0、52〜63 -> 1〜12 にして表を引き、値に足す差分を得る
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, result), indices);
+}
+// 12 バイト (先頭から) を 6bit ずつ 16 個の値に分ける
+static inline __m128i Base64EncodeSplit(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t0, t1);
+}
+// 16 文字を 6bit の値にする。base64 の文字以外があれば false
+static inline bool Base64DecodeLookup(__m128i in, __m128i &values)
+{
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+    const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+    const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+    const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+    const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+    if (_mm_movemask_epi8(valid) != 0xFFFF)
+        return false;
+    __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+    shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+    values = _mm_add_epi8(in, shift);
+    return true;
+}
+// 6bit の値 16 個を 12 バイトにまとめる (先頭 12 バイトに入る)
+static inline __m128i Base64DecodePack(__m128i values)
+{
+    const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+#endif
+// size バイトを out に Base64EncodedLength(size) 文字で書く
+inline size_t Base64Encode(const uint8_t *data, size_t size, char *out)
+{
+    size_t i = 0;
+    char *p = out;
+#if defined(VSTHOST_HAS_AVX2)
+    for (; i + 28 <= size; i += 24, p += 32)
+    {
+        const __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(data + i))),
+                                                   _mm_loadu_si128((const __m128i *)(data + i + 12)), 1);
+        __m256i split = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(split, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(split, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t0, t1);
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                               'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        _mm256_storeu_si256((__m256i *)p, _mm256_add_epi8(_mm256_shuffle_epi8(shift, result), indices));
+    }
+#endif
+#if defined(VSTHOST_HAS_SSE4)
+    for (; i + 16 <= size; i += 12, p += 16)
+        _mm_storeu_si128((__m128i *)p, Base64EncodeLookup(Base64EncodeSplit(_mm_loadu_si128((const __m128i *)(data + i)))));
+#endif
+    for (; i + 3 <= size; i += 3, p += 4)
+    {
+        const uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        p[0] = BASE64_ALPHABET[v >> 18];
+        p[1] = BASE64_ALPHABET[(v >> 12) & 63];
+        p[2] = BASE64_ALPHABET[(v >> 6) & 63];
+        p[3] = BASE64_ALPHABET[v & 63];
+    }
+    if (i < size)
+    {
+        const uint32_t v = ((uint32_t)data[i] << 16) | (i + 1 < size ? (uint32_t)data[i + 1] << 8 : 0);
+        p[0] = BASE64_ALPHABET[v >> 18];
+        p[1] = BASE64_ALPHABET[(v >> 12) & 63];
+        p[2] = i + 1 < size ? BASE64_ALPHABET[(v >> 6) & 63] : '=';
+        p[3] = '=';
+        p += 4;
+    }
+    return (size_t)(p - out);
+}
+// length 文字を out (capacity バイト) に復号し、書いたバイト数を written に入れる。
+// 空白は読み飛ばし、末尾の '=' は省略されていてもよい。base64 でない文字があれば false
+inline bool Base64Decode(const char *text, size_t length, uint8_t *out, size_t capacity, size_t &written)
+{
+    size_t i = 0, o = 0;
+#if defined(VSTHOST_HAS_AVX2)
+    for (; i + 32 <= length && o + 32 <= capacity; i += 32, o += 24)
+    {
+        const __m256i in = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m128i lo, hi;
+        if (!Base64DecodeLookup(_mm256_castsi256_si128(in), lo) || !Base64DecodeLookup(_mm256_extracti128_si256(in, 1), hi))
+            break;
+        const __m256i values = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        const __m256i packed = _mm256_shuffle_epi8(words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                                            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm256_storeu_si256((__m256i *)(out + o), _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)));
+    }
+#endif
+#if defined(VSTHOST_HAS_SSE4)
+    for (; i + 16 <= length && o + 16 <= capacity; i += 16, o += 12)
+    {
+        __m128i values;
+        if (!Base64DecodeLookup(_mm_loadu_si128((const __m128i *)(text + i)), values))
+            break;
+        _mm_storeu_si128((__m128i *)(out + o), Base64DecodePack(values));
+    }
+#endif
+    // 4 文字とも base64 の文字ならまとめて変換する
+    for (; i + 4 <= length && o + 3 <= capacity; i += 4, o += 3)
+    {
+        const uint32_t a = BASE64_DECODE_TABLE.values[(uint8_t)text[i]], b = BASE64_DECODE_TABLE.values[(uint8_t)text[i + 1]];
+        const uint32_t c = BASE64_DECODE_TABLE.values[(uint8_t)text[i + 2]], d = BASE64_DECODE_TABLE.values[(uint8_t)text[i + 3]];
+        if ((a | b | c | d) >= 64)
+            break;
+        const uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[o] = (uint8_t)(v >> 16);
+        out[o + 1] = (uint8_t)(v >> 8);
+        out[o + 2] = (uint8_t)v;
+    }
+    uint32_t v = 0, n = 0;
+    bool padding = false;
+    for (; i < length; ++i)
+    {
+        const uint8_t d = BASE64_DECODE_TABLE.values[(uint8_t)text[i]];
+        if (d == Base64DecodeTable::kSpace)
+            continue;
+        if (d == Base64DecodeTable::kPadding)
+        {
+            padding = true;
+            continue;
+        }
+        if (d == Base64DecodeTable::kInvalid || padding)
+            return false; // '=' の後にデータが続いている場合も不正
+        v = (v << 6) | d;
+        if (++n == 4)
+        {
+            if (o + 3 > capacity)
+                return false;
+            out[o++] = (uint8_t)(v >> 16);
+            out[o++] = (uint8_t)(v >> 8);
+            out[o++] = (uint8_t)v;
+            v = 0;
+            n = 0;
+        }
+    }
+    if (n == 1 || o + (n > 0 ? n - 1 : 0) > capacity)
+        return false;
+    if (n == 2)
+        out[o++] = (uint8_t)(v >> 4);
+    else if (n == 3)
+    {
+        out[o++] = (uint8_t)(v >> 10);
+        out[o++] = (uint8_t)(v >> 2);
+    }
+    written = o;
+    return true;
+}
+inline std::string base64_encode(const uint8_t *data, size_t size)
+{
+    std::string text(Base64EncodedLength(size), '\0');
+    if (size > 0)
+        Base64Encode(data, size, &text[0]);
+    return text;
+}
+inline std::vector<uint8_t> base64_decode(const char *text, size_t length)
+{
+    std::vector<uint8_t> data(Base64DecodedMaxLength(length));
+    size_t written = 0;
+    if (!Base64Decode(text, length, data.data(), data.size(), written))
+        return {};
+    data.resize(written);
+    return data;
+}
@@ -1,4 +1,6 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
+// windows.h の min / max マクロが std::min / std::max を壊さないようにする
+#define NOMINMAX
 #define VERSION_STRING "v0.1.1"
 
 // --- VST SDK Headers ---
@@ -11,6 +13,8 @@
 #include "pluginterfaces/vst/ivsteditcontroller.h"
 #include "pluginterfaces/vst/ivstcomponent.h"
 #include "pluginterfaces/vst/ivstprocesscontext.h"
+#include "pluginterfaces/vst/ivstevents.h"
+#include "pluginterfaces/vst/ivstmidicontrollers.h"
 #include "pluginterfaces/vst/vsttypes.h"
 #include "pluginterfaces/gui/iplugview.h"
 #include "pluginterfaces/base/ustring.h"
@@ -19,22 +23,40 @@
 // --- Standard/Windows Headers ---
 #include <windows.h>
 #include <shellapi.h>
+#include <avrt.h>
 #include <string>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <atomic>
 #include <stdexcept>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cmath>
 #include <tchar.h>
 #include <cstdio>
-#include <wincrypt.h>
 #include <objbase.h>
 #include <sstream>
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define VSTHOST_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#define VSTHOST_HAS_SSE4 1
+#endif
+#if defined(__AVX2__)
+#define VSTHOST_HAS_AVX2 1
+#endif
+#include "Base64.h"
 
-#pragma comment(lib, "Crypt32.lib")
 #pragma comment(lib, "ole32.lib")
 #pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "avrt.lib")
 
 using namespace Steinberg;
 using namespace Steinberg::Vst;
@@ -70,34 +92,686 @@ struct AudioSharedData
 const int FLOAT_SIZE = sizeof(float);
 const int BUFFER_BYTES = MAX_BLOCK_SIZE * FLOAT_SIZE;
 const int SHARED_MEM_TOTAL_SIZE = sizeof(AudioSharedData) + (4 * BUFFER_BYTES);
-std::string base64_encode(const BYTE *data, DWORD data_len)
+
+// --- リングバッファ転送モード ---
+// クライアントが head を進めてブロックを積み、ホストが tail を進めて連続処理する SPSC リング。
+// 各スロットは従来の単一ブロック領域 (AudioSharedData + 4 バッファ) と同じレイアウト。
+enum class TransportMode
 {
-    if (data == nullptr || data_len == 0)
-        return "";
-    DWORD b64_len = 0;
-    if (!CryptBinaryToStringA(data, data_len, CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, NULL, &b64_len))
-        return "";
-    if (b64_len == 0)
-        return "";
-    std::string b64_str(b64_len, '\0');
-    if (!CryptBinaryToStringA(data, data_len, CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, &b64_str[0], &b64_len))
-        return "";
-    b64_str.resize(b64_len - 1);
-    return b64_str;
+    Event,
+    Ring
+};
+const uint32_t AUDIO_RING_MAGIC = 0x52545356; // "VSTR"
+const int DEFAULT_RING_SLOTS = 8;
+const int MAX_RING_SLOTS = 256;
+const size_t CACHE_LINE_SIZE = 64;
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared ring indices must be lock-free");
+struct AudioRingHeader
+{
+    uint32_t magic;
+    uint32_t slotCount;
+    uint32_t slotBytes;
+    uint32_t reserved;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head; // クライアントが書き込んだブロック数
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail; // ホストが処理を終えたブロック数
+};
+inline size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+const size_t RING_HEADER_BYTES = AlignUp(sizeof(AudioRingHeader), CACHE_LINE_SIZE);
+const size_t RING_SLOT_BYTES = AlignUp(SHARED_MEM_TOTAL_SIZE, CACHE_LINE_SIZE);
+
+// --- 共有メモリレイアウト v2 ---
+// ヘッダにバス構成とチャンネルごとのオフセットを書き出す自己記述型レイアウト。
+// プラグインのロードごとに書き直され、書き換え中は generation が奇数になる。
+// スロットの先頭は AudioSharedData で、チャンネルのオフセットはスロット先頭からの相対値。
+const uint32_t SHARED_LAYOUT_MAGIC = 0x4C545356; // "VSTL"
+const uint32_t SHARED_LAYOUT_VERSION = 2;
+const int MAX_LAYOUT_BUSES = 16;
+const int MAX_LAYOUT_CHANNELS = 256;
+const size_t DEFAULT_SHM_CAPACITY = 64 * 1024 * 1024;
+struct SharedBusLayout
+{
+    int32_t numChannels;
+    uint32_t firstChannel; // channelOffsets の添字
+};
+struct SharedLayoutHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerBytes;
+    std::atomic<uint32_t> generation;
+    uint64_t totalBytes;
+    uint32_t blockCapacity; // 1 ブロックの最大サンプル数
+    uint32_t sampleBytes;
+    uint32_t slotCount;
+    uint32_t slotBytes;
+    uint32_t slotsOffset; // マッピング先頭から最初のスロットまでのバイト数
+    uint32_t numInputBuses;
+    uint32_t numOutputBuses;
+    uint32_t numChannels;
+    SharedBusLayout inputBuses[MAX_LAYOUT_BUSES];
+    SharedBusLayout outputBuses[MAX_LAYOUT_BUSES];
+    uint32_t channelOffsets[MAX_LAYOUT_CHANNELS];
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head; // -transport ring 用
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail;
+};
+const size_t LAYOUT_HEADER_BYTES = AlignUp(sizeof(SharedLayoutHeader), CACHE_LINE_SIZE);
+
+// --- スピン待機付きウェイクアップ (-wake spin) ---
+// "<shm>_<uid>_wake" に置く同期ブロック。どちらの側もシーケンス番号を進めてから、
+// 相手が眠っている (waiting が 1) ときだけカーネル経由で起こす。
+// 判定は常にシーケンス番号で行うので、イベントのリセット競合で通知を取りこぼさない。
+enum class WakeMode
+{
+    Event,
+    Spin
+};
+const uint32_t WAKE_SYNC_MAGIC = 0x4B575356; // "VSWK"
+const int32_t DEFAULT_SPIN_MICROS = 50;
+struct WakeSyncBlock
+{
+    uint32_t magic;
+    uint32_t spinMicros;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> clientSeq; // クライアントが送ったブロック (リングでは通知) の数
+    std::atomic<uint32_t> hostWaiting;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> hostSeq; // ホストが処理を終えた数 (リングでは tail)
+    std::atomic<uint32_t> clientWaiting;
+};
+const size_t WAKE_SYNC_BYTES = AlignUp(sizeof(WakeSyncBlock), CACHE_LINE_SIZE);
+
+// パラメータ変更位置でブロックを分割するときの最短スライス長。これより近い変更はスライス内のオフセットで渡す
+const int32_t DEFAULT_PARAM_SPLIT_SAMPLES = 32;
+// 入力の無音がテールより長く続いた後、出力がこの値以下になったら process() を止める (約 -160dBFS)
+const float BYPASS_SILENCE_LEVEL = 1.0e-8f;
+
+// --- オートメーション (サンプル単位のパラメータ変更) ---
+// "<shm>_<uid>_automation" にオーディオのスロットと同じ数のブロックを置く。
+// クライアントはスロットを送る前に同じ番号のブロックへ点を書いて numPoints を設定し、
+// ホストはそのスロットを処理するときに点を読んで numPoints を 0 に戻す。
+const uint32_t AUTOMATION_MAGIC = 0x41545356; // "VSTA"
+const uint32_t MAX_AUTOMATION_POINTS = 1024;  // 1 ブロックあたり
+struct AutomationPoint
+{
+    uint32_t paramId;
+    int32_t sampleOffset; // ブロック先頭からの位置
+    double value;         // 正規化値 (0.0〜1.0)
+};
+struct AutomationBlock
+{
+    uint32_t numPoints;
+    uint32_t reserved;
+    AutomationPoint points[MAX_AUTOMATION_POINTS];
+};
+struct AutomationHeader
+{
+    uint32_t magic;
+    uint32_t slotCount;
+    uint32_t maxPoints;
+    uint32_t blockBytes; // ブロックの間隔。最初のブロックは AUTOMATION_HEADER_BYTES の位置
+};
+const size_t AUTOMATION_HEADER_BYTES = AlignUp(sizeof(AutomationHeader), CACHE_LINE_SIZE);
+const size_t AUTOMATION_BLOCK_BYTES = AlignUp(sizeof(AutomationBlock), CACHE_LINE_SIZE);
+
+// --- 出力パラメータ (メーター、ゲインリダクションなど) ---
+// "<shm>_<uid>_params" に先頭プラグインのパラメータごとの最新値を置く。GUI の有無に関係なく毎ブロック更新する。
+// 各エントリの sequence は書き換え中に奇数になり、書き終えると偶数に戻る (値が変わるたびに 2 増える)。
+const uint32_t OUTPUT_PARAM_MAGIC = 0x50545356; // "VSTP"
+const uint32_t MAX_OUTPUT_PARAMS = 8192;
+struct OutputParamEntry
+{
+    std::atomic<uint32_t> sequence;
+    uint32_t paramId;
+    double value; // 正規化値
+};
+struct OutputParamHeader
+{
+    uint32_t magic;
+    uint32_t capacity;
+    std::atomic<uint32_t> generation; // エントリの並びを書き直すたびに増える。書き換え中は奇数
+    std::atomic<uint32_t> numEntries;
+    std::atomic<uint32_t> sequence; // いずれかのエントリを更新するたびに増える
+};
+const size_t OUTPUT_PARAM_HEADER_BYTES = AlignUp(sizeof(OutputParamHeader), CACHE_LINE_SIZE);
+
+// --- ノート / MIDI イベント ---
+// "<shm>_<uid>_events" に入力リング (クライアント -> ホスト) と戻りリング (ホスト -> クライアント) を置く。
+// どちらも容量固定の SPSC リングで、head / tail は書いたエントリ数・読んだエントリ数。
+// blockIndex はマッピング作成から数えたブロック番号で、ホストはそのブロックを処理するときにイベントを渡す。
+const uint32_t EVENT_RING_MAGIC = 0x45545356; // "VSTE"
+const uint32_t EVENT_RING_CAPACITY = 4096;    // 2 のべき乗
+const uint32_t MAX_BLOCK_EVENTS = 1024;       // 1 ブロックで渡す最大数
+enum SharedEventType : uint16_t
+{
+    kSharedNoteOn = 1,
+    kSharedNoteOff = 2,
+    kSharedPolyPressure = 3,
+    kSharedControlChange = 4 // controller 128 はチャンネルプレッシャー、129 はピッチベンド
+};
+struct SharedEvent
+{
+    uint32_t blockIndex;
+    int32_t sampleOffset; // ブロック先頭からの位置
+    uint16_t type;        // SharedEventType
+    int16_t channel;
+    int16_t pitch; // ノート番号、または CC 番号
+    int16_t reserved;
+    float value;    // ベロシティ、プレッシャー、CC 値 (0.0〜1.0)
+    int32_t noteId; // 使わない場合は -1
+};
+struct EventRingHeader
+{
+    uint32_t magic;
+    uint32_t capacity;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> inputHead; // クライアントのみ更新
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> inputTail; // ホストのみ更新
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> outputHead; // ホストのみ更新
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> outputTail; // クライアントのみ更新
+};
+const size_t EVENT_RING_HEADER_BYTES = AlignUp(sizeof(EventRingHeader), CACHE_LINE_SIZE);
+
+// --- 処理時間の統計 ---
+// "<shm>_<uid>_stats" に置く。書くのはオーディオスレッドだけで、監視側と stats コマンドは読むだけ
+// (clientSignalNs だけはクライアントが書く)。
+// ヒストグラムは 2 のべき乗ごとの区間を 8 等分した対数線形の区間で数える。
+const uint32_t STATS_MAGIC = 0x53545356; // "VSTS"
+const uint32_t STATS_SUB_BUCKET_BITS = 3;
+const uint32_t STATS_BUCKETS = 320; // 2^42 (ナノ秒なら約 73 分) まで。超えた値は最後の区間に入る
+inline uint32_t HighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (uint32_t)index;
+#else
+    return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+}
+inline uint32_t StatsBucketIndex(uint64_t value)
+{
+    const uint64_t sub = 1ull << STATS_SUB_BUCKET_BITS;
+    if (value < sub)
+        return (uint32_t)value;
+    const uint32_t shift = HighestBit(value) - STATS_SUB_BUCKET_BITS;
+    const uint64_t index = (shift + 1) * sub + ((value >> shift) & (sub - 1));
+    return index < STATS_BUCKETS ? (uint32_t)index : STATS_BUCKETS - 1;
+}
+// 区間に入る最大の値
+inline uint64_t StatsBucketUpper(uint32_t index)
+{
+    const uint64_t sub = 1ull << STATS_SUB_BUCKET_BITS;
+    if (index < sub)
+        return index;
+    const uint32_t shift = index / (uint32_t)sub - 1;
+    return (((sub + index % sub) << shift) + (1ull << shift)) - 1;
+}
+struct StatsHistogram
+{
+    std::atomic<uint64_t> count, sum, max;
+    std::atomic<uint64_t> buckets[STATS_BUCKETS];
+    // 書き手は 1 スレッドなので、ロック付きの加算は使わない
+    void Record(uint64_t value)
+    {
+        std::atomic<uint64_t> &bucket = buckets[StatsBucketIndex(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value > max.load(std::memory_order_relaxed))
+            max.store(value, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    // 値の小さい方から fraction の位置にある区間の上限
+    uint64_t Percentile(double fraction) const
+    {
+        const uint64_t total = count.load(std::memory_order_acquire);
+        if (total == 0)
+            return 0;
+        const uint64_t target = (uint64_t)(fraction * (double)(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < STATS_BUCKETS; ++i)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= target)
+                return std::min(StatsBucketUpper(i), max.load(std::memory_order_relaxed));
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+};
+struct StatsPage
+{
+    uint32_t magic;
+    uint32_t bucketCount;   // STATS_BUCKETS
+    uint32_t subBucketBits; // STATS_SUB_BUCKET_BITS
+    uint32_t reserved;
+    // クライアントが通知の直前に書くモノトニック時刻 (ナノ秒、任意)。書かれていればウェイク遅延を測る
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> clientSignalNs;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> blocks; // 処理したブロック数
+    std::atomic<uint64_t> skippedBlocks;                   // プラグインがなく処理しなかったブロック数
+    std::atomic<uint64_t> wakes;                           // クライアントの通知で起きた回数
+    std::atomic<uint64_t> deadlineMisses;                  // ブロックの長さより処理に時間がかかった回数
+    StatsHistogram wakeLatencyNs;
+    StatsHistogram processNs;
+    StatsHistogram dspLoadPermille; // 処理時間 / ブロックの長さ (1000 = 100%)
+};
+const size_t STATS_PAGE_BYTES = AlignUp(sizeof(StatsPage), CACHE_LINE_SIZE);
+// std::chrono::steady_clock は QueryPerformanceCounter を使う
+inline uint64_t MonotonicNanos()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline void StatsIncrement(std::atomic<uint64_t> &counter)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// --- 状態の受け渡し ---
+// "<shm>_<uid>_state_<generation>" のデータ部に VST3_DUAL の中身
+// (int64 コンポーネントの長さ, データ, int64 コントローラの長さ, データ) を置く。
+// 容量が足りなくなると generation を 1 増やした名前で作り直すので、クライアントは応答の generation が変わったら開き直す。
+const uint32_t STATE_ARENA_MAGIC = 0x4D545356;         // "VSTM"
+const uint64_t STATE_ARENA_MIN_BYTES = 1024 * 1024;    // 最初に確保するデータ部
+const uint64_t STATE_ARENA_MAX_BYTES = 0x7FFFFFFFull; // IBStream の read / write は int32
+struct StateArenaHeader
+{
+    uint32_t magic;
+    uint32_t generation;
+    uint64_t capacity;   // データ部のバイト数
+    uint64_t stateBytes; // 最後に get_state_shm で書いた状態のバイト数
+};
+const size_t STATE_ARENA_HEADER_BYTES = AlignUp(sizeof(StateArenaHeader), CACHE_LINE_SIZE);
+
+struct HostOptions
+{
+    uint64_t uniqueId = 0;
+    std::wstring pipeNameBase = L"\\\\.\\pipe\\VstBridge";
+    std::wstring shmNameBase = L"Local\\VstSharedAudio";
+    std::wstring eventClientReadyNameBase = L"Local\\VstClientReady";
+    std::wstring eventHostDoneNameBase = L"Local\\VstHostDone";
+    TransportMode transport = TransportMode::Event;
+    int32_t ringSlots = DEFAULT_RING_SLOTS;
+    int32_t layoutVersion = 1;
+    size_t shmCapacity = DEFAULT_SHM_CAPACITY;
+    bool sample64 = false; // レイアウト2の共有バッファを倍精度にする
+    int32_t blockCapacity = 0; // レイアウト2で確保する 1 ブロックの最大サンプル数 (0 なら block_size)
+    int32_t paramSplitSamples = DEFAULT_PARAM_SPLIT_SAMPLES;
+    WakeMode wake = WakeMode::Event;
+    int32_t spinMicros = DEFAULT_SPIN_MICROS;
+    int32_t graphWorkers = 0; // グラフを並列実行する追加ワーカー数 (0 ならオーディオスレッドで順に実行)
+    bool sessions = false;    // 1 プロセスで複数セッションを扱う (-sessions)
+    int32_t audioWorkers = 2; // セッションのオーディオ処理を分担するスレッド数
+    // オーディオ処理のスレッドのリアルタイム設定
+    int32_t rtPriority = 0;           // 0 以外なら MMCSS に登録する (0 なら変更しない)
+    std::vector<int32_t> cpuAffinity; // 固定する CPU 番号 (スレッドごとに順に割り当てる)
+    bool lockMemory = false;          // メモリをページアウトさせない (-mlock)
+    bool prefault = false;            // 共有メモリとスタックを先に触っておく (-prefault)
+    bool flushDenormals = false;      // FTZ/DAZ を立てる (-ftz)
+    // 起動時に初期化済みのインスタンスを用意しておくプラグイン (-preload)
+    std::vector<std::string> preloadPaths;
+    int32_t preloadCount = 1;
+    std::string indexPath; // scan の索引ファイル (-index)。空なら実行ファイルと同じフォルダ
+};
+
+// 名前付き共有メモリ (CreateFileMapping / MapViewOfFile)。
+class SharedMemoryRegion
+{
+public:
+    SharedMemoryRegion() {}
+    ~SharedMemoryRegion() { Close(); }
+    SharedMemoryRegion(const SharedMemoryRegion &) = delete;
+    SharedMemoryRegion &operator=(const SharedMemoryRegion &) = delete;
+    bool Create(const std::wstring &name, size_t size);
+    void Close();
+    bool Lock();
+    bool Prefault();
+    void *data() const { return m_pData; }
+    size_t size() const { return m_size; }
+
+private:
+    HANDLE m_hMapping = NULL;
+    void *m_pData = nullptr;
+    size_t m_size = 0;
+};
+bool SharedMemoryRegion::Create(const std::wstring &name, size_t size)
+{
+    Close();
+    uint64_t size64 = (uint64_t)size;
+    m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size64 >> 32), (DWORD)(size64 & 0xFFFFFFFF), name.c_str());
+    if (!m_hMapping)
+        return false;
+    m_pData = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!m_pData)
+    {
+        Close();
+        return false;
+    }
+    m_size = size;
+    return true;
+}
+void SharedMemoryRegion::Close()
+{
+    if (m_pData)
+    {
+        UnmapViewOfFile(m_pData);
+        m_pData = nullptr;
+    }
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+    m_size = 0;
+}
+bool SharedMemoryRegion::Lock()
+{
+    // VirtualLock できる量はワーキングセットの最小値までなので、その分広げてからロックする
+    SIZE_T minSize = 0, maxSize = 0;
+    if (!m_pData || !GetProcessWorkingSetSize(GetCurrentProcess(), &minSize, &maxSize))
+        return false;
+    SetProcessWorkingSetSize(GetCurrentProcess(), minSize + m_size, std::max<SIZE_T>(maxSize, minSize + m_size));
+    return VirtualLock(m_pData, m_size) != FALSE;
+}
+bool SharedMemoryRegion::Prefault()
+{
+    if (!m_pData)
+        return false;
+    // 読み取りでページを確定させる (クライアントが書き込み中でも内容は変えない)
+    volatile const char *p = (volatile const char *)m_pData;
+    for (size_t offset = 0; offset < m_size; offset += 4096)
+        (void)p[offset];
+    return true;
+}
+
+// パイプで受け取るパスは UTF-8
+static std::wstring Utf8ToWide(const std::string &text)
+{
+    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0);
+    std::wstring result(len > 0 ? len : 0, L'\0');
+    if (len > 0)
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), (int)text.size(), &result[0], len);
+    return result;
+}
+// コマンドライン引数のパスをパイプのコマンドと同じ UTF-8 にする
+static std::string WideToUtf8(const std::wstring &text)
+{
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    std::string result(len > 0 ? len : 0, '\0');
+    if (len > 0)
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &result[0], len, NULL, NULL);
+    return result;
+}
+// プラグインの更新時刻 (取得できなければ 0)。.vst3 はバンドル (ディレクトリ) のこともある
+static uint64_t PluginModifiedTime(const std::string &path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(Utf8ToWide(path).c_str(), GetFileExInfoStandard, &data))
+        return 0;
+    return ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+}
+
+// ファイル全体を読み取り専用でマップする (オフラインレンダリングの入力用)
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    bool Open(const std::string &path);
+    void Close();
+    const unsigned char *data() const { return m_pData; }
+    size_t size() const { return m_size; }
+
+private:
+    HANDLE m_hFile = INVALID_HANDLE_VALUE;
+    HANDLE m_hMapping = NULL;
+    const unsigned char *m_pData = nullptr;
+    size_t m_size = 0;
+};
+bool MappedFile::Open(const std::string &path)
+{
+    Close();
+    m_hFile = CreateFileW(Utf8ToWide(path).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0)
+    {
+        Close();
+        return false;
+    }
+    m_hMapping = CreateFileMappingW(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_hMapping)
+    {
+        Close();
+        return false;
+    }
+    m_pData = (const unsigned char *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_pData)
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+void MappedFile::Close()
+{
+    if (m_pData)
+    {
+        UnmapViewOfFile(m_pData);
+        m_pData = nullptr;
+    }
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+}
+
+inline void CpuRelax()
+{
+#if defined(VSTHOST_HAS_SSE2)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// --- リアルタイム設定 (-rt_priority, -cpu_affinity, -mlock, -prefault, -ftz) ---
+// 設定はプロセス共通で、オーディオ処理の各スレッドが自分に適用した結果をまとめて rt_status で返す
+enum RealtimeResult : int32_t
+{
+    kRtOff = 0,  // 指定なし
+    kRtApplied,  // すべてのスレッド (領域) で適用できた
+    kRtPartial,  // 一部だけ適用できた
+    kRtFailed
+};
+struct RealtimeStatus
+{
+    std::atomic<int32_t> priority{kRtOff}, affinity{kRtOff}, memoryLock{kRtOff}, prefault{kRtOff}, denormals{kRtOff};
+    static void Record(std::atomic<int32_t> &item, bool ok)
+    {
+        int32_t current = item.load();
+        int32_t next;
+        do
+        {
+            if (current == kRtOff)
+                next = ok ? kRtApplied : kRtFailed;
+            else if (current == (ok ? kRtFailed : kRtApplied))
+                next = kRtPartial;
+            else
+                return;
+        } while (!item.compare_exchange_weak(current, next));
+    }
+    static const char *Name(int32_t result)
+    {
+        static const char *names[] = {"off", "applied", "partial", "failed"};
+        return (result >= kRtOff && result <= kRtFailed) ? names[result] : "unknown";
+    }
+    std::string ToString() const
+    {
+        return std::string("priority=") + Name(priority.load()) + " affinity=" + Name(affinity.load()) +
+               " mlock=" + Name(memoryLock.load()) + " prefault=" + Name(prefault.load()) + " ftz=" + Name(denormals.load());
+    }
+};
+RealtimeStatus g_realtimeStatus;
+const size_t STACK_PREFAULT_BYTES = 256 * 1024;
+
+static void PrefaultStack()
+{
+    char stack[STACK_PREFAULT_BYTES];
+    volatile char *p = stack;
+    for (size_t i = 0; i < STACK_PREFAULT_BYTES; i += 4096)
+        p[i] = 0;
+}
+// 呼び出したスレッドに設定を適用する。cpuSlot は cpuAffinity の何番目を使うか (一覧の長さで折り返す)
+void ApplyRealtimeThreadSettings(const HostOptions &options, int32_t cpuSlot)
+{
+    if (options.rtPriority > 0)
+    {
+        // 値は使わず、MMCSS の "Pro Audio" タスクとして登録する
+        DWORD taskIndex = 0;
+        HANDLE hTask = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+        RealtimeStatus::Record(g_realtimeStatus.priority, hTask && AvSetMmThreadPriority(hTask, AVRT_PRIORITY_CRITICAL));
+    }
+    if (!options.cpuAffinity.empty())
+    {
+        int32_t cpu = options.cpuAffinity[cpuSlot % options.cpuAffinity.size()];
+        RealtimeStatus::Record(g_realtimeStatus.affinity, cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0);
+    }
+    if (options.prefault)
+    {
+        PrefaultStack();
+        RealtimeStatus::Record(g_realtimeStatus.prefault, true);
+    }
+    if (options.flushDenormals)
+    {
+#if defined(VSTHOST_HAS_SSE2)
+        // MXCSR の FTZ (bit 15) と DAZ (bit 6)
+        _mm_setcsr(_mm_getcsr() | 0x8040);
+        RealtimeStatus::Record(g_realtimeStatus.denormals, (_mm_getcsr() & 0x8040) == 0x8040);
+#else
+        RealtimeStatus::Record(g_realtimeStatus.denormals, false);
+#endif
+    }
+}
+
+// --- サンプル形式の変換 ---
+// 256 ビットの vcvtpd2ps / vcvtps2pd は AVX の命令なので、AVX2 ではなく __AVX__ (/arch:AVX 以上) で切り替える。
+// AVX2 のビルドでも同じコードになる。それ以外は SSE2 で 2 サンプルずつ変換する
+void ConvertDoubleToFloat(const double *src, float *dst, int32 numSamples)
+{
+    int32 i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= numSamples; i += 4)
+        _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_loadu_pd(src + i)));
+#elif defined(VSTHOST_HAS_SSE2)
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+        _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+    }
+#endif
+    for (; i < numSamples; ++i)
+        dst[i] = (float)src[i];
+}
+void ConvertFloatToDouble(const float *src, double *dst, int32 numSamples)
+{
+    int32 i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= numSamples; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+#elif defined(VSTHOST_HAS_SSE2)
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(src + i);
+        _mm_storeu_pd(dst + i, _mm_cvtps_pd(v));
+        _mm_storeu_pd(dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+#endif
+    for (; i < numSamples; ++i)
+        dst[i] = (double)src[i];
+}
+
+// --- 無音検出 ---
+// 全サンプルの絶対値が threshold 以下なら true (NaN は無音としない)。threshold 0 なら完全な 0 だけを無音とする。
+// 4 ベクトル分をまとめて比較し、無音でないサンプルが見つかった時点で抜ける
+bool IsSilentBuffer(const float *src, int32 numSamples, float threshold)
+{
+    int32 i = 0;
+#if defined(__AVX__)
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    const __m256 limit = _mm256_set1_ps(threshold);
+    for (; i + 32 <= numSamples; i += 32)
+    {
+        __m256 a = _mm256_cmp_ps(_mm256_and_ps(_mm256_loadu_ps(src + i), absMask), limit, _CMP_NLE_UQ);
+        __m256 b = _mm256_cmp_ps(_mm256_and_ps(_mm256_loadu_ps(src + i + 8), absMask), limit, _CMP_NLE_UQ);
+        __m256 c = _mm256_cmp_ps(_mm256_and_ps(_mm256_loadu_ps(src + i + 16), absMask), limit, _CMP_NLE_UQ);
+        __m256 d = _mm256_cmp_ps(_mm256_and_ps(_mm256_loadu_ps(src + i + 24), absMask), limit, _CMP_NLE_UQ);
+        if (_mm256_movemask_ps(_mm256_or_ps(_mm256_or_ps(a, b), _mm256_or_ps(c, d))))
+            return false;
+    }
+#elif defined(VSTHOST_HAS_SSE2)
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 limit = _mm_set1_ps(threshold);
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m128 a = _mm_cmpnle_ps(_mm_and_ps(_mm_loadu_ps(src + i), absMask), limit);
+        __m128 b = _mm_cmpnle_ps(_mm_and_ps(_mm_loadu_ps(src + i + 4), absMask), limit);
+        __m128 c = _mm_cmpnle_ps(_mm_and_ps(_mm_loadu_ps(src + i + 8), absMask), limit);
+        __m128 d = _mm_cmpnle_ps(_mm_and_ps(_mm_loadu_ps(src + i + 12), absMask), limit);
+        if (_mm_movemask_ps(_mm_or_ps(_mm_or_ps(a, b), _mm_or_ps(c, d))))
+            return false;
+    }
+#endif
+    for (; i < numSamples; ++i)
+    {
+        if (!(std::fabs(src[i]) <= threshold))
+            return false;
+    }
+    return true;
 }
-std::vector<BYTE> base64_decode(const std::string &b64_str)
+bool IsSilentBuffer(const double *src, int32 numSamples, double threshold)
 {
-    if (b64_str.empty())
-        return {};
-    DWORD bin_len = 0;
-    if (!CryptStringToBinaryA(b64_str.c_str(), (DWORD)b64_str.length(), CRYPT_STRING_BASE64, NULL, &bin_len, NULL, NULL))
-        return {};
-    if (bin_len == 0)
-        return {};
-    std::vector<BYTE> bin_data(bin_len);
-    if (!CryptStringToBinaryA(b64_str.c_str(), (DWORD)b64_str.length(), CRYPT_STRING_BASE64, bin_data.data(), &bin_len, NULL, NULL))
-        return {};
-    return bin_data;
+    int32 i = 0;
+#if defined(__AVX__)
+    const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    const __m256d limit = _mm256_set1_pd(threshold);
+    for (; i + 16 <= numSamples; i += 16)
+    {
+        __m256d a = _mm256_cmp_pd(_mm256_and_pd(_mm256_loadu_pd(src + i), absMask), limit, _CMP_NLE_UQ);
+        __m256d b = _mm256_cmp_pd(_mm256_and_pd(_mm256_loadu_pd(src + i + 4), absMask), limit, _CMP_NLE_UQ);
+        __m256d c = _mm256_cmp_pd(_mm256_and_pd(_mm256_loadu_pd(src + i + 8), absMask), limit, _CMP_NLE_UQ);
+        __m256d d = _mm256_cmp_pd(_mm256_and_pd(_mm256_loadu_pd(src + i + 12), absMask), limit, _CMP_NLE_UQ);
+        if (_mm256_movemask_pd(_mm256_or_pd(_mm256_or_pd(a, b), _mm256_or_pd(c, d))))
+            return false;
+    }
+#elif defined(VSTHOST_HAS_SSE2)
+    const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    const __m128d limit = _mm_set1_pd(threshold);
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        __m128d a = _mm_cmpnle_pd(_mm_and_pd(_mm_loadu_pd(src + i), absMask), limit);
+        __m128d b = _mm_cmpnle_pd(_mm_and_pd(_mm_loadu_pd(src + i + 2), absMask), limit);
+        __m128d c = _mm_cmpnle_pd(_mm_and_pd(_mm_loadu_pd(src + i + 4), absMask), limit);
+        __m128d d = _mm_cmpnle_pd(_mm_and_pd(_mm_loadu_pd(src + i + 6), absMask), limit);
+        if (_mm_movemask_pd(_mm_or_pd(_mm_or_pd(a, b), _mm_or_pd(c, d))))
+            return false;
+    }
+#endif
+    for (; i < numSamples; ++i)
+    {
+        if (!(std::fabs(src[i]) <= threshold))
+            return false;
+    }
+    return true;
 }
 
 class WindowController : public IPlugFrame
@@ -161,1091 +835,6325 @@ private:
     std::atomic<uint32> m_refCount;
 };
 
-class VstHost : public IHostApplication, public IComponentHandler, public IComponentHandler2
+// リアルタイムスレッドでメモリ確保をしないための固定容量パラメータキュー。
+// 容量は非リアルタイムスレッドの SetCapacity でのみ変更する。
+const int32 PARAM_QUEUE_POINTS = 16;
+// オートメーションを受け取る先頭段の入力キューは多めに確保する
+const int32 AUTOMATION_QUEUE_POINTS = 64;
+class HostParamValueQueue : public IParamValueQueue
 {
 public:
-    VstHost(HINSTANCE hInstance, uint64_t unique_id,
-            const std::wstring &pipeNameBase,
-            const std::wstring &shmNameBase,
-            const std::wstring &eventClientReadyNameBase,
-            const std::wstring &eventHostDoneNameBase);
-    ~VstHost();
-    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override;
-    uint32 PLUGIN_API addRef() override;
-    uint32 PLUGIN_API release() override;
-    tresult PLUGIN_API getName(String128 name) override;
-    tresult PLUGIN_API createInstance(TUID cid, TUID iid, void **obj) override;
-    tresult PLUGIN_API beginEdit(ParamID id) override;
-    tresult PLUGIN_API performEdit(ParamID id, ParamValue valueNormalized) override;
-    tresult PLUGIN_API endEdit(ParamID id) override;
-    tresult PLUGIN_API restartComponent(int32 flags) override;
-    tresult PLUGIN_API setDirty(TBool state) override { return kResultOk; }
-    tresult PLUGIN_API requestOpenEditor(FIDString name = nullptr) override
+    void SetCapacity(int32 maxPoints)
     {
-        if (m_hMainThreadMsgWindow)
-            PostMessage(m_hMainThreadMsgWindow, WM_APP_SHOW_GUI, 0, 0);
-        return kResultOk;
+        m_points.resize(maxPoints);
+        m_numPoints = 0;
     }
-    tresult PLUGIN_API startGroupEdit() override { return kResultOk; }
-    tresult PLUGIN_API finishGroupEdit() override { return kResultOk; }
-    bool Initialize();
-    void Cleanup();
-    void RunMessageLoop();
-    void RequestStop();
-
-private:
-    static DWORD WINAPI PipeThreadProc(LPVOID p)
+    void Reset(ParamID id)
     {
-        HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
-        if (SUCCEEDED(hr))
+        m_paramId = id;
+        m_numPoints = 0;
+    }
+    // 末尾より後ろの sampleOffset に点を足すと容量を超えるなら true (同じ位置の点は置き換えるので超えない)
+    bool IsFullAt(int32 sampleOffset) const
+    {
+        return m_numPoints >= (int32)m_points.size() && (m_numPoints == 0 || m_points[m_numPoints - 1].sampleOffset < sampleOffset);
+    }
+    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override
+    {
+        if (FUnknownPrivate::iidEqual(_iid, IParamValueQueue::iid) || FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
         {
-            ((VstHost *)p)->HandlePipeCommands();
-            CoUninitialize();
+            *obj = this;
+            return kResultTrue;
         }
-        return 0;
+        *obj = nullptr;
+        return kNoInterface;
     }
-    static DWORD WINAPI AudioThreadProc(LPVOID p)
+    // 所有者は ProcessPlan なので参照カウントは使わない
+    uint32 PLUGIN_API addRef() override { return 1; }
+    uint32 PLUGIN_API release() override { return 1; }
+    ParamID PLUGIN_API getParameterId() override { return m_paramId; }
+    int32 PLUGIN_API getPointCount() override { return m_numPoints; }
+    tresult PLUGIN_API getPoint(int32 index, int32 &sampleOffset, ParamValue &value) override
     {
-        ((VstHost *)p)->HandleAudioProcessing();
-        return 0;
+        if (index < 0 || index >= m_numPoints)
+            return kResultFalse;
+        sampleOffset = m_points[index].sampleOffset;
+        value = m_points[index].value;
+        return kResultTrue;
     }
-    static LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
-    static LRESULT CALLBACK MainThreadMsgWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
-    void HandlePipeCommands();
-    void HandleAudioProcessing();
-    void ProcessQueuedCommands();
-    void ShowGui();
-    void HideGui();
-    void OnGuiClose();
-    bool InitIPC();
-    std::string ProcessCommand(const std::string &full_cmd);
-    bool LoadPlugin(const std::string &path, double sampleRate, int32 blockSize);
-    void ReleasePlugin();
-    void ProcessAudioBlock();
-    void ProcessGuiUpdates();
-    std::atomic<uint32> m_refCount;
-    uint64_t m_uniqueId;
-    HINSTANCE m_hInstance;
-    std::atomic<bool> m_mainLoopRunning, m_threadsRunning;
-    HANDLE m_hPipeThread = NULL, m_hAudioThread = NULL;
-    HANDLE m_hPipe = INVALID_HANDLE_VALUE, m_hShm = NULL;
-    void *m_pSharedMem = nullptr;
-    AudioSharedData *m_pAudioData = nullptr;
-    HANDLE m_hEventClientReady = NULL, m_hEventHostDone = NULL;
-    std::mutex m_commandMutex, m_syncMutex;
-    std::mutex m_paramMutex;
-    std::mutex m_processorUpdateMutex;
-    std::vector<std::pair<ParamID, ParamValue>> m_processorParamUpdates;
-    static const UINT_PTR IDT_GUI_TIMER = 1;
-    std::vector<std::pair<ParamID, ParamValue>> m_pendingParamChanges;
-    std::vector<std::string> m_commandQueue;
-    std::condition_variable m_syncCv;
-    std::string m_syncCommand, m_syncResult;
-    bool m_syncSuccess = false;
-    Module::Ptr m_module;
-    PlugProvider *m_plugProvider = nullptr;
-    IComponent *m_component = nullptr;
-    IEditController *m_controller = nullptr;
-    IAudioProcessor *m_processor = nullptr;
-    std::atomic<bool> m_isPluginReady;
-    HWND m_hGuiWindow = NULL, m_hMainThreadMsgWindow = NULL;
-    FUnknownPtr<IPlugView> m_plugView;
-    WindowController *m_windowController = nullptr;
-    static const UINT WM_APP_SHOW_GUI = WM_APP + 1;
-    static const UINT WM_APP_HIDE_GUI = WM_APP + 2;
-    std::wstring m_pipeNameBase;
-    std::wstring m_shmNameBase;
-    std::wstring m_eventClientReadyNameBase;
-    std::wstring m_eventHostDoneNameBase;
+    tresult PLUGIN_API addPoint(int32 sampleOffset, ParamValue value, int32 &index) override
+    {
+        int32 dest = m_numPoints;
+        for (int32 i = 0; i < m_numPoints; ++i)
+        {
+            if (m_points[i].sampleOffset == sampleOffset)
+            {
+                m_points[i].value = value;
+                index = i;
+                return kResultTrue;
+            }
+            if (m_points[i].sampleOffset > sampleOffset)
+            {
+                dest = i;
+                break;
+            }
+        }
+        if (m_numPoints >= (int32)m_points.size())
+        {
+            // 満杯なら、後ろに来る点で最後の点を置き換えてスライス末の値を保つ
+            if (m_numPoints > 0 && dest == m_numPoints)
+            {
+                m_points[m_numPoints - 1] = {sampleOffset, value};
+                index = m_numPoints - 1;
+                return kResultTrue;
+            }
+            index = -1;
+            return kResultFalse;
+        }
+        for (int32 i = m_numPoints; i > dest; --i)
+            m_points[i] = m_points[i - 1];
+        m_points[dest] = {sampleOffset, value};
+        ++m_numPoints;
+        index = dest;
+        return kResultTrue;
+    }
+
+private:
+    struct Point
+    {
+        int32 sampleOffset;
+        ParamValue value;
+    };
+    ParamID m_paramId = kNoParamId;
+    std::vector<Point> m_points;
+    int32 m_numPoints = 0;
+};
+class HostParameterChanges : public IParameterChanges
+{
+public:
+    void SetCapacity(int32 maxParameters, int32 maxPoints)
+    {
+        m_queues.resize(maxParameters);
+        for (auto &queue : m_queues)
+            queue.SetCapacity(maxPoints);
+        m_numUsed = 0;
+    }
+    void Clear() { m_numUsed = 0; }
+    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override
+    {
+        if (FUnknownPrivate::iidEqual(_iid, IParameterChanges::iid) || FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
+        {
+            *obj = this;
+            return kResultTrue;
+        }
+        *obj = nullptr;
+        return kNoInterface;
+    }
+    uint32 PLUGIN_API addRef() override { return 1; }
+    uint32 PLUGIN_API release() override { return 1; }
+    int32 PLUGIN_API getParameterCount() override { return m_numUsed; }
+    IParamValueQueue *PLUGIN_API getParameterData(int32 index) override
+    {
+        return (index >= 0 && index < m_numUsed) ? &m_queues[index] : nullptr;
+    }
+    HostParamValueQueue *PLUGIN_API addParameterData(const ParamID &id, int32 &index) override
+    {
+        for (int32 i = 0; i < m_numUsed; ++i)
+        {
+            if (m_queues[i].getParameterId() == id)
+            {
+                index = i;
+                return &m_queues[i];
+            }
+        }
+        if (m_numUsed >= (int32)m_queues.size())
+        {
+            index = -1;
+            return nullptr;
+        }
+        index = m_numUsed++;
+        m_queues[index].Reset(id);
+        return &m_queues[index];
+    }
+
+private:
+    std::vector<HostParamValueQueue> m_queues;
+    int32 m_numUsed = 0;
 };
 
-VstHost *g_pVstHost = nullptr;
-VstHost::VstHost(HINSTANCE hInstance, uint64_t unique_id,
-                 const std::wstring &pipeNameBase,
-                 const std::wstring &shmNameBase,
-                 const std::wstring &eventClientReadyNameBase,
-                 const std::wstring &eventHostDoneNameBase)
-    : m_refCount(1), m_uniqueId(unique_id), m_hInstance(hInstance),
-      m_mainLoopRunning(false), m_threadsRunning(false), m_isPluginReady(false),
-      m_pipeNameBase(pipeNameBase),
-      m_shmNameBase(shmNameBase),
-      m_eventClientReadyNameBase(eventClientReadyNameBase),
-      m_eventHostDoneNameBase(eventHostDoneNameBase)
+// スレッド間でパラメータ値を受け渡す表。ロード時にコントローラのパラメータ一覧から
+// ID -> 添字の対応を作り、値は添字ごとの atomic スロット、変更の有無は 2 段のビット集合で持つ。
+// 書き手は値を書いてからビットを立て、読み手 (1 スレッドのみ) はビットを取り出してから値を読む。
+// どちらもロックを取らず、同じパラメータへの連続した変更は最後の値にまとまる。
+class ParamExchange
+{
+public:
+    // 読み書きするスレッドがいないときに呼ぶ (オーディオ停止中のメインスレッド)
+    void Build(const std::vector<ParamID> &ids)
+    {
+        m_lookup.clear();
+        m_lookup.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i)
+            m_lookup.emplace_back(ids[i], (uint32_t)i);
+        std::sort(m_lookup.begin(), m_lookup.end());
+        m_ids = ids;
+        m_values.reset(ids.empty() ? nullptr : new std::atomic<double>[ids.size()]);
+        for (size_t i = 0; i < ids.size(); ++i)
+            m_values[i].store(0.0, std::memory_order_relaxed);
+        m_numWords = (ids.size() + 63) / 64;
+        m_numSummaryWords = (m_numWords + 63) / 64;
+        m_dirty.reset(m_numWords ? new std::atomic<uint64_t>[m_numWords] : nullptr);
+        m_summary.reset(m_numSummaryWords ? new std::atomic<uint64_t>[m_numSummaryWords] : nullptr);
+        for (size_t w = 0; w < m_numWords; ++w)
+            m_dirty[w].store(0, std::memory_order_relaxed);
+        for (size_t s = 0; s < m_numSummaryWords; ++s)
+            m_summary[s].store(0, std::memory_order_release);
+    }
+    bool Matches(const std::vector<ParamID> &ids) const { return ids == m_ids; }
+    size_t Size() const { return m_ids.size(); }
+    // 表にない ID は false を返して捨てる
+    const std::vector<ParamID> &Ids() const { return m_ids; }
+    // 表にない ID は -1
+    int32 IndexOf(ParamID id) const
+    {
+        auto it = std::lower_bound(m_lookup.begin(), m_lookup.end(), std::make_pair(id, (uint32_t)0));
+        return (it == m_lookup.end() || it->first != id) ? -1 : (int32)it->second;
+    }
+    bool Set(ParamID id, ParamValue value)
+    {
+        const int32 found = IndexOf(id);
+        if (found < 0)
+            return false;
+        const uint32_t index = (uint32_t)found;
+        m_values[index].store(value, std::memory_order_relaxed);
+        const size_t word = index / 64;
+        m_dirty[word].fetch_or(1ull << (index % 64), std::memory_order_release);
+        m_summary[word / 64].fetch_or(1ull << (word % 64), std::memory_order_release);
+        return true;
+    }
+    // 前回から変更されたパラメータについて fn(id, value) を呼ぶ。コストは変更数に比例する
+    template <typename Fn>
+    void Drain(Fn &&fn)
+    {
+        for (size_t s = 0; s < m_numSummaryWords; ++s)
+        {
+            if (m_summary[s].load(std::memory_order_relaxed) == 0)
+                continue;
+            uint64_t words = m_summary[s].exchange(0, std::memory_order_acquire);
+            while (words)
+            {
+                const size_t word = s * 64 + CountTrailingZeros(words);
+                words &= words - 1;
+                uint64_t bits = m_dirty[word].exchange(0, std::memory_order_acquire);
+                while (bits)
+                {
+                    const size_t index = word * 64 + CountTrailingZeros(bits);
+                    bits &= bits - 1;
+                    fn(m_ids[index], m_values[index].load(std::memory_order_relaxed));
+                }
+            }
+        }
+    }
+
+private:
+    static uint32_t CountTrailingZeros(uint64_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, v);
+        return (uint32_t)index;
+#else
+        return (uint32_t)__builtin_ctzll(v);
+#endif
+    }
+    std::vector<ParamID> m_ids;
+    std::vector<std::pair<ParamID, uint32_t>> m_lookup; // ID 順
+    std::unique_ptr<std::atomic<double>[]> m_values;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_dirty;   // パラメータごとの変更ビット
+    std::unique_ptr<std::atomic<uint64_t>[]> m_summary; // m_dirty の 0 でない語を示すビット
+    size_t m_numWords = 0, m_numSummaryWords = 0;
+};
+
+// 容量固定の IEventList。確保は SetCapacity だけで、オーディオスレッドでは行わない
+class HostEventList : public IEventList
+{
+public:
+    void SetCapacity(int32 maxEvents)
+    {
+        m_events.clear();
+        m_events.reserve(maxEvents);
+    }
+    void Clear() { m_events.clear(); }
+    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override
+    {
+        if (FUnknownPrivate::iidEqual(_iid, IEventList::iid) || FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
+        {
+            *obj = this;
+            return kResultTrue;
+        }
+        *obj = nullptr;
+        return kNoInterface;
+    }
+    uint32 PLUGIN_API addRef() override { return 1; }
+    uint32 PLUGIN_API release() override { return 1; }
+    int32 PLUGIN_API getEventCount() override { return (int32)m_events.size(); }
+    tresult PLUGIN_API getEvent(int32 index, Event &e) override
+    {
+        if (index < 0 || index >= (int32)m_events.size())
+            return kResultFalse;
+        e = m_events[index];
+        return kResultTrue;
+    }
+    tresult PLUGIN_API addEvent(Event &e) override
+    {
+        if (m_events.size() >= m_events.capacity())
+            return kResultFalse;
+        m_events.push_back(e);
+        return kResultTrue;
+    }
+
+private:
+    std::vector<Event> m_events;
+};
+
+struct BlockParamChange
+{
+    ParamID id;
+    int32 sampleOffset;
+    ParamValue value;
+};
+
+// LoadPlugin 時に一度だけ組み立て、バス構成が変わったときだけ作り直す process() 用の構造一式。
+// オーディオスレッドはチャンネルポインタとサンプル数を書き換えるだけで確保は行わない。
+struct ProcessPlan
+{
+    std::vector<AudioBusBuffers> inputs, outputs;
+    std::vector<std::vector<float *>> inputPtrs, outputPtrs;
+    // スロット先頭からのチャンネルオフセット。共有メモリに割り当てがないチャンネルは -1
+    std::vector<std::vector<int64_t>> inputOffsets, outputOffsets;
+    std::vector<std::vector<double *>> inputPtrs64, outputPtrs64;
+    // 共有メモリが倍精度でプラグインが単精度のときの変換先
+    std::vector<float> convertScratch;
+    std::vector<std::vector<float *>> inputScratch, outputScratch;
+    // 最も広いサンプル形式に合わせて double で確保する
+    std::vector<double> silentInput, discardOutput;
+    // チェーンの中継バッファ。null なら入出力のオフセットはスロット先頭からの相対値
+    char *inputBase = nullptr;
+    char *outputBase = nullptr;
+    // 共有メモリ側が倍精度でプラグインが単精度のとき、その向きだけ変換する
+    bool convertInput = false, convertOutput = false;
+    int32 blockCapacity = 0;
+    int32 processSampleSize = kSample32;
+    int32 sharedSampleSize = kSample32;
+    // 1 回の process() に渡す最大サンプル数 (setupProcessing の maxSamplesPerBlock)
+    int32 maxSliceSamples = 0;
+    // 現在のブロックに適用するパラメータ変更 (サンプル位置順)
+    std::vector<BlockParamChange> blockChanges;
+    HostParameterChanges inParamChanges, outParamChanges;
+    HostEventList inEvents, outEvents;
+    ProcessContext context = {};
+    ProcessData data = {};
+    // 入力が続けて無音だったサンプル数と、テールが消えて process() を止めているかどうか
+    int64 silentSamples = 0;
+    bool bypassed = false;
+    // 音声入力がありイベント入力がないノードだけ止めてよい (シンセや発振器は入力が無音でも音を出す)
+    bool canBypass = false;
+};
+
+// オーディオスレッドが process() 中であることを示すフラグを立てる
+class AudioBusyScope
+{
+public:
+    explicit AudioBusyScope(std::atomic<bool> &busy) : m_busy(busy) { m_busy.store(true); }
+    ~AudioBusyScope() { m_busy.store(false); }
+
+private:
+    std::atomic<bool> &m_busy;
+};
+
+// チェーンの 2 段目以降に渡すコンポーネントハンドラ。
+// GUI を開かない段なのでパラメータ編集は受け取らず、再起動要求だけをホストに回す。
+class StageComponentHandler : public IComponentHandler
+{
+public:
+    void SetHost(IComponentHandler *host) { m_host = host; }
+    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override
+    {
+        if (FUnknownPrivate::iidEqual(_iid, IComponentHandler::iid) || FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
+        {
+            *obj = this;
+            return kResultTrue;
+        }
+        *obj = nullptr;
+        return kNoInterface;
+    }
+    // 所有者は PluginInstance なので参照カウントは使わない
+    uint32 PLUGIN_API addRef() override { return 1; }
+    uint32 PLUGIN_API release() override { return 1; }
+    tresult PLUGIN_API beginEdit(ParamID) override { return kResultOk; }
+    tresult PLUGIN_API performEdit(ParamID, ParamValue) override { return kResultOk; }
+    tresult PLUGIN_API endEdit(ParamID) override { return kResultOk; }
+    tresult PLUGIN_API restartComponent(int32 flags) override
+    {
+        return m_host ? m_host->restartComponent(flags) : kResultOk;
+    }
+
+private:
+    IComponentHandler *m_host = nullptr;
+};
+
+// プラグイン 1 つ分のインスタンスと、その process() 用の構造一式。グラフのノードも兼ねる
+struct PluginInstance
+{
+    Module::Ptr module;
+    PlugProvider *plugProvider = nullptr;
+    IComponent *component = nullptr;
+    IEditController *controller = nullptr;
+    IAudioProcessor *processor = nullptr;
+    std::string name;
+    int32 latencySamples = 0;
+    // getTailSamples の値。再起動要求で変わるのでオーディオスレッドからは atomic で読む
+    std::atomic<uint32> tailSamples{kNoTail};
+    ProcessPlan plan;
+    StageComponentHandler stageHandler;
+    // グラフ上の接続 (Stage の添字)
+    std::vector<uint32_t> predecessors, successors;
+    // このスライスでまだ終わっていない前段の数 (並列実行時のみ使う)
+    std::atomic<int32_t> pending{0};
+    // 全バスを通したチャンネル数
+    size_t inputChannels = 0, outputChannels = 0;
+    // 後段へ渡す出力と、前段が複数あるときの入力の合算先
+    std::vector<double> outputBuffer, mixBuffer;
+};
+
+// --- グラフ実行用のワーカープール ---
+const uint32_t MAX_GRAPH_NODES = 64;
+const int32_t MAX_GRAPH_WORKERS = 32;
+struct GraphEdge
+{
+    uint32_t from, to;
+};
+
+// 固定容量の Chase-Lev 両端キュー。Push/Pop は所有スレッドだけが、Steal は他のスレッドが呼ぶ
+class WorkStealingQueue
+{
+public:
+    WorkStealingQueue() : m_top(0), m_bottom(0)
+    {
+        for (auto &item : m_items)
+            item.store(0, std::memory_order_relaxed);
+    }
+    bool Push(uint32_t item)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if (b - t >= (int64_t)MAX_GRAPH_NODES)
+            return false;
+        m_items[b & (MAX_GRAPH_NODES - 1)].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+    bool Pop(uint32_t &item)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = m_items[b & (MAX_GRAPH_NODES - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // 最後の 1 つは盗みと競合するので CAS で取り合う
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+    bool Steal(uint32_t &item)
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        item = m_items[t & (MAX_GRAPH_NODES - 1)].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_top;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_bottom;
+    std::atomic<uint32_t> m_items[MAX_GRAPH_NODES];
+};
+
+// 1 スライス分のタスク (グラフのノード) を呼び出しスレッドとワーカーで分担して実行する。
+// 各スレッドは自分のキューから取り出し、空なら他のキューから盗む。
+// ワーカーは次のスライスを spinMicros だけスピンして待ち、その後セマフォで眠る。
+class GraphWorkerPool
+{
+public:
+    typedef void (*TaskFn)(void *context, int32 worker, uint32_t task);
+    GraphWorkerPool() : m_running(false), m_epoch(0), m_sleepers(0), m_remaining(0) {}
+    ~GraphWorkerPool() { Stop(); }
+    bool Start(int32 numWorkers, const HostOptions &options);
+    void Stop();
+    int32 WorkerCount() const { return (int32)m_threads.size(); }
+    // 呼び出しスレッドは worker 0 として参加し、numTasks 個のタスクがすべて終わるまで戻らない
+    void Run(TaskFn fn, void *context, uint32_t firstTask, uint32_t numTasks);
+    // タスクの中から後続のタスクを自分のキューに積む
+    void Push(int32 worker, uint32_t task) { m_queues[worker].Push(task); }
+
+private:
+    struct WorkerStart
+    {
+        GraphWorkerPool *pool;
+        int32 index;
+    };
+    static DWORD WINAPI WorkerThreadProc(LPVOID p)
+    {
+        WorkerStart *start = (WorkerStart *)p;
+        start->pool->WorkerLoop(start->index);
+        return 0;
+    }
+    void WorkerLoop(int32 index);
+    void WorkUntilDone(int32 index);
+    std::atomic<bool> m_running;
+    int32 m_spinMicros = 0;
+    const HostOptions *m_options = nullptr;
+    std::vector<HANDLE> m_threads;
+    std::vector<WorkerStart> m_starts;
+    std::unique_ptr<WorkStealingQueue[]> m_queues;
+    HANDLE m_hWake = NULL;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> m_epoch;
+    std::atomic<uint32_t> m_sleepers;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> m_remaining;
+    TaskFn m_fn = nullptr;
+    void *m_context = nullptr;
+};
+bool GraphWorkerPool::Start(int32 numWorkers, const HostOptions &options)
+{
+    Stop();
+    m_spinMicros = options.spinMicros;
+    m_options = &options;
+    m_queues.reset(new WorkStealingQueue[numWorkers + 1]);
+    m_hWake = CreateSemaphore(NULL, 0, numWorkers > 0 ? numWorkers * 2 + 1 : 1, NULL);
+    if (!m_hWake)
+        return false;
+    m_running = true;
+    m_starts.resize(numWorkers);
+    for (int32 i = 0; i < numWorkers; ++i)
+    {
+        m_starts[i] = {this, i + 1};
+        HANDLE h = CreateThread(NULL, 0, WorkerThreadProc, &m_starts[i], 0, NULL);
+        if (!h)
+        {
+            Stop();
+            return false;
+        }
+        SetThreadPriority(h, THREAD_PRIORITY_TIME_CRITICAL);
+        m_threads.push_back(h);
+    }
+    return true;
+}
+void GraphWorkerPool::Stop()
+{
+    if (m_running.exchange(false))
+    {
+        ReleaseSemaphore(m_hWake, (LONG)m_threads.size(), NULL);
+        for (HANDLE h : m_threads)
+        {
+            WaitForSingleObject(h, 2000);
+            CloseHandle(h);
+        }
+    }
+    m_threads.clear();
+    m_starts.clear();
+    if (m_hWake)
+    {
+        CloseHandle(m_hWake);
+        m_hWake = NULL;
+    }
+}
+void GraphWorkerPool::Run(TaskFn fn, void *context, uint32_t firstTask, uint32_t numTasks)
 {
+    m_fn = fn;
+    m_context = context;
+    m_remaining.store(numTasks, std::memory_order_release);
+    m_queues[0].Push(firstTask);
+    m_epoch.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t sleepers = m_sleepers.exchange(0);
+    if (sleepers > 0)
+        ReleaseSemaphore(m_hWake, (LONG)sleepers, NULL);
+    WorkUntilDone(0);
 }
-VstHost::~VstHost() { Cleanup(); }
-tresult PLUGIN_API VstHost::queryInterface(const TUID _iid, void **obj)
+void GraphWorkerPool::WorkerLoop(int32 index)
 {
-    if (FUnknownPrivate::iidEqual(_iid, IHostApplication::iid))
+    // CPU の割り当てはオーディオスレッド (0 番) の次から
+    ApplyRealtimeThreadSettings(*m_options, index);
+    uint32_t seen = m_epoch.load(std::memory_order_acquire);
+    while (m_running)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_spinMicros);
+        while (m_epoch.load(std::memory_order_acquire) == seen && m_running && std::chrono::steady_clock::now() < deadline)
+            CpuRelax();
+        if (m_epoch.load(std::memory_order_acquire) == seen)
+        {
+            // 起こし手はカウントした数だけセマフォを上げる。余った通知は次のループで読み捨てる
+            m_sleepers.fetch_add(1);
+            if (m_epoch.load() == seen && m_running)
+                WaitForSingleObject(m_hWake, 100);
+            continue;
+        }
+        seen = m_epoch.load(std::memory_order_acquire);
+        WorkUntilDone(index);
+    }
+}
+void GraphWorkerPool::WorkUntilDone(int32 index)
+{
+    const int32 numQueues = WorkerCount() + 1;
+    while (m_remaining.load(std::memory_order_acquire) > 0)
+    {
+        uint32_t task;
+        bool found = m_queues[index].Pop(task);
+        for (int32 n = 1; !found && n < numQueues; ++n)
+            found = m_queues[(index + n) % numQueues].Steal(task);
+        if (!found)
+        {
+            CpuRelax();
+            continue;
+        }
+        m_fn(m_context, index, task);
+        m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+// --- モジュールのキャッシュ ---
+// 読み込んだモジュールはパスと更新時刻をキーにして保持し、同じ .vst3 の再読み込みでは
+// エントリポイントとファクトリの列挙をやり直さない。グラフのノードやセッションでも共有する
+struct CachedModule
+{
+    uint64_t modifiedTime;
+    Module::Ptr module;
+};
+static std::mutex g_moduleCacheMutex;
+static std::map<std::string, CachedModule> g_moduleCache;
+Module::Ptr AcquireModule(const std::string &path, std::string &error)
+{
+    const uint64_t modifiedTime = PluginModifiedTime(path);
+    std::lock_guard<std::mutex> lock(g_moduleCacheMutex);
+    auto it = g_moduleCache.find(path);
+    if (it != g_moduleCache.end())
+    {
+        if (it->second.modifiedTime == modifiedTime)
+            return it->second.module;
+        // 更新されたファイルは読み込み直す。同じパスの DLL が残っていると LoadLibrary は古いモジュールを返すので、
+        // 先に解放する。まだ使っているインスタンスがあれば新しいファイルは読み込めない
+        if (it->second.module.use_count() > 1)
+        {
+            error = "An older version of the module is still in use.";
+            return nullptr;
+        }
+        g_moduleCache.erase(it);
+    }
+    Module::Ptr module = Module::create(path, error);
+    if (module)
+        g_moduleCache[path] = {modifiedTime, module};
+    return module;
+}
+// どのインスタンスも使っていないモジュールを解放する。paths を渡したときはそのパスのものだけ
+size_t PurgeModuleCache(const std::vector<std::string> *paths = nullptr)
+{
+    std::lock_guard<std::mutex> lock(g_moduleCacheMutex);
+    size_t purged = 0;
+    for (auto it = g_moduleCache.begin(); it != g_moduleCache.end();)
+    {
+        const bool listed = !paths || std::find(paths->begin(), paths->end(), it->first) != paths->end();
+        if (listed && it->second.module.use_count() == 1)
+        {
+            it = g_moduleCache.erase(it);
+            ++purged;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    return purged;
+}
+static bool IsPluginClassCategory(const std::string &category)
+{
+    return category == "Audio Module Class" || category == "Instrument Module Class" || category == "MIDI Module Class";
+}
+// 読み込むクラスを選ぶ。classId (TUID の 16 バイト) が空なら最初のオーディオ / インストゥルメント / MIDI モジュール
+static bool FindPluginClass(const PluginFactory &factory, const std::string &classId, ClassInfo &target)
+{
+    for (auto &classInfo : factory.classInfos())
+    {
+        if (!IsPluginClassCategory(classInfo.category()))
+            continue;
+        if (!classId.empty() && (classId.size() != 16 || memcmp(classInfo.ID().data(), classId.data(), 16) != 0))
+            continue;
+        target = classInfo;
+        return true;
+    }
+    return false;
+}
+
+// --- 事前に作っておくインスタンス (preload) ---
+// 1 つのパスに用意しておけるインスタンスの上限
+const int32 MAX_WARM_INSTANCES = 8;
+// 作成と initialize まで済ませた PlugProvider
+struct WarmInstance
+{
+    Module::Ptr module;
+    PlugProvider *plugProvider = nullptr;
+    ClassInfo classInfo;
+};
+// preload したクラスのインスタンスを用意しておき、load_plugin などで読み込む代わりに渡す。
+// パスとクラス ID (空なら FindPluginClass が選ぶ最初のクラス) の組ごとに用意する。
+// PlugProvider はメインスレッドで作るので、すべてメインスレッド (セッションでも共通) から使う。
+// 用意する数は頼んだもの (owner: セッションの VstHost、-preload は nullptr) ごとに持ち、そのうち最も多い数にする
+class WarmInstancePool
+{
+public:
+    ~WarmInstancePool() { Clear(); }
+    // owner が path の classId に用意しておく数を決める。0 なら取り下げ、どの owner も頼んでいなければ用意しているものを解放する
+    void SetTarget(const void *owner, const std::string &path, const std::string &classId, int32 count);
+    // 足りない分を作る。limit 個作ったら、まだ足りなくても戻る。作れなかったものは目標を 0 にする
+    void Fill(const std::string &path, const std::string &classId, int32 limit);
+    // 足りないものに 1 つ作る。まだ足りないものが残っていれば true
+    bool RefillOne();
+    bool Take(const std::string &path, const std::string &classId, WarmInstance &out);
+    int32 ReadyCount(const std::string &path, const std::string &classId) const;
+    // owner が頼んだものをすべて取り下げ、そのパスを返す
+    std::vector<std::string> ClearOwner(const void *owner);
+    void Clear();
+
+private:
+    // パスとクラス ID
+    typedef std::pair<std::string, std::string> Key;
+    struct Entry
+    {
+        int32 target = 0;
+        std::map<const void *, int32> owners;
+        uint64_t modifiedTime = 0;
+        std::vector<WarmInstance> ready;
+    };
+    static void Release(WarmInstance &instance);
+    void Discard(Entry &entry);
+    void DiscardStale(const std::string &path);
+    void Retarget(std::map<Key, Entry>::iterator it);
+    bool TakeFrom(std::map<Key, Entry>::iterator it, const std::string &classId, WarmInstance &out);
+    std::map<Key, Entry> m_entries;
+};
+void WarmInstancePool::Release(WarmInstance &instance)
+{
+    delete instance.plugProvider;
+    instance.plugProvider = nullptr;
+    instance.module.reset();
+}
+void WarmInstancePool::Discard(Entry &entry)
+{
+    for (auto &instance : entry.ready)
+        Release(instance);
+    entry.ready.clear();
+}
+void WarmInstancePool::SetTarget(const void *owner, const std::string &path, const std::string &classId, int32 count)
+{
+    count = std::max<int32>(0, std::min(count, MAX_WARM_INSTANCES));
+    const Key key(path, classId);
+    auto it = m_entries.find(key);
+    if (count == 0)
+    {
+        if (it != m_entries.end() && it->second.owners.erase(owner))
+            Retarget(it);
+        return;
+    }
+    if (it == m_entries.end())
+        it = m_entries.emplace(key, Entry()).first;
+    it->second.owners[owner] = count;
+    Retarget(it);
+}
+// path のファイルが更新される前に作ったものを捨てる。古いモジュールを離さないと新しいファイルを読み込めない
+void WarmInstancePool::DiscardStale(const std::string &path)
+{
+    auto it = m_entries.lower_bound(Key(path, std::string()));
+    if (it == m_entries.end() || it->first.first != path)
+        return;
+    const uint64_t modifiedTime = PluginModifiedTime(path);
+    for (; it != m_entries.end() && it->first.first == path; ++it)
+    {
+        if (it->second.modifiedTime != modifiedTime)
+        {
+            Discard(it->second);
+            it->second.modifiedTime = modifiedTime;
+        }
+    }
+}
+// 目標を owner の中で最も多い数にし、余った分を解放する。どの owner もいなければエントリごと消す
+void WarmInstancePool::Retarget(std::map<Key, Entry>::iterator it)
+{
+    Entry &entry = it->second;
+    if (entry.owners.empty())
+    {
+        Discard(entry);
+        m_entries.erase(it);
+        return;
+    }
+    entry.target = 0;
+    for (const auto &owner : entry.owners)
+        entry.target = std::max(entry.target, owner.second);
+    while ((int32)entry.ready.size() > entry.target)
+    {
+        Release(entry.ready.back());
+        entry.ready.pop_back();
+    }
+}
+void WarmInstancePool::Fill(const std::string &path, const std::string &classId, int32 limit)
+{
+    auto it = m_entries.find(Key(path, classId));
+    if (it == m_entries.end())
+        return;
+    Entry &entry = it->second;
+    DiscardStale(path);
+    for (int32 created = 0; created < limit && (int32)entry.ready.size() < entry.target; ++created)
+    {
+        WarmInstance instance;
+        std::string error;
+        instance.module = AcquireModule(path, error);
+        if (!instance.module || !FindPluginClass(instance.module->getFactory(), classId, instance.classInfo))
+        {
+            DbgPrint(_T("WarmInstancePool: Cannot preload '%hs'. %hs"), path.c_str(), error.c_str());
+            entry.target = 0;
+            return;
+        }
+        instance.plugProvider = new PlugProvider(instance.module->getFactory(), instance.classInfo, true);
+        if (!instance.plugProvider->getComponent() || !instance.plugProvider->getController())
+        {
+            DbgPrint(_T("WarmInstancePool: '%hs' could not be instantiated."), path.c_str());
+            Release(instance);
+            entry.target = 0;
+            return;
+        }
+        entry.ready.push_back(std::move(instance));
+    }
+}
+bool WarmInstancePool::RefillOne()
+{
+    bool filled = false;
+    for (auto &item : m_entries)
+    {
+        if ((int32)item.second.ready.size() >= item.second.target)
+            continue;
+        if (filled)
+            return true;
+        Fill(item.first.first, item.first.second, 1);
+        filled = true;
+        if ((int32)item.second.ready.size() < item.second.target)
+            return true;
+    }
+    return false;
+}
+// 用意したインスタンスを 1 つ渡す。ファイルが更新されていれば古いものは捨てて false。
+// classId を指定したときは、そのクラスで用意したものか、クラスを指定せずに用意したもののうち同じクラスのものを渡す
+bool WarmInstancePool::Take(const std::string &path, const std::string &classId, WarmInstance &out)
+{
+    if (!classId.empty() && classId.size() != 16)
+        return false;
+    DiscardStale(path);
+    if (TakeFrom(m_entries.find(Key(path, classId)), classId, out))
+        return true;
+    return !classId.empty() && TakeFrom(m_entries.find(Key(path, std::string())), classId, out);
+}
+bool WarmInstancePool::TakeFrom(std::map<Key, Entry>::iterator it, const std::string &classId, WarmInstance &out)
+{
+    if (it == m_entries.end() || it->second.ready.empty())
+        return false;
+    std::vector<WarmInstance> &ready = it->second.ready;
+    auto match = ready.end() - 1;
+    if (!classId.empty())
+    {
+        match = std::find_if(ready.begin(), ready.end(), [&classId](const WarmInstance &instance)
+                             { return memcmp(instance.classInfo.ID().data(), classId.data(), 16) == 0; });
+        if (match == ready.end())
+            return false;
+    }
+    out = std::move(*match);
+    ready.erase(match);
+    return true;
+}
+int32 WarmInstancePool::ReadyCount(const std::string &path, const std::string &classId) const
+{
+    auto it = m_entries.find(Key(path, classId));
+    return it == m_entries.end() ? 0 : (int32)it->second.ready.size();
+}
+std::vector<std::string> WarmInstancePool::ClearOwner(const void *owner)
+{
+    std::vector<std::string> paths;
+    for (auto it = m_entries.begin(); it != m_entries.end();)
+    {
+        auto next = std::next(it);
+        if (it->second.owners.erase(owner))
+        {
+            paths.push_back(it->first.first);
+            Retarget(it);
+        }
+        it = next;
+    }
+    return paths;
+}
+void WarmInstancePool::Clear()
+{
+    for (auto &item : m_entries)
+        Discard(item.second);
+    m_entries.clear();
+}
+static WarmInstancePool g_warmPool;
+
+// --- オフラインレンダリング (render コマンド) ---
+const int32 DEFAULT_RENDER_BLOCK = 8192;
+const int32 MAX_RENDER_BLOCK = 65536;
+// 無限のテールを報告するプラグインでも、この長さで打ち切る
+const double MAX_RENDER_TAIL_SECONDS = 30.0;
+
+// --- ベンチマーク (benchmark コマンド) ---
+const char *const DEFAULT_BENCHMARK_BLOCKS = "64,128,256,512,1024";
+const double DEFAULT_BENCHMARK_SECONDS = 2.0;
+const double MAX_BENCHMARK_SECONDS = 60.0;
+const size_t MAX_BENCHMARK_SIZES = 16;
+const int32 BENCHMARK_WARMUP_BLOCKS = 32;
+// 呼び出したスレッドが使った CPU 時間 (カーネル + ユーザー)
+inline uint64_t ThreadCpuNanos()
+{
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    const uint64_t kernel100ns = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    const uint64_t user100ns = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (kernel100ns + user100ns) * 100;
+}
+static std::string JsonEscape(const std::string &text)
+{
+    std::string out;
+    for (char ch : text)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            out += '\\';
+            out += ch;
+        }
+        else if ((unsigned char)ch < 0x20)
+        {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)ch);
+            out += buffer;
+        }
+        else
+        {
+            out += ch;
+        }
+    }
+    return out;
+}
+
+// --- プラグインのスキャン (scan コマンド) ---
+// .vst3 を 1 つずつ -scan_worker で起動した子プロセスで読み込み、クラスの情報を索引ファイルにまとめる。
+// クラッシュやハングするプラグインがあっても止まるのは子プロセスだけで、スキャンは続く
+const uint32_t PLUGIN_INDEX_MAGIC = 0x58495356; // "VSIX"
+const uint32_t PLUGIN_INDEX_VERSION = 1;
+const char *const PLUGIN_INDEX_FILE = "VstHostPlugins.idx";
+const int32 MAX_SCAN_JOBS = 16;
+// 1 つのプラグインの読み込みにかけられる時間。超えたら子プロセスを止める
+const uint64_t SCAN_WORKER_TIMEOUT_NS = 60ull * 1000000000ull;
+// 子プロセスの終了を確認する間隔
+const int32 SCAN_POLL_MS = 20;
+enum ScanStatus : int32_t
+{
+    kScanOk = 0,
+    kScanLoadFailed = 1, // モジュールを読み込めなかった
+    kScanNoClasses = 2,  // オーディオ / インストゥルメント / MIDI のクラスがなかった
+    kScanCrashed = 3,    // 子プロセスが異常終了した
+    kScanTimedOut = 4
+};
+// 索引ファイルの形式。クラスは CID の順に並んでいるので、マップしたまま二分探索できる。
+// 文字列は文字列表の先頭からのオフセット (NUL 終端、0 は空文字列)
+struct PluginIndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t moduleCount;
+    uint32_t classCount;
+    uint32_t modulesOffset; // ファイルの先頭から
+    uint32_t classesOffset;
+    uint32_t stringsOffset;
+    uint32_t totalBytes;
+};
+struct PluginIndexModule
+{
+    uint64_t modifiedTime; // PluginModifiedTime。変わっていれば次のスキャンで読み込み直す
+    uint32_t path;
+    int32_t status; // ScanStatus
+    uint32_t classCount;
+    uint32_t loadMicros; // モジュールの読み込みにかかった時間
+};
+struct PluginIndexClass
+{
+    uint8_t cid[16];
+    uint32_t module; // PluginIndexModule の添字
+    uint32_t name, category, subCategories, vendor, version;
+    int32_t audioInputBuses, audioOutputBuses, eventInputBuses, eventOutputBuses;
+    int32_t mainInputChannels, mainOutputChannels; // 最初のバスのチャンネル数
+    int32_t inputChannels, outputChannels;         // 全バスを通したチャンネル数
+    int32_t parameterCount;
+    uint32_t instantiateMicros; // 作成と initialize にかかった時間
+};
+static_assert(sizeof(PluginIndexHeader) == 32 && sizeof(PluginIndexModule) == 24 && sizeof(PluginIndexClass) == 80, "plugin index layout");
+static const char *ScanStatusName(int32_t status)
+{
+    switch (status)
+    {
+    case kScanOk:
+        return "ok";
+    case kScanLoadFailed:
+        return "load_failed";
+    case kScanNoClasses:
+        return "no_classes";
+    case kScanCrashed:
+        return "crashed";
+    case kScanTimedOut:
+        return "timed_out";
+    }
+    return "unknown";
+}
+// CID は TUID の 16 バイトをそのまま並べた 32 桁の 16 進数
+static std::string FormatClassId(const uint8_t *cid)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    std::string text;
+    for (int i = 0; i < 16; ++i)
+    {
+        text += digits[cid[i] >> 4];
+        text += digits[cid[i] & 15];
+    }
+    return text;
+}
+static bool ParseClassId(const std::string &text, std::string &cid)
+{
+    if (text.size() != 32)
+        return false;
+    cid.assign(16, '\0');
+    for (size_t i = 0; i < 32; ++i)
+    {
+        const char ch = text[i];
+        int value;
+        if (ch >= '0' && ch <= '9')
+            value = ch - '0';
+        else if (ch >= 'A' && ch <= 'F')
+            value = ch - 'A' + 10;
+        else if (ch >= 'a' && ch <= 'f')
+            value = ch - 'a' + 10;
+        else
+            return false;
+        cid[i / 2] = (char)(cid[i / 2] | (value << (i % 2 ? 0 : 4)));
+    }
+    return true;
+}
+static FILE *OpenUtf8File(const std::string &path, bool write)
+{
+    FILE *file = nullptr;
+    if (_wfopen_s(&file, Utf8ToWide(path).c_str(), write ? L"wb" : L"rb") != 0)
+        return nullptr;
+    return file;
+}
+static void RemoveUtf8File(const std::string &path)
+{
+    DeleteFileW(Utf8ToWide(path).c_str());
+}
+
+// スキャンの結果 (索引の 1 モジュール分)
+struct ScannedClass
+{
+    PluginIndexClass info = {}; // 文字列のオフセットと module は書き出すときに決める
+    std::string name, category, subCategories, vendor, version;
+};
+struct ScannedModule
+{
+    std::string path;
+    uint64_t modifiedTime = 0;
+    int32_t status = kScanOk;
+    uint32_t loadMicros = 0;
+    std::vector<ScannedClass> classes;
+};
+
+// 子プロセスとの受け渡しはタブ区切りのテキスト ("MODULE" の行と、クラスごとの "CLASS" の行)
+static std::string ScanField(const std::string &text)
+{
+    std::string out = text;
+    for (char &ch : out)
+    {
+        if (ch == '\t' || ch == '\r' || ch == '\n')
+            ch = ' ';
+    }
+    return out;
+}
+static bool WriteScanResult(const std::string &path, const ScannedModule &module)
+{
+    FILE *file = OpenUtf8File(path, true);
+    if (!file)
+        return false;
+    fprintf(file, "MODULE\t%d\t%u\n", module.status, module.loadMicros);
+    for (const auto &scanned : module.classes)
+    {
+        const PluginIndexClass &c = scanned.info;
+        fprintf(file, "CLASS\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%u\t%s\t%s\t%s\t%s\t%s\n", FormatClassId(c.cid).c_str(),
+                c.audioInputBuses, c.audioOutputBuses, c.eventInputBuses, c.eventOutputBuses, c.mainInputChannels, c.mainOutputChannels,
+                c.inputChannels, c.outputChannels, c.parameterCount, c.instantiateMicros, ScanField(scanned.name).c_str(),
+                ScanField(scanned.category).c_str(), ScanField(scanned.subCategories).c_str(), ScanField(scanned.vendor).c_str(),
+                ScanField(scanned.version).c_str());
+    }
+    return fclose(file) == 0;
+}
+static bool ReadScanResult(const std::string &path, ScannedModule &module)
+{
+    FILE *file = OpenUtf8File(path, false);
+    if (!file)
+        return false;
+    std::string content;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        content.append(buffer, read);
+    fclose(file);
+    std::stringstream lines(content);
+    std::string line;
+    bool header = false;
+    while (std::getline(lines, line))
+    {
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t'))
+            fields.push_back(field);
+        if (fields.size() == 3 && fields[0] == "MODULE")
+        {
+            module.status = (int32_t)strtol(fields[1].c_str(), nullptr, 10);
+            module.loadMicros = (uint32_t)strtoul(fields[2].c_str(), nullptr, 10);
+            header = true;
+            continue;
+        }
+        std::string cid;
+        if (fields.size() < 12 || fields[0] != "CLASS" || !ParseClassId(fields[1], cid))
+            return false;
+        fields.resize(17);
+        ScannedClass scanned;
+        PluginIndexClass &c = scanned.info;
+        memcpy(c.cid, cid.data(), 16);
+        int32_t *numbers[] = {&c.audioInputBuses, &c.audioOutputBuses, &c.eventInputBuses, &c.eventOutputBuses, &c.mainInputChannels,
+                              &c.mainOutputChannels, &c.inputChannels, &c.outputChannels, &c.parameterCount};
+        for (size_t i = 0; i < 9; ++i)
+            *numbers[i] = (int32_t)strtol(fields[2 + i].c_str(), nullptr, 10);
+        c.instantiateMicros = (uint32_t)strtoul(fields[11].c_str(), nullptr, 10);
+        scanned.name = fields[12];
+        scanned.category = fields[13];
+        scanned.subCategories = fields[14];
+        scanned.vendor = fields[15];
+        scanned.version = fields[16];
+        module.classes.push_back(std::move(scanned));
+    }
+    return header;
+}
+// -scan_worker の子プロセスで、1 つのプラグインを読み込んで調べる。戻り値は終了コード
+static int RunScanWorker(const std::string &path, const std::string &outPath)
+{
+    ScannedModule module;
+    std::string error;
+    uint64_t startNs = MonotonicNanos();
+    Module::Ptr plugin = Module::create(path, error);
+    module.loadMicros = (uint32_t)((MonotonicNanos() - startNs) / 1000);
+    if (!plugin)
+    {
+        DbgPrint(_T("ScanWorker: Could not load '%hs'. %hs"), path.c_str(), error.c_str());
+        module.status = kScanLoadFailed;
+        return WriteScanResult(outPath, module) ? 0 : 1;
+    }
+    auto factory = plugin->getFactory();
+    for (auto &classInfo : factory.classInfos())
+    {
+        if (!IsPluginClassCategory(classInfo.category()))
+            continue;
+        ScannedClass scanned;
+        PluginIndexClass &c = scanned.info;
+        memcpy(c.cid, classInfo.ID().data(), 16);
+        scanned.name = classInfo.name();
+        scanned.category = classInfo.category();
+        scanned.subCategories = classInfo.subCategoriesString();
+        scanned.vendor = classInfo.vendor();
+        scanned.version = classInfo.version();
+        startNs = MonotonicNanos();
+        PlugProvider *provider = new PlugProvider(factory, classInfo, true);
+        IComponent *component = provider->getComponent();
+        IEditController *controller = provider->getController();
+        c.instantiateMicros = (uint32_t)((MonotonicNanos() - startNs) / 1000);
+        if (component)
+        {
+            c.audioInputBuses = component->getBusCount(kAudio, kInput);
+            c.audioOutputBuses = component->getBusCount(kAudio, kOutput);
+            c.eventInputBuses = component->getBusCount(kEvent, kInput);
+            c.eventOutputBuses = component->getBusCount(kEvent, kOutput);
+            for (int32 b = 0; b < c.audioInputBuses; ++b)
+            {
+                BusInfo info = {};
+                if (component->getBusInfo(kAudio, kInput, b, info) != kResultOk)
+                    continue;
+                if (b == 0)
+                    c.mainInputChannels = info.channelCount;
+                c.inputChannels += info.channelCount;
+            }
+            for (int32 b = 0; b < c.audioOutputBuses; ++b)
+            {
+                BusInfo info = {};
+                if (component->getBusInfo(kAudio, kOutput, b, info) != kResultOk)
+                    continue;
+                if (b == 0)
+                    c.mainOutputChannels = info.channelCount;
+                c.outputChannels += info.channelCount;
+            }
+        }
+        if (controller)
+            c.parameterCount = controller->getParameterCount();
+        delete provider;
+        module.classes.push_back(std::move(scanned));
+    }
+    if (module.classes.empty())
+        module.status = kScanNoClasses;
+    return WriteScanResult(outPath, module) ? 0 : 1;
+}
+
+// 索引ファイルをマップして読む
+class PluginIndex
+{
+public:
+    bool Open(const std::string &path);
+    uint32_t ModuleCount() const { return m_header ? m_header->moduleCount : 0; }
+    uint32_t ClassCount() const { return m_header ? m_header->classCount : 0; }
+    const PluginIndexModule &ModuleAt(uint32_t index) const { return ((const PluginIndexModule *)(m_file.data() + m_header->modulesOffset))[index]; }
+    const PluginIndexClass &ClassAt(uint32_t index) const { return ((const PluginIndexClass *)(m_file.data() + m_header->classesOffset))[index]; }
+    const char *String(uint32_t offset) const;
+    // CID で引く。見つからなければ nullptr
+    const PluginIndexClass *Find(const std::string &cid) const;
+
+private:
+    MappedFile m_file;
+    const PluginIndexHeader *m_header = nullptr;
+};
+bool PluginIndex::Open(const std::string &path)
+{
+    m_header = nullptr;
+    if (!m_file.Open(path) || m_file.size() < sizeof(PluginIndexHeader))
+        return false;
+    const PluginIndexHeader *header = (const PluginIndexHeader *)m_file.data();
+    const uint64_t size = m_file.size();
+    if (header->magic != PLUGIN_INDEX_MAGIC || header->version != PLUGIN_INDEX_VERSION || header->totalBytes != size ||
+        (uint64_t)header->modulesOffset + (uint64_t)header->moduleCount * sizeof(PluginIndexModule) > size ||
+        (uint64_t)header->classesOffset + (uint64_t)header->classCount * sizeof(PluginIndexClass) > size ||
+        header->stringsOffset >= size || m_file.data()[size - 1] != '\0')
+    {
+        m_file.Close();
+        return false;
+    }
+    m_header = header;
+    for (uint32_t i = 0; i < header->classCount; ++i)
+    {
+        if (ClassAt(i).module >= header->moduleCount)
+        {
+            m_header = nullptr;
+            m_file.Close();
+            return false;
+        }
+    }
+    return true;
+}
+const char *PluginIndex::String(uint32_t offset) const
+{
+    if ((uint64_t)m_header->stringsOffset + offset >= m_file.size())
+        return "";
+    return (const char *)m_file.data() + m_header->stringsOffset + offset;
+}
+const PluginIndexClass *PluginIndex::Find(const std::string &cid) const
+{
+    uint32_t low = 0, high = ClassCount();
+    while (low < high)
+    {
+        const uint32_t mid = low + (high - low) / 2;
+        const int order = memcmp(ClassAt(mid).cid, cid.data(), 16);
+        if (order == 0)
+            return &ClassAt(mid);
+        if (order < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return nullptr;
+}
+// 前回の索引の内容。更新時刻が変わっていないモジュールはこれを使い、読み込み直さない
+static void ReadPluginIndex(const PluginIndex &index, std::map<std::string, ScannedModule> &modules)
+{
+    std::vector<ScannedModule> byIndex(index.ModuleCount());
+    for (uint32_t i = 0; i < index.ModuleCount(); ++i)
+    {
+        const PluginIndexModule &entry = index.ModuleAt(i);
+        byIndex[i].path = index.String(entry.path);
+        byIndex[i].modifiedTime = entry.modifiedTime;
+        byIndex[i].status = entry.status;
+        byIndex[i].loadMicros = entry.loadMicros;
+    }
+    for (uint32_t i = 0; i < index.ClassCount(); ++i)
+    {
+        const PluginIndexClass &entry = index.ClassAt(i);
+        ScannedClass scanned;
+        scanned.info = entry;
+        scanned.name = index.String(entry.name);
+        scanned.category = index.String(entry.category);
+        scanned.subCategories = index.String(entry.subCategories);
+        scanned.vendor = index.String(entry.vendor);
+        scanned.version = index.String(entry.version);
+        byIndex[entry.module].classes.push_back(std::move(scanned));
+    }
+    for (auto &module : byIndex)
+        modules[module.path] = std::move(module);
+}
+// 一時ファイルに書いてから置き換えるので、読み込み中のクライアントが途中の内容を見ることはない
+static bool WritePluginIndex(const std::string &path, const std::vector<ScannedModule> &modules)
+{
+    std::string strings(1, '\0');
+    auto addString = [&strings](const std::string &text) -> uint32_t
+    {
+        if (text.empty())
+            return 0;
+        const uint32_t offset = (uint32_t)strings.size();
+        strings.append(text.c_str(), strlen(text.c_str()) + 1);
+        return offset;
+    };
+    std::vector<PluginIndexModule> moduleEntries;
+    std::vector<PluginIndexClass> classEntries;
+    for (const auto &module : modules)
+    {
+        PluginIndexModule entry = {};
+        entry.modifiedTime = module.modifiedTime;
+        entry.path = addString(module.path);
+        entry.status = module.status;
+        entry.classCount = (uint32_t)module.classes.size();
+        entry.loadMicros = module.loadMicros;
+        for (const auto &scanned : module.classes)
+        {
+            PluginIndexClass c = scanned.info;
+            c.module = (uint32_t)moduleEntries.size();
+            c.name = addString(scanned.name);
+            c.category = addString(scanned.category);
+            c.subCategories = addString(scanned.subCategories);
+            c.vendor = addString(scanned.vendor);
+            c.version = addString(scanned.version);
+            classEntries.push_back(c);
+        }
+        moduleEntries.push_back(entry);
+    }
+    std::sort(classEntries.begin(), classEntries.end(), [](const PluginIndexClass &a, const PluginIndexClass &b)
+              { return memcmp(a.cid, b.cid, 16) < 0; });
+    PluginIndexHeader header = {};
+    header.magic = PLUGIN_INDEX_MAGIC;
+    header.version = PLUGIN_INDEX_VERSION;
+    header.moduleCount = (uint32_t)moduleEntries.size();
+    header.classCount = (uint32_t)classEntries.size();
+    header.modulesOffset = sizeof(header);
+    header.classesOffset = header.modulesOffset + header.moduleCount * (uint32_t)sizeof(PluginIndexModule);
+    header.stringsOffset = header.classesOffset + header.classCount * (uint32_t)sizeof(PluginIndexClass);
+    header.totalBytes = header.stringsOffset + (uint32_t)strings.size();
+
+    const std::string tempPath = path + ".tmp";
+    FILE *file = OpenUtf8File(tempPath, true);
+    if (!file)
+        return false;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!moduleEntries.empty())
+        written = written && fwrite(moduleEntries.data(), sizeof(PluginIndexModule), moduleEntries.size(), file) == moduleEntries.size();
+    if (!classEntries.empty())
+        written = written && fwrite(classEntries.data(), sizeof(PluginIndexClass), classEntries.size(), file) == classEntries.size();
+    written = written && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    written = (fclose(file) == 0) && written;
+    if (!written)
+    {
+        RemoveUtf8File(tempPath);
+        return false;
+    }
+    // 他のプロセスが索引をマップしている間は置き換えられないので、少し待ってやり直す
+    for (int retry = 0; retry < 20; ++retry)
+    {
+        if (MoveFileExW(Utf8ToWide(tempPath).c_str(), Utf8ToWide(path).c_str(), MOVEFILE_REPLACE_EXISTING))
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    RemoveUtf8File(tempPath);
+    return false;
+}
+
+static std::string ExecutablePath()
+{
+    wchar_t buffer[MAX_PATH * 4];
+    DWORD length = GetModuleFileNameW(NULL, buffer, (DWORD)(sizeof(buffer) / sizeof(buffer[0])));
+    if (length == 0 || length >= sizeof(buffer) / sizeof(buffer[0]))
+        return std::string();
+    return WideToUtf8(std::wstring(buffer, length));
+}
+// -index を指定しなければ実行ファイルと同じフォルダに置く
+static std::string DefaultPluginIndexPath()
+{
+    std::string exe = ExecutablePath();
+    size_t pos = exe.find_last_of("\\/");
+    return (pos == std::string::npos ? std::string() : exe.substr(0, pos + 1)) + PLUGIN_INDEX_FILE;
+}
+// ディレクトリを指定しない scan で探す場所 (VST3 の標準のフォルダ)
+static std::vector<std::string> DefaultPluginDirectories()
+{
+    std::vector<std::string> dirs;
+    wchar_t buffer[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"CommonProgramFiles", buffer, MAX_PATH);
+    if (length > 0 && length < MAX_PATH)
+        dirs.push_back(WideToUtf8(std::wstring(buffer, length)) + "\\VST3");
+    return dirs;
+}
+static bool HasVst3Extension(const std::string &name)
+{
+    if (name.size() < 5)
+        return false;
+    std::string ext = name.substr(name.size() - 5);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch)
+                   { return (char)tolower(ch); });
+    return ext == ".vst3";
+}
+// dir 以下の .vst3 (ファイルまたはバンドル) を探す。バンドルの中には入らない
+static void FindPluginFiles(const std::string &dir, std::vector<std::string> &paths, int depth = 0)
+{
+    if (depth > 16)
+        return;
+    WIN32_FIND_DATAW data;
+    HANDLE hFind = FindFirstFileW(Utf8ToWide(dir + "\\*").c_str(), &data);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        const std::string name = WideToUtf8(data.cFileName);
+        if (name == "." || name == "..")
+            continue;
+        const std::string path = dir + "\\" + name;
+        if (HasVst3Extension(name))
+            paths.push_back(path);
+        else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            FindPluginFiles(path, paths, depth + 1);
+    } while (FindNextFileW(hFind, &data));
+    FindClose(hFind);
+}
+
+// 実行中の -scan_worker 1 つ分
+struct ScanJob
+{
+    size_t module = 0; // 結果を入れる ScannedModule の添字
+    std::string outPath;
+    uint64_t startNs = 0;
+    HANDLE hProcess = NULL;
+};
+static bool StartScanWorker(const std::string &exe, const std::string &pluginPath, ScanJob &job)
+{
+    std::wstring cmdLine = L"\"" + Utf8ToWide(exe) + L"\" -scan_worker \"" + Utf8ToWide(pluginPath) + L"\" \"" + Utf8ToWide(job.outPath) + L"\"";
+    STARTUPINFOW si = {};
+    si.cb = sizeof(si);
+    PROCESS_INFORMATION pi = {};
+    if (!CreateProcessW(NULL, &cmdLine[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi))
+        return false;
+    CloseHandle(pi.hThread);
+    job.hProcess = pi.hProcess;
+    job.startNs = MonotonicNanos();
+    return true;
+}
+// 終わっていれば true を返し、exitCode に終了コード (異常終了なら -1) を入れる
+static bool PollScanWorker(ScanJob &job, int &exitCode)
+{
+    if (WaitForSingleObject(job.hProcess, 0) != WAIT_OBJECT_0)
+        return false;
+    DWORD code = 0;
+    exitCode = GetExitCodeProcess(job.hProcess, &code) ? (int)code : -1;
+    CloseHandle(job.hProcess);
+    job.hProcess = NULL;
+    return true;
+}
+static void KillScanWorker(ScanJob &job)
+{
+    if (!job.hProcess)
+        return;
+    TerminateProcess(job.hProcess, 1);
+    WaitForSingleObject(job.hProcess, INFINITE);
+    CloseHandle(job.hProcess);
+    job.hProcess = NULL;
+}
+static bool IsScanCommand(const std::string &cmd)
+{
+    return cmd == "scan" || cmd.rfind("scan ", 0) == 0;
+}
+struct ScanSummary
+{
+    size_t plugins = 0; // 見つかった .vst3
+    size_t classes = 0;
+    size_t scanned = 0; // 今回読み込んだもの (残りは索引の内容を使った)
+    size_t failed = 0;  // 読み込めなかった、またはクラスがなかったもの
+};
+// dirs 以下の .vst3 を最大 jobs 個の子プロセスで並列に調べ、索引を indexPath に書き直す。
+// 索引は今回見つかったものだけになる。更新時刻が索引と同じものは force でなければ読み込まない
+static bool ScanPlugins(const std::vector<std::string> &dirs, const std::string &indexPath, bool force, int32 jobs,
+                        const std::atomic<bool> &running, ScanSummary &summary, std::string &error)
+{
+    const std::string exe = ExecutablePath();
+    if (exe.empty())
+    {
+        error = "NoExecutable";
+        return false;
+    }
+    std::map<std::string, ScannedModule> previous;
+    if (!force)
+    {
+        PluginIndex index;
+        if (index.Open(indexPath))
+            ReadPluginIndex(index, previous);
+    }
+    std::vector<std::string> paths;
+    for (const auto &dir : dirs)
+        FindPluginFiles(dir, paths);
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    std::vector<ScannedModule> modules(paths.size());
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const uint64_t modifiedTime = PluginModifiedTime(paths[i]);
+        auto it = previous.find(paths[i]);
+        if (it != previous.end() && it->second.modifiedTime == modifiedTime)
+        {
+            modules[i] = std::move(it->second);
+            continue;
+        }
+        modules[i].path = paths[i];
+        modules[i].modifiedTime = modifiedTime;
+        pending.push_back(i);
+    }
+
+    std::vector<ScanJob> active;
+    size_t next = 0;
+    while (next < pending.size() || !active.empty())
+    {
+        if (!running)
+        {
+            for (auto &job : active)
+            {
+                KillScanWorker(job);
+                RemoveUtf8File(job.outPath);
+            }
+            error = "Cancelled";
+            return false;
+        }
+        while (next < pending.size() && (int32)active.size() < jobs)
+        {
+            ScanJob job;
+            job.module = pending[next++];
+            job.outPath = indexPath + "." + std::to_string(job.module) + ".scan";
+            if (!StartScanWorker(exe, modules[job.module].path, job))
+            {
+                DbgPrint(_T("ScanPlugins: Could not start a worker for '%hs'."), modules[job.module].path.c_str());
+                modules[job.module].status = kScanCrashed;
+                continue;
+            }
+            active.push_back(job);
+        }
+        for (size_t i = 0; i < active.size();)
+        {
+            ScanJob &job = active[i];
+            ScannedModule &module = modules[job.module];
+            int exitCode = 0;
+            if (PollScanWorker(job, exitCode))
+            {
+                if (exitCode != 0 || !ReadScanResult(job.outPath, module))
+                {
+                    DbgPrint(_T("ScanPlugins: Worker for '%hs' failed (exit code %d)."), module.path.c_str(), exitCode);
+                    module.classes.clear();
+                    module.status = kScanCrashed;
+                }
+            }
+            else if (MonotonicNanos() - job.startNs > SCAN_WORKER_TIMEOUT_NS)
+            {
+                DbgPrint(_T("ScanPlugins: '%hs' did not finish in time."), module.path.c_str());
+                KillScanWorker(job);
+                module.status = kScanTimedOut;
+            }
+            else
+            {
+                ++i;
+                continue;
+            }
+            RemoveUtf8File(job.outPath);
+            ++summary.scanned;
+            active.erase(active.begin() + i);
+        }
+        if (!active.empty())
+            std::this_thread::sleep_for(std::chrono::milliseconds(SCAN_POLL_MS));
+    }
+    summary.plugins = modules.size();
+    for (const auto &module : modules)
+    {
+        summary.classes += module.classes.size();
+        if (module.status != kScanOk)
+            ++summary.failed;
+    }
+    if (!WritePluginIndex(indexPath, modules))
+    {
+        error = "WriteFailed";
+        return false;
+    }
+    return true;
+}
+
+// list_plugins の応答。{"plugins":[クラスごと],"failed":[読み込めなかったモジュール]}
+static bool FormatPluginIndex(const std::string &indexPath, std::string &json)
+{
+    PluginIndex index;
+    if (!index.Open(indexPath))
+        return false;
+    std::ostringstream out;
+    out << "{\"plugins\":[";
+    for (uint32_t i = 0; i < index.ClassCount(); ++i)
+    {
+        const PluginIndexClass &c = index.ClassAt(i);
+        const PluginIndexModule &module = index.ModuleAt(c.module);
+        out << (i ? "," : "") << "{\"cid\":\"" << FormatClassId(c.cid) << "\",\"name\":\"" << JsonEscape(index.String(c.name))
+            << "\",\"category\":\"" << JsonEscape(index.String(c.category)) << "\",\"subCategories\":\"" << JsonEscape(index.String(c.subCategories))
+            << "\",\"vendor\":\"" << JsonEscape(index.String(c.vendor)) << "\",\"version\":\"" << JsonEscape(index.String(c.version))
+            << "\",\"path\":\"" << JsonEscape(index.String(module.path)) << "\",\"audioInputs\":" << c.audioInputBuses
+            << ",\"audioOutputs\":" << c.audioOutputBuses << ",\"eventInputs\":" << c.eventInputBuses << ",\"eventOutputs\":" << c.eventOutputBuses
+            << ",\"mainInputChannels\":" << c.mainInputChannels << ",\"mainOutputChannels\":" << c.mainOutputChannels
+            << ",\"inputChannels\":" << c.inputChannels << ",\"outputChannels\":" << c.outputChannels << ",\"parameters\":" << c.parameterCount
+            << ",\"loadUs\":" << module.loadMicros << ",\"instantiateUs\":" << c.instantiateMicros << "}";
+    }
+    out << "],\"failed\":[";
+    bool first = true;
+    for (uint32_t i = 0; i < index.ModuleCount(); ++i)
+    {
+        const PluginIndexModule &module = index.ModuleAt(i);
+        if (module.status == kScanOk)
+            continue;
+        out << (first ? "" : ",") << "{\"path\":\"" << JsonEscape(index.String(module.path)) << "\",\"status\":\"" << ScanStatusName(module.status) << "\"}";
+        first = false;
+    }
+    out << "]}";
+    json = out.str();
+    return true;
+}
+// load_cid で読み込むモジュールのパスを索引から引く。
+// スキャンの後にファイルが更新されていれば、索引の情報と違うものを読み込まないよう StaleIndex で失敗する
+static bool LookupPluginClass(const std::string &indexPath, const std::string &cid, std::string &path, std::string &error)
+{
+    PluginIndex index;
+    const PluginIndexClass *entry = index.Open(indexPath) ? index.Find(cid) : nullptr;
+    if (!entry)
+    {
+        error = "NotInIndex";
+        return false;
+    }
+    const PluginIndexModule &module = index.ModuleAt(entry->module);
+    path = index.String(module.path);
+    if (path.empty() || module.modifiedTime != PluginModifiedTime(path))
+    {
+        DbgPrint(_T("LookupPluginClass: '%hs' changed since the last scan."), path.c_str());
+        error = "StaleIndex";
+        return false;
+    }
+    return true;
+}
+
+// マップした入力ファイル上のインターリーブされたサンプル列
+struct RenderSource
+{
+    const unsigned char *frames = nullptr;
+    int64 numFrames = 0;
+    int32 numChannels = 0;
+    int32 bytesPerSample = 4;
+    bool isFloat = true;
+    double sampleRate = 0.0; // 0 ならロード時のサンプルレート
+};
+// PCM (16/24/32bit) と IEEE float (32/64bit) の WAV を読む
+static bool ParseWavFile(const unsigned char *data, size_t size, RenderSource &src)
+{
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0)
+        return false;
+    uint16_t formatTag = 0, channels = 0, bits = 0;
+    uint32_t rate = 0;
+    bool haveFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= size)
+    {
+        uint32_t chunkSize;
+        memcpy(&chunkSize, data + pos + 4, sizeof(chunkSize));
+        const unsigned char *body = data + pos + 8;
+        const size_t available = size - pos - 8;
+        if (memcmp(data + pos, "fmt ", 4) == 0 && chunkSize >= 16 && available >= 16)
+        {
+            memcpy(&formatTag, body, 2);
+            memcpy(&channels, body + 2, 2);
+            memcpy(&rate, body + 4, 4);
+            memcpy(&bits, body + 14, 2);
+            // WAVE_FORMAT_EXTENSIBLE はサブフォーマット GUID の先頭 2 バイトが実際の形式
+            if (formatTag == 0xFFFE && chunkSize >= 26 && available >= 26)
+                memcpy(&formatTag, body + 24, 2);
+            haveFormat = true;
+        }
+        else if (memcmp(data + pos, "data", 4) == 0 && haveFormat)
+        {
+            const bool pcm = formatTag == 1 && (bits == 16 || bits == 24 || bits == 32);
+            const bool ieee = formatTag == 3 && (bits == 32 || bits == 64);
+            if ((!pcm && !ieee) || channels == 0)
+                return false;
+            src.frames = body;
+            src.numChannels = channels;
+            src.bytesPerSample = bits / 8;
+            src.isFloat = ieee;
+            src.sampleRate = rate;
+            src.numFrames = (int64)(std::min<size_t>(chunkSize, available) / ((size_t)channels * src.bytesPerSample));
+            return true;
+        }
+        pos += 8 + (size_t)chunkSize + (chunkSize & 1);
+    }
+    return false;
+}
+// 1 チャンネル分を取り出して -1.0〜1.0 の T に変換する
+template <typename T>
+static void DecodeRenderChannel(const RenderSource &src, int64 firstFrame, int32 numFrames, int32 channel, T *dst)
+{
+    const size_t stride = (size_t)src.numChannels * src.bytesPerSample;
+    const unsigned char *p = src.frames + (size_t)firstFrame * stride + (size_t)channel * src.bytesPerSample;
+    if (src.isFloat && src.bytesPerSample == 4)
+    {
+        for (int32 n = 0; n < numFrames; ++n, p += stride)
+        {
+            float v;
+            memcpy(&v, p, sizeof(v));
+            dst[n] = (T)v;
+        }
+    }
+    else if (src.isFloat)
+    {
+        for (int32 n = 0; n < numFrames; ++n, p += stride)
+        {
+            double v;
+            memcpy(&v, p, sizeof(v));
+            dst[n] = (T)v;
+        }
+    }
+    else if (src.bytesPerSample == 2)
+    {
+        for (int32 n = 0; n < numFrames; ++n, p += stride)
+        {
+            int16_t v;
+            memcpy(&v, p, sizeof(v));
+            dst[n] = (T)(v * (1.0 / 32768.0));
+        }
+    }
+    else if (src.bytesPerSample == 3)
+    {
+        for (int32 n = 0; n < numFrames; ++n, p += stride)
+        {
+            int32_t v = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+            dst[n] = (T)(v * (1.0 / 8388608.0));
+        }
+    }
+    else
+    {
+        for (int32 n = 0; n < numFrames; ++n, p += stride)
+        {
+            int32_t v;
+            memcpy(&v, p, sizeof(v));
+            dst[n] = (T)(v * (1.0 / 2147483648.0));
+        }
+    }
+}
+
+// レンダリング結果をブロックごとに書き出す。拡張子が .wav なら浮動小数点 WAV、それ以外はヘッダなしの raw
+class RenderWriter
+{
+public:
+    RenderWriter() {}
+    ~RenderWriter() { Close(); }
+    RenderWriter(const RenderWriter &) = delete;
+    RenderWriter &operator=(const RenderWriter &) = delete;
+    bool Open(const std::string &path, int32 numChannels, int32 bytesPerSample, double sampleRate);
+    bool Write(const void *data, size_t bytes);
+    bool Close();
+
+private:
+    void WriteWavHeader();
+    FILE *m_file = nullptr;
+    bool m_wav = false;
+    int32 m_numChannels = 0, m_bytesPerSample = 4;
+    uint32_t m_sampleRate = 0;
+    uint64_t m_dataBytes = 0;
+};
+bool RenderWriter::Open(const std::string &path, int32 numChannels, int32 bytesPerSample, double sampleRate)
+{
+    Close();
+    if (_wfopen_s(&m_file, Utf8ToWide(path).c_str(), L"wb") != 0)
+        m_file = nullptr;
+    if (!m_file)
+        return false;
+    std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : std::string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch)
+                   { return (char)tolower(ch); });
+    m_wav = ext == ".wav";
+    m_numChannels = numChannels;
+    m_bytesPerSample = bytesPerSample;
+    m_sampleRate = (uint32_t)(sampleRate + 0.5);
+    m_dataBytes = 0;
+    if (m_wav)
+        WriteWavHeader(); // サイズは Close で書き直す
+    return true;
+}
+bool RenderWriter::Write(const void *data, size_t bytes)
+{
+    if (!m_file || fwrite(data, 1, bytes, m_file) != bytes)
+        return false;
+    m_dataBytes += bytes;
+    return true;
+}
+bool RenderWriter::Close()
+{
+    if (!m_file)
+        return true;
+    if (m_wav && fseek(m_file, 0, SEEK_SET) == 0)
+        WriteWavHeader();
+    bool ok = fclose(m_file) == 0;
+    m_file = nullptr;
+    return ok;
+}
+void RenderWriter::WriteWavHeader()
+{
+    // 4 GiB を超える場合、サイズ欄は上限値のままになる
+    const uint32_t dataBytes = (uint32_t)std::min<uint64_t>(m_dataBytes, UINT32_MAX - 36);
+    const uint16_t formatTag = 3; // WAVE_FORMAT_IEEE_FLOAT
+    const uint16_t channels = (uint16_t)m_numChannels;
+    const uint16_t blockAlign = (uint16_t)(m_numChannels * m_bytesPerSample);
+    const uint16_t bits = (uint16_t)(m_bytesPerSample * 8);
+    const uint32_t byteRate = m_sampleRate * blockAlign;
+    const uint32_t riffBytes = dataBytes + 36;
+    const uint32_t fmtBytes = 16;
+    unsigned char header[44];
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 4, &riffBytes, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    memcpy(header + 16, &fmtBytes, 4);
+    memcpy(header + 20, &formatTag, 2);
+    memcpy(header + 22, &channels, 2);
+    memcpy(header + 24, &m_sampleRate, 4);
+    memcpy(header + 28, &byteRate, 4);
+    memcpy(header + 32, &blockAlign, 2);
+    memcpy(header + 34, &bits, 2);
+    memcpy(header + 36, "data", 4);
+    memcpy(header + 40, &dataBytes, 4);
+    fwrite(header, 1, sizeof(header), m_file);
+}
+
+// --- パイプのメッセージ ---
+// 1 メッセージの上限。テキストのコマンドもこの長さまでは途中で切れない
+const size_t MAX_PIPE_MESSAGE_BYTES = 256 * 1024 * 1024;
+// --- 完了通知 ---
+// "@<id> <command>" やバイナリプロトコルで受け付けたコマンドの結果。
+// メインスレッドが Post し、接続を担当するスレッドが event で起きて Take する
+class CompletionQueue
+{
+public:
+    struct Entry
+    {
+        uint64_t connection; // 送り先の接続。切断された接続あての通知は捨てる
+        std::string message; // パイプの 1 メッセージ
+        bool reply;          // 接続が待っている "@<id>" なしのコマンドの応答
+    };
+    CompletionQueue() { m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL); }
+    ~CompletionQueue() { CloseHandle(m_hEvent); }
+    CompletionQueue(const CompletionQueue &) = delete;
+    CompletionQueue &operator=(const CompletionQueue &) = delete;
+    // reply なら最後のメッセージを送ったところで接続の次のメッセージの処理を再開する
+    void Post(uint64_t connection, std::vector<std::string> &&messages, bool reply = false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < messages.size(); ++i)
+                m_entries.push_back({connection, std::move(messages[i]), reply && i + 1 == messages.size()});
+        }
+        SetEvent(m_hEvent);
+    }
+    void Take(std::vector<Entry> &entries)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entries.swap(m_entries);
+    }
+    HANDLE event() const { return m_hEvent; }
+
+private:
+    HANDLE m_hEvent = NULL;
+    std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+};
+// 要求 ID に使える文字は英数字と '-' '_' (32 文字まで)
+static bool IsValidRequestId(const std::string &id)
+{
+    if (id.empty() || id.size() > 32)
+        return false;
+    for (char ch : id)
+    {
+        if (!isalnum((unsigned char)ch) && ch != '-' && ch != '_')
+            return false;
+    }
+    return true;
+}
+
+// --- バイナリプロトコル (binary_mode で切り替え) ---
+// パイプの 1 メッセージが 1 フレーム。フレームはヘッダとペイロードで、ペイロードは型付きフィールドの並び。
+// MAX_FRAME_PAYLOAD を超えるメッセージは同じ requestId の複数フレームに分け、最後以外に kFrameMore を立てる。
+// 応答は要求の opcode に kOpResponse を足したもの。数値はすべてリトルエンディアン
+const uint32_t FRAME_MAGIC = 0x46545356; // "VSTF"
+const uint32_t BINARY_PROTOCOL_VERSION = 1;
+const uint32_t MAX_FRAME_PAYLOAD = 60 * 1024;
+enum FrameFlags : uint16_t
+{
+    kFrameMore = 1 // 同じ requestId の続きのフレームがある
+};
+enum BinaryOpcode : uint16_t
+{
+    kOpText = 1,            // String: テキストのコマンド
+    kOpGetState = 2,        // なし
+    kOpSetState = 3,        // Blob: 状態 (VST3_DUAL の中身)
+    kOpLoadAndSetState = 4, // String: パス, Double: サンプルレート, Int: ブロックサイズ, [Blob: 状態]
+    kOpCompletion = 0x4000, // 完了通知 (kOpResponse と一緒に立てる): Int: 0 / 1, String: メッセージ, Int: 待ち時間 (µs), Int: 実行時間 (µs), [Blob: データ]
+    kOpResponse = 0x8000    // 応答: Int: 0 = OK / 1 = FAIL, String: メッセージ, [Blob: データ]
+};
+enum BinaryFieldType : uint16_t
+{
+    kFieldInt = 1,    // int64
+    kFieldDouble = 2, // double
+    kFieldString = 3, // UTF-8
+    kFieldBlob = 4
+};
+#pragma pack(push, 1)
+struct FrameHeader
+{
+    uint32_t magic;
+    uint16_t opcode;
+    uint16_t flags;
+    uint32_t requestId;
+    uint32_t payloadBytes;
+};
+struct FieldHeader
+{
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t length;
+};
+#pragma pack(pop)
+struct BinaryField
+{
+    uint16_t type;
+    const char *data;
+    uint32_t length;
+};
+// ペイロードをフィールドに分ける。データはペイロードを指したまま (コピーしない)
+static bool ParseBinaryFields(const std::string &payload, std::vector<BinaryField> &fields)
+{
+    size_t pos = 0;
+    while (pos < payload.size())
+    {
+        FieldHeader header;
+        if (payload.size() - pos < sizeof(header))
+            return false;
+        memcpy(&header, payload.data() + pos, sizeof(header));
+        pos += sizeof(header);
+        if (payload.size() - pos < header.length)
+            return false;
+        if ((header.type == kFieldInt || header.type == kFieldDouble) && header.length != 8)
+            return false;
+        fields.push_back({header.type, payload.data() + pos, header.length});
+        pos += header.length;
+    }
+    return true;
+}
+static void AppendBinaryField(std::string &payload, uint16_t type, const void *data, size_t length)
+{
+    FieldHeader header = {type, 0, (uint32_t)length};
+    payload.append((const char *)&header, sizeof(header));
+    payload.append((const char *)data, length);
+}
+static void AppendIntField(std::string &payload, int64_t value) { AppendBinaryField(payload, kFieldInt, &value, sizeof(value)); }
+static void AppendStringField(std::string &payload, const std::string &value) { AppendBinaryField(payload, kFieldString, value.data(), value.size()); }
+static bool FieldAsInt(const BinaryField &field, int64_t &value)
+{
+    if (field.type != kFieldInt)
+        return false;
+    memcpy(&value, field.data, sizeof(value));
+    return true;
+}
+static bool FieldAsDouble(const BinaryField &field, double &value)
+{
+    if (field.type == kFieldInt)
+    {
+        int64_t i;
+        memcpy(&i, field.data, sizeof(i));
+        value = (double)i;
+        return true;
+    }
+    if (field.type != kFieldDouble)
+        return false;
+    memcpy(&value, field.data, sizeof(value));
+    return true;
+}
+// 状態を置く共有メモリ。メインスレッドだけが触る
+class StateArena
+{
+public:
+    void SetName(const std::wstring &name) { m_name = name; }
+    // データ部を capacity バイト以上にする。作り直す場合は先頭 keepBytes バイトを引き継ぐ
+    bool Reserve(uint64_t capacity, uint64_t keepBytes);
+    void Close() { m_region.reset(); }
+    BYTE *data() const { return m_region ? (BYTE *)m_region->data() + STATE_ARENA_HEADER_BYTES : nullptr; }
+    StateArenaHeader *header() const { return m_region ? (StateArenaHeader *)m_region->data() : nullptr; }
+    uint64_t capacity() const { return m_region ? header()->capacity : 0; }
+    uint32_t generation() const { return m_generation; }
+
+private:
+    std::wstring m_name;
+    std::unique_ptr<SharedMemoryRegion> m_region;
+    uint32_t m_generation = 0;
+};
+bool StateArena::Reserve(uint64_t capacity, uint64_t keepBytes)
+{
+    if (capacity <= this->capacity())
+        return true;
+    if (capacity > STATE_ARENA_MAX_BYTES)
+        return false;
+    uint64_t newCapacity = std::max(STATE_ARENA_MIN_BYTES, this->capacity());
+    while (newCapacity < capacity)
+        newCapacity *= 2;
+    newCapacity = std::min(newCapacity, STATE_ARENA_MAX_BYTES);
+    std::unique_ptr<SharedMemoryRegion> region(new SharedMemoryRegion());
+    if (!region->Create(m_name + L"_" + std::to_wstring(m_generation + 1), (size_t)(STATE_ARENA_HEADER_BYTES + newCapacity)))
+        return false;
+    StateArenaHeader *h = (StateArenaHeader *)region->data();
+    h->magic = STATE_ARENA_MAGIC;
+    h->generation = ++m_generation;
+    h->capacity = newCapacity;
+    h->stateBytes = 0;
+    keepBytes = std::min(keepBytes, this->capacity());
+    if (keepBytes > 0)
+        memcpy((BYTE *)region->data() + STATE_ARENA_HEADER_BYTES, data(), (size_t)keepBytes);
+    m_region = std::move(region);
+    DbgPrint(_T("StateArena: Generation %u, %llu bytes."), m_generation, (unsigned long long)newCapacity);
+    return true;
+}
+// StateArena の offset 以降に直接書き込む IBStream (getState 用)。足りなければ StateArena を広げる
+class StateArenaStream : public IBStream
+{
+public:
+    StateArenaStream(StateArena &arena, uint64_t offset) : m_arena(arena), m_offset(offset) {}
+    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override
+    {
+        if (FUnknownPrivate::iidEqual(_iid, IBStream::iid) || FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
+        {
+            *obj = this;
+            return kResultTrue;
+        }
+        *obj = nullptr;
+        return kNoInterface;
+    }
+    // 呼び出し側のスタックに置くので参照カウントは使わない
+    uint32 PLUGIN_API addRef() override { return 1; }
+    uint32 PLUGIN_API release() override { return 1; }
+    tresult PLUGIN_API read(void *buffer, int32 numBytes, int32 *numBytesRead) override
+    {
+        int32 count = (int32)std::max<int64>(0, std::min<int64>(numBytes, m_size - m_pos));
+        if (count > 0)
+            memcpy(buffer, m_arena.data() + m_offset + m_pos, count);
+        m_pos += count;
+        if (numBytesRead)
+            *numBytesRead = count;
+        return kResultTrue;
+    }
+    tresult PLUGIN_API write(void *buffer, int32 numBytes, int32 *numBytesWritten) override
+    {
+        if (numBytesWritten)
+            *numBytesWritten = 0;
+        if (numBytes < 0 || m_failed)
+            return kResultFalse;
+        const uint64_t end = m_offset + (uint64_t)m_pos + (uint64_t)numBytes;
+        if (!m_arena.Reserve(end, m_offset + (uint64_t)m_size))
+        {
+            m_failed = true;
+            return kOutOfMemory;
+        }
+        memcpy(m_arena.data() + m_offset + m_pos, buffer, numBytes);
+        m_pos += numBytes;
+        m_size = std::max(m_size, m_pos);
+        if (numBytesWritten)
+            *numBytesWritten = numBytes;
+        return kResultTrue;
+    }
+    tresult PLUGIN_API seek(int64 pos, int32 mode, int64 *result) override
+    {
+        int64 base = mode == kIBSeekSet ? 0 : mode == kIBSeekCur ? m_pos
+                                          : mode == kIBSeekEnd   ? m_size
+                                                                 : -1;
+        if (base < 0 || base + pos < 0)
+            return kInvalidArgument;
+        m_pos = base + pos;
+        if (result)
+            *result = m_pos;
+        return kResultTrue;
+    }
+    tresult PLUGIN_API tell(int64 *pos) override
+    {
+        if (!pos)
+            return kInvalidArgument;
+        *pos = m_pos;
+        return kResultTrue;
+    }
+    int64 size() const { return m_size; }
+    bool failed() const { return m_failed; }
+
+private:
+    StateArena &m_arena;
+    uint64_t m_offset;
+    int64 m_pos = 0, m_size = 0;
+    bool m_failed = false;
+};
+
+// 組み立て中の分割されたリクエスト
+struct BinaryRequest
+{
+    uint16_t opcode = 0;
+    std::string payload;
+};
+// 非同期で処理するコマンド。バイナリで受け取った状態はテキストに戻さず state に持つ
+struct QueuedCommand
+{
+    std::string text;
+    std::vector<BYTE> state;
+    // 完了を通知する場合
+    bool tracked = false;
+    std::string requestId;       // テキストの "@<id>"
+    bool binary = false;         // バイナリプロトコルで受け取った
+    uint16_t opcode = 0;         // バイナリの要求の opcode
+    uint32_t binaryRequestId = 0;
+    uint64_t connection = 0;
+    uint64_t queuedNs = 0;
+    // "@<id>" の付かない get_state などは DONE ではなく従来の "OK <result>" で答える
+    bool plainReply = false;
+};
+// 応答のペイロードを MAX_FRAME_PAYLOAD ごとのフレームに分ける
+static void BuildBinaryFrames(uint16_t opcode, uint32_t requestId, const std::string &payload, std::vector<std::string> &frames)
+{
+    size_t pos = 0;
+    do
+    {
+        const size_t chunk = std::min<size_t>(MAX_FRAME_PAYLOAD, payload.size() - pos);
+        FrameHeader header = {FRAME_MAGIC, opcode, (uint16_t)(pos + chunk < payload.size() ? kFrameMore : 0), requestId, (uint32_t)chunk};
+        std::string frame((const char *)&header, sizeof(header));
+        frame.append(payload, pos, chunk);
+        frames.push_back(std::move(frame));
+        pos += chunk;
+    } while (pos < payload.size());
+}
+// --- 制御用の接続 ---
+// 同時に受け付ける接続の数 (Windows では待機できるハンドルの数で決まる)
+const size_t MAX_CONTROL_CONNECTIONS = 16;
+// 読まないクライアントに溜める送信データの上限。超えたらその接続だけ切断する
+const size_t MAX_CONNECTION_BACKLOG = MAX_PIPE_MESSAGE_BYTES;
+// 停止を確認する間隔
+const DWORD PIPE_POLL_MS = 200;
+
+// 接続 1 本分の状態
+class ControlConnection
+{
+public:
+    uint64_t id = 0;
+    bool binary = false; // binary_mode を受け取った
+    std::map<uint32_t, BinaryRequest> partial;
+    // 送るメッセージを積む。書き込みは ControlServer がほかの接続を待たせずに行う
+    void Send(std::string message)
+    {
+        if (message.empty())
+            return;
+        m_backlog += message.size();
+        m_outgoing.push_back(std::move(message));
+    }
+    // 応答を後から完了通知で送るコマンドを受け付けた。応答を送るまでこの接続の次のメッセージは処理しないので、
+    // "@<id>" を付けないクライアントには従来どおりコマンドの順に応答が届く
+    void AwaitReply() { m_awaitingReply = true; }
+
+private:
+    friend class ControlServer;
+    std::deque<std::string> m_outgoing;
+    size_t m_backlog = 0;
+    bool m_closing = false;    // 送り終えたら切断する
+    bool m_broken = false;     // すぐに切断する
+    bool m_overflowed = false; // 上限を超えたメッセージの残りを読み捨てている
+    bool m_awaitingReply = false; // AwaitReply から応答を送るまで
+    HANDLE m_hPipe = INVALID_HANDLE_VALUE;
+    OVERLAPPED m_read = {}, m_write = {};
+    bool m_reading = false, m_writing = false;
+    std::vector<char> m_buffer;
+    std::string m_partial;
+};
+class ControlHandler
+{
+public:
+    virtual ~ControlHandler() {}
+    // 受け取ったメッセージを 1 つ処理する。false を返すと送信待ちのものを送ってから切断する
+    virtual bool OnControlMessage(ControlConnection &conn, const std::string &message) = 0;
+};
+// 制御用の接続を 1 スレッドで複数受け付けるサーバー。
+// 名前付きパイプのインスタンスを接続ごとに作ってオーバーラップ I/O で扱う。どの接続の読み書きもほかの接続を待たせない
+class ControlServer
+{
+public:
+    ControlServer() {}
+    ~ControlServer() { Close(); }
+    ControlServer(const ControlServer &) = delete;
+    ControlServer &operator=(const ControlServer &) = delete;
+    bool Listen(const std::wstring &name);
+    // running が false になるまで接続とメッセージ、完了通知を処理する
+    void Run(const std::atomic<bool> &running, CompletionQueue &completions, ControlHandler &handler);
+    void Close();
+
+private:
+    void Dispatch(ControlConnection &conn, const std::string &message, ControlHandler &handler);
+    void RejectOversized(ControlConnection &conn);
+    void Deliver(CompletionQueue &completions, ControlHandler &handler);
+    void Resume(ControlConnection &conn, ControlHandler &handler);
+    void Prune();
+    void Destroy(ControlConnection &conn);
+    std::vector<std::unique_ptr<ControlConnection>> m_connections;
+    uint64_t m_nextId = 1;
+    bool CreateListener();
+    void Accept();
+    bool StartRead(ControlConnection &conn);
+    void CompleteRead(ControlConnection &conn, ControlHandler &handler);
+    void StartWrite(ControlConnection &conn);
+    void CompleteWrite(ControlConnection &conn);
+    std::wstring m_name;
+    HANDLE m_hListen = INVALID_HANDLE_VALUE; // 次のクライアントを待つインスタンス
+    OVERLAPPED m_connect = {};
+    bool m_listenReady = false; // ConnectNamedPipe の時点で接続済みだった
+};
+void ControlServer::Dispatch(ControlConnection &conn, const std::string &message, ControlHandler &handler)
+{
+    if (!handler.OnControlMessage(conn, message))
+        conn.m_closing = true;
+}
+// MAX_PIPE_MESSAGE_BYTES を超えたメッセージは途中までの内容を実行せずに捨てる。
+// テキストなら FAIL を返し、バイナリはフレームの区切りがわからなくなるので切断する
+void ControlServer::RejectOversized(ControlConnection &conn)
+{
+    DbgPrint(_T("ControlServer: Message on connection %llu is too large. Discarded."), (unsigned long long)conn.id);
+    if (conn.binary)
+        conn.m_closing = true;
+    else
+        conn.Send("FAIL MessageTooLarge\n");
+}
+void ControlServer::Deliver(CompletionQueue &completions, ControlHandler &handler)
+{
+    std::vector<CompletionQueue::Entry> entries;
+    completions.Take(entries);
+    for (auto &entry : entries)
+    {
+        // 切断された接続あての通知は捨てる
+        for (auto &conn : m_connections)
+        {
+            if (conn->id == entry.connection)
+            {
+                conn->Send(std::move(entry.message));
+                if (entry.reply && conn->m_awaitingReply)
+                {
+                    conn->m_awaitingReply = false;
+                    Resume(*conn, handler);
+                }
+                break;
+            }
+        }
+    }
+}
+// 送信が溜まりすぎた接続と、切断する接続を片付ける
+void ControlServer::Prune()
+{
+    for (size_t i = 0; i < m_connections.size();)
+    {
+        ControlConnection &conn = *m_connections[i];
+        if (conn.m_backlog > MAX_CONNECTION_BACKLOG)
+        {
+            DbgPrint(_T("ControlServer: Connection %llu is not reading. Disconnecting."), (unsigned long long)conn.id);
+            conn.m_broken = true;
+        }
+        const bool idle = conn.m_outgoing.empty() && !conn.m_writing;
+        if (conn.m_broken || (conn.m_closing && idle))
+        {
+            Destroy(conn);
+            m_connections.erase(m_connections.begin() + i);
+            continue;
+        }
+        ++i;
+    }
+}
+bool ControlServer::Listen(const std::wstring &name)
+{
+    Close();
+    m_name = name;
+    m_connect.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    return m_connect.hEvent && CreateListener();
+}
+// 次のクライアントを待つインスタンスを作り、ConnectNamedPipe を始める
+bool ControlServer::CreateListener()
+{
+    m_hListen = CreateNamedPipeW(m_name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT,
+                                 PIPE_UNLIMITED_INSTANCES, MAX_STATE_DATA_LEN, MAX_STATE_DATA_LEN, 0, NULL);
+    if (m_hListen == INVALID_HANDLE_VALUE)
+        return false;
+    ResetEvent(m_connect.hEvent);
+    m_listenReady = false;
+    if (!ConnectNamedPipe(m_hListen, &m_connect))
+    {
+        DWORD error = GetLastError();
+        if (error == ERROR_PIPE_CONNECTED)
+        {
+            m_listenReady = true;
+            SetEvent(m_connect.hEvent);
+        }
+        else if (error != ERROR_IO_PENDING)
+        {
+            CloseHandle(m_hListen);
+            m_hListen = INVALID_HANDLE_VALUE;
+            return false;
+        }
+    }
+    return true;
+}
+void ControlServer::Close()
+{
+    for (auto &conn : m_connections)
+        Destroy(*conn);
+    m_connections.clear();
+    if (m_hListen != INVALID_HANDLE_VALUE)
+    {
+        CancelIoEx(m_hListen, &m_connect);
+        DWORD ignored;
+        GetOverlappedResult(m_hListen, &m_connect, &ignored, TRUE);
+        CloseHandle(m_hListen);
+        m_hListen = INVALID_HANDLE_VALUE;
+    }
+    if (m_connect.hEvent)
+    {
+        CloseHandle(m_connect.hEvent);
+        m_connect.hEvent = NULL;
+    }
+}
+void ControlServer::Destroy(ControlConnection &conn)
+{
+    if (conn.m_hPipe == INVALID_HANDLE_VALUE)
+        return;
+    DWORD ignored;
+    if (conn.m_reading)
+    {
+        CancelIoEx(conn.m_hPipe, &conn.m_read);
+        GetOverlappedResult(conn.m_hPipe, &conn.m_read, &ignored, TRUE);
+    }
+    if (conn.m_writing)
+    {
+        CancelIoEx(conn.m_hPipe, &conn.m_write);
+        GetOverlappedResult(conn.m_hPipe, &conn.m_write, &ignored, TRUE);
+    }
+    DisconnectNamedPipe(conn.m_hPipe);
+    CloseHandle(conn.m_hPipe);
+    CloseHandle(conn.m_read.hEvent);
+    CloseHandle(conn.m_write.hEvent);
+    conn.m_hPipe = INVALID_HANDLE_VALUE;
+}
+// 待ち受けていたインスタンスを接続にし、次のインスタンスを作る
+void ControlServer::Accept()
+{
+    DWORD ignored;
+    const bool connected = m_listenReady || GetOverlappedResult(m_hListen, &m_connect, &ignored, FALSE);
+    if (connected)
+    {
+        std::unique_ptr<ControlConnection> conn(new ControlConnection());
+        conn->id = m_nextId++;
+        conn->m_hPipe = m_hListen;
+        conn->m_read.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        conn->m_write.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        conn->m_buffer.resize(MAX_STATE_DATA_LEN);
+        m_hListen = INVALID_HANDLE_VALUE;
+        if (!StartRead(*conn))
+            conn->m_broken = true;
+        m_connections.push_back(std::move(conn));
+    }
+    else
+    {
+        CloseHandle(m_hListen);
+        m_hListen = INVALID_HANDLE_VALUE;
+    }
+}
+bool ControlServer::StartRead(ControlConnection &conn)
+{
+    ResetEvent(conn.m_read.hEvent);
+    if (!ReadFile(conn.m_hPipe, conn.m_buffer.data(), (DWORD)conn.m_buffer.size(), NULL, &conn.m_read))
+    {
+        DWORD error = GetLastError();
+        if (error != ERROR_IO_PENDING && error != ERROR_MORE_DATA)
+            return false;
+    }
+    conn.m_reading = true;
+    return true;
+}
+// 読み取りバッファより長いメッセージは ERROR_MORE_DATA で続きを読み、1 メッセージにまとめてから渡す
+void ControlServer::CompleteRead(ControlConnection &conn, ControlHandler &handler)
+{
+    DWORD bytesRead = 0;
+    BOOL success = GetOverlappedResult(conn.m_hPipe, &conn.m_read, &bytesRead, FALSE);
+    conn.m_reading = false;
+    if (!success && GetLastError() != ERROR_MORE_DATA)
+    {
+        conn.m_broken = true;
+        return;
+    }
+    if (conn.m_overflowed || conn.m_partial.size() + bytesRead > MAX_PIPE_MESSAGE_BYTES)
+    {
+        // メッセージの終わりまで読み捨てる
+        conn.m_overflowed = true;
+        std::string().swap(conn.m_partial);
+    }
+    else
+    {
+        conn.m_partial.append(conn.m_buffer.data(), bytesRead);
+    }
+    if (success && conn.m_overflowed)
+    {
+        conn.m_overflowed = false;
+        RejectOversized(conn);
+    }
+    else if (success && !conn.m_partial.empty())
+    {
+        std::string message;
+        message.swap(conn.m_partial);
+        Dispatch(conn, message, handler);
+    }
+    // 応答を待っている間は次のメッセージを読まない
+    if (!conn.m_closing && !conn.m_awaitingReply && !StartRead(conn))
+        conn.m_broken = true;
+}
+void ControlServer::Resume(ControlConnection &conn, ControlHandler &)
+{
+    if (!conn.m_closing && !conn.m_broken && !conn.m_reading && !StartRead(conn))
+        conn.m_broken = true;
+}
+void ControlServer::StartWrite(ControlConnection &conn)
+{
+    if (conn.m_writing || conn.m_broken || conn.m_outgoing.empty())
+        return;
+    const std::string &message = conn.m_outgoing.front();
+    ResetEvent(conn.m_write.hEvent);
+    if (!WriteFile(conn.m_hPipe, message.data(), (DWORD)message.size(), NULL, &conn.m_write) && GetLastError() != ERROR_IO_PENDING)
+    {
+        conn.m_broken = true;
+        return;
+    }
+    conn.m_writing = true;
+}
+void ControlServer::CompleteWrite(ControlConnection &conn)
+{
+    DWORD bytesWritten = 0;
+    BOOL success = GetOverlappedResult(conn.m_hPipe, &conn.m_write, &bytesWritten, FALSE);
+    conn.m_writing = false;
+    if (!success)
+    {
+        conn.m_broken = true;
+        return;
+    }
+    conn.m_backlog -= conn.m_outgoing.front().size();
+    conn.m_outgoing.pop_front();
+}
+void ControlServer::Run(const std::atomic<bool> &running, CompletionQueue &completions, ControlHandler &handler)
+{
+    // 待つハンドル: 完了通知、待ち受け、接続ごとの読み取りと書き込み
+    std::vector<HANDLE> handles;
+    std::vector<std::pair<ControlConnection *, bool>> owners; // (接続, 書き込みか)
+    while (running)
+    {
+        if (m_hListen == INVALID_HANDLE_VALUE && m_connections.size() < MAX_CONTROL_CONNECTIONS && !CreateListener())
+        {
+            DbgPrint(_T("ControlServer: CreateNamedPipe failed (%lu)."), GetLastError());
+        }
+        handles.assign(1, completions.event());
+        owners.assign(1, std::make_pair((ControlConnection *)nullptr, false));
+        if (m_hListen != INVALID_HANDLE_VALUE)
+        {
+            handles.push_back(m_connect.hEvent);
+            owners.push_back(std::make_pair((ControlConnection *)nullptr, false));
+        }
+        for (auto &conn : m_connections)
+        {
+            if (conn->m_reading)
+            {
+                handles.push_back(conn->m_read.hEvent);
+                owners.push_back(std::make_pair(conn.get(), false));
+            }
+            if (conn->m_writing)
+            {
+                handles.push_back(conn->m_write.hEvent);
+                owners.push_back(std::make_pair(conn.get(), true));
+            }
+        }
+        DWORD waited = WaitForMultipleObjects((DWORD)handles.size(), handles.data(), FALSE, PIPE_POLL_MS);
+        if (waited == WAIT_TIMEOUT)
+            continue;
+        const size_t index = waited - WAIT_OBJECT_0;
+        if (index >= handles.size())
+        {
+            Sleep(PIPE_POLL_MS);
+            continue;
+        }
+        // 先頭のハンドルばかりが優先されないよう、起きたらすべての状態を見て順に処理する
+        for (size_t i = 0; i < handles.size(); ++i)
+        {
+            if (i != index && WaitForSingleObject(handles[i], 0) != WAIT_OBJECT_0)
+                continue;
+            if (i == 0)
+                Deliver(completions, handler);
+            else if (!owners[i].first)
+                Accept();
+            else if (owners[i].second)
+                CompleteWrite(*owners[i].first);
+            else
+                CompleteRead(*owners[i].first, handler);
+        }
+        for (auto &conn : m_connections)
+            StartWrite(*conn);
+        Prune();
+    }
+}
+
+class VstHost : public IHostApplication, public IComponentHandler, public IComponentHandler2, public ControlHandler
+{
+public:
+    VstHost(HINSTANCE hInstance, const HostOptions &options);
+    ~VstHost();
+    tresult PLUGIN_API queryInterface(const TUID _iid, void **obj) override;
+    uint32 PLUGIN_API addRef() override;
+    uint32 PLUGIN_API release() override;
+    tresult PLUGIN_API getName(String128 name) override;
+    tresult PLUGIN_API createInstance(TUID cid, TUID iid, void **obj) override;
+    tresult PLUGIN_API beginEdit(ParamID id) override;
+    tresult PLUGIN_API performEdit(ParamID id, ParamValue valueNormalized) override;
+    tresult PLUGIN_API endEdit(ParamID id) override;
+    tresult PLUGIN_API restartComponent(int32 flags) override;
+    tresult PLUGIN_API setDirty(TBool state) override { return kResultOk; }
+    tresult PLUGIN_API requestOpenEditor(FIDString name = nullptr) override
+    {
+        if (m_hMainThreadMsgWindow)
+            PostMessage(m_hMainThreadMsgWindow, WM_APP_SHOW_GUI, 0, 0);
+        return kResultOk;
+    }
+    tresult PLUGIN_API startGroupEdit() override { return kResultOk; }
+    tresult PLUGIN_API finishGroupEdit() override { return kResultOk; }
+    bool Initialize();
+    void Cleanup();
+    void RunMessageLoop();
+    void RequestStop();
+    // -sessions モードで SessionManager から使う。パイプとスレッドを持たず、メインスレッドで初期化する
+    bool InitSession();
+    void ServiceAudio();
+    std::string ExecuteCommand(const std::string &cmd, uint64_t connection) { return ProcessCommand(cmd, connection); }
+    // セッションの完了通知は SessionManager の制御パイプに送る
+    void SetCompletionQueue(CompletionQueue *queue) { m_completions = queue; }
+    HANDLE ClientReadyEvent() const { return m_hEventClientReady; }
+
+private:
+    static DWORD WINAPI PipeThreadProc(LPVOID p)
+    {
+        HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+        if (SUCCEEDED(hr))
+        {
+            ((VstHost *)p)->HandlePipeCommands();
+            CoUninitialize();
+        }
+        return 0;
+    }
+    static DWORD WINAPI AudioThreadProc(LPVOID p)
+    {
+        ((VstHost *)p)->HandleAudioProcessing();
+        return 0;
+    }
+    static LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+    static LRESULT CALLBACK MainThreadMsgWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+    void HandlePipeCommands() { m_control.Run(m_threadsRunning, *m_completions, *this); }
+    bool OnControlMessage(ControlConnection &conn, const std::string &message) override;
+    void HandleAudioProcessing();
+    void HandleRingProcessing();
+    uint32_t DrainRing(uint32_t tail);
+    bool WaitForClient(uint32_t lastSeq);
+    void SignalClient(uint32_t seq);
+    void ProcessQueuedCommands();
+    bool ExecuteSyncCommand(const std::string &cmd, std::string &result);
+    bool ExecuteQueuedCommand(const QueuedCommand &queued, std::string &result);
+    static bool IsSyncCommand(const std::string &cmd);
+    void QueueCommand(QueuedCommand &&command);
+    std::string SubmitTrackedCommand(QueuedCommand &&command);
+    void PostCompletion(const QueuedCommand &command, bool success, uint64_t startNs, const std::string &result);
+    void StartScan(QueuedCommand &&command);
+    bool RunScan(const std::string &cmd, std::string &result);
+    std::string PluginIndexPath() const { return m_options.indexPath.empty() ? DefaultPluginIndexPath() : m_options.indexPath; }
+    bool HandleBinaryFrame(ControlConnection &conn, const std::string &frame);
+    void WriteBinaryResponse(ControlConnection &conn, uint16_t opcode, uint32_t requestId, bool ok, const std::string &message, const void *data, size_t length);
+    bool CaptureDualState(std::string &out);
+    bool CaptureDualStateToArena(uint64_t &bytes);
+    bool ApplyDualState(const BYTE *data, size_t size);
+    void ShowGui();
+    void HideGui();
+    void OnGuiClose();
+    bool CreateMessageWindow();
+    bool InitIPC();
+    void PrepareSharedMemory();
+    std::string ProcessCommand(const std::string &full_cmd, uint64_t connection);
+    bool LoadPlugin(const std::string &path, double sampleRate, int32 blockSize, const std::string &classId = std::string());
+    bool LoadChain(const std::vector<std::string> &paths, double sampleRate, int32 blockSize);
+    bool LoadGraph(const std::vector<std::string> &paths, const std::vector<GraphEdge> &edges, double sampleRate, int32 blockSize,
+                   const std::vector<std::string> &classIds = std::vector<std::string>());
+    bool SetGraphEdges(const std::vector<GraphEdge> &edges);
+    bool LoadInstance(PluginInstance &inst, const std::string &path, bool requireProcessor, const std::string &classId);
+    void ReleaseInstance(PluginInstance &inst);
+    void ReleasePlugin();
+    void SuspendAudio();
+    size_t StageCount() const { return 1 + m_chainStages.size(); }
+    PluginInstance &Stage(size_t index) { return index == 0 ? m_plugin : *m_chainStages[index - 1]; }
+    void SetChainActive(bool active);
+    void UpdateChainLatency();
+    bool SetupChainProcessing(int32 processMode, int32 blockSize, double sampleRate);
+    bool BuildProcessPlan(bool offline = false);
+    void ReadBusLayout(PluginInstance &inst);
+    void FinishProcessPlan(ProcessPlan &plan);
+    bool ApplySharedLayout(ProcessPlan &inputPlan, ProcessPlan &outputPlan);
+    bool ApplyRenderLayout(ProcessPlan &inputPlan, ProcessPlan &outputPlan);
+    bool RenderOffline(const std::string &inPath, const std::string &outPath, int32 blockSize, std::string &result);
+    bool RunBenchmark(const std::vector<int32> &blockSizes, double seconds, std::string &result);
+    bool RestoreRealtimeProcessing();
+    int64 ChainTailSamples(double sampleRate);
+    AudioSharedData *GetSlot(uint32_t index) const { return (AudioSharedData *)(m_pSlots + (size_t)index * m_slotBytes); }
+    AutomationBlock *GetAutomation(uint32_t index) const { return m_pAutomation ? (AutomationBlock *)((char *)m_pAutomation + AUTOMATION_HEADER_BYTES + (size_t)index * AUTOMATION_BLOCK_BYTES) : nullptr; }
+    int32 SharedSampleSize() const { return (m_pLayout && m_options.sample64) ? kSample64 : kSample32; }
+    void OnRestartComponent(int32 flags);
+    void ProcessAudioBlock(uint32_t slotIndex);
+    void ProcessBlock(AudioSharedData *block, AutomationBlock *automation, const std::vector<SharedEvent> &events);
+    static void GraphTask(void *context, int32 worker, uint32_t node) { ((VstHost *)context)->ExecuteNode(worker, node); }
+    void ExecuteNode(int32 worker, uint32_t node);
+    void MixNodeInputs(PluginInstance &inst, int32 start, int32 numSamples);
+    void RunSlice(PluginInstance &inst, char *slotBase, int32 start, int32 numSamples);
+    void BindSliceBuffers(ProcessPlan &plan, char *slotBase, int32 start);
+    bool UpdateInputSilence(ProcessPlan &plan, int32 numSamples);
+    bool IsOutputSilent(const ProcessPlan &plan, int32 numSamples);
+    void ClearSliceOutputs(ProcessPlan &plan, int32 numSamples);
+    void CollectOutputParameterChanges();
+    void ReadInputEvents();
+    void WriteOutputEvents(int32 start);
+    void RecordWake();
+    void RecordBlockStats(const AudioSharedData *block, uint64_t elapsedNs);
+    std::string FormatStats() const;
+    SharedEvent *InputEventEntries() const { return (SharedEvent *)((char *)m_pEvents + EVENT_RING_HEADER_BYTES); }
+    SharedEvent *OutputEventEntries() const { return InputEventEntries() + m_pEvents->capacity; }
+    void QueueProcessorParamUpdate(ParamID id, ParamValue value);
+    void PublishOutputParamIds();
+    OutputParamEntry *OutputParamEntries() const { return (OutputParamEntry *)((char *)m_pOutputParams + OUTPUT_PARAM_HEADER_BYTES); }
+    void ProcessGuiUpdates();
+    std::atomic<uint32> m_refCount;
+    uint64_t m_uniqueId;
+    HINSTANCE m_hInstance;
+    HostOptions m_options;
+    bool m_sessionMode = false;
+    std::atomic<bool> m_mainLoopRunning, m_threadsRunning;
+    HANDLE m_hPipeThread = NULL, m_hAudioThread = NULL;
+    std::thread m_scanThread;
+    std::atomic<bool> m_scanning{false};
+    ControlServer m_control;
+    CompletionQueue m_ownCompletions;
+    CompletionQueue *m_completions = &m_ownCompletions;
+    SharedMemoryRegion m_shm;
+    SharedMemoryRegion m_wakeShm;
+    WakeSyncBlock *m_pWake = nullptr;
+    SharedMemoryRegion m_automationShm;
+    AutomationHeader *m_pAutomation = nullptr;
+    SharedMemoryRegion m_outputParamShm;
+    OutputParamHeader *m_pOutputParams = nullptr;
+    SharedMemoryRegion m_eventShm;
+    EventRingHeader *m_pEvents = nullptr;
+    SharedMemoryRegion m_statsShm;
+    StatsPage *m_pStats = nullptr;
+    // get_state_shm / set_state_shm で使うまでは作らない
+    StateArena m_stateArena;
+    // 通知から起きるまでの時間。起きて最初のブロックの期限超過の判定に足す
+    uint64_t m_wakeLatencyNs = 0;
+    uint32_t m_eventBlockIndex = 0;
+    // 現在のブロックのイベント (リングから読んだもの、プラグインに渡す形に直したもの)
+    std::vector<SharedEvent> m_blockEvents;
+    std::vector<Event> m_blockNoteEvents;
+    // チャンネル x コントローラ番号 -> パラメータ ID (IMidiMapping から BuildProcessPlan で作る)
+    std::vector<ParamID> m_midiControllerMap;
+    AudioRingHeader *m_pRing = nullptr;
+    SharedLayoutHeader *m_pLayout = nullptr;
+    char *m_pSlots = nullptr;
+    size_t m_slotBytes = 0;
+    uint32_t m_slotCount = 1;
+    // 最後に組んだレイアウトが -shm_size の容量に収まらなかったか (ロードの失敗理由として返す)
+    bool m_layoutTooLarge = false;
+    std::atomic<uint32_t> *m_pRingHead = nullptr, *m_pRingTail = nullptr;
+    int32 m_blockSize = 0;
+    double m_sampleRate = 44100.0;
+    int32 m_processSampleSize = kSample32;
+    int64 m_samplePosition = 0;
+    HANDLE m_hEventClientReady = NULL, m_hEventHostDone = NULL;
+    std::mutex m_commandMutex;
+    // GUI (performEdit) からオーディオスレッドへ、オーディオスレッドから GUI への値の受け渡し
+    ParamExchange m_pendingParams;
+    ParamExchange m_processorParams;
+    static const UINT_PTR IDT_GUI_TIMER = 1;
+    std::vector<QueuedCommand> m_commandQueue;
+    // 先頭段。GUI・ステート・パラメータ編集はこのプラグインが対象
+    PluginInstance m_plugin;
+    // load_chain / load_graph で読み込んだ 2 つ目以降のノード
+    std::vector<std::unique_ptr<PluginInstance>> m_chainStages;
+    // ノードの実行順 (トポロジカル順) と、共有メモリへ出力するノード
+    std::vector<uint32_t> m_graphOrder;
+    uint32_t m_graphSink = 0;
+    size_t m_linkChannelBytes = 0;
+    GraphWorkerPool m_workers;
+    // 実行中のスライス (ワーカーが参照する)
+    char *m_sliceBase = nullptr;
+    int32 m_sliceStart = 0, m_sliceSamples = 0;
+    double m_sliceSampleRate = 0.0;
+    int32 m_blockCapacity = 0;
+    // render コマンド中だけ共有メモリのスロットの代わりに使う領域 (AudioSharedData + チャンネル)
+    std::vector<double> m_renderSlot;
+    std::atomic<int32> m_chainLatency;
+    std::atomic<bool> m_isPluginReady;
+    std::atomic<bool> m_audioBusy;
+    HWND m_hGuiWindow = NULL, m_hMainThreadMsgWindow = NULL;
+    FUnknownPtr<IPlugView> m_plugView;
+    WindowController *m_windowController = nullptr;
+    static const UINT WM_APP_SHOW_GUI = WM_APP + 1;
+    static const UINT WM_APP_HIDE_GUI = WM_APP + 2;
+    static const UINT WM_APP_RESTART_COMPONENT = WM_APP + 3;
+};
+
+VstHost *g_pVstHost = nullptr;
+VstHost::VstHost(HINSTANCE hInstance, const HostOptions &options)
+    : m_refCount(1), m_uniqueId(options.uniqueId), m_hInstance(hInstance), m_options(options),
+      m_mainLoopRunning(false), m_threadsRunning(false), m_chainLatency(0), m_isPluginReady(false), m_audioBusy(false)
+{
+}
+VstHost::~VstHost() { Cleanup(); }
+tresult PLUGIN_API VstHost::queryInterface(const TUID _iid, void **obj)
+{
+    if (FUnknownPrivate::iidEqual(_iid, IHostApplication::iid))
+    {
+        *obj = static_cast<IHostApplication *>(this);
+        addRef();
+        return kResultOk;
+    }
+    if (FUnknownPrivate::iidEqual(_iid, IComponentHandler::iid))
+    {
+        *obj = static_cast<IComponentHandler *>(this);
+        addRef();
+        return kResultOk;
+    }
+    if (FUnknownPrivate::iidEqual(_iid, IComponentHandler2::iid))
+    {
+        *obj = static_cast<IComponentHandler2 *>(this);
+        addRef();
+        return kResultOk;
+    }
+    if (FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
+    {
+        *obj = static_cast<IHostApplication *>(this);
+        addRef();
+        return kResultOk;
+    }
+    *obj = nullptr;
+    return kNoInterface;
+}
+uint32 PLUGIN_API VstHost::addRef() { return ++m_refCount; }
+uint32 PLUGIN_API VstHost::release()
+{
+    if (--m_refCount == 0)
+    {
+        delete this;
+        return 0;
+    }
+    return m_refCount;
+}
+tresult PLUGIN_API VstHost::getName(String128 name)
+{
+    Steinberg::str8ToStr16(name, "VST3 Host Bridge", 128);
+    return kResultOk;
+}
+tresult PLUGIN_API VstHost::createInstance(TUID cid, TUID iid, void **obj)
+{
+    FUnknownPtr<IMessage> message;
+    if (FUnknownPrivate::iidEqual(cid, IMessage::iid))
+    {
+        message = owned(new HostMessage);
+        if (message)
+        {
+            return message->queryInterface(iid, obj);
+        }
+    }
+    *obj = nullptr;
+    return kNoInterface;
+}
+tresult PLUGIN_API VstHost::beginEdit(ParamID id)
+{
+    return kResultOk;
+}
+
+tresult PLUGIN_API VstHost::performEdit(ParamID id, ParamValue valueNormalized)
+{
+    return m_pendingParams.Set(id, valueNormalized) ? kResultOk : kInvalidArgument;
+}
+
+tresult PLUGIN_API VstHost::endEdit(ParamID id)
+{
+    return kResultOk;
+}
+
+tresult PLUGIN_API VstHost::restartComponent(int32 flags)
+{
+    DbgPrint(_T("restartComponent(0x%X) called."), flags);
+    // バス構成の変更はメインスレッドで処理を止めてから反映する
+    if ((flags & (kIoChanged | kReloadComponent | kLatencyChanged)) && m_hMainThreadMsgWindow)
+        PostMessage(m_hMainThreadMsgWindow, WM_APP_RESTART_COMPONENT, (WPARAM)flags, 0);
+    return kResultOk;
+}
+bool VstHost::Initialize()
+{
+    if (!InitIPC())
+    {
+        DbgPrint(_T("Initialize: InitIPC FAILED."));
+        return false;
+    }
+    if (m_options.graphWorkers > 0 && !m_workers.Start(m_options.graphWorkers, m_options))
+    {
+        DbgPrint(_T("Initialize: Failed to start %d graph workers. Graphs run on the audio thread."), m_options.graphWorkers);
+        m_workers.Stop();
+    }
+    m_threadsRunning = true;
+    m_hPipeThread = CreateThread(NULL, 0, PipeThreadProc, this, 0, NULL);
+    m_hAudioThread = CreateThread(NULL, 0, AudioThreadProc, this, 0, NULL);
+    if (!m_hPipeThread || !m_hAudioThread)
+    {
+        DbgPrint(_T("Initialize: Failed to create worker threads."));
+        return false;
+    }
+    return true;
+}
+bool VstHost::InitSession()
+{
+    m_sessionMode = true;
+    // 失敗時も Cleanup で作成済みのハンドルを閉じられるよう、先に立てておく
+    m_threadsRunning = true;
+    if (!InitIPC())
+    {
+        DbgPrint(_T("InitSession: InitIPC FAILED."));
+        return false;
+    }
+    if (!CreateMessageWindow())
+        return false;
+    m_mainLoopRunning = true;
+    return true;
+}
+void VstHost::RequestStop() { m_mainLoopRunning = false; }
+bool VstHost::CreateMessageWindow()
+{
+    WNDCLASS wc = {};
+    wc.lpfnWndProc = VstHost::MainThreadMsgWndProc;
+    wc.hInstance = m_hInstance;
+    wc.lpszClassName = TEXT("VstHostMsgWindowClass");
+    RegisterClass(&wc);
+    m_hMainThreadMsgWindow = CreateWindow(wc.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, m_hInstance, this);
+    if (!m_hMainThreadMsgWindow)
+        return false;
+    SetTimer(m_hMainThreadMsgWindow, IDT_GUI_TIMER, 33, nullptr);
+    return true;
+}
+void VstHost::RunMessageLoop()
+{
+    // -preload のインスタンスはメッセージループで 1 つずつ作る
+    if (CreateMessageWindow())
+        PostMessage(m_hMainThreadMsgWindow, WM_APP, 0, 0);
+    MSG msg;
+    m_mainLoopRunning = true;
+    while (m_mainLoopRunning && GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        if (m_hGuiWindow && IsDialogMessage(m_hGuiWindow, &msg))
+        {
+            continue;
+        }
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    if (m_hGuiWindow)
+    {
+        DestroyWindow(m_hGuiWindow);
+    }
+}
+void VstHost::Cleanup()
+{
+    if (!m_threadsRunning.exchange(false))
+        return;
+    m_mainLoopRunning = false;
+    if (m_hEventClientReady)
+        SetEvent(m_hEventClientReady);
+    // セッションはメッセージループを共有しているので WM_QUIT を送らない
+    if (m_hMainThreadMsgWindow && !m_sessionMode)
+        PostMessage(m_hMainThreadMsgWindow, WM_QUIT, 0, 0);
+    if (m_hPipeThread)
+    {
+        WaitForSingleObject(m_hPipeThread, 2000);
+        CloseHandle(m_hPipeThread);
+        m_hPipeThread = NULL;
+    }
+    // m_threadsRunning を下ろしたので、scan は子プロセスを止めて戻る
+    if (m_scanThread.joinable())
+        m_scanThread.join();
+    // 実行されずに残ったコマンドの完了を待っている接続に知らせる (セッションを閉じたとき)
+    std::vector<QueuedCommand> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_commandMutex);
+        pending.swap(m_commandQueue);
+    }
+    for (const auto &queued : pending)
+    {
+        if (queued.tracked)
+            PostCompletion(queued, false, MonotonicNanos(), "Cancelled");
+    }
+    m_control.Close();
+    if (m_hAudioThread)
+    {
+        WaitForSingleObject(m_hAudioThread, 2000);
+        CloseHandle(m_hAudioThread);
+        m_hAudioThread = NULL;
+    }
+    m_workers.Stop();
+    ReleasePlugin();
+    // セッションが preload したものだけを取り下げる。共通のものは SessionManager が片付ける
+    if (m_sessionMode)
+        g_warmPool.ClearOwner(this);
+    else
+        g_warmPool.Clear();
+    m_pRing = nullptr;
+    m_pLayout = nullptr;
+    m_pSlots = nullptr;
+    m_pRingHead = m_pRingTail = nullptr;
+    m_shm.Close();
+    m_pWake = nullptr;
+    m_wakeShm.Close();
+    m_pAutomation = nullptr;
+    m_automationShm.Close();
+    m_pOutputParams = nullptr;
+    m_outputParamShm.Close();
+    m_pEvents = nullptr;
+    m_eventShm.Close();
+    m_pStats = nullptr;
+    m_statsShm.Close();
+    m_stateArena.Close();
+    if (m_hEventClientReady)
+    {
+        CloseHandle(m_hEventClientReady);
+        m_hEventClientReady = NULL;
+    }
+    if (m_hEventHostDone)
+    {
+        CloseHandle(m_hEventHostDone);
+        m_hEventHostDone = NULL;
+    }
+    if (m_hMainThreadMsgWindow)
+    {
+        DestroyWindow(m_hMainThreadMsgWindow);
+        m_hMainThreadMsgWindow = NULL;
+    }
+}
+// 接続ごとにテキストで始まり、binary_mode を受け取ったらバイナリのフレームに切り替わる
+bool VstHost::OnControlMessage(ControlConnection &conn, const std::string &message)
+{
+    if (conn.binary)
+        return HandleBinaryFrame(conn, message);
+    std::string cmd(message.c_str()); // 以前と同じく NUL までをコマンドとする
+    if (cmd.rfind("binary_mode", 0) == 0)
+    {
+        conn.binary = true;
+        conn.Send("OK BINARY " + std::to_string(BINARY_PROTOCOL_VERSION) + " " + std::to_string(MAX_FRAME_PAYLOAD) + "\n");
+        return true;
+    }
+    // 空の応答は後から完了通知で届く
+    std::string response = ProcessCommand(cmd, conn.id);
+    if (response.empty())
+        conn.AwaitReply();
+    else
+        conn.Send(std::move(response));
+    return cmd.rfind("exit", 0) != 0;
+}
+void VstHost::HandleAudioProcessing()
+{
+    ApplyRealtimeThreadSettings(m_options, 0);
+    DbgPrint(_T("HandleAudioProcessing: Realtime settings: %hs"), g_realtimeStatus.ToString().c_str());
+    if (m_pRingHead && m_pRingTail)
+    {
+        HandleRingProcessing();
+        return;
+    }
+    uint32_t seq = m_pWake ? m_pWake->clientSeq.load(std::memory_order_acquire) : 0;
+    while (m_threadsRunning)
+    {
+        if (!WaitForClient(seq))
+            continue;
+        if (!m_threadsRunning)
+            break;
+        RecordWake();
+        if (m_pWake)
+            seq = m_pWake->clientSeq.load(std::memory_order_acquire);
+        ProcessAudioBlock(0);
+        SignalClient(seq);
+    }
+}
+void VstHost::HandleRingProcessing()
+{
+    // ClientReady (または clientSeq) はリングが空のときだけ待つドアベルとして使う。
+    // 待つ前に head を読み直すので、クライアントの通知を取りこぼさない。
+    uint32_t tail = m_pRingTail->load(std::memory_order_relaxed);
+    while (m_threadsRunning)
+    {
+        uint32_t head = m_pRingHead->load(std::memory_order_acquire);
+        if (head == tail)
+        {
+            uint32_t seq = m_pWake ? m_pWake->clientSeq.load(std::memory_order_acquire) : 0;
+            if (m_pRingHead->load(std::memory_order_acquire) == tail && WaitForClient(seq))
+                RecordWake();
+            continue;
+        }
+        tail = DrainRing(tail);
+    }
+}
+// tail から head までのスロットを処理し、新しい tail を返す
+uint32_t VstHost::DrainRing(uint32_t tail)
+{
+    const uint32_t slotCount = m_slotCount;
+    uint32_t head = m_pRingHead->load(std::memory_order_acquire);
+    if (head == tail)
+        return tail;
+    if (head - tail > slotCount)
+    {
+        DbgPrint(_T("DrainRing: Ring overrun (head=%u, tail=%u). Resynchronizing."), head, tail);
+        tail = head - slotCount;
+    }
+    while (tail != head && m_threadsRunning)
+    {
+        ProcessAudioBlock(tail % slotCount);
+        ++tail;
+        m_pRingTail->store(tail, std::memory_order_release);
+    }
+    SignalClient(tail);
+    return tail;
+}
+// セッションのワーカーから ClientReady がシグナル状態のときに呼ばれる
+void VstHost::ServiceAudio()
+{
+    ResetEvent(m_hEventClientReady);
+    RecordWake();
+    if (m_pRingHead && m_pRingTail)
+    {
+        DrainRing(m_pRingTail->load(std::memory_order_relaxed));
+        return;
+    }
+    ProcessAudioBlock(0);
+    SetEvent(m_hEventHostDone);
+}
+// clientSeq が lastSeq から進むまで spinMicros だけスピンし、その後カーネルで待つ。
+// -wake event のときは従来どおり ClientReady イベントだけを見る。
+bool VstHost::WaitForClient(uint32_t lastSeq)
+{
+    WakeSyncBlock *wake = m_pWake;
+    if (!wake)
+    {
+        if (WaitForSingleObject(m_hEventClientReady, 1000) != WAIT_OBJECT_0)
+            return false;
+        ResetEvent(m_hEventClientReady);
+        return true;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_options.spinMicros);
+    do
+    {
+        if (wake->clientSeq.load(std::memory_order_acquire) != lastSeq)
+            return true;
+        CpuRelax();
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    // hostWaiting を立ててから読み直す。クライアントは clientSeq を進めた後に hostWaiting を見るので、
+    // どちらかが必ず相手の書き込みを観測する
+    wake->hostWaiting.store(1, std::memory_order_seq_cst);
+    if (wake->clientSeq.load(std::memory_order_seq_cst) == lastSeq)
+    {
+        // WaitOnAddress はプロセス内でしか使えないので、眠るときだけイベントを使う
+        if (WaitForSingleObject(m_hEventClientReady, 1000) == WAIT_OBJECT_0)
+            ResetEvent(m_hEventClientReady);
+    }
+    wake->hostWaiting.store(0, std::memory_order_relaxed);
+    return wake->clientSeq.load(std::memory_order_acquire) != lastSeq;
+}
+void VstHost::SignalClient(uint32_t seq)
+{
+    WakeSyncBlock *wake = m_pWake;
+    if (!wake)
+    {
+        SetEvent(m_hEventHostDone);
+        return;
+    }
+    wake->hostSeq.store(seq, std::memory_order_seq_cst);
+    if (wake->clientWaiting.load(std::memory_order_seq_cst))
+    {
+        SetEvent(m_hEventHostDone);
+    }
+}
+LRESULT CALLBACK VstHost::MainThreadMsgWndProc(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
+{
+    VstHost *h;
+    if (msg == WM_CREATE)
+    {
+        h = (VstHost *)((CREATESTRUCT *)lp)->lpCreateParams;
+        SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)h);
+    }
+    else
+    {
+        h = (VstHost *)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+    }
+    if (h)
+    {
+        switch (msg)
+        {
+        case WM_APP_SHOW_GUI:
+            h->ShowGui();
+            return 0;
+        case WM_APP_HIDE_GUI:
+            h->HideGui();
+            return 0;
+        case WM_APP:
+            h->ProcessQueuedCommands();
+            return 0;
+        case WM_APP_RESTART_COMPONENT:
+            h->OnRestartComponent((int32)wp);
+            return 0;
+        case WM_TIMER:
+            if (wp == IDT_GUI_TIMER)
+            {
+                h->ProcessGuiUpdates();
+            }
+            return 0;
+        }
+    }
+    return DefWindowProc(hWnd, msg, wp, lp);
+}
+std::string VstHost::ProcessCommand(const std::string &full_cmd, uint64_t connection)
+{
+    std::string cmd = full_cmd;
+    while (!cmd.empty() && isspace(cmd.back()))
+        cmd.pop_back();
+    if (cmd == "exit")
+    {
+        RequestStop();
+        return "OK: Exit requested.\n";
+    }
+    if (cmd == "get_latency")
+    {
+        if (!m_isPluginReady)
+            return "FAIL NoPlugin\n";
+        return "OK " + std::to_string(m_chainLatency.load()) + "\n";
+    }
+    if (cmd == "rt_status")
+        return "OK " + g_realtimeStatus.ToString() + "\n";
+    if (cmd == "stats")
+        return FormatStats();
+    if (cmd == "list_plugins")
+    {
+        std::string json;
+        if (!FormatPluginIndex(PluginIndexPath(), json))
+            return "FAIL NoIndex\n";
+        return "OK " + json + "\n";
+    }
+    if (!cmd.empty() && cmd[0] == '@')
+    {
+        // "@<id> <command>": すぐに ACK を返し、終わったら DONE で結果を通知する
+        size_t space = cmd.find(' ');
+        QueuedCommand command;
+        command.requestId = cmd.substr(1, space == std::string::npos ? std::string::npos : space - 1);
+        command.text = space == std::string::npos ? std::string() : cmd.substr(cmd.find_first_not_of(' ', space));
+        command.connection = connection;
+        if (!IsValidRequestId(command.requestId) || command.text.empty())
+            return "FAIL InvalidRequestId\n";
+        return SubmitTrackedCommand(std::move(command));
+    }
+    if (IsSyncCommand(cmd) || IsScanCommand(cmd))
+    {
+        // パイプのスレッドは待たせず、メインスレッドで実行し終えたら応答を送る
+        QueuedCommand command;
+        command.text = cmd;
+        command.tracked = true;
+        command.plainReply = true;
+        command.connection = connection;
+        command.queuedNs = MonotonicNanos();
+        if (IsScanCommand(cmd))
+            StartScan(std::move(command));
+        else
+            QueueCommand(std::move(command));
+        return std::string();
+    }
+    QueuedCommand command;
+    command.text = cmd;
+    command.connection = connection;
+    command.queuedNs = MonotonicNanos();
+    QueueCommand(std::move(command));
+    return "OK\n";
+}
+// パイプのスレッドで結果を返すコマンド
+static bool IsImmediateCommand(const std::string &cmd)
+{
+    return cmd == "get_latency" || cmd == "rt_status" || cmd == "stats" || cmd == "list_plugins";
+}
+bool VstHost::IsSyncCommand(const std::string &cmd)
+{
+    return cmd == "get_state" || cmd == "get_state_raw" || cmd.rfind("render ", 0) == 0 || cmd == "benchmark" || cmd.rfind("benchmark ", 0) == 0 ||
+           cmd == "get_state_shm" || cmd.rfind("set_state_shm ", 0) == 0 || cmd.rfind("reserve_state_shm ", 0) == 0;
+}
+// 完了を通知するコマンドを受け付ける。メインスレッドで実行するものはキューに入れ、それ以外はその場で実行して通知を出す
+std::string VstHost::SubmitTrackedCommand(QueuedCommand &&command)
+{
+    std::string ack = command.binary ? std::string("ACK") : "ACK " + command.requestId + "\n";
+    command.tracked = true;
+    command.queuedNs = MonotonicNanos();
+    if (command.text == "exit" || command.text[0] == '@')
+        return command.binary ? std::string("FAIL NotTrackable") : "FAIL NotTrackable\n";
+    if (IsImmediateCommand(command.text))
+    {
+        std::string response = ProcessCommand(command.text, command.connection);
+        while (!response.empty() && (response.back() == '\n' || response.back() == '\r'))
+            response.pop_back();
+        const bool success = response.rfind("OK", 0) == 0;
+        const size_t skip = std::min(response.size(), (size_t)(success ? 3 : 5));
+        PostCompletion(command, success, command.queuedNs, response.substr(skip));
+        return ack;
+    }
+    if (IsScanCommand(command.text))
+    {
+        StartScan(std::move(command));
+        return ack;
+    }
+    QueueCommand(std::move(command));
+    return ack;
+}
+// 完了通知を組み立てて送り先の接続に渡す。startNs は実行を始めた時刻
+void VstHost::PostCompletion(const QueuedCommand &command, bool success, uint64_t startNs, const std::string &result)
+{
+    const uint64_t endNs = MonotonicNanos();
+    const uint64_t queueUs = (startNs - command.queuedNs) / 1000, runUs = (endNs - startNs) / 1000;
+    std::vector<std::string> messages;
+    if (command.plainReply)
+    {
+        messages.push_back((success ? "OK " : "FAIL ") + result + "\n");
+    }
+    else if (command.binary)
+    {
+        // get_state_raw の結果は状態そのものなので Blob で返す
+        const bool blob = success && command.text == "get_state_raw";
+        std::string payload;
+        AppendIntField(payload, success ? 0 : 1);
+        AppendStringField(payload, blob ? (result.empty() ? "EMPTY" : "OK") : result);
+        AppendIntField(payload, (int64_t)queueUs);
+        AppendIntField(payload, (int64_t)runUs);
+        if (blob)
+            AppendBinaryField(payload, kFieldBlob, result.data(), result.size());
+        BuildBinaryFrames((uint16_t)(command.opcode | kOpResponse | kOpCompletion), command.binaryRequestId, payload, messages);
+    }
+    else
+    {
+        char timing[64];
+        snprintf(timing, sizeof(timing), " %.3f %.3f", queueUs / 1000.0, runUs / 1000.0);
+        messages.push_back("DONE " + command.requestId + (success ? " OK" : " FAIL") + timing + (result.empty() ? "" : " " + result) + "\n");
+    }
+    m_completions->Post(command.connection, std::move(messages), command.plainReply);
+}
+void VstHost::QueueCommand(QueuedCommand &&command)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_commandMutex);
+        m_commandQueue.push_back(std::move(command));
+    }
+    if (m_hMainThreadMsgWindow)
+        PostMessage(m_hMainThreadMsgWindow, WM_APP, 0, 0);
+}
+// 1 フレームを処理する。切断すべきとき (exit、プロトコル違反) は false を返す
+bool VstHost::HandleBinaryFrame(ControlConnection &conn, const std::string &frame)
+{
+    std::map<uint32_t, BinaryRequest> &partial = conn.partial;
+    FrameHeader header;
+    if (frame.size() < sizeof(header))
+        return false;
+    memcpy(&header, frame.data(), sizeof(header));
+    if (header.magic != FRAME_MAGIC || header.payloadBytes != frame.size() - sizeof(header))
+    {
+        DbgPrint(_T("HandleBinaryFrame: Malformed frame (%zu bytes). Closing connection."), frame.size());
+        return false;
+    }
+    BinaryRequest &request = partial[header.requestId];
+    if (request.payload.empty())
+        request.opcode = header.opcode;
+    if (request.payload.size() + header.payloadBytes > MAX_PIPE_MESSAGE_BYTES)
+    {
+        partial.erase(header.requestId);
+        WriteBinaryResponse(conn, header.opcode, header.requestId, false, "TooLarge", nullptr, 0);
+        return true;
+    }
+    request.payload.append(frame, sizeof(header), std::string::npos);
+    if (header.flags & kFrameMore)
+        return true;
+
+    BinaryRequest complete = std::move(request);
+    partial.erase(header.requestId);
+    std::vector<BinaryField> fields;
+    if (!ParseBinaryFields(complete.payload, fields))
+    {
+        WriteBinaryResponse(conn, complete.opcode, header.requestId, false, "MalformedFields", nullptr, 0);
+        return true;
+    }
+    // メインスレッドで実行するものは ACK を返し、終わったら kOpCompletion のフレームで結果を送る
+    QueuedCommand command;
+    command.binary = true;
+    command.opcode = complete.opcode;
+    command.binaryRequestId = header.requestId;
+    command.connection = conn.id;
+    switch (complete.opcode)
+    {
+    case kOpText:
+    {
+        if (fields.empty() || fields[0].type != kFieldString)
+            break;
+        std::string cmd(fields[0].data, fields[0].length);
+        while (!cmd.empty() && isspace((unsigned char)cmd.back()))
+            cmd.pop_back();
+        if (cmd.empty() || cmd[0] == '@')
+            break;
+        std::string response;
+        if (IsImmediateCommand(cmd) || cmd == "exit")
+        {
+            response = ProcessCommand(cmd, conn.id);
+        }
+        else
+        {
+            command.text = cmd;
+            response = SubmitTrackedCommand(std::move(command));
+        }
+        while (!response.empty() && (response.back() == '\n' || response.back() == '\r'))
+            response.pop_back();
+        WriteBinaryResponse(conn, complete.opcode, header.requestId, response.rfind("OK", 0) == 0 || response == "ACK", response, nullptr, 0);
+        return cmd != "exit";
+    }
+    case kOpGetState:
+    {
+        command.text = "get_state_raw";
+        WriteBinaryResponse(conn, complete.opcode, header.requestId, true, SubmitTrackedCommand(std::move(command)), nullptr, 0);
+        return true;
+    }
+    case kOpSetState:
+    case kOpLoadAndSetState:
+    {
+        const BinaryField *state = nullptr;
+        if (complete.opcode == kOpSetState)
+        {
+            if (fields.size() != 1 || fields[0].type != kFieldBlob)
+                break;
+            command.text = "set_state";
+            state = &fields[0];
+        }
+        else
+        {
+            double sampleRate = 44100.0;
+            int64_t blockSize = 1024;
+            if (fields.size() < 3 || fields[0].type != kFieldString || !FieldAsDouble(fields[1], sampleRate) || !FieldAsInt(fields[2], blockSize))
+                break;
+            if (fields.size() > 3)
+            {
+                if (fields[3].type != kFieldBlob)
+                    break;
+                state = &fields[3];
+            }
+            // パスはテキストのコマンドと同じ処理に渡すので、引数の区切りを変えてしまう '"' や改行を含むものは受け付けない
+            const std::string path(fields[0].data, fields[0].length);
+            if (path.empty() || path.find_first_of(std::string("\"\r\n\0", 4)) != std::string::npos)
+                break;
+            command.text = "load_and_set_state \"" + path + "\" " + std::to_string(sampleRate) + " " + std::to_string(blockSize);
+        }
+        if (state)
+            command.state.assign((const BYTE *)state->data, (const BYTE *)state->data + state->length);
+        WriteBinaryResponse(conn, complete.opcode, header.requestId, true, SubmitTrackedCommand(std::move(command)), nullptr, 0);
+        return true;
+    }
+    default:
+        WriteBinaryResponse(conn, complete.opcode, header.requestId, false, "UnknownOpcode", nullptr, 0);
+        return true;
+    }
+    WriteBinaryResponse(conn, complete.opcode, header.requestId, false, "InvalidArguments", nullptr, 0);
+    return true;
+}
+void VstHost::WriteBinaryResponse(ControlConnection &conn, uint16_t opcode, uint32_t requestId, bool ok, const std::string &message, const void *data, size_t length)
+{
+    std::string payload;
+    payload.reserve(3 * sizeof(FieldHeader) + sizeof(int64_t) + message.size() + length);
+    AppendIntField(payload, ok ? 0 : 1);
+    AppendStringField(payload, message);
+    if (data)
+        AppendBinaryField(payload, kFieldBlob, data, length);
+    std::vector<std::string> frames;
+    BuildBinaryFrames((uint16_t)(opcode | kOpResponse), requestId, payload, frames);
+    for (auto &frame : frames)
+        conn.Send(std::move(frame));
+}
+// 空白区切りのダブルクォーテーションで囲まれたパスを読めるだけ読み、pos を続きの位置に進める
+static bool ParseQuotedPaths(const std::string &args, std::vector<std::string> &paths, size_t &pos)
+{
+    while (true)
+    {
+        while (pos < args.size() && isspace((unsigned char)args[pos]))
+            ++pos;
+        if (pos >= args.size() || args[pos] != '"')
+            return true;
+        size_t end_quote = args.find('"', pos + 1);
+        if (end_quote == std::string::npos)
+            return false;
+        paths.push_back(args.substr(pos + 1, end_quote - pos - 1));
+        pos = end_quote + 1;
+    }
+}
+// "0>1,0>2,1>3,2>3" 形式の接続リスト
+static bool ParseGraphEdges(const std::string &text, std::vector<GraphEdge> &edges)
+{
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        size_t sep = item.find('>');
+        if (sep == std::string::npos)
+            return false;
+        try
+        {
+            edges.push_back({(uint32_t)std::stoul(item.substr(0, sep)), (uint32_t)std::stoul(item.substr(sep + 1))});
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+// get_state、render などパイプのスレッドが結果を待つコマンドをメインスレッドで実行する
+bool VstHost::ExecuteSyncCommand(const std::string &cmd, std::string &result)
+{
+    bool success = false;
+    if (cmd == "get_state" || cmd == "get_state_raw")
+    {
+        // get_state_raw はバイナリプロトコル用で、base64 にせずそのまま返す (空なら空)
+        std::string state;
+        if (CaptureDualState(state))
+        {
+            if (cmd == "get_state_raw")
+                result.swap(state);
+            else if (state.empty())
+                result = "EMPTY";
+            else
+            {
+                // 応答に直接書き込む
+                static const char prefix[] = "VST3_DUAL:";
+                const size_t prefixLength = sizeof(prefix) - 1;
+                result.resize(prefixLength + Base64EncodedLength(state.size()));
+                memcpy(&result[0], prefix, prefixLength);
+                Base64Encode((const BYTE *)state.data(), state.size(), &result[prefixLength]);
+            }
+            success = true;
+        }
+        else
+        {
+            result = "NoPlugin";
+            success = false;
+        }
+    }
+    else if (cmd == "get_state_shm")
+    {
+        uint64_t bytes = 0;
+        if (!m_plugin.plugProvider || !m_plugin.plugProvider->getComponent() || !m_plugin.plugProvider->getController())
+        {
+            result = "NoPlugin";
+            success = false;
+        }
+        else if (!CaptureDualStateToArena(bytes))
+        {
+            result = "ArenaFailed";
+            success = false;
+        }
+        else
+        {
+            result = std::to_string(m_stateArena.generation()) + " " + std::to_string(bytes);
+            success = true;
+        }
+    }
+    else if (cmd.rfind("reserve_state_shm ", 0) == 0)
+    {
+        // クライアントが set_state_shm の前に状態を書き込む領域を用意する
+        uint64_t bytes = strtoull(cmd.c_str() + 18, nullptr, 10);
+        success = bytes > 0 && m_stateArena.Reserve(bytes, 0);
+        if (success)
+            result = std::to_string(m_stateArena.generation()) + " " + std::to_string(m_stateArena.capacity());
+        else
+            result = bytes > 0 ? "ArenaFailed" : "InvalidArguments";
+    }
+    else if (cmd.rfind("set_state_shm ", 0) == 0)
+    {
+        // 状態は StateArena から直接読ませる。応答を返すまでクライアントは領域を書き換えない
+        uint64_t bytes = strtoull(cmd.c_str() + 14, nullptr, 10);
+        success = false;
+        if (!m_plugin.plugProvider)
+            result = "NoPlugin";
+        else if (bytes == 0 || bytes > m_stateArena.capacity())
+            result = "InvalidArguments";
+        else if (!ApplyDualState(m_stateArena.data(), (size_t)bytes))
+            result = "MalformedState";
+        else
+            success = true;
+    }
+    else if (cmd.rfind("render ", 0) == 0)
+    {
+        std::vector<std::string> paths;
+        size_t pos = 0;
+        std::string args_str = cmd.substr(7);
+        int32 bs = DEFAULT_RENDER_BLOCK;
+        if (!ParseQuotedPaths(args_str, paths, pos) || paths.size() != 2)
+        {
+            result = "InvalidArguments";
+            success = false;
+        }
+        else
+        {
+            std::stringstream ss(args_str.substr(pos));
+            ss >> bs;
+            if (bs < 1 || bs > MAX_RENDER_BLOCK)
+                bs = DEFAULT_RENDER_BLOCK;
+            DbgPrint(_T("Executing render: '%hs' -> '%hs', BS: %d"), paths[0].c_str(), paths[1].c_str(), bs);
+            success = RenderOffline(paths[0], paths[1], bs, result);
+        }
+    }
+    else if (cmd.rfind("benchmark", 0) == 0)
+    {
+        // benchmark [ブロックサイズ,...] [秒数]
+        std::stringstream ss(cmd.substr(9));
+        std::string sizesText = DEFAULT_BENCHMARK_BLOCKS;
+        double seconds = DEFAULT_BENCHMARK_SECONDS;
+        ss >> sizesText >> seconds;
+        if (!(seconds > 0.0) || seconds > MAX_BENCHMARK_SECONDS)
+            seconds = DEFAULT_BENCHMARK_SECONDS;
+        std::vector<int32> blockSizes;
+        std::stringstream sizes(sizesText);
+        std::string item;
+        bool valid = true;
+        while (std::getline(sizes, item, ','))
+        {
+            int32 bs = atoi(item.c_str());
+            if (bs < 1 || bs > MAX_RENDER_BLOCK || blockSizes.size() >= MAX_BENCHMARK_SIZES)
+                valid = false;
+            else
+                blockSizes.push_back(bs);
+        }
+        if (!valid || blockSizes.empty())
+        {
+            result = "InvalidArguments";
+            success = false;
+        }
+        else
+        {
+            DbgPrint(_T("Executing benchmark: %zu block size(s), %.1f s each."), blockSizes.size(), seconds);
+            success = RunBenchmark(blockSizes, seconds, result);
+        }
+    }
+    else
+    {
+        result = "UnknownCommand";
+    }
+    return success;
+}
+void VstHost::ProcessQueuedCommands()
+{
+    std::vector<QueuedCommand> commandsToProcess;
+    {
+        std::lock_guard<std::mutex> lock(m_commandMutex);
+        commandsToProcess.swap(m_commandQueue);
+    }
+
+    for (const auto &queued : commandsToProcess)
+    {
+        const uint64_t startNs = MonotonicNanos();
+        std::string result;
+        bool success = ExecuteQueuedCommand(queued, result);
+        if (!success)
+        {
+            DbgPrint(_T("ProcessQueuedCommands: '%hs' failed: %hs"), queued.text.substr(0, 64).c_str(), result.substr(0, 64).c_str());
+        }
+        if (queued.tracked)
+            PostCompletion(queued, success, startNs, result);
+    }
+    // 使われた preload のインスタンスは 1 回に 1 つずつ補充し、続きは次のメッセージで行う
+    if (g_warmPool.RefillOne() && m_hMainThreadMsgWindow)
+        PostMessage(m_hMainThreadMsgWindow, WM_APP, 0, 0);
+}
+// scan は子プロセスを待つだけなので、メインスレッドを止めないよう専用のスレッドで行う。同時に走らせるのは 1 つまで
+void VstHost::StartScan(QueuedCommand &&command)
+{
+    if (m_scanning.exchange(true))
+    {
+        PostCompletion(command, false, MonotonicNanos(), "ScanInProgress");
+        return;
+    }
+    if (m_scanThread.joinable())
+        m_scanThread.join();
+    m_scanThread = std::thread([this, command = std::move(command)]()
+                               {
+        const uint64_t startNs = MonotonicNanos();
+        std::string result;
+        const bool success = RunScan(command.text, result);
+        PostCompletion(command, success, startNs, result);
+        m_scanning = false; });
+}
+// scan [-force] [-jobs <n>] ["<dir>" ...]
+bool VstHost::RunScan(const std::string &cmd, std::string &result)
+{
+    const std::string args = cmd.size() > 4 ? cmd.substr(4) : std::string();
+    bool force = false;
+    int32 jobs = (int32)std::max(1u, std::min(std::thread::hardware_concurrency(), (unsigned)MAX_SCAN_JOBS));
+    size_t pos = 0;
+    while (true)
+    {
+        while (pos < args.size() && isspace((unsigned char)args[pos]))
+            ++pos;
+        if (args.compare(pos, 6, "-force") == 0)
+        {
+            force = true;
+            pos += 6;
+        }
+        else if (args.compare(pos, 5, "-jobs") == 0)
+        {
+            char *end = nullptr;
+            const long value = strtol(args.c_str() + pos + 5, &end, 10);
+            if (end == args.c_str() + pos + 5 || value < 1)
+            {
+                result = "InvalidArguments";
+                return false;
+            }
+            jobs = (int32)std::min(value, (long)MAX_SCAN_JOBS);
+            pos = end - args.c_str();
+        }
+        else
+        {
+            break;
+        }
+    }
+    std::vector<std::string> dirs;
+    if (!ParseQuotedPaths(args, dirs, pos) || pos < args.size())
+    {
+        result = "InvalidArguments";
+        return false;
+    }
+    if (dirs.empty())
+        dirs = DefaultPluginDirectories();
+    const uint64_t startNs = MonotonicNanos();
+    ScanSummary summary;
+    if (!ScanPlugins(dirs, PluginIndexPath(), force, jobs, m_threadsRunning, summary, result))
+        return false;
+    // <プラグイン数> <クラス数> <今回読み込んだ数> <失敗した数> <ミリ秒>
+    result = std::to_string(summary.plugins) + " " + std::to_string(summary.classes) + " " + std::to_string(summary.scanned) + " " +
+             std::to_string(summary.failed) + " " + std::to_string((MonotonicNanos() - startNs) / 1000000);
+    return true;
+}
+// キューに入ったコマンドを実行する。失敗した場合は result にエラーの種類を入れる
+bool VstHost::ExecuteQueuedCommand(const QueuedCommand &queued, std::string &result)
+{
+    std::string cmd = queued.text;
+    while (!cmd.empty() && isspace((unsigned char)cmd.back()))
+    {
+        cmd.pop_back();
+    }
+    if (IsSyncCommand(cmd))
+        return ExecuteSyncCommand(cmd, result);
+    if (cmd.rfind("load_and_set_state ", 0) == 0)
+    {
+        std::string path, state_b64;
+        double sr = 44100.0;
+        int32 bs = 1024;
+
+        try
+        {
+            std::string args_str = cmd.substr(19);
+            if (args_str.empty() || args_str.front() != '"')
+            {
+                DbgPrint(_T("Error: Path for load_and_set_state must be quoted. Command: %hs"), cmd.c_str());
+                result = "InvalidArguments";
+                return false;
+            }
+            size_t end_quote = args_str.find('"', 1);
+            if (end_quote == std::string::npos)
+            {
+                DbgPrint(_T("Error: Unmatched quote in path for load_and_set_state. Command: %hs"), cmd.c_str());
+                result = "InvalidArguments";
+                return false;
+            }
+            path = args_str.substr(1, end_quote - 1);
+            std::stringstream ss(args_str.substr(end_quote + 1));
+            ss >> sr >> bs;
+            std::string temp_state;
+            if (ss >> temp_state)
+            {
+                state_b64 = temp_state;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            DbgPrint(_T("Exception during argument parsing for load_and_set_state: %hs"), e.what());
+            result = "InvalidArguments";
+            return false;
+        }
+
+        if (path.empty())
+        {
+            result = "InvalidArguments";
+            return false;
+        }
+        DbgPrint(_T("Executing load_and_set_state: '%hs', SR: %f, BS: %d"), path.c_str(), sr, bs);
+        if (!LoadPlugin(path, sr, bs))
+        {
+            result = m_layoutTooLarge ? "LayoutTooLarge" : "LoadFailed";
+            return false;
+        }
+        if (m_plugin.plugProvider && !queued.state.empty())
+        {
+            // バイナリプロトコルで受け取った状態
+            DbgPrint(_T("Restoring %zu bytes of binary state..."), queued.state.size());
+            if (!ApplyDualState(queued.state.data(), queued.state.size()))
+            {
+                DbgPrint(_T("Warning: Binary state data is malformed."));
+                result = "MalformedState";
+                return false;
+            }
+        }
+        else if (m_plugin.plugProvider && !state_b64.empty())
+        {
+            DbgPrint(_T("Restoring state..."));
+            if (state_b64.rfind("VST3_DUAL:", 0) != 0)
+            {
+                DbgPrint(_T("Warning: State data format is not VST3_DUAL. State starts with: %hs"), state_b64.substr(0, 20).c_str());
+                result = "UnsupportedStateFormat";
+                return false;
+            }
+            auto state_data = base64_decode(state_b64.data() + 10, state_b64.size() - 10);
+            if (state_data.empty())
+            {
+                DbgPrint(_T("Warning: State data was empty after base64 decoding."));
+                result = "MalformedState";
+                return false;
+            }
+            if (!ApplyDualState(state_data.data(), state_data.size()))
+            {
+                DbgPrint(_T("Warning: State data is malformed."));
+                result = "MalformedState";
+                return false;
+            }
+        }
+        return true;
+    }
+    else if (cmd.rfind("load_plugin ", 0) == 0)
+    {
+        std::string path;
+        double sr = 44100.0;
+        int32 bs = 1024;
+        try
+        {
+            std::string args_str = cmd.substr(12);
+            if (args_str.empty() || args_str.front() != '"')
+            {
+                DbgPrint(_T("Error: Path for load_plugin must be quoted. Command: %hs"), cmd.c_str());
+                result = "InvalidArguments";
+                return false;
+            }
+            size_t end_quote = args_str.find('"', 1);
+            if (end_quote == std::string::npos)
+            {
+                DbgPrint(_T("Error: Unmatched quote in path for load_plugin. Command: %hs"), cmd.c_str());
+                result = "InvalidArguments";
+                return false;
+            }
+            path = args_str.substr(1, end_quote - 1);
+
+            std::stringstream ss(args_str.substr(end_quote + 1));
+            ss >> sr >> bs;
+        }
+        catch (const std::exception &e)
+        {
+            DbgPrint(_T("Exception during argument parsing for load_plugin: %hs"), e.what());
+            result = "InvalidArguments";
+            return false;
+        }
+        if (path.empty())
+        {
+            result = "InvalidArguments";
+            return false;
+        }
+        DbgPrint(_T("Executing load_plugin: '%hs', SR: %f, BS: %d"), path.c_str(), sr, bs);
+        if (!LoadPlugin(path, sr, bs))
+        {
+            result = m_layoutTooLarge ? "LayoutTooLarge" : "LoadFailed";
+            return false;
+        }
+        return true;
+    }
+    else if (cmd.rfind("load_cid ", 0) == 0)
+    {
+        // load_cid <cid> [sample_rate] [block_size]: scan の索引でクラスを引き、そのクラスを読み込む
+        std::string text, cid, path;
+        double sr = 44100.0;
+        int32 bs = 1024;
+        std::stringstream ss(cmd.substr(9));
+        ss >> text >> sr >> bs;
+        if (!ParseClassId(text, cid))
+        {
+            result = "InvalidArguments";
+            return false;
+        }
+        if (!LookupPluginClass(PluginIndexPath(), cid, path, result))
+            return false;
+        DbgPrint(_T("Executing load_cid: %hs -> '%hs', SR: %f, BS: %d"), text.c_str(), path.c_str(), sr, bs);
+        if (!LoadPlugin(path, sr, bs, cid))
+        {
+            result = m_layoutTooLarge ? "LayoutTooLarge" : "LoadFailed";
+            return false;
+        }
+        return true;
+    }
+    else if (cmd.rfind("load_chain ", 0) == 0 || cmd.rfind("load_graph ", 0) == 0)
+    {
+        const bool graph = cmd.rfind("load_graph ", 0) == 0;
+        std::vector<std::string> paths;
+        std::vector<GraphEdge> edges;
+        double sr = 44100.0;
+        int32 bs = 1024;
+        std::string args_str = cmd.substr(11);
+        size_t pos = 0;
+        if (!ParseQuotedPaths(args_str, paths, pos) || paths.empty())
+        {
+            DbgPrint(_T("Error: %hs needs one or more quoted paths. Command: %hs"), graph ? "load_graph" : "load_chain", cmd.c_str());
+            result = "InvalidArguments";
+            return false;
+        }
+        std::stringstream ss(args_str.substr(pos));
+        ss >> sr >> bs;
+        bool loaded;
+        if (graph)
+        {
+            std::string edges_str;
+            ss >> edges_str;
+            if (!ParseGraphEdges(edges_str, edges))
+            {
+                DbgPrint(_T("Error: Malformed edge list for load_graph: '%hs'"), edges_str.c_str());
+                result = "InvalidArguments";
+                return false;
+            }
+            DbgPrint(_T("Executing load_graph: %zu node(s), %zu edge(s), SR: %f, BS: %d"), paths.size(), edges.size(), sr, bs);
+            loaded = LoadGraph(paths, edges, sr, bs);
+        }
+        else
+        {
+            DbgPrint(_T("Executing load_chain: %zu plugin(s), SR: %f, BS: %d"), paths.size(), sr, bs);
+            loaded = LoadChain(paths, sr, bs);
+        }
+        if (!loaded)
+            result = m_layoutTooLarge ? "LayoutTooLarge" : "LoadFailed";
+        return loaded;
+    }
+    else if (cmd == "set_state" && !queued.state.empty())
+    {
+        // バイナリプロトコルの kOpSetState
+        if (!m_plugin.plugProvider)
+        {
+            result = "NoPlugin";
+            return false;
+        }
+        if (!ApplyDualState(queued.state.data(), queued.state.size()))
+        {
+            DbgPrint(_T("Warning: Binary state data is malformed."));
+            result = "MalformedState";
+            return false;
+        }
+        return true;
+    }
+    else if (cmd.rfind("set_state ", 0) == 0)
+    {
+        DbgPrint(_T("Warning: Obsolete 'set_state' command received. Use 'load_and_set_state' instead."));
+        if (!m_plugin.plugProvider || !m_plugin.plugProvider->getComponent() || !m_plugin.plugProvider->getController())
+        {
+            result = "NoPlugin";
+            return false;
+        }
+        std::string data = cmd.substr(10);
+        if (data.rfind("VST3_DUAL:", 0) != 0)
+        {
+            result = "UnsupportedStateFormat";
+            return false;
+        }
+        auto state = base64_decode(data.data() + 10, data.size() - 10);
+        if (state.empty() || !ApplyDualState(state.data(), state.size()))
+        {
+            result = "MalformedState";
+            return false;
+        }
+        return true;
+    }
+    else if (cmd.rfind("preload ", 0) == 0)
+    {
+        // preload "<path>" [count] [class_id]: load_plugin などですぐ使えるよう、初期化済みのインスタンスを用意しておく
+        std::vector<std::string> paths;
+        std::string args_str = cmd.substr(8);
+        size_t pos = 0;
+        int32 count = 1;
+        std::string text, cid;
+        if (!ParseQuotedPaths(args_str, paths, pos) || paths.size() != 1)
+        {
+            DbgPrint(_T("Error: preload needs one quoted path. Command: %hs"), cmd.c_str());
+            result = "InvalidArguments";
+            return false;
+        }
+        std::stringstream ss(args_str.substr(pos));
+        if (!(ss >> count))
+            count = 1;
+        if (count < 0 || count > MAX_WARM_INSTANCES || (ss >> text && !ParseClassId(text, cid)))
+        {
+            result = "InvalidArguments";
+            return false;
+        }
+        g_warmPool.SetTarget(this, paths[0], cid, count);
+        g_warmPool.Fill(paths[0], cid, count);
+        const int32 ready = g_warmPool.ReadyCount(paths[0], cid);
+        if (count > 0 && ready == 0)
+        {
+            result = "LoadFailed";
+            return false;
+        }
+        result = std::to_string(ready);
+        return true;
+    }
+    else if (cmd == "preload_clear")
+    {
+        // セッションではほかのセッションのものに触れないよう、このセッションが preload したパスだけを片付ける
+        if (m_sessionMode)
+        {
+            const std::vector<std::string> paths = g_warmPool.ClearOwner(this);
+            result = std::to_string(PurgeModuleCache(&paths));
+        }
+        else
+        {
+            g_warmPool.Clear();
+            result = std::to_string(PurgeModuleCache());
+        }
+        return true;
+    }
+    else if (cmd == "show_gui")
+    {
+        ShowGui();
+        return true;
+    }
+    else if (cmd == "hide_gui")
+    {
+        HideGui();
+        return true;
+    }
+    result = "UnknownCommand";
+    return false;
+}
+// 先頭プラグインの状態を VST3_DUAL の中身 (コンポーネント、コントローラの順に 64bit の長さ付きで並べたもの) にする。
+// 状態が空なら out も空。プラグインがなければ false
+bool VstHost::CaptureDualState(std::string &out)
+{
+    out.clear();
+    if (!m_plugin.plugProvider || !m_plugin.plugProvider->getComponent() || !m_plugin.plugProvider->getController())
+        return false;
+    MemoryStream cStream, tStream;
+    m_plugin.plugProvider->getComponent()->getState(&cStream);
+    m_plugin.plugProvider->getController()->getState(&tStream);
+    const int64 cs = cStream.getSize(), ts = tStream.getSize();
+    if (cs <= 0 && ts <= 0)
+        return true;
+    out.reserve(2 * sizeof(int64) + (size_t)std::max<int64>(cs, 0) + (size_t)std::max<int64>(ts, 0));
+    out.append((const char *)&cs, sizeof(cs));
+    if (cs > 0)
+        out.append(cStream.getData(), (size_t)cs);
+    out.append((const char *)&ts, sizeof(ts));
+    if (ts > 0)
+        out.append(tStream.getData(), (size_t)ts);
+    return true;
+}
+// CaptureDualState と同じ形式で、プラグインに StateArena へ直接書かせる。状態が空なら bytes は 0
+bool VstHost::CaptureDualStateToArena(uint64_t &bytes)
+{
+    bytes = 0;
+    if (!m_stateArena.Reserve(STATE_ARENA_MIN_BYTES, 0))
+        return false;
+    StateArenaStream cStream(m_stateArena, sizeof(int64));
+    m_plugin.plugProvider->getComponent()->getState(&cStream);
+    const int64 cs = cStream.size();
+    const uint64_t tsOffset = sizeof(int64) + (uint64_t)cs;
+    if (cStream.failed() || !m_stateArena.Reserve(tsOffset + sizeof(int64), tsOffset))
+        return false;
+    StateArenaStream tStream(m_stateArena, tsOffset + sizeof(int64));
+    m_plugin.plugProvider->getController()->getState(&tStream);
+    const int64 ts = tStream.size();
+    if (tStream.failed())
+        return false;
+    // 広げた場合は data() が変わっているので、長さはすべて書き終えてから入れる
+    memcpy(m_stateArena.data(), &cs, sizeof(cs));
+    memcpy(m_stateArena.data() + tsOffset, &ts, sizeof(ts));
+    if (cs > 0 || ts > 0)
+        bytes = tsOffset + sizeof(int64) + (uint64_t)ts;
+    m_stateArena.header()->stateBytes = bytes;
+    return true;
+}
+// CaptureDualState の形式の状態を先頭プラグインに復元する。各状態はコピーせずに元のバッファを読ませる
+bool VstHost::ApplyDualState(const BYTE *data, size_t size)
+{
+    int64 cs = 0, ts = 0;
+    if (size < sizeof(cs))
+        return false;
+    memcpy(&cs, data, sizeof(cs));
+    size_t pos = sizeof(cs);
+    if (cs < 0 || (uint64_t)cs > size - pos)
+        return false;
+    const BYTE *componentState = data + pos;
+    pos += (size_t)cs;
+    if (size - pos >= sizeof(ts))
+    {
+        memcpy(&ts, data + pos, sizeof(ts));
+        pos += sizeof(ts);
+    }
+    if (ts < 0 || (uint64_t)ts > size - pos)
+        return false;
+    if (cs > 0 && m_plugin.plugProvider->getComponent())
+    {
+        MemoryStream s((void *)componentState, (TSize)cs);
+        m_plugin.plugProvider->getComponent()->setState(&s);
+    }
+    if (ts > 0 && m_plugin.plugProvider->getController())
+    {
+        MemoryStream s((void *)(data + pos), (TSize)ts);
+        m_plugin.plugProvider->getController()->setState(&s);
+    }
+    DbgPrint(_T("State restored. Restarting component."));
+    restartComponent(kParamValuesChanged | kReloadComponent);
+    return true;
+}
+bool VstHost::LoadPlugin(const std::string &path, double sampleRate, int32 blockSize, const std::string &classId)
+{
+    return LoadGraph(std::vector<std::string>{path}, std::vector<GraphEdge>(), sampleRate, blockSize, std::vector<std::string>{classId});
+}
+bool VstHost::LoadInstance(PluginInstance &inst, const std::string &path, bool requireProcessor, const std::string &classId)
+{
+    ClassInfo targetClass;
+    WarmInstance warm;
+    if (g_warmPool.Take(path, classId, warm))
+    {
+        // preload で作っておいたインスタンスを使う
+        inst.module = std::move(warm.module);
+        inst.plugProvider = warm.plugProvider;
+        targetClass = warm.classInfo;
+        DbgPrint(_T("LoadInstance: Using preloaded instance of %hs."), targetClass.name().c_str());
+    }
+    else
+    {
+        std::string error;
+        inst.module = AcquireModule(path, error);
+        if (!inst.module)
+        {
+            DbgPrint(_T("LoadInstance: Could not create Module. Error: %hs"), error.c_str());
+            return false;
+        }
+
+        auto factory = inst.module->getFactory();
+        if (!FindPluginClass(factory, classId, targetClass))
+        {
+            DbgPrint(_T("LoadInstance: No compatible VST3 plugin class found."));
+            for ([[maybe_unused]] auto &classInfo : factory.classInfos())
+            {
+                DbgPrint(_T("  Available class: %hs (Category: %hs)"),
+                         classInfo.name().c_str(), classInfo.category().c_str());
+            }
+            inst.module.reset();
+            return false;
+        }
+        DbgPrint(_T("LoadInstance: Found plugin class: %hs (Category: %hs)"),
+                 targetClass.name().c_str(), targetClass.category().c_str());
+
+        inst.plugProvider = new PlugProvider(factory, targetClass, true);
+        if (!inst.plugProvider)
+        {
+            DbgPrint(_T("LoadInstance: PlugProvider creation failed."));
+            inst.module.reset();
+            return false;
+        }
+    }
+    inst.component = inst.plugProvider->getComponent();
+    inst.controller = inst.plugProvider->getController();
+    if (!inst.component || !inst.controller)
+    {
+        DbgPrint(_T("LoadInstance: Failed to get Component/Controller from PlugProvider."));
+        ReleaseInstance(inst);
+        return false;
+    }
+    if (&inst == &m_plugin)
+    {
+        inst.controller->setComponentHandler(this);
+    }
+    else
+    {
+        inst.stageHandler.SetHost(this);
+        inst.controller->setComponentHandler(&inst.stageHandler);
+    }
+    if (targetClass.category() != "MIDI Module Class")
+    {
+        if (inst.component->queryInterface(IAudioProcessor::iid, (void **)&inst.processor) != kResultOk || !inst.processor)
+        {
+            DbgPrint(_T("LoadInstance: Failed to get IAudioProcessor."));
+            ReleaseInstance(inst);
+            return false;
+        }
+    }
+    if (requireProcessor && !inst.processor)
+    {
+        // 2 段目以降は音声を次の段へ渡す必要があるため、処理を持たないプラグインは置けない
+        DbgPrint(_T("LoadInstance: '%hs' has no audio processor and cannot be chained."), path.c_str());
+        ReleaseInstance(inst);
+        return false;
+    }
+    inst.name = targetClass.name();
+    return true;
+}
+bool VstHost::LoadChain(const std::vector<std::string> &paths, double sampleRate, int32 blockSize)
+{
+    std::vector<GraphEdge> edges;
+    for (uint32_t i = 1; i < (uint32_t)paths.size(); ++i)
+        edges.push_back({i - 1, i});
+    return LoadGraph(paths, edges, sampleRate, blockSize);
+}
+bool VstHost::LoadGraph(const std::vector<std::string> &paths, const std::vector<GraphEdge> &edges, double sampleRate, int32 blockSize,
+                        const std::vector<std::string> &classIds)
+{
+    DbgPrint(_T("LoadGraph: Loading %zu plugin(s) on main thread."), paths.size());
+    ReleasePlugin(); // 以前のプラグインを安全に解放
+    m_layoutTooLarge = false;
+    if (paths.empty() || paths.size() > MAX_GRAPH_NODES)
+        return false;
+
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        DbgPrint(_T("LoadGraph: [%zu] %hs"), i, paths[i].c_str());
+        if (i > 0)
+            m_chainStages.push_back(std::unique_ptr<PluginInstance>(new PluginInstance()));
+        if (!LoadInstance(Stage(i), paths[i], i > 0, i < classIds.size() ? classIds[i] : std::string()))
+        {
+            ReleasePlugin();
+            return false;
+        }
+    }
+    if (!SetGraphEdges(edges))
+    {
+        ReleasePlugin();
+        return false;
+    }
+
+    // --- オーディオ処理のセットアップ ---
+    // 中継バッファを共有するため、チェーン全体で同じサンプル形式を使う。
+    // 倍精度モードでは全段が対応していれば kSample64 で直接処理し、それ以外はホスト内で単精度に変換する
+    m_processSampleSize = SharedSampleSize();
+    for (size_t i = 0; i < StageCount(); ++i)
+    {
+        IAudioProcessor *processor = Stage(i).processor;
+        if (processor && m_processSampleSize == kSample64 && processor->canProcessSampleSize(kSample64) != kResultTrue)
+            m_processSampleSize = kSample32;
+    }
+    DbgPrint(_T("LoadGraph: Processing with %d-bit samples."), m_processSampleSize == kSample64 ? 64 : 32);
+    if (!SetupChainProcessing(kRealtime, blockSize, sampleRate))
+    {
+        ReleasePlugin();
+        return false;
+    }
+    for (size_t i = 0; i < StageCount(); ++i)
+    {
+        PluginInstance &inst = Stage(i);
+        if (!inst.processor)
+            continue;
+        int32 numIn = inst.component->getBusCount(kAudio, kInput);
+        int32 numOut = inst.component->getBusCount(kAudio, kOutput);
+        DbgPrint(_T("LoadGraph: [%zu] Audio buses - Input: %d, Output: %d"), i, numIn, numOut);
+        for (int32 b = 0; b < numIn; ++b)
+        {
+            inst.component->activateBus(kAudio, kInput, b, true);
+        }
+        for (int32 b = 0; b < numOut; ++b)
+        {
+            inst.component->activateBus(kAudio, kOutput, b, true);
+        }
+        // イベントリングを受け取るのは先頭段だけ
+        if (i == 0)
+        {
+            for (int32 b = 0; b < inst.component->getBusCount(kEvent, kInput); ++b)
+                inst.component->activateBus(kEvent, kInput, b, true);
+            for (int32 b = 0; b < inst.component->getBusCount(kEvent, kOutput); ++b)
+                inst.component->activateBus(kEvent, kOutput, b, true);
+        }
+    }
+    m_blockSize = blockSize;
+    m_sampleRate = sampleRate;
+    m_samplePosition = 0;
+    if (!BuildProcessPlan())
+    {
+        DbgPrint(_T("LoadGraph: Could not build process plan for the shared memory layout."));
+        ReleasePlugin();
+        return false;
+    }
+
+    for (size_t i = 0; i < StageCount(); ++i)
+    {
+        tresult result = Stage(i).component->setActive(true);
+        if (result != kResultOk)
+        {
+            DbgPrint(_T("LoadGraph: setActive(true) failed for '%hs'. Result: 0x%X"), Stage(i).name.c_str(), result);
+            ReleasePlugin();
+            return false;
+        }
+        if (Stage(i).processor)
+        {
+            result = Stage(i).processor->setProcessing(true);
+            if (result != kResultOk)
+            {
+                DbgPrint(_T("LoadGraph: setProcessing(true) failed. Result: 0x%X. Continuing..."), result);
+            }
+        }
+    }
+    UpdateChainLatency();
+
+    m_isPluginReady = true;
+    DbgPrint(_T("LoadGraph: %zu plugin(s) loaded, latency %d samples. Ready for processing."), StageCount(), m_chainLatency.load());
+    return true;
+}
+bool VstHost::SetGraphEdges(const std::vector<GraphEdge> &edges)
+{
+    // 共有メモリから入力を受けるのはノード 0 だけ、出力を書き戻すのは後段を持たない 1 つのノードだけとする
+    const uint32_t numNodes = (uint32_t)StageCount();
+    for (uint32_t i = 0; i < numNodes; ++i)
+    {
+        Stage(i).predecessors.clear();
+        Stage(i).successors.clear();
+    }
+    for (const auto &edge : edges)
+    {
+        if (edge.from >= numNodes || edge.to >= numNodes || edge.from == edge.to || edge.to == 0)
+        {
+            DbgPrint(_T("SetGraphEdges: Invalid edge %u>%u."), edge.from, edge.to);
+            return false;
+        }
+        auto &successors = Stage(edge.from).successors;
+        if (std::find(successors.begin(), successors.end(), edge.to) != successors.end())
+            continue;
+        successors.push_back(edge.to);
+        Stage(edge.to).predecessors.push_back(edge.from);
+    }
+
+    // Kahn のアルゴリズムで実行順を決め、閉路を弾く
+    std::vector<size_t> indegree(numNodes);
+    for (uint32_t i = 1; i < numNodes; ++i)
     {
-        *obj = static_cast<IHostApplication *>(this);
-        addRef();
-        return kResultOk;
+        indegree[i] = Stage(i).predecessors.size();
+        if (indegree[i] == 0)
+        {
+            DbgPrint(_T("SetGraphEdges: Node %u has no input."), i);
+            return false;
+        }
     }
-    if (FUnknownPrivate::iidEqual(_iid, IComponentHandler::iid))
+    m_graphOrder.assign(1, 0);
+    for (size_t n = 0; n < m_graphOrder.size(); ++n)
     {
-        *obj = static_cast<IComponentHandler *>(this);
-        addRef();
-        return kResultOk;
+        for (uint32_t next : Stage(m_graphOrder[n]).successors)
+        {
+            if (--indegree[next] == 0)
+                m_graphOrder.push_back(next);
+        }
     }
-    if (FUnknownPrivate::iidEqual(_iid, IComponentHandler2::iid))
+    if (m_graphOrder.size() != numNodes)
     {
-        *obj = static_cast<IComponentHandler2 *>(this);
-        addRef();
-        return kResultOk;
+        DbgPrint(_T("SetGraphEdges: The graph has a cycle."));
+        return false;
     }
-    if (FUnknownPrivate::iidEqual(_iid, FUnknown::iid))
+    uint32_t numSinks = 0;
+    for (uint32_t i = 0; i < numNodes; ++i)
     {
-        *obj = static_cast<IHostApplication *>(this);
-        addRef();
-        return kResultOk;
+        if (Stage(i).successors.empty())
+        {
+            m_graphSink = i;
+            ++numSinks;
+        }
     }
-    *obj = nullptr;
-    return kNoInterface;
+    if (numSinks != 1)
+    {
+        DbgPrint(_T("SetGraphEdges: The graph needs exactly one output node (found %u)."), numSinks);
+        return false;
+    }
+    return true;
 }
-uint32 PLUGIN_API VstHost::addRef() { return ++m_refCount; }
-uint32 PLUGIN_API VstHost::release()
+void VstHost::ReleaseInstance(PluginInstance &inst)
 {
-    if (--m_refCount == 0)
+    if (inst.component)
     {
-        delete this;
-        return 0;
+        if (inst.processor)
+        {
+            inst.processor->setProcessing(false);
+        }
+        inst.component->setActive(false);
     }
-    return m_refCount;
+    if (inst.processor)
+    {
+        inst.processor->release();
+        inst.processor = nullptr;
+    }
+    inst.component = nullptr;
+    inst.controller = nullptr;
+    if (inst.plugProvider)
+    {
+        delete inst.plugProvider;
+        inst.plugProvider = nullptr;
+    }
+    inst.module.reset();
+    inst.latencySamples = 0;
 }
-tresult PLUGIN_API VstHost::getName(String128 name)
+void VstHost::ReleasePlugin()
 {
-    Steinberg::str8ToStr16(name, "VST3 Host Bridge", 128);
-    return kResultOk;
+    DbgPrint(_T("ReleasePlugin: Releasing current plugin chain..."));
+    SuspendAudio();
+    HideGui();
+
+    while (!m_chainStages.empty())
+    {
+        ReleaseInstance(*m_chainStages.back());
+        m_chainStages.pop_back();
+    }
+    ReleaseInstance(m_plugin);
+    m_plugin.predecessors.clear();
+    m_plugin.successors.clear();
+    m_graphOrder.assign(1, 0);
+    m_graphSink = 0;
+    m_chainLatency = 0;
+    // 前のプラグインの未処理の変更を次のプラグインに持ち越さない
+    m_pendingParams.Build(std::vector<ParamID>());
+    m_processorParams.Build(std::vector<ParamID>());
+    PublishOutputParamIds();
+    DbgPrint(_T("ReleasePlugin: Plugin chain released."));
 }
-tresult PLUGIN_API VstHost::createInstance(TUID cid, TUID iid, void **obj)
+
+void VstHost::SuspendAudio()
 {
-    FUnknownPtr<IMessage> message;
-    if (FUnknownPrivate::iidEqual(cid, IMessage::iid))
+    // 準備完了フラグを下ろしてから、実行中のブロックが抜けるのを待つ
+    m_isPluginReady.store(false);
+    while (m_audioBusy.load())
+        std::this_thread::yield();
+}
+void VstHost::SetChainActive(bool active)
+{
+    // 停止は後段から、開始は前段から行う
+    for (size_t n = 0; n < StageCount(); ++n)
     {
-        message = owned(new HostMessage);
-        if (message)
+        PluginInstance &inst = Stage(active ? n : StageCount() - 1 - n);
+        if (!inst.component)
+            continue;
+        if (active)
         {
-            return message->queryInterface(iid, obj);
+            inst.component->setActive(true);
+            if (inst.processor)
+                inst.processor->setProcessing(true);
+        }
+        else
+        {
+            if (inst.processor)
+                inst.processor->setProcessing(false);
+            inst.component->setActive(false);
         }
     }
-    *obj = nullptr;
-    return kNoInterface;
 }
-tresult PLUGIN_API VstHost::beginEdit(ParamID id)
+bool VstHost::SetupChainProcessing(int32 processMode, int32 blockSize, double sampleRate)
 {
-    return kResultOk;
+    for (size_t i = 0; i < StageCount(); ++i)
+    {
+        PluginInstance &inst = Stage(i);
+        if (!inst.processor)
+            continue;
+        inst.processor->setProcessing(false); // 念のため一旦停止
+        ProcessSetup setup{processMode, m_processSampleSize, (int32_t)blockSize, sampleRate};
+        if (inst.processor->setupProcessing(setup) != kResultOk)
+        {
+            DbgPrint(_T("SetupChainProcessing: setupProcessing failed for '%hs'."), inst.name.c_str());
+            return false;
+        }
+    }
+    return true;
 }
-
-tresult PLUGIN_API VstHost::performEdit(ParamID id, ParamValue valueNormalized)
+void VstHost::UpdateChainLatency()
+{
+    // 出力ノードまでの経路のうち最も長いものをグラフ全体のレイテンシとする (直列チェーンなら全段の合計)
+    std::vector<int32> pathLatency(StageCount(), 0);
+    for (uint32_t node : m_graphOrder)
+    {
+        PluginInstance &inst = Stage(node);
+        inst.latencySamples = inst.processor ? (int32)inst.processor->getLatencySamples() : 0;
+        inst.tailSamples.store(inst.processor ? inst.processor->getTailSamples() : kNoTail, std::memory_order_relaxed);
+        int32 longest = 0;
+        for (uint32_t p : inst.predecessors)
+            longest = std::max(longest, pathLatency[p]);
+        pathLatency[node] = longest + inst.latencySamples;
+    }
+    m_chainLatency = pathLatency[m_graphSink];
+}
+bool VstHost::BuildProcessPlan(bool offline)
 {
-    std::lock_guard<std::mutex> lock(m_paramMutex);
-    for (auto &change : m_pendingParamChanges)
+    // 全ノードのバス構成を読み、共有メモリとノード間バッファの割り当てを決めてから各ノードの plan を仕上げる。
+    // offline のときは共有メモリの代わりに m_renderSlot を使う
+    const size_t numStages = StageCount();
+    for (size_t i = 0; i < numStages; ++i)
+        ReadBusLayout(Stage(i));
+    if (offline ? !ApplyRenderLayout(m_plugin.plan, Stage(m_graphSink).plan) : !ApplySharedLayout(m_plugin.plan, Stage(m_graphSink).plan))
+        return false;
+
+    // 前段の出力の k 番目のチャンネル (全バスを通した通し番号) を後段の入力の k 番目に渡す。
+    // 分岐を並列に処理できるよう、出力バッファはノードごとに持つ
+    const size_t sampleBytes = m_processSampleSize == kSample64 ? sizeof(double) : sizeof(float);
+    const size_t channelBytes = AlignUp((size_t)m_blockCapacity * sampleBytes, CACHE_LINE_SIZE);
+    m_linkChannelBytes = channelBytes;
+    for (size_t i = 0; i < numStages; ++i)
     {
-        if (change.first == id)
+        PluginInstance &inst = Stage(i);
+        ProcessPlan &plan = inst.plan;
+        if (i == m_graphSink)
+        {
+            inst.outputBuffer.clear();
+            plan.outputBase = nullptr;
+            continue;
+        }
+        // チャンネルがなくても null (= 共有メモリ) と区別できるよう 1 要素は確保する
+        inst.outputBuffer.assign(std::max<size_t>(1, inst.outputChannels * channelBytes / sizeof(double)), 0.0);
+        plan.outputBase = (char *)inst.outputBuffer.data();
+        size_t k = 0;
+        for (auto &bus : plan.outputOffsets)
         {
-            change.second = valueNormalized;
-            return kResultOk;
+            for (auto &channel : bus)
+                channel = (int64_t)(k++ * channelBytes);
         }
     }
-    m_pendingParamChanges.emplace_back(id, valueNormalized);
-    return kResultOk;
-}
+    for (size_t i = 0; i < numStages; ++i)
+    {
+        PluginInstance &inst = Stage(i);
+        ProcessPlan &plan = inst.plan;
+        inst.mixBuffer.clear();
+        if (inst.predecessors.empty())
+        {
+            plan.inputBase = nullptr;
+        }
+        else if (inst.predecessors.size() == 1)
+        {
+            // 前段の出力をそのまま読む。前段の出力より多いチャンネルは無音
+            const PluginInstance &source = Stage(inst.predecessors[0]);
+            plan.inputBase = (char *)source.outputBuffer.data();
+            size_t k = 0;
+            for (auto &bus : plan.inputOffsets)
+            {
+                for (auto &channel : bus)
+                {
+                    channel = k < source.outputChannels ? (int64_t)(k * channelBytes) : -1;
+                    ++k;
+                }
+            }
+        }
+        else
+        {
+            // 複数の前段の出力は MixNodeInputs で合算してから渡す
+            inst.mixBuffer.assign(std::max<size_t>(1, inst.inputChannels * channelBytes / sizeof(double)), 0.0);
+            plan.inputBase = (char *)inst.mixBuffer.data();
+            size_t k = 0;
+            for (auto &bus : plan.inputOffsets)
+            {
+                for (auto &channel : bus)
+                    channel = (int64_t)(k++ * channelBytes);
+            }
+        }
+        FinishProcessPlan(plan);
+    }
 
-tresult PLUGIN_API VstHost::endEdit(ParamID id)
+    // パラメータ編集と GUI への反映は先頭段だけが対象
+    int32 numParams = m_plugin.controller ? m_plugin.controller->getParameterCount() : 0;
+    m_plugin.plan.blockChanges.clear();
+    m_plugin.plan.blockChanges.reserve(numParams + MAX_AUTOMATION_POINTS);
+    // パラメータ一覧が変わったときだけ作り直す (オーディオは停止中)
+    std::vector<ParamID> paramIds;
+    paramIds.reserve(numParams);
+    for (int32 i = 0; i < numParams; ++i)
+    {
+        ParameterInfo info = {};
+        if (m_plugin.controller->getParameterInfo(i, info) == kResultOk)
+            paramIds.push_back(info.id);
+    }
+    // CC の割り当ては処理中に問い合わせず、ここで表にしておく
+    m_midiControllerMap.clear();
+    FUnknownPtr<IMidiMapping> midiMapping(m_plugin.controller);
+    if (midiMapping)
+    {
+        m_midiControllerMap.assign(16 * kCountCtrlNumber, kNoParamId);
+        for (int16 channel = 0; channel < 16; ++channel)
+        {
+            for (int16 cc = 0; cc < kCountCtrlNumber; ++cc)
+            {
+                ParamID id;
+                if (midiMapping->getMidiControllerAssignment(0, channel, cc, id) == kResultTrue)
+                    m_midiControllerMap[channel * kCountCtrlNumber + cc] = id;
+            }
+        }
+    }
+    m_blockEvents.reserve(MAX_BLOCK_EVENTS);
+    m_blockNoteEvents.reserve(MAX_BLOCK_EVENTS);
+    if (!m_pendingParams.Matches(paramIds))
+    {
+        m_pendingParams.Build(paramIds);
+        m_processorParams.Build(paramIds);
+        PublishOutputParamIds();
+    }
+    DbgPrint(_T("BuildProcessPlan: %zu node(s), sink %u, Parameters: %d"), numStages, m_graphSink, numParams);
+    return true;
+}
+void VstHost::ReadBusLayout(PluginInstance &inst)
 {
-    return kResultOk;
+    ProcessPlan &plan = inst.plan;
+    int32 numIn = inst.component ? inst.component->getBusCount(kAudio, kInput) : 0;
+    int32 numOut = inst.component ? inst.component->getBusCount(kAudio, kOutput) : 0;
+    plan.inputs.assign(numIn, AudioBusBuffers());
+    plan.outputs.assign(numOut, AudioBusBuffers());
+    plan.inputPtrs.assign(numIn, std::vector<float *>());
+    plan.outputPtrs.assign(numOut, std::vector<float *>());
+    plan.inputPtrs64.assign(numIn, std::vector<double *>());
+    plan.outputPtrs64.assign(numOut, std::vector<double *>());
+    plan.inputOffsets.assign(numIn, std::vector<int64_t>());
+    plan.outputOffsets.assign(numOut, std::vector<int64_t>());
+    for (int32 i = 0; i < numIn; ++i)
+    {
+        BusInfo bi = {};
+        inst.component->getBusInfo(kAudio, kInput, i, bi);
+        plan.inputPtrs[i].assign(bi.channelCount, nullptr);
+        plan.inputPtrs64[i].assign(bi.channelCount, nullptr);
+        plan.inputOffsets[i].assign(bi.channelCount, -1);
+        plan.inputs[i].numChannels = bi.channelCount;
+    }
+    for (int32 i = 0; i < numOut; ++i)
+    {
+        BusInfo bi = {};
+        inst.component->getBusInfo(kAudio, kOutput, i, bi);
+        plan.outputPtrs[i].assign(bi.channelCount, nullptr);
+        plan.outputPtrs64[i].assign(bi.channelCount, nullptr);
+        plan.outputOffsets[i].assign(bi.channelCount, -1);
+        plan.outputs[i].numChannels = bi.channelCount;
+    }
+    inst.inputChannels = 0;
+    for (const auto &bus : plan.inputOffsets)
+        inst.inputChannels += bus.size();
+    inst.outputChannels = 0;
+    for (const auto &bus : plan.outputOffsets)
+        inst.outputChannels += bus.size();
+    plan.canBypass = inst.inputChannels > 0 && inst.component && inst.component->getBusCount(kEvent, kInput) == 0;
+    int32 numParams = inst.controller ? inst.controller->getParameterCount() : 0;
+    plan.inParamChanges.SetCapacity(numParams, &inst == &m_plugin ? AUTOMATION_QUEUE_POINTS : PARAM_QUEUE_POINTS);
+    plan.inEvents.SetCapacity(&inst == &m_plugin ? MAX_BLOCK_EVENTS : 0);
+    plan.outEvents.SetCapacity(MAX_BLOCK_EVENTS);
+    plan.outParamChanges.SetCapacity(numParams, PARAM_QUEUE_POINTS);
 }
-
-tresult PLUGIN_API VstHost::restartComponent(int32 flags)
+void VstHost::FinishProcessPlan(ProcessPlan &plan)
 {
-    DbgPrint(_T("restartComponent(0x%X) called."), flags);
-    return kResultOk;
+    const int32 numIn = (int32)plan.inputs.size();
+    const int32 numOut = (int32)plan.outputs.size();
+    plan.blockCapacity = m_blockCapacity;
+    plan.processSampleSize = m_processSampleSize;
+    plan.sharedSampleSize = SharedSampleSize();
+    plan.silentInput.assign(plan.blockCapacity, 0.0);
+    plan.discardOutput.assign(plan.blockCapacity, 0.0);
+    plan.silentSamples = 0;
+    plan.bypassed = false;
+
+    const bool convert = plan.sharedSampleSize == kSample64 && plan.processSampleSize == kSample32;
+    plan.convertInput = convert && !plan.inputBase;
+    plan.convertOutput = convert && !plan.outputBase;
+    size_t scratchChannels = 0;
+    if (plan.convertInput)
+    {
+        for (const auto &bus : plan.inputPtrs)
+            scratchChannels += bus.size();
+    }
+    if (plan.convertOutput)
+    {
+        for (const auto &bus : plan.outputPtrs)
+            scratchChannels += bus.size();
+    }
+    plan.convertScratch.assign(scratchChannels * plan.blockCapacity, 0.0f);
+    plan.inputScratch.assign(numIn, std::vector<float *>());
+    plan.outputScratch.assign(numOut, std::vector<float *>());
+    float *scratch = plan.convertScratch.data();
+    for (int32 i = 0; i < numIn; ++i)
+    {
+        if (plan.processSampleSize == kSample64)
+        {
+            plan.inputs[i].channelBuffers64 = plan.inputPtrs64[i].data();
+            continue;
+        }
+        plan.inputs[i].channelBuffers32 = plan.inputPtrs[i].data();
+        if (plan.convertInput)
+        {
+            for (size_t c = 0; c < plan.inputPtrs[i].size(); ++c)
+            {
+                plan.inputScratch[i].push_back(scratch);
+                scratch += plan.blockCapacity;
+            }
+        }
+    }
+    for (int32 i = 0; i < numOut; ++i)
+    {
+        if (plan.processSampleSize == kSample64)
+        {
+            plan.outputs[i].channelBuffers64 = plan.outputPtrs64[i].data();
+            continue;
+        }
+        plan.outputs[i].channelBuffers32 = plan.outputPtrs[i].data();
+        if (plan.convertOutput)
+        {
+            for (size_t c = 0; c < plan.outputPtrs[i].size(); ++c)
+            {
+                plan.outputScratch[i].push_back(scratch);
+                scratch += plan.blockCapacity;
+            }
+        }
+    }
+    plan.maxSliceSamples = (m_blockSize > 0 && m_blockSize < plan.blockCapacity) ? m_blockSize : plan.blockCapacity;
+
+    plan.context = {};
+    plan.context.state = ProcessContext::StatesAndFlags::kPlaying;
+    plan.data = {};
+    plan.data.symbolicSampleSize = plan.processSampleSize;
+    plan.data.numInputs = numIn;
+    plan.data.numOutputs = numOut;
+    plan.data.inputs = numIn > 0 ? plan.inputs.data() : nullptr;
+    plan.data.outputs = numOut > 0 ? plan.outputs.data() : nullptr;
+    plan.data.inputParameterChanges = &plan.inParamChanges;
+    plan.data.outputParameterChanges = &plan.outParamChanges;
+    plan.data.inputEvents = &plan.inEvents;
+    plan.data.outputEvents = &plan.outEvents;
+    plan.data.processContext = &plan.context;
 }
-bool VstHost::Initialize()
+bool VstHost::ApplySharedLayout(ProcessPlan &inputPlan, ProcessPlan &outputPlan)
 {
-    if (!InitIPC())
+    // 共有メモリに載るのはチェーン先頭の入力と最後の段の出力
+    m_layoutTooLarge = false;
+    if (!m_pLayout)
     {
-        DbgPrint(_T("Initialize: InitIPC FAILED."));
+        // 従来レイアウト: バス 0 の 2ch だけが固定位置に割り当てられる
+        const int64_t base = sizeof(AudioSharedData);
+        if (!inputPlan.inputOffsets.empty())
+        {
+            for (size_t c = 0; c < inputPlan.inputOffsets[0].size() && c < 2; ++c)
+                inputPlan.inputOffsets[0][c] = base + (int64_t)c * BUFFER_BYTES;
+        }
+        if (!outputPlan.outputOffsets.empty())
+        {
+            for (size_t c = 0; c < outputPlan.outputOffsets[0].size() && c < 2; ++c)
+                outputPlan.outputOffsets[0][c] = base + (int64_t)(2 + c) * BUFFER_BYTES;
+        }
+        m_blockCapacity = MAX_BLOCK_SIZE;
+        return true;
+    }
+
+    if (inputPlan.inputOffsets.size() > MAX_LAYOUT_BUSES || outputPlan.outputOffsets.size() > MAX_LAYOUT_BUSES)
+    {
+        DbgPrint(_T("ApplySharedLayout: Too many buses (in=%zu, out=%zu)."), inputPlan.inputOffsets.size(), outputPlan.outputOffsets.size());
         return false;
     }
-    m_threadsRunning = true;
-    m_hPipeThread = CreateThread(NULL, 0, PipeThreadProc, this, 0, NULL);
-    m_hAudioThread = CreateThread(NULL, 0, AudioThreadProc, this, 0, NULL);
-    if (!m_hPipeThread || !m_hAudioThread)
+    size_t numChannels = 0;
+    for (const auto &bus : inputPlan.inputOffsets)
+        numChannels += bus.size();
+    for (const auto &bus : outputPlan.outputOffsets)
+        numChannels += bus.size();
+    if (numChannels > MAX_LAYOUT_CHANNELS)
     {
-        DbgPrint(_T("Initialize: Failed to create worker threads."));
+        DbgPrint(_T("ApplySharedLayout: Too many channels (%zu)."), numChannels);
+        return false;
+    }
+
+    // クライアントは block_size より大きいブロックを送ってもよい (ホスト側で分割する)
+    size_t capacity = (size_t)(m_blockSize > 0 ? m_blockSize : MAX_BLOCK_SIZE);
+    if ((size_t)m_options.blockCapacity > capacity)
+        capacity = (size_t)m_options.blockCapacity;
+    const size_t sampleBytes = SharedSampleSize() == kSample64 ? sizeof(double) : sizeof(float);
+    const size_t channelBytes = AlignUp(capacity * sampleBytes, CACHE_LINE_SIZE);
+    size_t offset = AlignUp(sizeof(AudioSharedData), CACHE_LINE_SIZE);
+    uint32_t channelOffsets[MAX_LAYOUT_CHANNELS] = {};
+    uint32_t channelIndex = 0;
+    for (auto &bus : inputPlan.inputOffsets)
+    {
+        for (auto &channel : bus)
+        {
+            channel = (int64_t)offset;
+            channelOffsets[channelIndex++] = (uint32_t)offset;
+            offset += channelBytes;
+        }
+    }
+    for (auto &bus : outputPlan.outputOffsets)
+    {
+        for (auto &channel : bus)
+        {
+            channel = (int64_t)offset;
+            channelOffsets[channelIndex++] = (uint32_t)offset;
+            offset += channelBytes;
+        }
+    }
+    const size_t slotBytes = AlignUp(offset, CACHE_LINE_SIZE);
+    if (slotBytes > UINT32_MAX || LAYOUT_HEADER_BYTES + m_slotCount * slotBytes > m_shm.size())
+    {
+        DbgPrint(_T("ApplySharedLayout: Layout needs %zu bytes but the mapping has %zu. Increase -shm_size."),
+                 LAYOUT_HEADER_BYTES + m_slotCount * slotBytes, m_shm.size());
+        m_layoutTooLarge = true;
         return false;
     }
+
+    SharedLayoutHeader *h = m_pLayout;
+    h->generation.fetch_add(1); // 奇数: 書き換え中
+    h->blockCapacity = (uint32_t)capacity;
+    h->sampleBytes = (uint32_t)sampleBytes;
+    h->slotBytes = (uint32_t)slotBytes;
+    h->numInputBuses = (uint32_t)inputPlan.inputOffsets.size();
+    h->numOutputBuses = (uint32_t)outputPlan.outputOffsets.size();
+    h->numChannels = channelIndex;
+    uint32_t first = 0;
+    for (size_t b = 0; b < inputPlan.inputOffsets.size(); ++b)
+    {
+        h->inputBuses[b].numChannels = (int32_t)inputPlan.inputOffsets[b].size();
+        h->inputBuses[b].firstChannel = first;
+        first += (uint32_t)inputPlan.inputOffsets[b].size();
+    }
+    for (size_t b = 0; b < outputPlan.outputOffsets.size(); ++b)
+    {
+        h->outputBuses[b].numChannels = (int32_t)outputPlan.outputOffsets[b].size();
+        h->outputBuses[b].firstChannel = first;
+        first += (uint32_t)outputPlan.outputOffsets[b].size();
+    }
+    memcpy(h->channelOffsets, channelOffsets, sizeof(channelOffsets));
+    h->generation.fetch_add(1); // 偶数: 確定
+    m_slotBytes = slotBytes;
+    m_blockCapacity = (int32)capacity;
+    DbgPrint(_T("ApplySharedLayout: %u channels, capacity %zu samples, slot %zu bytes."), channelIndex, capacity, slotBytes);
     return true;
 }
-void VstHost::RequestStop() { m_mainLoopRunning = false; }
-void VstHost::RunMessageLoop()
+bool VstHost::ApplyRenderLayout(ProcessPlan &inputPlan, ProcessPlan &outputPlan)
 {
-    WNDCLASS wc = {};
-    wc.lpfnWndProc = VstHost::MainThreadMsgWndProc;
-    wc.hInstance = m_hInstance;
-    wc.lpszClassName = TEXT("VstHostMsgWindowClass");
-    RegisterClass(&wc);
-    m_hMainThreadMsgWindow = CreateWindow(wc.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, m_hInstance, this);
-    SetTimer(m_hMainThreadMsgWindow, IDT_GUI_TIMER, 33, nullptr);
-    MSG msg;
-    m_mainLoopRunning = true;
-    while (m_mainLoopRunning && GetMessage(&msg, NULL, 0, 0) > 0)
+    // 共有メモリのスロットと同じく、AudioSharedData の後に入力・出力チャンネルを並べる
+    const size_t sampleBytes = SharedSampleSize() == kSample64 ? sizeof(double) : sizeof(float);
+    const size_t channelBytes = AlignUp((size_t)m_blockSize * sampleBytes, CACHE_LINE_SIZE);
+    size_t offset = AlignUp(sizeof(AudioSharedData), CACHE_LINE_SIZE);
+    for (auto &bus : inputPlan.inputOffsets)
     {
-        if (m_hGuiWindow && IsDialogMessage(m_hGuiWindow, &msg))
+        for (auto &channel : bus)
         {
-            continue;
+            channel = (int64_t)offset;
+            offset += channelBytes;
         }
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
     }
-    if (m_hGuiWindow)
+    for (auto &bus : outputPlan.outputOffsets)
     {
-        DestroyWindow(m_hGuiWindow);
+        for (auto &channel : bus)
+        {
+            channel = (int64_t)offset;
+            offset += channelBytes;
+        }
     }
+    m_renderSlot.assign(offset / sizeof(double), 0.0);
+    m_blockCapacity = m_blockSize;
+    return true;
 }
-void VstHost::Cleanup()
+int64 VstHost::ChainTailSamples(double sampleRate)
 {
-    if (!m_threadsRunning.exchange(false))
-        return;
-    m_mainLoopRunning = false;
-    m_syncCv.notify_all();
-    if (m_hPipe != INVALID_HANDLE_VALUE)
+    // レイテンシと同じく、出力ノードまでの経路のうち最も長いもの
+    const int64 limit = (int64)(MAX_RENDER_TAIL_SECONDS * sampleRate);
+    std::vector<int64> pathTail(StageCount(), 0);
+    for (uint32_t node : m_graphOrder)
+    {
+        PluginInstance &inst = Stage(node);
+        uint32 tail = inst.processor ? inst.processor->getTailSamples() : kNoTail;
+        int64 longest = 0;
+        for (uint32_t p : inst.predecessors)
+            longest = std::max(longest, pathTail[p]);
+        pathTail[node] = std::min(limit, longest + (tail == kInfiniteTail ? limit : (int64)tail));
+    }
+    return pathTail[m_graphSink];
+}
+// メインスレッドで呼ばれる。リアルタイム処理を止め、kOffline で入力ファイル全体とテールを処理してから元の設定に戻す
+bool VstHost::RenderOffline(const std::string &inPath, const std::string &outPath, int32 blockSize, std::string &result)
+{
+    if (!m_isPluginReady || !m_plugin.processor)
+    {
+        result = "NoPlugin";
+        return false;
+    }
+    MappedFile input;
+    if (!input.Open(inPath))
+    {
+        result = "CannotOpenInput";
+        return false;
+    }
+    RenderSource src;
+    if (!ParseWavFile(input.data(), input.size(), src))
+    {
+        if (input.size() >= 4 && memcmp(input.data(), "RIFF", 4) == 0)
+        {
+            result = "UnsupportedWav";
+            return false;
+        }
+        // raw は先頭段の入力チャンネル数の float32 インターリーブとして扱う
+        src.frames = input.data();
+        src.numChannels = m_plugin.inputChannels > 0 ? (int32)m_plugin.inputChannels : 1;
+        src.bytesPerSample = sizeof(float);
+        src.isFloat = true;
+        src.numFrames = (int64)(input.size() / ((size_t)src.numChannels * sizeof(float)));
+    }
+    const double sampleRate = src.sampleRate > 0.0 ? src.sampleRate : m_sampleRate;
+    const bool is64 = SharedSampleSize() == kSample64;
+    const size_t sampleBytes = is64 ? sizeof(double) : sizeof(float);
+    const int32 outChannels = (int32)Stage(m_graphSink).outputChannels;
+    RenderWriter writer;
+    if (!writer.Open(outPath, outChannels, (int32)sampleBytes, sampleRate))
+    {
+        result = "CannotOpenOutput";
+        return false;
+    }
+
+    DbgPrint(_T("RenderOffline: %lld frames, %d ch, %.0f Hz, block %d."), (long long)src.numFrames, src.numChannels, sampleRate, blockSize);
+    SuspendAudio();
+    SetChainActive(false);
+    const int32 realtimeBlockSize = m_blockSize;
+    m_blockSize = blockSize;
+    bool ok = SetupChainProcessing(kOffline, blockSize, sampleRate) && BuildProcessPlan(true);
+    int64 processed = 0, written = 0;
+    double seconds = 0.0;
+    if (!ok)
+    {
+        result = "SetupFailed";
+    }
+    else
+    {
+        SetChainActive(true);
+        UpdateChainLatency();
+        // 先頭のレイテンシ分は捨て、その分だけ長く回してテールまで書き出す
+        const int64 latency = m_chainLatency.load();
+        const int64 total = src.numFrames + latency + ChainTailSamples(sampleRate);
+        AudioSharedData *block = (AudioSharedData *)m_renderSlot.data();
+        char *slotBase = (char *)block;
+        block->sampleRate = sampleRate;
+        block->numChannels = (int32_t)m_plugin.inputChannels;
+        std::vector<char> interleaved((size_t)blockSize * std::max(outChannels, 1) * sampleBytes);
+        m_samplePosition = 0;
+        // イベントリングはオーディオスレッドのもので、render では読まない
+        const std::vector<SharedEvent> noEvents;
+        const auto begin = std::chrono::steady_clock::now();
+        while (processed < total && ok)
+        {
+            const int32 numSamples = (int32)std::min<int64>(blockSize, total - processed);
+            const int32 available = (int32)std::max<int64>(0, std::min<int64>(numSamples, src.numFrames - processed));
+            int32 k = 0;
+            for (const auto &bus : m_plugin.plan.inputOffsets)
+            {
+                for (int64_t offset : bus)
+                {
+                    char *dst = slotBase + offset;
+                    const int32 decoded = k < src.numChannels ? available : 0;
+                    if (decoded > 0)
+                    {
+                        if (is64)
+                            DecodeRenderChannel(src, processed, decoded, k, (double *)dst);
+                        else
+                            DecodeRenderChannel(src, processed, decoded, k, (float *)dst);
+                    }
+                    memset(dst + decoded * sampleBytes, 0, (numSamples - decoded) * sampleBytes);
+                    ++k;
+                }
+            }
+            block->numSamples = numSamples;
+            ProcessBlock(block, nullptr, noEvents);
+
+            const int32 skip = processed < latency ? (int32)std::min<int64>(numSamples, latency - processed) : 0;
+            const int32 frames = numSamples - skip;
+            if (frames > 0 && outChannels > 0)
+            {
+                int32 c = 0;
+                for (const auto &bus : Stage(m_graphSink).plan.outputOffsets)
+                {
+                    for (int64_t offset : bus)
+                    {
+                        const char *srcChannel = slotBase + offset + skip * sampleBytes;
+                        if (is64)
+                        {
+                            double *dst = (double *)interleaved.data() + c;
+                            for (int32 n = 0; n < frames; ++n)
+                                dst[(size_t)n * outChannels] = ((const double *)srcChannel)[n];
+                        }
+                        else
+                        {
+                            float *dst = (float *)interleaved.data() + c;
+                            for (int32 n = 0; n < frames; ++n)
+                                dst[(size_t)n * outChannels] = ((const float *)srcChannel)[n];
+                        }
+                        ++c;
+                    }
+                }
+                if (!writer.Write(interleaved.data(), (size_t)frames * outChannels * sampleBytes))
+                {
+                    result = "WriteFailed";
+                    ok = false;
+                }
+                written += frames;
+            }
+            processed += numSamples;
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        SetChainActive(false);
+    }
+    if (!writer.Close() && ok)
+    {
+        result = "WriteFailed";
+        ok = false;
+    }
+
+    m_blockSize = realtimeBlockSize;
+    if (!RestoreRealtimeProcessing())
     {
-        CloseHandle(m_hPipe);
-        m_hPipe = INVALID_HANDLE_VALUE;
+        result = "RestoreFailed";
+        return false;
     }
-    if (m_hEventClientReady)
-        SetEvent(m_hEventClientReady);
-    if (m_hMainThreadMsgWindow)
-        PostMessage(m_hMainThreadMsgWindow, WM_QUIT, 0, 0);
-    if (m_hPipeThread)
+    if (!ok)
+        return false;
+
+    const double rate = seconds > 0.0 ? processed / seconds : 0.0;
+    DbgPrint(_T("RenderOffline: %lld frames in %.3f s (%.0f samples/sec, %.1fx realtime)."), (long long)processed, seconds, rate, rate / sampleRate);
+    result = std::to_string(written) + " " + std::to_string((int64)(seconds * 1000.0)) + " " + std::to_string((int64)rate);
+    return true;
+}
+// render / benchmark の後に、m_blockSize のリアルタイム処理と共有メモリの割り当てに戻す
+bool VstHost::RestoreRealtimeProcessing()
+{
+    m_renderSlot.clear();
+    m_renderSlot.shrink_to_fit();
+    m_samplePosition = 0;
+    if (!SetupChainProcessing(kRealtime, m_blockSize, m_sampleRate) || !BuildProcessPlan())
     {
-        WaitForSingleObject(m_hPipeThread, 2000);
-        CloseHandle(m_hPipeThread);
-        m_hPipeThread = NULL;
+        DbgPrint(_T("RestoreRealtimeProcessing: Could not restore realtime processing. Processing stays stopped."));
+        return false;
     }
-    if (m_hAudioThread)
+    SetChainActive(true);
+    UpdateChainLatency();
+    m_isPluginReady = true;
+    return true;
+}
+// メインスレッドで呼ばれる。リアルタイム処理を止め、ブロックサイズごとにノイズを seconds 秒分処理して
+// 1 ブロックの処理時間の分布と CPU 使用率を JSON で返す。処理モードは kRealtime のままで、
+// バッファは共有メモリの代わりに m_renderSlot を使う (クライアントとの往復は含まない)
+bool VstHost::RunBenchmark(const std::vector<int32> &blockSizes, double seconds, std::string &result)
+{
+    if (!m_isPluginReady || !m_plugin.processor)
     {
-        WaitForSingleObject(m_hAudioThread, 2000);
-        CloseHandle(m_hAudioThread);
-        m_hAudioThread = NULL;
+        result = "NoPlugin";
+        return false;
     }
-    ReleasePlugin();
-    if (m_pSharedMem)
+    const bool is64 = SharedSampleSize() == kSample64;
+    const double sampleRate = m_sampleRate;
+    std::ostringstream json;
+    json << "{\"plugin\":\"" << JsonEscape(m_plugin.name) << "\",\"nodes\":" << StageCount()
+         << ",\"sampleRate\":" << sampleRate << ",\"inputChannels\":" << m_plugin.inputChannels
+         << ",\"outputChannels\":" << Stage(m_graphSink).outputChannels << ",\"sample64\":" << (is64 ? "true" : "false")
+         << ",\"seconds\":" << seconds << ",\"results\":[";
+
+    SuspendAudio();
+    SetChainActive(false);
+    const int32 realtimeBlockSize = m_blockSize;
+    bool ok = true;
+    for (size_t i = 0; i < blockSizes.size() && ok; ++i)
     {
-        UnmapViewOfFile(m_pSharedMem);
-        m_pSharedMem = nullptr;
+        const int32 blockSize = blockSizes[i];
+        m_blockSize = blockSize;
+        if (!SetupChainProcessing(kRealtime, blockSize, sampleRate) || !BuildProcessPlan(true))
+        {
+            result = "SetupFailed";
+            ok = false;
+            break;
+        }
+        SetChainActive(true);
+        UpdateChainLatency();
+        AudioSharedData *block = (AudioSharedData *)m_renderSlot.data();
+        char *slotBase = (char *)block;
+        block->sampleRate = sampleRate;
+        block->numSamples = blockSize;
+        block->numChannels = (int32_t)m_plugin.inputChannels;
+        // 無音だと処理が止まるので、入力には -20dB 程度のノイズを入れておく (出力は別の領域なので毎回書き直さない)
+        uint32_t seed = 0x12345678u;
+        for (const auto &bus : m_plugin.plan.inputOffsets)
+        {
+            for (int64_t offset : bus)
+            {
+                for (int32 n = 0; n < blockSize; ++n)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    const double value = ((int32_t)seed / 2147483648.0) * 0.1;
+                    if (is64)
+                        ((double *)(slotBase + offset))[n] = value;
+                    else
+                        ((float *)(slotBase + offset))[n] = (float)value;
+                }
+            }
+        }
+        m_samplePosition = 0;
+        const std::vector<SharedEvent> noEvents;
+        for (int32 n = 0; n < BENCHMARK_WARMUP_BLOCKS; ++n)
+            ProcessBlock(block, nullptr, noEvents);
+
+        std::unique_ptr<StatsHistogram> histogram(new StatsHistogram());
+        const int64 numBlocks = std::max<int64>(1, (int64)(seconds * sampleRate / blockSize));
+        const uint64_t cpuBegin = ThreadCpuNanos();
+        const uint64_t wallBegin = MonotonicNanos();
+        for (int64 n = 0; n < numBlocks; ++n)
+        {
+            const uint64_t start = MonotonicNanos();
+            ProcessBlock(block, nullptr, noEvents);
+            histogram->Record(MonotonicNanos() - start);
+        }
+        const double wallNs = (double)(MonotonicNanos() - wallBegin);
+        const double cpuNs = (double)(ThreadCpuNanos() - cpuBegin);
+        SetChainActive(false);
+
+        const double periodNs = blockSize * 1.0e9 / sampleRate;
+        const double audioNs = numBlocks * periodNs;
+        char entry[512];
+        snprintf(entry, sizeof(entry),
+                 "%s{\"blockSize\":%d,\"blocks\":%lld,\"p50Us\":%.2f,\"p99Us\":%.2f,\"p999Us\":%.2f,\"maxUs\":%.2f,\"meanUs\":%.2f,"
+                 "\"p99LoadPct\":%.2f,\"realtimeFactor\":%.1f,\"cpuPct\":%.2f}",
+                 i > 0 ? "," : "", blockSize, (long long)numBlocks,
+                 histogram->Percentile(0.5) / 1000.0, histogram->Percentile(0.99) / 1000.0, histogram->Percentile(0.999) / 1000.0,
+                 histogram->max.load() / 1000.0, histogram->sum.load() / 1000.0 / numBlocks,
+                 histogram->Percentile(0.99) * 100.0 / periodNs, wallNs > 0.0 ? audioNs / wallNs : 0.0, cpuNs * 100.0 / audioNs);
+        json << entry;
+        DbgPrint(_T("RunBenchmark: block %d, p99 %.2f us, %.2f%% CPU."), blockSize, histogram->Percentile(0.99) / 1000.0, cpuNs * 100.0 / audioNs);
     }
-    if (m_hShm)
+    json << "]}";
+
+    m_blockSize = realtimeBlockSize;
+    if (!RestoreRealtimeProcessing())
     {
-        CloseHandle(m_hShm);
-        m_hShm = NULL;
+        result = "RestoreFailed";
+        return false;
     }
-    if (m_hEventClientReady)
+    if (!ok)
+        return false;
+    result = json.str();
+    return true;
+}
+void VstHost::OnRestartComponent(int32 flags)
+{
+    if (!m_plugin.component || !m_plugin.processor || !m_isPluginReady)
+        return;
+    if (!(flags & (kIoChanged | kReloadComponent)))
     {
-        CloseHandle(m_hEventClientReady);
-        m_hEventClientReady = NULL;
+        UpdateChainLatency();
+        DbgPrint(_T("OnRestartComponent: Chain latency is now %d samples."), m_chainLatency.load());
+        return;
     }
-    if (m_hEventHostDone)
+    DbgPrint(_T("OnRestartComponent: Rebuilding process plan (flags=0x%X)."), flags);
+    SuspendAudio();
+    SetChainActive(false);
+    if (!BuildProcessPlan())
     {
-        CloseHandle(m_hEventHostDone);
-        m_hEventHostDone = NULL;
+        DbgPrint(_T("OnRestartComponent: New bus layout does not fit the shared memory. Processing stays stopped."));
+        return;
     }
-    if (m_hMainThreadMsgWindow)
+    SetChainActive(true);
+    UpdateChainLatency();
+    m_isPluginReady = true;
+}
+
+void VstHost::ProcessAudioBlock(uint32_t slotIndex)
+{
+    AudioBusyScope busy(m_audioBusy);
+    const uint64_t startNs = MonotonicNanos();
+    AutomationBlock *automation = GetAutomation(slotIndex);
+    if (!m_isPluginReady || !m_plugin.component || !m_pSlots)
     {
-        DestroyWindow(m_hMainThreadMsgWindow);
-        m_hMainThreadMsgWindow = NULL;
+        // 処理しなかったブロックの点は次のブロックに持ち越さない。
+        // イベントはリングに残し、次に処理するブロックで渡す (render / benchmark 中もここを通る)
+        if (automation)
+            automation->numPoints = 0;
+        ++m_eventBlockIndex;
+        if (m_pStats)
+            StatsIncrement(m_pStats->skippedBlocks);
+        return;
     }
+    ReadInputEvents();
+    ++m_eventBlockIndex;
+    AudioSharedData *block = GetSlot(slotIndex);
+    ProcessBlock(block, automation, m_blockEvents);
+    if (m_pStats)
+        RecordBlockStats(block, MonotonicNanos() - startNs);
 }
-void VstHost::HandlePipeCommands()
+// 通知で起きたときに呼ぶ。クライアントが時刻を書いていればウェイク遅延として記録する
+void VstHost::RecordWake()
 {
-    char buffer[MAX_STATE_DATA_LEN];
-    DWORD bytesRead;
-    while (m_threadsRunning)
+    m_wakeLatencyNs = 0;
+    if (!m_pStats)
+        return;
+    StatsIncrement(m_pStats->wakes);
+    const uint64_t signalNs = m_pStats->clientSignalNs.exchange(0, std::memory_order_acquire);
+    const uint64_t nowNs = MonotonicNanos();
+    if (signalNs != 0 && signalNs <= nowNs)
     {
-        BOOL connected = ConnectNamedPipe(m_hPipe, NULL) ? TRUE : (GetLastError() == ERROR_PIPE_CONNECTED);
-        if (!connected)
-        {
-            if (!m_threadsRunning || m_hPipe == INVALID_HANDLE_VALUE)
-                break;
-            Sleep(100);
-            continue;
-        }
-        while (m_threadsRunning)
-        {
-            BOOL success = ReadFile(m_hPipe, buffer, sizeof(buffer) - 1, &bytesRead, NULL);
-            if (!success || bytesRead == 0)
-                break;
-            buffer[bytesRead] = '\0';
-            std::string cmd(buffer);
-            std::string response = ProcessCommand(cmd);
-            DWORD bytesWritten;
-            WriteFile(m_hPipe, response.c_str(), (DWORD)response.length(), &bytesWritten, NULL);
-            if (cmd.rfind("exit", 0) == 0)
-                break;
-        }
-        if (m_hPipe != INVALID_HANDLE_VALUE)
-            DisconnectNamedPipe(m_hPipe);
+        m_wakeLatencyNs = nowNs - signalNs;
+        m_pStats->wakeLatencyNs.Record(m_wakeLatencyNs);
     }
 }
-void VstHost::HandleAudioProcessing()
+void VstHost::RecordBlockStats(const AudioSharedData *block, uint64_t elapsedNs)
 {
-    while (m_threadsRunning)
+    StatsPage &stats = *m_pStats;
+    StatsIncrement(stats.blocks);
+    stats.processNs.Record(elapsedNs);
+    if (block->numSamples > 0 && block->sampleRate > 0.0)
     {
-        if (WaitForSingleObject(m_hEventClientReady, 1000) != WAIT_OBJECT_0)
-            continue;
-        if (!m_threadsRunning)
-            break;
-        ResetEvent(m_hEventClientReady);
-        ProcessAudioBlock();
-        SetEvent(m_hEventHostDone);
+        const double periodNs = block->numSamples * 1.0e9 / block->sampleRate;
+        stats.dspLoadPermille.Record((uint64_t)(elapsedNs * 1000.0 / periodNs));
+        // 起きて最初のブロックは通知からの遅れも含めて判定する
+        if (elapsedNs + m_wakeLatencyNs > periodNs)
+            StatsIncrement(stats.deadlineMisses);
     }
+    m_wakeLatencyNs = 0;
 }
-LRESULT CALLBACK VstHost::MainThreadMsgWndProc(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
+// stats コマンドの応答。時間はマイクロ秒、負荷はパーセントで p50/p99/最大 を返す
+std::string VstHost::FormatStats() const
 {
-    VstHost *h;
-    if (msg == WM_CREATE)
+    if (!m_pStats)
+        return "FAIL NoStats\n";
+    const StatsPage &stats = *m_pStats;
+    char buffer[512];
+    auto triple = [](const StatsHistogram &h, double scale, char *out, size_t size)
     {
-        h = (VstHost *)((CREATESTRUCT *)lp)->lpCreateParams;
-        SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)h);
-    }
-    else
+        snprintf(out, size, "%.1f/%.1f/%.1f", h.Percentile(0.5) * scale, h.Percentile(0.99) * scale, h.max.load(std::memory_order_relaxed) * scale);
+    };
+    char wake[96], process[96], load[96];
+    triple(stats.wakeLatencyNs, 1.0e-3, wake, sizeof(wake));
+    triple(stats.processNs, 1.0e-3, process, sizeof(process));
+    triple(stats.dspLoadPermille, 0.1, load, sizeof(load));
+    snprintf(buffer, sizeof(buffer), "OK blocks=%llu skipped=%llu wakes=%llu misses=%llu wake_us=%s process_us=%s load_pct=%s\n",
+             (unsigned long long)stats.blocks.load(std::memory_order_relaxed), (unsigned long long)stats.skippedBlocks.load(std::memory_order_relaxed),
+             (unsigned long long)stats.wakes.load(std::memory_order_relaxed), (unsigned long long)stats.deadlineMisses.load(std::memory_order_relaxed),
+             wake, process, load);
+    return buffer;
+}
+// 入力リングから現在のブロック (とそれ以前の遅れたもの) のイベントを m_blockEvents に取り出す
+void VstHost::ReadInputEvents()
+{
+    m_blockEvents.clear();
+    if (!m_pEvents)
+        return;
+    const uint32_t mask = m_pEvents->capacity - 1;
+    const uint32_t head = m_pEvents->inputHead.load(std::memory_order_acquire);
+    uint32_t tail = m_pEvents->inputTail.load(std::memory_order_relaxed);
+    if (head - tail > m_pEvents->capacity)
+        tail = head - m_pEvents->capacity;
+    const SharedEvent *entries = InputEventEntries();
+    while (tail != head)
     {
-        h = (VstHost *)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+        const SharedEvent &e = entries[tail & mask];
+        if ((int32_t)(e.blockIndex - m_eventBlockIndex) > 0)
+            break; // 先のブロックの分
+        if (m_blockEvents.size() < m_blockEvents.capacity())
+            m_blockEvents.push_back(e);
+        ++tail;
     }
-    if (h)
+    m_pEvents->inputTail.store(tail, std::memory_order_release);
+}
+// 先頭段の outputEvents を戻りリングに書く。満杯なら残りは捨てる
+void VstHost::WriteOutputEvents(int32 start)
+{
+    HostEventList &events = m_plugin.plan.outEvents;
+    const int32 count = events.getEventCount();
+    if (!m_pEvents || count == 0)
+        return;
+    const uint32_t capacity = m_pEvents->capacity;
+    const uint32_t tail = m_pEvents->outputTail.load(std::memory_order_acquire);
+    uint32_t head = m_pEvents->outputHead.load(std::memory_order_relaxed);
+    SharedEvent *entries = OutputEventEntries();
+    for (int32 i = 0; i < count && head - tail < capacity; ++i)
     {
-        switch (msg)
+        Event e;
+        if (events.getEvent(i, e) != kResultTrue)
+            continue;
+        SharedEvent out = {};
+        out.blockIndex = m_eventBlockIndex - 1;
+        out.sampleOffset = e.sampleOffset + start;
+        out.noteId = -1;
+        switch (e.type)
         {
-        case WM_APP_SHOW_GUI:
-            h->ShowGui();
-            return 0;
-        case WM_APP_HIDE_GUI:
-            h->HideGui();
-            return 0;
-        case WM_APP:
-            h->ProcessQueuedCommands();
-            return 0;
-        case WM_TIMER:
-            if (wp == IDT_GUI_TIMER)
-            {
-                h->ProcessGuiUpdates();
-            }
-            return 0;
+        case Event::kNoteOnEvent:
+            out.type = kSharedNoteOn;
+            out.channel = e.noteOn.channel;
+            out.pitch = e.noteOn.pitch;
+            out.value = e.noteOn.velocity;
+            out.noteId = e.noteOn.noteId;
+            break;
+        case Event::kNoteOffEvent:
+            out.type = kSharedNoteOff;
+            out.channel = e.noteOff.channel;
+            out.pitch = e.noteOff.pitch;
+            out.value = e.noteOff.velocity;
+            out.noteId = e.noteOff.noteId;
+            break;
+        case Event::kPolyPressureEvent:
+            out.type = kSharedPolyPressure;
+            out.channel = e.polyPressure.channel;
+            out.pitch = e.polyPressure.pitch;
+            out.value = e.polyPressure.pressure;
+            out.noteId = e.polyPressure.noteId;
+            break;
+        case Event::kLegacyMIDICCOutEvent:
+            out.type = kSharedControlChange;
+            out.channel = e.midiCCOut.channel;
+            out.pitch = e.midiCCOut.controlNumber;
+            // ピッチベンドは value (下位 7bit) と value2 (上位 7bit) の 14bit
+            if (e.midiCCOut.controlNumber == kPitchBend)
+                out.value = (float)((e.midiCCOut.value & 0x7F) | (e.midiCCOut.value2 & 0x7F) << 7) / 16383.0f;
+            else
+                out.value = (float)(e.midiCCOut.value & 0x7F) / 127.0f;
+            break;
+        default:
+            continue;
         }
+        entries[head & (capacity - 1)] = out;
+        ++head;
     }
-    return DefWindowProc(hWnd, msg, wp, lp);
+    m_pEvents->outputHead.store(head, std::memory_order_release);
 }
-std::string VstHost::ProcessCommand(const std::string &full_cmd)
+// block は共有メモリのスロットか、render 中は m_renderSlot (automation なし、イベントリングも使わない)。
+// events はこのブロックで渡すイベント (オーディオスレッドでは m_blockEvents)
+void VstHost::ProcessBlock(AudioSharedData *block, AutomationBlock *automation, const std::vector<SharedEvent> &events)
 {
-    std::string cmd = full_cmd;
-    while (!cmd.empty() && isspace(cmd.back()))
-        cmd.pop_back();
-    if (cmd == "exit")
+    if (block->numSamples <= 0)
+        return;
+    if (!m_plugin.processor)
     {
-        RequestStop();
-        return "OK: Exit requested.\n";
+        DbgPrint(_T("ProcessAudioBlock: Skipping audio processing (no processor available)."));
+        return;
     }
-    if (cmd == "get_state")
+
+    ProcessPlan &plan = m_plugin.plan;
+    const int32 numSamples = block->numSamples < plan.blockCapacity ? block->numSamples : plan.blockCapacity;
+    plan.blockChanges.clear();
+    // 容量はパラメータ数以上確保してあるので GUI の変更は必ず入る
+    m_pendingParams.Drain([&plan](ParamID id, ParamValue value)
+                          {
+                              if (plan.blockChanges.size() < plan.blockChanges.capacity())
+                                  plan.blockChanges.push_back({id, 0, value}); });
+    // クライアントのオートメーションは GUI の変更の後ろに並べ、同じ位置ではこちらが後勝ちになる
+    const size_t automationBegin = plan.blockChanges.size();
+    if (automation)
     {
-        std::string result;
-        bool success = false;
+        const uint32_t numPoints = std::min(automation->numPoints, MAX_AUTOMATION_POINTS);
+        for (uint32_t i = 0; i < numPoints && plan.blockChanges.size() < plan.blockChanges.capacity(); ++i)
         {
-            std::unique_lock<std::mutex> lock(m_syncMutex);
-            m_syncCommand = cmd;
-            if (m_hMainThreadMsgWindow)
-                PostMessage(m_hMainThreadMsgWindow, WM_APP, 0, 0);
-            m_syncCv.wait(lock, [this]
-                          { return m_syncCommand.empty() || !m_mainLoopRunning; });
-            if (m_mainLoopRunning)
-            {
-                success = m_syncSuccess;
-                result = m_syncResult;
-            }
+            const AutomationPoint &point = automation->points[i];
+            int32 offset = point.sampleOffset < 0 ? 0 : (point.sampleOffset >= numSamples ? numSamples - 1 : point.sampleOffset);
+            ParamValue value = point.value < 0.0 ? 0.0 : (point.value > 1.0 ? 1.0 : point.value);
+            plan.blockChanges.push_back({point.paramId, offset, value});
         }
-        if (success)
-            return "OK " + result + "\n";
-        else
-            return "FAIL " + result + "\n";
+        automation->numPoints = 0;
     }
+    // イベントリングの CC はコントローラの割り当て (IMidiMapping) に従ってパラメータ変更にし、
+    // ノート系のイベントはプラグインに渡す形に直す
+    m_blockNoteEvents.clear();
+    for (const SharedEvent &src : events)
     {
-        std::lock_guard<std::mutex> lock(m_commandMutex);
-        m_commandQueue.push_back(full_cmd);
+        const int32 offset = src.sampleOffset < 0 ? 0 : (src.sampleOffset >= numSamples ? numSamples - 1 : src.sampleOffset);
+        const int16 channel = src.channel < 0 ? 0 : (src.channel > 15 ? 15 : src.channel);
+        if (src.type == kSharedControlChange)
+        {
+            if (src.pitch < 0 || src.pitch >= kCountCtrlNumber || m_midiControllerMap.empty())
+                continue;
+            ParamID id = m_midiControllerMap[channel * kCountCtrlNumber + src.pitch];
+            if (id != kNoParamId && plan.blockChanges.size() < plan.blockChanges.capacity())
+                plan.blockChanges.push_back({id, offset, src.value < 0.0f ? 0.0 : (src.value > 1.0f ? 1.0 : (ParamValue)src.value)});
+            continue;
+        }
+        Event e = {};
+        e.busIndex = 0;
+        e.sampleOffset = offset;
+        e.flags = Event::kIsLive;
+        if (src.type == kSharedNoteOn)
+        {
+            e.type = Event::kNoteOnEvent;
+            e.noteOn.channel = channel;
+            e.noteOn.pitch = src.pitch;
+            e.noteOn.velocity = src.value;
+            e.noteOn.noteId = src.noteId;
+        }
+        else if (src.type == kSharedNoteOff)
+        {
+            e.type = Event::kNoteOffEvent;
+            e.noteOff.channel = channel;
+            e.noteOff.pitch = src.pitch;
+            e.noteOff.velocity = src.value;
+            e.noteOff.noteId = src.noteId;
+        }
+        else if (src.type == kSharedPolyPressure)
+        {
+            e.type = Event::kPolyPressureEvent;
+            e.polyPressure.channel = channel;
+            e.polyPressure.pitch = src.pitch;
+            e.polyPressure.pressure = src.value;
+            e.polyPressure.noteId = src.noteId;
+        }
+        else
+        {
+            continue;
+        }
+        // 同じ位置のイベントは到着順を保つ (挿入ソート: 通常は整列済み)
+        m_blockNoteEvents.push_back(e);
+        for (size_t j = m_blockNoteEvents.size() - 1; j > 0 && m_blockNoteEvents[j - 1].sampleOffset > offset; --j)
+            std::swap(m_blockNoteEvents[j], m_blockNoteEvents[j - 1]);
     }
-    if (m_hMainThreadMsgWindow)
-        PostMessage(m_hMainThreadMsgWindow, WM_APP, 0, 0);
-    return "OK\n";
-}
-void VstHost::ProcessQueuedCommands()
-{
-    // 同期コマンド処理 (get_state)
+    const bool hasAutomation = plan.blockChanges.size() > automationBegin;
+    // 同じ位置の変更は到着順を保つ (挿入ソート: 通常はほぼ整列済み)
+    for (size_t i = 1; i < plan.blockChanges.size(); ++i)
     {
-        std::unique_lock<std::mutex> lock(m_syncMutex);
-        if (!m_syncCommand.empty())
+        BlockParamChange change = plan.blockChanges[i];
+        size_t j = i;
+        while (j > 0 && plan.blockChanges[j - 1].sampleOffset > change.sampleOffset)
         {
-            if (m_syncCommand == "get_state")
-            {
-                if (m_plugProvider && m_plugProvider->getComponent() && m_plugProvider->getController())
-                {
-                    MemoryStream cStream, tStream;
-                    m_plugProvider->getComponent()->getState(&cStream);
-                    m_plugProvider->getController()->getState(&tStream);
-                    if (cStream.getSize() > 0 || tStream.getSize() > 0)
-                    {
-                        MemoryStream fStream;
-                        int32 b;
-                        int64 cs = cStream.getSize(), ts = tStream.getSize();
-                        fStream.write(&cs, sizeof(cs), &b);
-                        if (cs > 0)
-                            fStream.write(cStream.getData(), (int32)cs, &b);
-                        fStream.write(&ts, sizeof(ts), &b);
-                        if (ts > 0)
-                            fStream.write(tStream.getData(), (int32)ts, &b);
-                        m_syncResult = "VST3_DUAL:" + base64_encode((const BYTE *)fStream.getData(), (DWORD)fStream.getSize());
-                        m_syncSuccess = true;
-                    }
-                    else
-                    {
-                        m_syncResult = "EMPTY";
-                        m_syncSuccess = true;
-                    }
-                }
-                else
-                {
-                    m_syncResult = "NoPlugin";
-                    m_syncSuccess = false;
-                }
-            }
-            m_syncCommand.clear();
-            lock.unlock();
-            m_syncCv.notify_one();
+            plan.blockChanges[j] = plan.blockChanges[j - 1];
+            --j;
         }
+        plan.blockChanges[j] = change;
     }
 
-    // 非同期コマンド処理
-    std::vector<std::string> commandsToProcess;
+    char *slotBase = (char *)block;
+    if (plan.convertInput)
     {
-        std::lock_guard<std::mutex> lock(m_commandMutex);
-        if (m_commandQueue.empty())
-            return;
-        commandsToProcess.swap(m_commandQueue);
+        for (size_t b = 0; b < plan.inputOffsets.size(); ++b)
+        {
+            for (size_t c = 0; c < plan.inputOffsets[b].size(); ++c)
+                ConvertDoubleToFloat((const double *)(slotBase + plan.inputOffsets[b][c]), plan.inputScratch[b][c], numSamples);
+        }
     }
 
-    for (const auto &cmd_raw : commandsToProcess)
+    // setupProcessing で伝えた最大サイズと、離れたパラメータ変更の位置でブロックを分割する。
+    // グラフの各ノードは同じスライスを処理する
+    const int32 splitSamples = m_options.paramSplitSamples;
+    const size_t numStages = StageCount();
+    size_t changeIndex = 0, eventIndex = 0;
+    int32 start = 0;
+    while (start < numSamples)
     {
-        std::string cmd = cmd_raw;
-        while (!cmd.empty() && isspace((unsigned char)cmd.back()))
-        {
-            cmd.pop_back();
-        }
-        if (cmd.rfind("load_and_set_state ", 0) == 0)
+        int32 end = numSamples - start > plan.maxSliceSamples ? start + plan.maxSliceSamples : numSamples;
+        if (splitSamples > 0)
         {
-            std::string path, state_b64;
-            double sr = 44100.0;
-            int32 bs = 1024;
-
-            try
+            for (size_t i = changeIndex; i < plan.blockChanges.size(); ++i)
             {
-                std::string args_str = cmd.substr(19);
-                if (args_str.empty() || args_str.front() != '"')
-                {
-                    DbgPrint(_T("Error: Path for load_and_set_state must be quoted. Command: %hs"), cmd.c_str());
-                    continue;
-                }
-                size_t end_quote = args_str.find('"', 1);
-                if (end_quote == std::string::npos)
-                {
-                    DbgPrint(_T("Error: Unmatched quote in path for load_and_set_state. Command: %hs"), cmd.c_str());
-                    continue;
-                }
-                path = args_str.substr(1, end_quote - 1);
-                std::stringstream ss(args_str.substr(end_quote + 1));
-                ss >> sr >> bs;
-                std::string temp_state;
-                if (ss >> temp_state)
+                int32 offset = plan.blockChanges[i].sampleOffset;
+                if (offset >= end)
+                    break;
+                if (offset >= start + splitSamples)
                 {
-                    state_b64 = temp_state;
+                    end = offset;
+                    break;
                 }
             }
-            catch (const std::exception &e)
+        }
+
+        plan.inParamChanges.Clear();
+        while (changeIndex < plan.blockChanges.size() && plan.blockChanges[changeIndex].sampleOffset < end)
+        {
+            const BlockParamChange &change = plan.blockChanges[changeIndex];
+            int32 queueIndex;
+            HostParamValueQueue *paramQueue = plan.inParamChanges.addParameterData(change.id, queueIndex);
+            int32 offset = change.sampleOffset > start ? change.sampleOffset - start : 0;
+            // 1 つのパラメータの点がキューに入りきらなければ、その位置でスライスを切って残りを次に回す
+            // (満杯のキューは異なる位置の点で埋まっているので offset > 0 になり、必ず先へ進む)
+            if (paramQueue && offset > 0 && paramQueue->IsFullAt(offset))
             {
-                DbgPrint(_T("Exception during argument parsing for load_and_set_state: %hs"), e.what());
-                continue;
+                end = change.sampleOffset;
+                break;
             }
-
-            if (!path.empty())
+            ++changeIndex;
+            if (paramQueue)
             {
-                DbgPrint(_T("Executing load_and_set_state: '%hs', SR: %f, BS: %d"), path.c_str(), sr, bs);
-                if (LoadPlugin(path, sr, bs))
-                {
-                    if (m_plugProvider && !state_b64.empty())
-                    {
-                        DbgPrint(_T("Restoring state..."));
-                        if (state_b64.rfind("VST3_DUAL:", 0) == 0)
-                        {
-                            auto state_data = base64_decode(state_b64.substr(10));
-                            if (!state_data.empty())
-                            {
-                                MemoryStream stream(state_data.data(), state_data.size());
-                                int32 br;
-                                int64 cs = 0, ts = 0;
-                                stream.read(&cs, sizeof(cs), &br);
-                                if (cs > 0 && m_plugProvider->getComponent())
-                                {
-                                    std::vector<BYTE> d(cs);
-                                    stream.read(d.data(), (int32)cs, &br);
-                                    MemoryStream s(d.data(), cs);
-                                    m_plugProvider->getComponent()->setState(&s);
-                                }
-                                stream.read(&ts, sizeof(ts), &br);
-                                if (ts > 0 && m_plugProvider->getController())
-                                {
-                                    std::vector<BYTE> d(ts);
-                                    stream.read(d.data(), (int32)ts, &br);
-                                    MemoryStream s(d.data(), ts);
-                                    m_plugProvider->getController()->setState(&s);
-                                }
-                                DbgPrint(_T("State restored. Restarting component."));
-                                restartComponent(kParamValuesChanged | kReloadComponent);
-                            }
-                            else
-                            {
-                                DbgPrint(_T("Warning: State data was empty after base64 decoding."));
-                            }
-                        }
-                        else
-                        {
-                            DbgPrint(_T("Warning: State data format is not VST3_DUAL. State starts with: %hs"), state_b64.substr(0, 20).c_str());
-                        }
-                    }
-                }
+                int32 pointIndex;
+                paramQueue->addPoint(offset, change.value, pointIndex);
             }
         }
-        else if (cmd.rfind("load_plugin ", 0) == 0)
+        plan.inEvents.Clear();
+        while (eventIndex < m_blockNoteEvents.size() && m_blockNoteEvents[eventIndex].sampleOffset < end)
         {
-            std::string path;
-            double sr = 44100.0;
-            int32 bs = 1024;
-            try
-            {
-                std::string args_str = cmd.substr(12);
-                if (args_str.empty() || args_str.front() != '"')
-                {
-                    DbgPrint(_T("Error: Path for load_plugin must be quoted. Command: %hs"), cmd.c_str());
-                    continue;
-                }
-                size_t end_quote = args_str.find('"', 1);
-                if (end_quote == std::string::npos)
-                {
-                    DbgPrint(_T("Error: Unmatched quote in path for load_plugin. Command: %hs"), cmd.c_str());
-                    continue;
-                }
-                path = args_str.substr(1, end_quote - 1);
+            Event e = m_blockNoteEvents[eventIndex++];
+            e.sampleOffset -= start;
+            plan.inEvents.addEvent(e);
+        }
+
+        m_sliceBase = slotBase;
+        m_sliceStart = start;
+        m_sliceSamples = end - start;
+        m_sliceSampleRate = block->sampleRate;
+        if (numStages > 1 && m_workers.WorkerCount() > 0)
+        {
+            for (size_t i = 0; i < numStages; ++i)
+                Stage(i).pending.store((int32_t)Stage(i).predecessors.size(), std::memory_order_relaxed);
+            m_workers.Run(&VstHost::GraphTask, this, 0, (uint32_t)numStages);
+        }
+        else
+        {
+            for (uint32_t node : m_graphOrder)
+                ExecuteNode(-1, node);
+        }
+        CollectOutputParameterChanges();
+        if (automation)
+            WriteOutputEvents(start);
+        m_samplePosition += end - start;
+        start = end;
+    }
 
-                std::stringstream ss(args_str.substr(end_quote + 1));
-                ss >> sr >> bs;
+    // オートメーションで動いた値を GUI に反映する (整列済みなので最後に書いた値が残る)
+    if (hasAutomation)
+    {
+        for (const auto &change : plan.blockChanges)
+            QueueProcessorParamUpdate(change.id, change.value);
+    }
+
+    ProcessPlan &last = Stage(m_graphSink).plan;
+    if (last.convertOutput)
+    {
+        for (size_t b = 0; b < last.outputOffsets.size(); ++b)
+        {
+            for (size_t c = 0; c < last.outputOffsets[b].size(); ++c)
+                ConvertFloatToDouble(last.outputScratch[b][c], (double *)(slotBase + last.outputOffsets[b][c]), numSamples);
+        }
+    }
+}
+// worker が -1 のときはオーディオスレッドから実行順どおりに呼ばれる
+void VstHost::ExecuteNode(int32 worker, uint32_t node)
+{
+    PluginInstance &inst = Stage(node);
+    if (node > 0)
+        inst.plan.inParamChanges.Clear();
+    if (inst.predecessors.size() > 1)
+        MixNodeInputs(inst, m_sliceStart, m_sliceSamples);
+    inst.plan.context.sampleRate = m_sliceSampleRate;
+    RunSlice(inst, m_sliceBase, m_sliceStart, m_sliceSamples);
+    if (worker < 0)
+        return;
+    // 最後に終わった前段が後続ノードを自分のキューに積む
+    for (uint32_t next : inst.successors)
+    {
+        if (Stage(next).pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            m_workers.Push(worker, next);
+    }
+}
+void VstHost::MixNodeInputs(PluginInstance &inst, int32 start, int32 numSamples)
+{
+    const size_t channelBytes = m_linkChannelBytes;
+    const bool is64 = m_processSampleSize == kSample64;
+    const size_t sampleBytes = is64 ? sizeof(double) : sizeof(float);
+    for (size_t k = 0; k < inst.inputChannels; ++k)
+    {
+        char *dst = inst.plan.inputBase + k * channelBytes + start * sampleBytes;
+        bool written = false;
+        for (uint32_t p : inst.predecessors)
+        {
+            const PluginInstance &source = Stage(p);
+            if (k >= source.outputChannels)
+                continue;
+            const char *src = source.plan.outputBase + k * channelBytes + start * sampleBytes;
+            if (!written)
+            {
+                memcpy(dst, src, numSamples * sampleBytes);
             }
-            catch (const std::exception &e)
+            else if (is64)
             {
-                DbgPrint(_T("Exception during argument parsing for load_plugin: %hs"), e.what());
-                continue;
+                for (int32 n = 0; n < numSamples; ++n)
+                    ((double *)dst)[n] += ((const double *)src)[n];
             }
-            if (!path.empty())
+            else
             {
-                DbgPrint(_T("Executing load_plugin: '%hs', SR: %f, BS: %d"), path.c_str(), sr, bs);
-                LoadPlugin(path, sr, bs);
+                for (int32 n = 0; n < numSamples; ++n)
+                    ((float *)dst)[n] += ((const float *)src)[n];
             }
+            written = true;
         }
-        else if (cmd.rfind("set_state ", 0) == 0)
+        if (!written)
+            memset(dst, 0, numSamples * sampleBytes);
+    }
+}
+void VstHost::RunSlice(PluginInstance &inst, char *slotBase, int32 start, int32 numSamples)
+{
+    ProcessPlan &plan = inst.plan;
+    plan.outParamChanges.Clear();
+    plan.outEvents.Clear();
+    BindSliceBuffers(plan, slotBase, start);
+    const bool inputSilent = UpdateInputSilence(plan, numSamples);
+    // パラメータ変更やイベントで音が出ることがあるので、無音の長さを数え直す
+    if (plan.inParamChanges.getParameterCount() != 0 || plan.inEvents.getEventCount() != 0)
+        plan.silentSamples = 0;
+    if (plan.bypassed && plan.silentSamples != 0)
+    {
+        ClearSliceOutputs(plan, numSamples);
+        return;
+    }
+    plan.data.numSamples = numSamples;
+    plan.context.projectTimeSamples = m_samplePosition;
+    plan.context.continousTimeSamples = m_samplePosition;
+    for (auto &bus : plan.outputs)
+        bus.silenceFlags = 0;
+    if (inst.processor->process(plan.data) != kResultOk)
+    {
+        DbgPrint(_T("ProcessAudioBlock: Error in process method."));
+    }
+    // 入力の無音がテールより長く続き、出力も消えていれば次のスライスから process() を呼ばない
+    const uint32 tail = inst.tailSamples.load(std::memory_order_relaxed);
+    plan.bypassed = plan.canBypass && inputSilent && tail != kInfiniteTail && plan.silentSamples >= (int64)tail && IsOutputSilent(plan, numSamples);
+}
+// 入力チャンネルを調べて silenceFlags を設定する。全チャンネルが無音なら true
+bool VstHost::UpdateInputSilence(ProcessPlan &plan, int32 numSamples)
+{
+    bool allSilent = true;
+    for (size_t b = 0; b < plan.inputOffsets.size(); ++b)
+    {
+        uint64 flags = 0;
+        for (size_t c = 0; c < plan.inputOffsets[b].size(); ++c)
         {
-            DbgPrint(_T("Warning: Obsolete 'set_state' command received. Use 'load_and_set_state' instead."));
-            if (m_plugProvider && m_plugProvider->getComponent() && m_plugProvider->getController())
-            {
-                std::string data = cmd.substr(10);
-                if (data.rfind("VST3_DUAL:", 0) == 0)
-                {
-                    auto state = base64_decode(data.substr(10));
-                    if (!state.empty())
-                    {
-                        MemoryStream stream(state.data(), state.size());
-                        int32 br;
-                        int64 cs = 0, ts = 0;
-                        stream.read(&cs, sizeof(cs), &br);
-                        if (cs > 0)
-                        {
-                            std::vector<BYTE> d(cs);
-                            stream.read(d.data(), (int32)cs, &br);
-                            MemoryStream s(d.data(), cs);
-                            m_plugProvider->getComponent()->setState(&s);
-                        }
-                        stream.read(&ts, sizeof(ts), &br);
-                        if (ts > 0)
-                        {
-                            std::vector<BYTE> d(ts);
-                            stream.read(d.data(), (int32)ts, &br);
-                            MemoryStream s(d.data(), ts);
-                            m_plugProvider->getController()->setState(&s);
-                        }
-                    }
-                }
-                restartComponent(kParamValuesChanged | kReloadComponent);
+            // 割り当てのないチャンネルは常に無音のバッファを指す
+            bool silent = plan.inputOffsets[b][c] < 0;
+            if (!silent)
+            {
+                if (plan.processSampleSize == kSample64)
+                    silent = IsSilentBuffer(plan.inputPtrs64[b][c], numSamples, 0.0);
+                else
+                    silent = IsSilentBuffer(plan.inputPtrs[b][c], numSamples, 0.0f);
             }
+            if (!silent)
+                allSilent = false;
+            else if (c < 64)
+                flags |= (uint64)1 << c;
         }
-        else if (cmd == "show_gui")
+        plan.inputs[b].silenceFlags = flags;
+    }
+    plan.silentSamples = allSilent ? plan.silentSamples + numSamples : 0;
+    return allSilent;
+}
+bool VstHost::IsOutputSilent(const ProcessPlan &plan, int32 numSamples)
+{
+    for (size_t b = 0; b < plan.outputOffsets.size(); ++b)
+    {
+        for (size_t c = 0; c < plan.outputOffsets[b].size(); ++c)
         {
-            ShowGui();
+            // プラグインが無音と申告したチャンネルは調べない
+            if (c < 64 && (plan.outputs[b].silenceFlags & ((uint64)1 << c)))
+                continue;
+            if (plan.processSampleSize == kSample64 ? !IsSilentBuffer(plan.outputPtrs64[b][c], numSamples, (double)BYPASS_SILENCE_LEVEL)
+                                                    : !IsSilentBuffer(plan.outputPtrs[b][c], numSamples, BYPASS_SILENCE_LEVEL))
+                return false;
         }
-        else if (cmd == "hide_gui")
+    }
+    return true;
+}
+void VstHost::ClearSliceOutputs(ProcessPlan &plan, int32 numSamples)
+{
+    for (size_t b = 0; b < plan.outputOffsets.size(); ++b)
+    {
+        for (size_t c = 0; c < plan.outputOffsets[b].size(); ++c)
         {
-            HideGui();
+            if (plan.processSampleSize == kSample64)
+                memset(plan.outputPtrs64[b][c], 0, numSamples * sizeof(double));
+            else
+                memset(plan.outputPtrs[b][c], 0, numSamples * sizeof(float));
         }
+        plan.outputs[b].silenceFlags = plan.outputs[b].numChannels >= 64 ? ~(uint64)0 : ((uint64)1 << plan.outputs[b].numChannels) - 1;
     }
 }
-bool VstHost::LoadPlugin(const std::string &path, double sampleRate, int32 blockSize)
+void VstHost::BindSliceBuffers(ProcessPlan &plan, char *slotBase, int32 start)
 {
-    DbgPrint(_T("LoadPlugin (Corrected): Loading plugin on main thread: %hs"), path.c_str());
-    ReleasePlugin(); // 以前のプラグインを安全に解放
-
-    std::string error;
-    m_module = Module::create(path, error);
-    if (!m_module)
+    // 割り当てのあるチャンネルは共有メモリか中継バッファを直接指す (変換が必要な場合を除きコピーなし)
+    char *inBase = plan.inputBase ? plan.inputBase : slotBase;
+    char *outBase = plan.outputBase ? plan.outputBase : slotBase;
+    for (size_t b = 0; b < plan.inputOffsets.size(); ++b)
     {
-        DbgPrint(_T("LoadPlugin (Corrected): Could not create Module. Error: %hs"), error.c_str());
-        return false;
+        for (size_t c = 0; c < plan.inputOffsets[b].size(); ++c)
+        {
+            int64_t offset = plan.inputOffsets[b][c];
+            if (plan.processSampleSize == kSample64)
+                plan.inputPtrs64[b][c] = (offset >= 0 ? (double *)(inBase + offset) : plan.silentInput.data()) + start;
+            else if (plan.convertInput)
+                plan.inputPtrs[b][c] = plan.inputScratch[b][c] + start;
+            else
+                plan.inputPtrs[b][c] = (offset >= 0 ? (float *)(inBase + offset) : (float *)plan.silentInput.data()) + start;
+        }
     }
-
-    auto factory = m_module->getFactory();
-    ClassInfo targetClass;
-    bool found = false;
-    for (auto &classInfo : factory.classInfos())
+    for (size_t b = 0; b < plan.outputOffsets.size(); ++b)
     {
-        if (classInfo.category() == "Audio Module Class" ||
-            classInfo.category() == "Instrument Module Class" ||
-            classInfo.category() == "MIDI Module Class")
+        for (size_t c = 0; c < plan.outputOffsets[b].size(); ++c)
         {
-            targetClass = classInfo;
-            found = true;
-            DbgPrint(_T("LoadPlugin: Found plugin class: %hs (Category: %hs)"),
-                     classInfo.name().c_str(), classInfo.category().c_str());
-            break;
+            int64_t offset = plan.outputOffsets[b][c];
+            if (plan.processSampleSize == kSample64)
+                plan.outputPtrs64[b][c] = (offset >= 0 ? (double *)(outBase + offset) : plan.discardOutput.data()) + start;
+            else if (plan.convertOutput)
+                plan.outputPtrs[b][c] = plan.outputScratch[b][c] + start;
+            else
+                plan.outputPtrs[b][c] = (offset >= 0 ? (float *)(outBase + offset) : (float *)plan.discardOutput.data()) + start;
         }
     }
-
-    if (!found)
+}
+void VstHost::CollectOutputParameterChanges()
+{
+    ProcessPlan &plan = m_plugin.plan;
+    int32 numParams = plan.outParamChanges.getParameterCount();
+    OutputParamEntry *entries = m_pOutputParams ? OutputParamEntries() : nullptr;
+    const int32 numEntries = entries ? (int32)m_pOutputParams->numEntries.load(std::memory_order_relaxed) : 0;
+    bool published = false;
+    for (int32 i = 0; i < numParams; ++i)
     {
-        DbgPrint(_T("LoadPlugin (Corrected): No compatible VST3 plugin class found."));
-        for (auto &classInfo : factory.classInfos())
+        IParamValueQueue *queue = plan.outParamChanges.getParameterData(i);
+        if (queue)
         {
-            DbgPrint(_T("  Available class: %hs (Category: %hs)"),
-                     classInfo.name().c_str(), classInfo.category().c_str());
+            ParamID paramId = queue->getParameterId();
+            int32 numPoints = queue->getPointCount();
+            if (numPoints > 0)
+            {
+                ParamValue value;
+                int32 sampleOffset;
+                if (queue->getPoint(numPoints - 1, sampleOffset, value) == kResultTrue)
+                {
+                    QueueProcessorParamUpdate(paramId, value);
+                    int32 index = m_processorParams.IndexOf(paramId);
+                    if (index >= 0 && index < numEntries)
+                    {
+                        OutputParamEntry &entry = entries[index];
+                        entry.sequence.fetch_add(1, std::memory_order_acq_rel); // 奇数: 書き換え中
+                        entry.value = value;
+                        entry.sequence.fetch_add(1, std::memory_order_release);
+                        published = true;
+                    }
+                }
+            }
         }
-        m_module.reset();
-        return false;
     }
-
-    m_plugProvider = new PlugProvider(factory, targetClass, true);
-    if (!m_plugProvider)
+    if (published)
+        m_pOutputParams->sequence.fetch_add(1, std::memory_order_release);
+}
+// パラメータ一覧が変わったときに、エントリの並び (ParamExchange の添字順) を書き直す
+void VstHost::PublishOutputParamIds()
+{
+    if (!m_pOutputParams)
+        return;
+    const std::vector<ParamID> &ids = m_processorParams.Ids();
+    const uint32_t count = (uint32_t)std::min<size_t>(ids.size(), m_pOutputParams->capacity);
+    OutputParamEntry *entries = OutputParamEntries();
+    m_pOutputParams->generation.fetch_add(1); // 奇数: 書き換え中
+    for (uint32_t i = 0; i < count; ++i)
     {
-        DbgPrint(_T("LoadPlugin (Corrected): PlugProvider creation failed."));
-        m_module.reset();
-        return false;
+        entries[i].paramId = ids[i];
+        entries[i].value = 0.0;
+        entries[i].sequence.store(0, std::memory_order_relaxed);
     }
-    m_component = m_plugProvider->getComponent();
-    m_controller = m_plugProvider->getController();
-    if (!m_component || !m_controller)
+    m_pOutputParams->numEntries.store(count, std::memory_order_relaxed);
+    m_pOutputParams->generation.fetch_add(1); // 偶数: 確定
+    if (count < ids.size())
     {
-        DbgPrint(_T("LoadPlugin (Corrected): Failed to get Component/Controller from PlugProvider."));
-        ReleasePlugin();
-        return false;
+        DbgPrint(_T("PublishOutputParamIds: %zu parameters, only the first %u are published."), ids.size(), count);
     }
-    m_controller->setComponentHandler(this);
-    if (targetClass.category() != "MIDI Module Class")
+}
+void VstHost::QueueProcessorParamUpdate(ParamID id, ParamValue value)
+{
+    m_processorParams.Set(id, value);
+}
+void VstHost::ShowGui()
+{
+    if (!m_plugin.plugProvider)
     {
-        if (m_component->queryInterface(IAudioProcessor::iid, (void **)&m_processor) != kResultOk || !m_processor)
-        {
-            DbgPrint(_T("LoadPlugin (Corrected): Failed to get IAudioProcessor."));
-            ReleasePlugin();
-            return false;
-        }
+        DbgPrint(_T("ShowGui: Plugin not loaded."));
+        return;
     }
-
-    // --- オーディオ処理のセットアップ ---
-    if (m_processor)
+    IEditController *controller = m_plugin.plugProvider->getController();
+    if (!controller)
     {
-        m_processor->setProcessing(false); // 念のため一旦停止
-
-        ProcessSetup setup{kRealtime, kSample32, (int32_t)blockSize, sampleRate};
-        if (m_processor->setupProcessing(setup) != kResultOk)
-        {
-            DbgPrint(_T("LoadPlugin (Corrected): setupProcessing failed."));
-            ReleasePlugin();
-            return false;
-        }
+        DbgPrint(_T("ShowGui: Controller not available."));
+        return;
     }
-    if (targetClass.category() != "MIDI Module Class")
+    if (m_hGuiWindow && IsWindow(m_hGuiWindow))
     {
-        int32 numIn = m_component->getBusCount(kAudio, kInput);
-        int32 numOut = m_component->getBusCount(kAudio, kOutput);
-        DbgPrint(_T("LoadPlugin: Audio buses - Input: %d, Output: %d"), numIn, numOut);
-        for (int32 i = 0; i < numIn; ++i)
-        {
-            m_component->activateBus(kAudio, kInput, i, true);
-        }
-        for (int32 i = 0; i < numOut; ++i)
-        {
-            m_component->activateBus(kAudio, kOutput, i, true);
-        }
+        ShowWindow(m_hGuiWindow, SW_SHOW);
+        SetForegroundWindow(m_hGuiWindow);
+        return;
     }
-
-    tresult result = m_component->setActive(true);
-    if (result != kResultOk)
+    m_plugView = owned(controller->createView(ViewType::kEditor));
+    if (!m_plugView)
     {
-        DbgPrint(_T("LoadPlugin (Corrected): setActive(true) failed. Result: 0x%X"), result);
-        ReleasePlugin();
-        return false;
+        DbgPrint(_T("ShowGui: Failed to create plug-in view."));
+        return;
+    }
+    ViewRect sz;
+    if (m_plugView->getSize(&sz) != kResultOk)
+    {
+        sz = {0, 0, 800, 600};
+    }
+    RECT wr = {0, 0, sz.right - sz.left, sz.bottom - sz.top};
+    AdjustWindowRectEx(&wr, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU, FALSE, WS_EX_APPWINDOW);
+    WNDCLASS wc = {};
+    wc.lpfnWndProc = VstHost::WndProc;
+    wc.hInstance = m_hInstance;
+    wc.lpszClassName = TEXT("VstHostGuiWindowClass");
+    RegisterClass(&wc);
+    m_hGuiWindow = CreateWindowEx(WS_EX_APPWINDOW, wc.lpszClassName, TEXT("VST3 Plugin"), WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU, CW_USEDEFAULT, CW_USEDEFAULT, wr.right - wr.left, wr.bottom - wr.top, NULL, NULL, m_hInstance, this);
+    if (!m_hGuiWindow)
+    {
+        m_plugView.reset();
+        return;
+    }
+    m_windowController = new WindowController(m_plugView, m_hGuiWindow);
+    m_windowController->connect();
+    if (m_plugView->attached(m_hGuiWindow, kPlatformTypeHWND) != kResultOk)
+    {
+        m_windowController->disconnect();
+        m_windowController->release();
+        m_windowController = nullptr;
+        DestroyWindow(m_hGuiWindow);
+        m_plugView.reset();
+        return;
+    }
+    ShowWindow(m_hGuiWindow, SW_SHOW);
+    UpdateWindow(m_hGuiWindow);
+    m_windowController->resizeView(m_plugView, &sz);
+}
+void VstHost::HideGui()
+{
+    if (m_hGuiWindow)
+        DestroyWindow(m_hGuiWindow);
+}
+void VstHost::OnGuiClose()
+{
+    if (m_windowController)
+    {
+        m_windowController->disconnect();
+        m_windowController->release();
+        m_windowController = nullptr;
+    }
+    if (m_plugView)
+    {
+        m_plugView->removed();
+        m_plugView.reset();
+    }
+    m_hGuiWindow = NULL;
+}
+void VstHost::ProcessGuiUpdates()
+{
+    if (!m_plugin.controller || !m_hGuiWindow)
+    {
+        return;
     }
 
-    if (m_processor)
+    m_processorParams.Drain([this](ParamID id, ParamValue value)
+                            { m_plugin.controller->setParamNormalized(id, value); });
+}
+LRESULT CALLBACK VstHost::WndProc(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
+{
+    VstHost *h;
+    if (msg == WM_CREATE)
     {
-        result = m_processor->setProcessing(true);
-        if (result != kResultOk)
+        h = (VstHost *)((CREATESTRUCT *)lp)->lpCreateParams;
+        SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)h);
+    }
+    else
+    {
+        h = (VstHost *)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+    }
+    if (h)
+    {
+        if (msg == WM_DESTROY)
+        {
+            h->OnGuiClose();
+            SetWindowLongPtr(hWnd, GWLP_USERDATA, NULL);
+        }
+        else if (msg == WM_CLOSE)
         {
-            DbgPrint(_T("LoadPlugin (Corrected): setProcessing(true) failed. Result: 0x%X. Continuing..."), result);
+            return 0;
         }
     }
-
-    m_isPluginReady = true;
-
-    String128 name;
-    Steinberg::str8ToStr16(name, targetClass.name().c_str(), 128);
-    DbgPrint(_T("LoadPlugin (Corrected): Plugin loaded and setup: %s. Ready for processing."), (wchar_t *)name);
-    return true;
+    return DefWindowProc(hWnd, msg, wp, lp);
 }
-void VstHost::ReleasePlugin()
+bool VstHost::InitIPC()
 {
-    DbgPrint(_T("ReleasePlugin (Corrected): Releasing current plugin..."));
-    m_isPluginReady = false;
-    HideGui();
+    TCHAR p[MAX_PATH], s[MAX_PATH], er[MAX_PATH], ed[MAX_PATH];
+    _stprintf_s(p, _T("%s_%llu"), m_options.pipeNameBase.c_str(), m_uniqueId);
+    _stprintf_s(s, _T("%s_%llu"), m_options.shmNameBase.c_str(), m_uniqueId);
+    _stprintf_s(er, _T("%s_%llu"), m_options.eventClientReadyNameBase.c_str(), m_uniqueId);
+    _stprintf_s(ed, _T("%s_%llu"), m_options.eventHostDoneNameBase.c_str(), m_uniqueId);
+
+    DbgPrint(_T("InitIPC Pipe: %s"), p);
+    DbgPrint(_T("InitIPC Shm: %s"), s);
+    DbgPrint(_T("InitIPC Event Ready: %s"), er);
+    DbgPrint(_T("InitIPC Event Done: %s"), ed);
 
-    if (m_component)
+    // セッションのコマンドは SessionManager の制御パイプから届く
+    if (!m_sessionMode && !m_control.Listen(m_options.pipeNameBase + L"_" + std::to_wstring(m_uniqueId)))
+        return false;
+    std::wstring shmName = m_options.shmNameBase + L"_" + std::to_wstring(m_uniqueId);
+    m_slotCount = m_options.transport == TransportMode::Ring ? (uint32_t)m_options.ringSlots : 1;
+    if (m_options.layoutVersion >= 2)
     {
-        if (m_processor)
+        // 名前付きマッピングはクライアントが開いている間は作り直せないため、
+        // 容量だけ先に確保し、レイアウトはプラグインのロード時に決める
+        if (m_options.shmCapacity < LAYOUT_HEADER_BYTES || !m_shm.Create(shmName, m_options.shmCapacity))
+            return false;
+        m_pLayout = new (m_shm.data()) SharedLayoutHeader();
+        m_pLayout->magic = SHARED_LAYOUT_MAGIC;
+        m_pLayout->version = SHARED_LAYOUT_VERSION;
+        m_pLayout->headerBytes = (uint32_t)LAYOUT_HEADER_BYTES;
+        m_pLayout->totalBytes = m_shm.size();
+        m_pLayout->slotCount = m_slotCount;
+        m_pLayout->slotsOffset = (uint32_t)LAYOUT_HEADER_BYTES;
+        m_pLayout->head.store(0, std::memory_order_relaxed);
+        m_pLayout->tail.store(0, std::memory_order_relaxed);
+        m_pLayout->generation.store(0, std::memory_order_release);
+        m_pSlots = (char *)m_shm.data() + LAYOUT_HEADER_BYTES;
+        if (m_options.transport == TransportMode::Ring)
         {
-            m_processor->setProcessing(false);
+            m_pRingHead = &m_pLayout->head;
+            m_pRingTail = &m_pLayout->tail;
         }
-        m_component->setActive(false);
+        DbgPrint(_T("InitIPC Layout v2: capacity %zu bytes, %u slots"), m_shm.size(), m_slotCount);
+    }
+    else if (m_options.transport == TransportMode::Ring)
+    {
+        if (!m_shm.Create(shmName, RING_HEADER_BYTES + m_slotCount * RING_SLOT_BYTES))
+            return false;
+        m_pRing = new (m_shm.data()) AudioRingHeader();
+        m_pRing->magic = AUDIO_RING_MAGIC;
+        m_pRing->slotCount = m_slotCount;
+        m_pRing->slotBytes = (uint32_t)RING_SLOT_BYTES;
+        m_pRing->head.store(0, std::memory_order_relaxed);
+        m_pRing->tail.store(0, std::memory_order_release);
+        m_pSlots = (char *)m_shm.data() + RING_HEADER_BYTES;
+        m_slotBytes = RING_SLOT_BYTES;
+        m_pRingHead = &m_pRing->head;
+        m_pRingTail = &m_pRing->tail;
+        DbgPrint(_T("InitIPC Ring: %u slots x %u bytes"), m_slotCount, (uint32_t)RING_SLOT_BYTES);
     }
-    if (m_processor)
+    else
     {
-        m_processor->release();
-        m_processor = nullptr;
+        if (!m_shm.Create(shmName, SHARED_MEM_TOTAL_SIZE))
+            return false;
+        m_pSlots = (char *)m_shm.data();
+        m_slotBytes = SHARED_MEM_TOTAL_SIZE;
     }
-    m_component = nullptr;
-    m_controller = nullptr;
-    if (m_plugProvider)
+    if (m_options.wake == WakeMode::Spin)
     {
-        delete m_plugProvider;
-        m_plugProvider = nullptr;
+        if (!m_wakeShm.Create(shmName + L"_wake", WAKE_SYNC_BYTES))
+            return false;
+        m_pWake = new (m_wakeShm.data()) WakeSyncBlock();
+        m_pWake->magic = WAKE_SYNC_MAGIC;
+        m_pWake->spinMicros = (uint32_t)m_options.spinMicros;
+        m_pWake->clientSeq.store(0, std::memory_order_relaxed);
+        m_pWake->hostWaiting.store(0, std::memory_order_relaxed);
+        m_pWake->clientWaiting.store(0, std::memory_order_relaxed);
+        m_pWake->hostSeq.store(0, std::memory_order_release);
+        DbgPrint(_T("InitIPC Wake: spin %d us"), m_options.spinMicros);
     }
-    m_module.reset();
-    DbgPrint(_T("ReleasePlugin (Corrected): Plugin released."));
+    if (!m_automationShm.Create(shmName + L"_automation", AUTOMATION_HEADER_BYTES + m_slotCount * AUTOMATION_BLOCK_BYTES))
+        return false;
+    m_pAutomation = new (m_automationShm.data()) AutomationHeader();
+    m_pAutomation->magic = AUTOMATION_MAGIC;
+    m_pAutomation->slotCount = m_slotCount;
+    m_pAutomation->maxPoints = MAX_AUTOMATION_POINTS;
+    m_pAutomation->blockBytes = (uint32_t)AUTOMATION_BLOCK_BYTES;
+    for (uint32_t i = 0; i < m_slotCount; ++i)
+        GetAutomation(i)->numPoints = 0;
+    if (!m_outputParamShm.Create(shmName + L"_params", OUTPUT_PARAM_HEADER_BYTES + MAX_OUTPUT_PARAMS * sizeof(OutputParamEntry)))
+        return false;
+    m_pOutputParams = new (m_outputParamShm.data()) OutputParamHeader();
+    m_pOutputParams->magic = OUTPUT_PARAM_MAGIC;
+    m_pOutputParams->capacity = MAX_OUTPUT_PARAMS;
+    m_pOutputParams->numEntries.store(0, std::memory_order_relaxed);
+    m_pOutputParams->sequence.store(0, std::memory_order_relaxed);
+    m_pOutputParams->generation.store(0, std::memory_order_release);
+    if (!m_eventShm.Create(shmName + L"_events", EVENT_RING_HEADER_BYTES + 2 * EVENT_RING_CAPACITY * sizeof(SharedEvent)))
+        return false;
+    m_pEvents = new (m_eventShm.data()) EventRingHeader();
+    m_pEvents->magic = EVENT_RING_MAGIC;
+    m_pEvents->capacity = EVENT_RING_CAPACITY;
+    m_pEvents->inputHead.store(0, std::memory_order_relaxed);
+    m_pEvents->inputTail.store(0, std::memory_order_relaxed);
+    m_pEvents->outputHead.store(0, std::memory_order_relaxed);
+    m_pEvents->outputTail.store(0, std::memory_order_release);
+    m_eventBlockIndex = 0;
+    if (!m_statsShm.Create(shmName + L"_stats", STATS_PAGE_BYTES))
+        return false;
+    memset(m_statsShm.data(), 0, STATS_PAGE_BYTES);
+    m_pStats = new (m_statsShm.data()) StatsPage();
+    m_pStats->magic = STATS_MAGIC;
+    m_pStats->bucketCount = STATS_BUCKETS;
+    m_pStats->subBucketBits = STATS_SUB_BUCKET_BITS;
+    m_stateArena.SetName(shmName + L"_state");
+    PrepareSharedMemory();
+    m_hEventClientReady = CreateEvent(NULL, TRUE, FALSE, er);
+    m_hEventHostDone = CreateEvent(NULL, FALSE, FALSE, ed);
+    if (!m_hEventClientReady || !m_hEventHostDone)
+        return false;
+    return true;
 }
 
-void VstHost::ProcessAudioBlock()
+// 処理中にページフォールトが起きないよう、共有メモリを先に確保してロックする
+void VstHost::PrepareSharedMemory()
 {
-    if (!m_isPluginReady || !m_component || !m_pAudioData || m_pAudioData->numSamples <= 0)
-        return;
-    if (!m_processor)
+    SharedMemoryRegion *regions[] = {&m_shm, &m_wakeShm, &m_automationShm, &m_outputParamShm, &m_eventShm, &m_statsShm};
+    for (SharedMemoryRegion *region : regions)
     {
-        DbgPrint(_T("ProcessAudioBlock: Skipping audio processing (no processor available)."));
-        return;
+        if (!region->data())
+            continue;
+        if (m_options.prefault)
+            RealtimeStatus::Record(g_realtimeStatus.prefault, region->Prefault());
+        if (m_options.lockMemory)
+            RealtimeStatus::Record(g_realtimeStatus.memoryLock, region->Lock());
     }
+}
+
+// --- マルチセッション (-sessions) ---
+// 1 つのプロセスで複数のセッション (共有メモリ・イベント・プラグイン・状態の組) を扱う。
+// 制御パイプは 1 本で、セッションのオーディオ処理は固定数のワーカーが分担する。
+const size_t MAX_SESSIONS_PER_WORKER = MAXIMUM_WAIT_OBJECTS - 1;
+class SessionManager : public ControlHandler
+{
+public:
+    SessionManager(HINSTANCE hInstance, const HostOptions &options) : m_hInstance(hInstance), m_options(options), m_running(false) {}
+    ~SessionManager() { Cleanup(); }
+    bool Initialize();
+    void RunMessageLoop();
+    void Cleanup();
 
-    ParameterChanges inParamChanges;
-    ParameterChanges outParamChanges;
+private:
+    struct AudioWorker
     {
-        std::lock_guard<std::mutex> lock(m_paramMutex);
-        if (!m_pendingParamChanges.empty())
+        SessionManager *owner = nullptr;
+        int32_t index = 0;
+        HANDLE hThread = NULL;
+        HANDLE hChanged = NULL;
+        std::vector<VstHost *> sessions;
+        uint32_t version = 0, ackVersion = 0;
+    };
+    static DWORD WINAPI PipeThreadProc(LPVOID p)
+    {
+        HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+        if (SUCCEEDED(hr))
         {
-            IParamValueQueue *paramQueue;
-            int32 numPoints = 1;
-            for (const auto &change : m_pendingParamChanges)
-            {
-                paramQueue = inParamChanges.addParameterData(change.first, numPoints);
-                if (paramQueue)
-                {
-                    int32 pointIndex;
-                    paramQueue->addPoint(0, change.second, pointIndex);
-                }
-            }
-            m_pendingParamChanges.clear();
+            ((SessionManager *)p)->HandlePipeCommands();
+            CoUninitialize();
         }
+        return 0;
     }
-    ProcessData data = {};
-    data.numSamples = m_pAudioData->numSamples;
-    data.symbolicSampleSize = kSample32;
-
-    data.inputParameterChanges = &inParamChanges;
-    data.outputParameterChanges = &outParamChanges;
-    ProcessContext processContext = {};
-    processContext.state = ProcessContext::StatesAndFlags::kPlaying;
-    processContext.sampleRate = m_pAudioData->sampleRate;
-    data.processContext = &processContext;
-    float *pSharedAudio = (float *)((char *)m_pSharedMem + sizeof(AudioSharedData));
-
-    std::vector<AudioBusBuffers> inBuf, outBuf;
-    std::vector<std::vector<float *>> inPtrs, outPtrs;
-
-    int32 numIn = m_component->getBusCount(kAudio, kInput);
-    int32 numOut = m_component->getBusCount(kAudio, kOutput);
-    data.numInputs = numIn;
-    data.numOutputs = numOut;
-
-    if (numIn > 0)
-    {
-        inBuf.resize(numIn);
-        inPtrs.resize(numIn);
-        for (int32 i = 0; i < numIn; ++i)
-        {
-            BusInfo bi;
-            m_component->getBusInfo(kAudio, kInput, i, bi);
-            inBuf[i].numChannels = bi.channelCount;
-            inPtrs[i].resize(bi.channelCount, nullptr);
-            if (i == 0)
-            {
-                if (bi.channelCount > 0)
-                    inPtrs[i][0] = pSharedAudio;
-                if (bi.channelCount > 1)
-                    inPtrs[i][1] = pSharedAudio + MAX_BLOCK_SIZE;
-            }
-            inBuf[i].channelBuffers32 = inPtrs[i].data();
-        }
-        data.inputs = inBuf.data();
+    static DWORD WINAPI WorkerThreadProc(LPVOID p)
+    {
+        AudioWorker *worker = (AudioWorker *)p;
+        worker->owner->WorkerLoop(*worker);
+        return 0;
     }
+    static LRESULT CALLBACK MsgWndProc(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp);
+    void HandlePipeCommands() { m_control.Run(m_running, m_completions, *this); }
+    bool OnControlMessage(ControlConnection &conn, const std::string &message) override;
+    std::string ProcessCommand(const std::string &full_cmd, uint64_t connection);
+    void ProcessSyncCommand();
+    std::string CreateSession(uint64_t id);
+    std::string DestroySession(uint64_t id);
+    void DetachFromWorker(VstHost *session);
+    void WorkerLoop(AudioWorker &worker);
+    HINSTANCE m_hInstance;
+    HostOptions m_options;
+    std::atomic<bool> m_running;
+    HANDLE m_hPipeThread = NULL;
+    ControlServer m_control;
+    CompletionQueue m_completions;
+    HWND m_hMsgWindow = NULL;
+    std::vector<std::unique_ptr<AudioWorker>> m_workers;
+    std::mutex m_workerMutex;
+    std::condition_variable m_workerCv;
+    std::mutex m_sessionsMutex;
+    std::map<uint64_t, VstHost *> m_sessions;
+    // メインスレッドで実行する create_session / destroy_session (接続, コマンド)
+    std::mutex m_syncMutex;
+    std::vector<std::pair<uint64_t, std::string>> m_syncCommands;
+};
+bool SessionManager::Initialize()
+{
+    TCHAR p[MAX_PATH];
+    _stprintf_s(p, _T("%s_%llu"), m_options.pipeNameBase.c_str(), m_options.uniqueId);
+    DbgPrint(_T("SessionManager Pipe: %s, audio workers: %d"), p, m_options.audioWorkers);
+    m_running = true;
+    if (!m_control.Listen(m_options.pipeNameBase + L"_" + std::to_wstring(m_options.uniqueId)))
+        return false;
+
+    WNDCLASS wc = {};
+    wc.lpfnWndProc = SessionManager::MsgWndProc;
+    wc.hInstance = m_hInstance;
+    wc.lpszClassName = TEXT("VstSessionManagerWindowClass");
+    RegisterClass(&wc);
+    m_hMsgWindow = CreateWindow(wc.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, m_hInstance, this);
+    if (!m_hMsgWindow)
+        return false;
+    // -preload のインスタンスはメッセージループで 1 つずつ作る
+    PostMessage(m_hMsgWindow, WM_APP, 0, 0);
 
-    if (numOut > 0)
+    for (int32_t i = 0; i < m_options.audioWorkers; ++i)
     {
-        outBuf.resize(numOut);
-        outPtrs.resize(numOut);
-        for (int32 i = 0; i < numOut; ++i)
+        std::unique_ptr<AudioWorker> worker(new AudioWorker());
+        worker->owner = this;
+        worker->index = i;
+        worker->hChanged = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (!worker->hChanged)
+            return false;
+        worker->hThread = CreateThread(NULL, 0, WorkerThreadProc, worker.get(), 0, NULL);
+        if (!worker->hThread)
         {
-            BusInfo bi;
-            m_component->getBusInfo(kAudio, kOutput, i, bi);
-            outBuf[i].numChannels = bi.channelCount;
-            outPtrs[i].resize(bi.channelCount, nullptr);
-            if (i == 0)
-            {
-                if (bi.channelCount > 0)
-                    outPtrs[i][0] = pSharedAudio + 2 * MAX_BLOCK_SIZE;
-                if (bi.channelCount > 1)
-                    outPtrs[i][1] = pSharedAudio + 3 * MAX_BLOCK_SIZE;
-            }
-            outBuf[i].channelBuffers32 = outPtrs[i].data();
+            CloseHandle(worker->hChanged);
+            return false;
         }
-        data.outputs = outBuf.data();
+        SetThreadPriority(worker->hThread, THREAD_PRIORITY_TIME_CRITICAL);
+        m_workers.push_back(std::move(worker));
+    }
+    m_hPipeThread = CreateThread(NULL, 0, PipeThreadProc, this, 0, NULL);
+    return m_hPipeThread != NULL;
+}
+void SessionManager::RunMessageLoop()
+{
+    MSG msg;
+    while (m_running && GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+}
+void SessionManager::Cleanup()
+{
+    if (!m_running.exchange(false) && m_workers.empty() && m_sessions.empty() && !m_hMsgWindow)
+        return;
+    if (m_hPipeThread)
+    {
+        WaitForSingleObject(m_hPipeThread, 2000);
+        CloseHandle(m_hPipeThread);
+        m_hPipeThread = NULL;
     }
-    if (m_processor)
+    m_control.Close();
+    // ワーカーを止めてからセッションを片付ける
+    m_workerCv.notify_all();
+    for (auto &worker : m_workers)
     {
-        if (m_processor->process(data) != kResultOk)
-        {
-            DbgPrint(_T("ProcessAudioBlock: Error in process method."));
-        }
+        SetEvent(worker->hChanged);
+        WaitForSingleObject(worker->hThread, 2000);
+        CloseHandle(worker->hThread);
+        CloseHandle(worker->hChanged);
+    }
+    m_workers.clear();
+    for (auto &entry : m_sessions)
+    {
+        entry.second->Cleanup();
+        entry.second->release();
     }
+    m_sessions.clear();
+    g_warmPool.Clear();
+    if (m_hMsgWindow)
+    {
+        DestroyWindow(m_hMsgWindow);
+        m_hMsgWindow = NULL;
+    }
+}
+bool SessionManager::OnControlMessage(ControlConnection &conn, const std::string &message)
+{
+    std::string cmd(message.c_str());
+    // 空の応答は後から完了通知で届く
+    std::string response = ProcessCommand(cmd, conn.id);
+    if (response.empty())
+        conn.AwaitReply();
     else
+        conn.Send(std::move(response));
+    return cmd.rfind("exit", 0) != 0;
+}
+std::string SessionManager::ProcessCommand(const std::string &full_cmd, uint64_t connection)
+{
+    std::string cmd = full_cmd;
+    while (!cmd.empty() && isspace((unsigned char)cmd.back()))
+        cmd.pop_back();
+    if (cmd == "exit")
     {
-        DbgPrint(_T("ProcessAudioBlock: Skipping process call (no processor available)."));
+        m_running = false;
+        if (m_hMsgWindow)
+            PostMessage(m_hMsgWindow, WM_QUIT, 0, 0);
+        return "OK: Exit requested.\n";
     }
-
-    int32 numParams = outParamChanges.getParameterCount();
-    for (int32 i = 0; i < numParams; ++i)
+    if (cmd == "rt_status")
+        return "OK " + g_realtimeStatus.ToString() + "\n";
+    if (cmd == "list_sessions")
     {
-        IParamValueQueue *queue = outParamChanges.getParameterData(i);
-        if (queue)
+        std::string result = "OK";
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        for (const auto &entry : m_sessions)
+            result += " " + std::to_string(entry.first);
+        return result + "\n";
+    }
+    if (cmd.rfind("session ", 0) == 0)
+    {
+        // "session <id> <command>" をそのセッションのコマンドとして処理する
+        std::stringstream ss(cmd.substr(8));
+        uint64_t id = 0;
+        std::string rest;
+        if (!(ss >> id))
+            return "FAIL InvalidId\n";
+        std::getline(ss, rest);
+        size_t first = rest.find_first_not_of(' ');
+        rest = first == std::string::npos ? std::string() : rest.substr(first);
+        if (rest == "exit")
+            return "FAIL UseDestroySession\n";
+        VstHost *session = nullptr;
         {
-            ParamID paramId = queue->getParameterId();
-            int32 numPoints = queue->getPointCount();
-            if (numPoints > 0)
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            auto it = m_sessions.find(id);
+            if (it != m_sessions.end())
             {
-                ParamValue value;
-                int32 sampleOffset;
-                if (queue->getPoint(numPoints - 1, sampleOffset, value) == kResultTrue)
-                {
-                    std::lock_guard<std::mutex> lock(m_processorUpdateMutex);
-                    bool found = false;
-                    for (auto &update : m_processorParamUpdates)
-                    {
-                        if (update.first == paramId)
-                        {
-                            update.second = value;
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (!found)
-                    {
-                        m_processorParamUpdates.emplace_back(paramId, value);
-                    }
-                }
+                session = it->second;
+                session->addRef();
             }
         }
+        if (!session)
+            return "FAIL NoSession\n";
+        std::string response = session->ExecuteCommand(rest + "\n", connection);
+        session->release();
+        return response;
+    }
+    if (cmd.rfind("create_session ", 0) == 0 || cmd.rfind("destroy_session ", 0) == 0)
+    {
+        // ウィンドウの作成とプラグインの解放はメインスレッドで行い、終わったら応答を送る
+        {
+            std::lock_guard<std::mutex> lock(m_syncMutex);
+            m_syncCommands.push_back(std::make_pair(connection, cmd));
+        }
+        if (m_hMsgWindow)
+            PostMessage(m_hMsgWindow, WM_APP, 0, 0);
+        return std::string();
     }
+    return "FAIL UnknownCommand\n";
 }
-void VstHost::ShowGui()
+void SessionManager::ProcessSyncCommand()
 {
-    if (!m_plugProvider)
+    std::vector<std::pair<uint64_t, std::string>> commands;
     {
-        DbgPrint(_T("ShowGui: Plugin not loaded."));
-        return;
+        std::lock_guard<std::mutex> lock(m_syncMutex);
+        commands.swap(m_syncCommands);
     }
-    IEditController *controller = m_plugProvider->getController();
-    if (!controller)
+    for (const auto &command : commands)
     {
-        DbgPrint(_T("ShowGui: Controller not available."));
-        return;
+        std::stringstream ss(command.second);
+        std::string verb;
+        uint64_t id = 0;
+        ss >> verb;
+        std::vector<std::string> response(1);
+        if (!(ss >> id))
+            response[0] = "FAIL InvalidId\n";
+        else if (verb == "create_session")
+            response[0] = CreateSession(id);
+        else
+            response[0] = DestroySession(id);
+        m_completions.Post(command.first, std::move(response), true);
     }
-    if (m_hGuiWindow && IsWindow(m_hGuiWindow))
+}
+std::string SessionManager::CreateSession(uint64_t id)
+{
     {
-        ShowWindow(m_hGuiWindow, SW_SHOW);
-        SetForegroundWindow(m_hGuiWindow);
-        return;
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        if (m_sessions.count(id))
+            return "FAIL SessionExists\n";
     }
-    m_plugView = owned(controller->createView(ViewType::kEditor));
-    if (!m_plugView)
+    // 空きのあるワーカーのうち、担当セッションが最も少ないものに割り当てる
+    AudioWorker *target = nullptr;
     {
-        DbgPrint(_T("ShowGui: Failed to create plug-in view."));
-        return;
+        std::lock_guard<std::mutex> lock(m_workerMutex);
+        for (auto &worker : m_workers)
+        {
+            if (worker->sessions.size() < MAX_SESSIONS_PER_WORKER && (!target || worker->sessions.size() < target->sessions.size()))
+                target = worker.get();
+        }
     }
-    ViewRect sz;
-    if (m_plugView->getSize(&sz) != kResultOk)
+    if (!target)
+        return "FAIL NoCapacity\n";
+
+    // セッションは共有のワーカーで処理するので、スピン待機とグラフ用ワーカーは使わない
+    HostOptions options = m_options;
+    options.uniqueId = id;
+    options.wake = WakeMode::Event;
+    options.graphWorkers = 0;
+    VstHost *session = new VstHost(m_hInstance, options);
+    session->SetCompletionQueue(&m_completions);
+    if (!session->InitSession())
     {
-        sz = {0, 0, 800, 600};
+        DbgPrint(_T("CreateSession: Failed to initialize session %llu."), id);
+        session->release();
+        return "FAIL InitFailed\n";
     }
-    RECT wr = {0, 0, sz.right - sz.left, sz.bottom - sz.top};
-    AdjustWindowRectEx(&wr, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU, FALSE, WS_EX_APPWINDOW);
-    WNDCLASS wc = {};
-    wc.lpfnWndProc = VstHost::WndProc;
-    wc.hInstance = m_hInstance;
-    wc.lpszClassName = TEXT("VstHostGuiWindowClass");
-    RegisterClass(&wc);
-    m_hGuiWindow = CreateWindowEx(WS_EX_APPWINDOW, wc.lpszClassName, TEXT("VST3 Plugin"), WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU, CW_USEDEFAULT, CW_USEDEFAULT, wr.right - wr.left, wr.bottom - wr.top, NULL, NULL, m_hInstance, this);
-    if (!m_hGuiWindow)
     {
-        m_plugView.reset();
-        return;
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        m_sessions[id] = session;
     }
-    m_windowController = new WindowController(m_plugView, m_hGuiWindow);
-    m_windowController->connect();
-    if (m_plugView->attached(m_hGuiWindow, kPlatformTypeHWND) != kResultOk)
     {
-        m_windowController->disconnect();
-        m_windowController->release();
-        m_windowController = nullptr;
-        DestroyWindow(m_hGuiWindow);
-        m_plugView.reset();
-        return;
+        std::lock_guard<std::mutex> lock(m_workerMutex);
+        target->sessions.push_back(session);
+        ++target->version;
     }
-    ShowWindow(m_hGuiWindow, SW_SHOW);
-    UpdateWindow(m_hGuiWindow);
-    m_windowController->resizeView(m_plugView, &sz);
-}
-void VstHost::HideGui()
-{
-    if (m_hGuiWindow)
-        DestroyWindow(m_hGuiWindow);
+    SetEvent(target->hChanged);
+    DbgPrint(_T("CreateSession: Session %llu created."), id);
+    return "OK\n";
 }
-void VstHost::OnGuiClose()
+std::string SessionManager::DestroySession(uint64_t id)
 {
-    if (m_windowController)
-    {
-        m_windowController->disconnect();
-        m_windowController->release();
-        m_windowController = nullptr;
-    }
-    if (m_plugView)
+    VstHost *session = nullptr;
     {
-        m_plugView->removed();
-        m_plugView.reset();
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        auto it = m_sessions.find(id);
+        if (it == m_sessions.end())
+            return "FAIL NoSession\n";
+        session = it->second;
+        m_sessions.erase(it);
     }
-    m_hGuiWindow = NULL;
+    DetachFromWorker(session);
+    session->Cleanup();
+    session->release();
+    DbgPrint(_T("DestroySession: Session %llu destroyed."), id);
+    return "OK\n";
 }
-void VstHost::ProcessGuiUpdates()
+void SessionManager::DetachFromWorker(VstHost *session)
 {
-    if (!m_controller || !m_hGuiWindow)
+    // ワーカーが新しい一覧を読み込んだ (= もうこのセッションに触れない) ことを確認してから戻る
+    std::unique_lock<std::mutex> lock(m_workerMutex);
+    for (auto &worker : m_workers)
     {
+        auto it = std::find(worker->sessions.begin(), worker->sessions.end(), session);
+        if (it == worker->sessions.end())
+            continue;
+        worker->sessions.erase(it);
+        uint32_t version = ++worker->version;
+        AudioWorker *w = worker.get();
+        SetEvent(w->hChanged);
+        m_workerCv.wait(lock, [this, w, version]
+                        { return w->ackVersion == version || !m_running; });
         return;
     }
-
-    std::vector<std::pair<ParamID, ParamValue>> updatesToProcess;
+}
+void SessionManager::WorkerLoop(AudioWorker &worker)
+{
+    ApplyRealtimeThreadSettings(m_options, worker.index);
+    std::vector<VstHost *> sessions;
+    std::vector<HANDLE> handles;
+    sessions.reserve(MAX_SESSIONS_PER_WORKER);
+    handles.reserve(MAX_SESSIONS_PER_WORKER + 1);
+    uint32_t seen = 0;
+    handles.push_back(worker.hChanged);
+    while (m_running)
     {
-        std::lock_guard<std::mutex> lock(m_processorUpdateMutex);
-        if (m_processorParamUpdates.empty())
         {
-            return;
+            std::lock_guard<std::mutex> lock(m_workerMutex);
+            if (worker.version != seen)
+            {
+                sessions = worker.sessions;
+                handles.resize(1);
+                for (VstHost *session : sessions)
+                    handles.push_back(session->ClientReadyEvent());
+                seen = worker.version;
+                worker.ackVersion = seen;
+                m_workerCv.notify_all();
+            }
+        }
+        DWORD result = WaitForMultipleObjects((DWORD)handles.size(), handles.data(), FALSE, 1000);
+        if (result == WAIT_TIMEOUT || result == WAIT_FAILED || result == WAIT_OBJECT_0)
+            continue;
+        // 若い番号のセッションだけが優先されないよう、起きたら全セッションの状態を見て順に処理する
+        for (size_t i = 0; i < sessions.size(); ++i)
+        {
+            if (WaitForSingleObject(handles[i + 1], 0) == WAIT_OBJECT_0)
+                sessions[i]->ServiceAudio();
         }
-        updatesToProcess.swap(m_processorParamUpdates);
-    }
-    for (const auto &update : updatesToProcess)
-    {
-        m_controller->setParamNormalized(update.first, update.second);
     }
 }
-LRESULT CALLBACK VstHost::WndProc(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
+LRESULT CALLBACK SessionManager::MsgWndProc(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
 {
-    VstHost *h;
+    SessionManager *m;
     if (msg == WM_CREATE)
     {
-        h = (VstHost *)((CREATESTRUCT *)lp)->lpCreateParams;
-        SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)h);
+        m = (SessionManager *)((CREATESTRUCT *)lp)->lpCreateParams;
+        SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)m);
     }
     else
     {
-        h = (VstHost *)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+        m = (SessionManager *)GetWindowLongPtr(hWnd, GWLP_USERDATA);
     }
-    if (h)
+    if (m && msg == WM_APP)
     {
-        if (msg == WM_DESTROY)
-        {
-            h->OnGuiClose();
-            SetWindowLongPtr(hWnd, GWLP_USERDATA, NULL);
-        }
-        else if (msg == WM_CLOSE)
-        {
-            return 0;
-        }
+        m->ProcessSyncCommand();
+        if (g_warmPool.RefillOne())
+            PostMessage(hWnd, WM_APP, 0, 0);
+        return 0;
     }
     return DefWindowProc(hWnd, msg, wp, lp);
 }
-bool VstHost::InitIPC()
-{
-    TCHAR p[MAX_PATH], s[MAX_PATH], er[MAX_PATH], ed[MAX_PATH];
-    _stprintf_s(p, _T("%s_%llu"), m_pipeNameBase.c_str(), m_uniqueId);
-    _stprintf_s(s, _T("%s_%llu"), m_shmNameBase.c_str(), m_uniqueId);
-    _stprintf_s(er, _T("%s_%llu"), m_eventClientReadyNameBase.c_str(), m_uniqueId);
-    _stprintf_s(ed, _T("%s_%llu"), m_eventHostDoneNameBase.c_str(), m_uniqueId);
-
-    DbgPrint(_T("InitIPC Pipe: %s"), p);
-    DbgPrint(_T("InitIPC Shm: %s"), s);
-    DbgPrint(_T("InitIPC Event Ready: %s"), er);
-    DbgPrint(_T("InitIPC Event Done: %s"), ed);
-
-    m_hPipe = CreateNamedPipe(p, PIPE_ACCESS_DUPLEX, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES, MAX_STATE_DATA_LEN, MAX_STATE_DATA_LEN, 0, NULL);
-    if (m_hPipe == INVALID_HANDLE_VALUE)
-        return false;
-    m_hShm = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, SHARED_MEM_TOTAL_SIZE, s);
-    if (!m_hShm)
-        return false;
-    m_pSharedMem = MapViewOfFile(m_hShm, FILE_MAP_ALL_ACCESS, 0, 0, SHARED_MEM_TOTAL_SIZE);
-    if (!m_pSharedMem)
-        return false;
-    m_pAudioData = (AudioSharedData *)m_pSharedMem;
-    m_hEventClientReady = CreateEvent(NULL, TRUE, FALSE, er);
-    m_hEventHostDone = CreateEvent(NULL, FALSE, FALSE, ed);
-    if (!m_hEventClientReady || !m_hEventHostDone)
-        return false;
-    return true;
-}
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int)
 {
 #ifdef _DEBUG
@@ -1267,6 +7175,22 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int)
         MessageBox(NULL, L"Fatal Error: Failed to parse command line.", L"VstHost Error", MB_ICONERROR | MB_OK);
         return 1;
     }
+    // -scan_worker "<plugin>" "<output>": scan が起動する子プロセス。1 つのプラグインを調べて終了する
+    if (argc == 4 && std::wstring(argv[1]) == L"-scan_worker")
+    {
+        IPtr<HostApplication> hostContext = owned(new HostApplication());
+        PluginContextFactory::instance().setPluginContext(hostContext);
+        const int exitCode = RunScanWorker(WideToUtf8(argv[2]), WideToUtf8(argv[3]));
+        PluginContextFactory::instance().setPluginContext(nullptr);
+        LocalFree(argv);
+        CoUninitialize();
+#ifdef _DEBUG
+        if (c)
+            fclose(c);
+        FreeConsole();
+#endif
+        return exitCode;
+    }
     for (int i = 1; i < argc; ++i)
     {
         std::wstring arg = argv[i];
@@ -1296,6 +7220,62 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int)
                         << L"  -event_done <base_name>\n"
                         << L"    Sets the base name for the host-done event.\n"
                         << L"    Default: Local\\VstHostDone\n\n"
+                        << L"  -transport <event|ring>\n"
+                        << L"    Selects the audio transport. 'ring' maps a multi-block SPSC ring.\n"
+                        << L"    Default: event\n\n"
+                        << L"  -ring_slots <count>\n"
+                        << L"    Sets the number of blocks in the ring transport (1-256).\n"
+                        << L"    Default: 8\n\n"
+                        << L"  -layout <1|2>\n"
+                        << L"    Selects the shared memory layout. '2' is the self-describing multi-bus layout.\n"
+                        << L"    Default: 1\n\n"
+                        << L"  -shm_size <MiB>\n"
+                        << L"    Sets the shared memory capacity reserved for layout 2.\n"
+                        << L"    Default: 64\n\n"
+                        << L"  -sample64\n"
+                        << L"    Uses 64-bit (double) shared audio buffers. Requires -layout 2.\n\n"
+                        << L"  -block_capacity <samples>\n"
+                        << L"    Sets the per-block capacity of layout 2 when it should exceed block_size.\n"
+                        << L"    Larger client blocks are split before they reach the plugin.\n\n"
+                        << L"  -param_split <samples>\n"
+                        << L"    Splits blocks at parameter changes at least this far apart. 0 disables it.\n"
+                        << L"    Default: 32\n\n"
+                        << L"  -wake <event|spin>\n"
+                        << L"    'spin' spins on shared sequence counters before sleeping in the kernel.\n"
+                        << L"    Default: event\n\n"
+                        << L"  -spin_us <microseconds>\n"
+                        << L"    Sets how long '-wake spin' spins before it blocks.\n"
+                        << L"    Default: 50\n\n"
+                        << L"  -graph_workers <count>\n"
+                        << L"    Runs plugin graph branches in parallel on this many extra worker threads (0-32).\n"
+                        << L"    Default: 0\n\n"
+                        << L"  -sessions\n"
+                        << L"    Serves multiple sessions from this process. Sessions are created with\n"
+                        << L"    'create_session <id>' on the control pipe and use '<base_name>_<id>' IPC names.\n\n"
+                        << L"  -audio_workers <count>\n"
+                        << L"    Sets the number of threads that process session audio in '-sessions' mode.\n"
+                        << L"    Default: 2\n\n"
+                        << L"  -rt_priority <1-99>\n"
+                        << L"    Registers audio threads as MMCSS 'Pro Audio' tasks.\n"
+                        << L"    Default: 0 (unchanged)\n\n"
+                        << L"  -cpu_affinity <cpu[,cpu...]>\n"
+                        << L"    Pins the audio thread and workers to these CPUs, one per thread in order.\n\n"
+                        << L"  -mlock\n"
+                        << L"    Locks the shared memory so it cannot be paged out.\n\n"
+                        << L"  -prefault\n"
+                        << L"    Touches shared memory and audio thread stacks up front to avoid page faults.\n\n"
+                        << L"  -ftz\n"
+                        << L"    Flushes denormals to zero (FTZ/DAZ) on audio threads.\n"
+                        << L"    Use 'rt_status' on the pipe to see which settings were applied.\n\n"
+                        << L"  -preload <path>\n"
+                        << L"    Keeps initialized instances of this plugin ready so loading it is instant.\n"
+                        << L"    May be given more than once. Instances are created after startup.\n\n"
+                        << L"  -preload_count <count>\n"
+                        << L"    Sets how many instances -preload keeps ready per plugin (1-8).\n"
+                        << L"    Default: 1\n\n"
+                        << L"  -index <path>\n"
+                        << L"    Sets the plugin index file written by 'scan' and read by 'list_plugins' and 'load_cid'.\n"
+                        << L"    Default: VstHostPlugins.idx next to the executable\n\n"
                         << L"Example:\n"
                         << L"  VstHost.exe -uid 12345 -pipe \"\\\\.\\pipe\\MyVstPipe\"\n"
                         << L"VST is a trademark of Steinberg Media Technologies GmbH, "
@@ -1331,11 +7311,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int)
     }
 
     // デフォルト値
-    uint64_t uid = GetCurrentProcessId();
-    std::wstring pipeNameBase = TEXT("\\\\.\\pipe\\VstBridge");
-    std::wstring shmNameBase = TEXT("Local\\VstSharedAudio");
-    std::wstring eventClientReadyNameBase = TEXT("Local\\VstClientReady");
-    std::wstring eventHostDoneNameBase = TEXT("Local\\VstHostDone");
+    HostOptions options;
+    options.uniqueId = GetCurrentProcessId();
 
     // コマンドライン引数をループで解析
     for (int i = 1; i < argc; ++i)
@@ -1345,7 +7322,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int)
         {
             try
             {
-                uid = std::stoull(argv[++i]);
+                options.uniqueId = std::stoull(argv[++i]);
             }
             catch (const std::exception &e)
             {
@@ -1354,24 +7331,233 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int)
         }
         else if ((arg == L"-pipe") && i + 1 < argc)
         {
-            pipeNameBase = argv[++i];
+            options.pipeNameBase = argv[++i];
         }
         else if ((arg == L"-shm") && i + 1 < argc)
         {
-            shmNameBase = argv[++i];
+            options.shmNameBase = argv[++i];
         }
         else if ((arg == L"-event_ready") && i + 1 < argc)
         {
-            eventClientReadyNameBase = argv[++i];
+            options.eventClientReadyNameBase = argv[++i];
         }
         else if ((arg == L"-event_done") && i + 1 < argc)
         {
-            eventHostDoneNameBase = argv[++i];
+            options.eventHostDoneNameBase = argv[++i];
+        }
+        else if ((arg == L"-transport") && i + 1 < argc)
+        {
+            std::wstring mode = argv[++i];
+            if (mode == L"ring")
+                options.transport = TransportMode::Ring;
+            else if (mode == L"event")
+                options.transport = TransportMode::Event;
+            else
+            {
+                DbgPrint(_T("Unknown transport '%ls'. Using 'event'."), mode.c_str());
+            }
+        }
+        else if ((arg == L"-ring_slots") && i + 1 < argc)
+        {
+            try
+            {
+                int slots = std::stoi(argv[++i]);
+                if (slots < 1)
+                    slots = 1;
+                if (slots > MAX_RING_SLOTS)
+                    slots = MAX_RING_SLOTS;
+                options.ringSlots = slots;
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse ring slot count from '%ls'. Error: %hs"), argv[i], e.what());
+            }
+        }
+        else if ((arg == L"-wake") && i + 1 < argc)
+        {
+            std::wstring mode = argv[++i];
+            if (mode == L"spin")
+                options.wake = WakeMode::Spin;
+            else if (mode == L"event")
+                options.wake = WakeMode::Event;
+            else
+            {
+                DbgPrint(_T("Unknown wake mode '%ls'. Using 'event'."), mode.c_str());
+            }
+        }
+        else if ((arg == L"-spin_us") && i + 1 < argc)
+        {
+            try
+            {
+                int micros = std::stoi(argv[++i]);
+                options.spinMicros = micros < 0 ? 0 : micros;
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse spin duration from '%ls'. Error: %hs"), argv[i], e.what());
+            }
+        }
+        else if ((arg == L"-graph_workers") && i + 1 < argc)
+        {
+            try
+            {
+                int workers = std::stoi(argv[++i]);
+                if (workers < 0)
+                    workers = 0;
+                if (workers > MAX_GRAPH_WORKERS)
+                    workers = MAX_GRAPH_WORKERS;
+                options.graphWorkers = workers;
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse graph worker count from '%ls'. Error: %hs"), argv[i], e.what());
+            }
+        }
+        else if (arg == L"-sessions")
+        {
+            options.sessions = true;
+        }
+        else if ((arg == L"-audio_workers") && i + 1 < argc)
+        {
+            try
+            {
+                int workers = std::stoi(argv[++i]);
+                options.audioWorkers = workers < 1 ? 1 : workers;
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse audio worker count from '%ls'. Error: %hs"), argv[i], e.what());
+            }
+        }
+        else if ((arg == L"-rt_priority") && i + 1 < argc)
+        {
+            try
+            {
+                int priority = std::stoi(argv[++i]);
+                options.rtPriority = priority < 0 ? 0 : (priority > 99 ? 99 : priority);
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse realtime priority from '%ls'. Error: %hs"), argv[i], e.what());
+            }
+        }
+        else if ((arg == L"-cpu_affinity") && i + 1 < argc)
+        {
+            // カンマ区切りの CPU 番号 (例: 2,3)
+            std::wstringstream ss(argv[++i]);
+            std::wstring item;
+            options.cpuAffinity.clear();
+            while (std::getline(ss, item, L','))
+            {
+                try
+                {
+                    int cpu = std::stoi(item);
+                    if (cpu >= 0)
+                        options.cpuAffinity.push_back(cpu);
+                }
+                catch (const std::exception &e)
+                {
+                    DbgPrint(_T("Failed to parse CPU number '%ls'. Error: %hs"), item.c_str(), e.what());
+                }
+            }
+        }
+        else if (arg == L"-mlock")
+        {
+            options.lockMemory = true;
+        }
+        else if (arg == L"-prefault")
+        {
+            options.prefault = true;
+        }
+        else if (arg == L"-ftz")
+        {
+            options.flushDenormals = true;
+        }
+        else if ((arg == L"-layout") && i + 1 < argc)
+        {
+            std::wstring layout = argv[++i];
+            options.layoutVersion = (layout == L"2") ? 2 : 1;
+        }
+        else if (arg == L"-sample64")
+        {
+            options.sample64 = true;
+        }
+        else if ((arg == L"-block_capacity" || arg == L"-param_split") && i + 1 < argc)
+        {
+            try
+            {
+                int value = std::stoi(argv[++i]);
+                if (value < 0)
+                    value = 0;
+                if (arg == L"-block_capacity")
+                    options.blockCapacity = value;
+                else
+                    options.paramSplitSamples = value;
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse %ls value from '%ls'. Error: %hs"), arg.c_str(), argv[i], e.what());
+            }
+        }
+        else if ((arg == L"-preload") && i + 1 < argc)
+        {
+            options.preloadPaths.push_back(WideToUtf8(argv[++i]));
+        }
+        else if ((arg == L"-index") && i + 1 < argc)
+        {
+            options.indexPath = WideToUtf8(argv[++i]);
+        }
+        else if ((arg == L"-preload_count") && i + 1 < argc)
+        {
+            try
+            {
+                int count = std::stoi(argv[++i]);
+                options.preloadCount = std::max(1, std::min(count, (int)MAX_WARM_INSTANCES));
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse preload count from '%ls'. Error: %hs"), argv[i], e.what());
+            }
+        }
+        else if ((arg == L"-shm_size") && i + 1 < argc)
+        {
+            try
+            {
+                unsigned long long mib = std::stoull(argv[++i]);
+                if (mib > 0)
+                    options.shmCapacity = (size_t)mib * 1024 * 1024;
+            }
+            catch (const std::exception &e)
+            {
+                DbgPrint(_T("Failed to parse shared memory size from '%ls'. Error: %hs"), argv[i], e.what());
+            }
         }
     }
 
     LocalFree(argv);
-    g_pVstHost = new VstHost(hInstance, uid, pipeNameBase, shmNameBase, eventClientReadyNameBase, eventHostDoneNameBase);
+    for (const auto &path : options.preloadPaths)
+        g_warmPool.SetTarget(nullptr, path, std::string(), options.preloadCount);
+    if (options.sessions)
+    {
+        // セッションごとの VstHost はプラグインのホストコンテキストにならないので、共通のものを用意する
+        IPtr<HostApplication> hostContext = owned(new HostApplication());
+        PluginContextFactory::instance().setPluginContext(hostContext);
+        SessionManager *manager = new SessionManager(hInstance, options);
+        if (manager->Initialize())
+        {
+            manager->RunMessageLoop();
+        }
+        delete manager;
+        PluginContextFactory::instance().setPluginContext(nullptr);
+        CoUninitialize();
+#ifdef _DEBUG
+        if (c)
+            fclose(c);
+        FreeConsole();
+#endif
+        return 0;
+    }
+    g_pVstHost = new VstHost(hInstance, options);
 
     PluginContextFactory::instance().setPluginContext(static_cast<IHostApplication *>(g_pVstHost));
     if (g_pVstHost->Initialize())
@@ -0,0 +1,272 @@
+﻿// 読み込みが終わった後のブロック処理でメモリを確保していないことを確かめる。
+// VSTHost.cpp をそのまま取り込んで同じプロセスで VstHost を動かし、operator new を数えるものに置き換える。
+// クライアント (このテストのメインスレッド) とホストのメインループのスレッドは数えず、
+// オーディオスレッド、グラフのワーカー、パイプのスレッドでの確保が 0 回であることを確かめる。
+// プラグインは support/TestPlugin.cpp のテスト用プラグインを使う (Windows で vst3sdk があるときだけビルドする)
+#define WinMain VstHostWinMain
+#include "../VSTHost.cpp"
+#include "support/HostClient.h"
+#include <malloc.h>
+#include <math.h>
+#include <new>
+
+#ifndef VSTHOST_TEST_PLUGIN_DIR
+#define VSTHOST_TEST_PLUGIN_DIR ""
+#endif
+
+// ctest で飛ばしたことにする終了コード
+const int SKIP_EXIT_CODE = 77;
+const int TEST_BLOCK_SIZE = 256;
+const double TEST_SAMPLE_RATE = 48000.0;
+const int WARMUP_BLOCKS = 200;
+const int MEASURED_BLOCKS = 2000;
+
+static int g_failures = 0;
+#define CHECK(condition, ...)                           \
+    do                                                  \
+    {                                                   \
+        if (!(condition))                               \
+        {                                               \
+            ++g_failures;                               \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+        }                                               \
+    } while (0)
+
+// --- 確保を数える operator new ---
+static std::atomic<uint64_t> g_allocations(0);     // すべてのスレッド
+static std::atomic<uint64_t> g_hostAllocations(0); // t_ignored を立てていないスレッド
+static thread_local bool t_ignored = false;
+static void CountAllocation()
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (!t_ignored)
+        g_hostAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+void *operator new(size_t size)
+{
+    CountAllocation();
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    CountAllocation();
+    return malloc(size ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return operator new(size, std::nothrow); }
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    CountAllocation();
+    if (void *p = _aligned_malloc(size ? size : 1, (size_t)alignment))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { _aligned_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { _aligned_free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { _aligned_free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { _aligned_free(p); }
+
+// --- 同じプロセスで動かすホスト ---
+// WinMain の後半と同じ手順で VstHost を作り、別スレッドでメッセージループを回す
+class InProcessHost
+{
+public:
+    explicit InProcessHost(const HostClient::HostConfig &config)
+    {
+        m_options.uniqueId = config.uid;
+        m_options.pipeNameBase = HostClient::Widen(HostClient::PIPE_NAME_BASE);
+        m_options.shmNameBase = HostClient::Widen(HostClient::SHM_NAME_BASE);
+        m_options.eventClientReadyNameBase = HostClient::Widen(HostClient::READY_EVENT_NAME_BASE);
+        m_options.eventHostDoneNameBase = HostClient::Widen(HostClient::DONE_EVENT_NAME_BASE);
+        m_options.layoutVersion = config.layout;
+        m_options.shmCapacity = (size_t)config.shmMiB * 1024 * 1024;
+        m_options.sample64 = config.sample64;
+        m_options.wake = config.spinWake ? WakeMode::Spin : WakeMode::Event;
+        m_options.spinMicros = config.spinMicros;
+        m_options.graphWorkers = config.graphWorkers;
+    }
+    ~InProcessHost() { Join(); }
+    bool Start()
+    {
+        m_thread = std::thread([this]() {
+            t_ignored = true;
+            if (FAILED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED)))
+            {
+                m_state = -1;
+                return;
+            }
+            g_pVstHost = new VstHost(GetModuleHandle(NULL), m_options);
+            PluginContextFactory::instance().setPluginContext(static_cast<IHostApplication *>(g_pVstHost));
+            if (g_pVstHost->Initialize())
+            {
+                m_state = 1;
+                g_pVstHost->RunMessageLoop();
+            }
+            else
+            {
+                m_state = -1;
+            }
+            g_pVstHost->release();
+            g_pVstHost = nullptr;
+            PluginContextFactory::instance().setPluginContext(nullptr);
+            CoUninitialize();
+        });
+        while (m_state == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return m_state > 0;
+    }
+    // 制御パイプがつながらなかったときに、exit の代わりにメッセージループを止める
+    void RequestStop()
+    {
+        if (m_state > 0 && g_pVstHost)
+            g_pVstHost->RequestStop();
+    }
+    void Join()
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+private:
+    HostOptions m_options;
+    std::thread m_thread;
+    std::atomic<int> m_state{0};
+};
+
+struct AllocationCase
+{
+    const char *name;
+    std::string command; // "<load コマンド> <パス...>"。サンプルレートとブロック長は後ろに付ける
+    std::string suffix;  // load_graph の接続リスト
+    int32_t layout;
+    bool sample64;
+    bool spinWake;
+    int32_t graphWorkers;
+};
+
+static std::string PluginPath(const char *name)
+{
+    std::string dir = VSTHOST_TEST_PLUGIN_DIR;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+        dir += '/';
+    return dir + name + ".vst3";
+}
+static void FillInputs(HostClient::Host &client)
+{
+    for (size_t c = 0; c < client.NumInputs(); ++c)
+    {
+        for (int i = 0; i < TEST_BLOCK_SIZE; ++i)
+        {
+            const double value = 0.25 * sin(0.01 * i + (double)c);
+            if (client.SampleBytes() == sizeof(double))
+                ((double *)client.InputChannel(c))[i] = value;
+            else
+                ((float *)client.InputChannel(c))[i] = (float)value;
+        }
+    }
+}
+// パラメータ 0 (テスト用プラグインのゲイン) に点を書き、パラメータ変更のキューも通す。レイアウト2のときだけ
+static void WriteAutomation(HostClient::Host &client, int block)
+{
+    HostClient::AutomationBlock *automation = client.Automation();
+    if (!automation)
+        return;
+    const int numPoints = 8;
+    for (int i = 0; i < numPoints; ++i)
+    {
+        automation->points[i].paramId = 0;
+        automation->points[i].sampleOffset = i * TEST_BLOCK_SIZE / numPoints;
+        automation->points[i].value = 0.5 + 0.5 * ((block + i) & 1);
+    }
+    automation->numPoints = numPoints;
+}
+
+static void RunCase(const AllocationCase &test, uint64_t uid)
+{
+    HostClient::HostConfig config;
+    config.uid = uid;
+    config.layout = test.layout;
+    config.sample64 = test.sample64;
+    config.spinWake = test.spinWake;
+    config.graphWorkers = test.graphWorkers;
+    InProcessHost host(config);
+    if (!host.Start())
+    {
+        CHECK(false, "%s: the host did not start", test.name);
+        return;
+    }
+    HostClient::Host client;
+    std::string error, result;
+    if (!client.Start(config, error))
+    {
+        CHECK(false, "%s: %s", test.name, error.c_str());
+        client.Stop();
+        host.RequestStop();
+        return;
+    }
+    const uint64_t beforeLoad = g_allocations.load();
+    char args[64];
+    snprintf(args, sizeof(args), " %.0f %d", TEST_SAMPLE_RATE, TEST_BLOCK_SIZE);
+    const bool loaded = client.Load(test.command + args + test.suffix, result) && client.ReadLayout();
+    CHECK(loaded, "%s: load failed (%s)", test.name, result.c_str());
+    // 読み込みでは確保が起きるので、数えられていなければ置き換えが効いていない
+    CHECK(g_allocations.load() > beforeLoad, "%s: the allocation counter saw nothing during the load", test.name);
+    if (loaded)
+    {
+        FillInputs(client);
+        bool processed = true;
+        uint64_t beforeBlocks = 0;
+        for (int block = 0; block < WARMUP_BLOCKS + MEASURED_BLOCKS && processed; ++block)
+        {
+            if (block == WARMUP_BLOCKS)
+                beforeBlocks = g_hostAllocations.load();
+            WriteAutomation(client, block);
+            processed = client.ProcessBlock(TEST_BLOCK_SIZE, TEST_SAMPLE_RATE);
+        }
+        const uint64_t allocations = g_hostAllocations.load() - beforeBlocks;
+        CHECK(processed, "%s: block round trip timed out", test.name);
+        CHECK(allocations == 0, "%s: %llu allocation(s) on the host threads over %d blocks", test.name, (unsigned long long)allocations, MEASURED_BLOCKS);
+        printf("%s: %llu allocation(s) over %d blocks\n", test.name, (unsigned long long)allocations, MEASURED_BLOCKS);
+    }
+    client.Stop();
+    host.Join();
+}
+
+int main()
+{
+    t_ignored = true;
+    const std::string passthrough = PluginPath("VstHostTestPassthrough");
+    const std::string fixedCost = PluginPath("VstHostTestFixedCost");
+    if (GetFileAttributesA(passthrough.c_str()) == INVALID_FILE_ATTRIBUTES || GetFileAttributesA(fixedCost.c_str()) == INVALID_FILE_ATTRIBUTES)
+    {
+        printf("SKIP: test plugins not found (%s)\n", passthrough.c_str());
+        return SKIP_EXIT_CODE;
+    }
+    setlocale(LC_ALL, "C");
+    const std::string p = " \"" + passthrough + "\"", f = " \"" + fixedCost + "\"";
+    const AllocationCase cases[] = {
+        {"layout1", "load_plugin" + p, "", 1, false, false, 0},
+        {"layout2", "load_plugin" + p, "", 2, false, false, 0},
+        {"sample64", "load_plugin" + p, "", 2, true, false, 0},
+        {"sample64_convert", "load_plugin" + f, "", 2, true, false, 0},
+        {"spin", "load_plugin" + p, "", 2, false, true, 0},
+        {"chain", "load_chain" + p + f + p, "", 2, false, false, 0},
+        {"graph", "load_graph" + p + f + f + p, " 0>1,0>2,1>3,2>3", 2, false, false, 2},
+    };
+    uint64_t uid = (uint64_t)GetCurrentProcessId() * 100;
+    for (const auto &test : cases)
+        RunCase(test, ++uid);
+    printf("AllocationTest: %s\n", g_failures == 0 ? "OK" : "FAILED");
+    return g_failures == 0 ? 0 : 1;
+}
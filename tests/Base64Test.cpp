@@ -0,0 +1,314 @@
+﻿// Base64.h の変換を以前の実装 (Windows では CryptoAPI、それ以外は 1 文字ずつ変換する参照実装) と比べる。
+// 同じソースをスカラー、SSE4.1、AVX2 でビルドしてそれぞれの経路を試す (tests/CMakeLists.txt)。
+// 引数なしでテスト、"bench" で変換速度を測る
+#ifdef _WIN32
+#include <windows.h>
+#include <wincrypt.h>
+#include <intrin.h>
+#pragma comment(lib, "crypt32.lib")
+#endif
+#include "Base64.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+// ctest で飛ばしたことにする終了コード
+const int SKIP_EXIT_CODE = 77;
+
+static int g_failures = 0;
+#define CHECK(condition, ...)                           \
+    do                                                  \
+    {                                                   \
+        if (!(condition))                               \
+        {                                               \
+            ++g_failures;                               \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+        }                                               \
+    } while (0)
+
+// --- 以前の実装 ---
+#ifdef _WIN32
+static std::string OldBase64Encode(const uint8_t *data, size_t size)
+{
+    if (data == nullptr || size == 0)
+        return "";
+    DWORD b64_len = 0;
+    if (!CryptBinaryToStringA(data, (DWORD)size, CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, NULL, &b64_len))
+        return "";
+    if (b64_len == 0)
+        return "";
+    std::string b64_str(b64_len, '\0');
+    if (!CryptBinaryToStringA(data, (DWORD)size, CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, &b64_str[0], &b64_len))
+        return "";
+    b64_str.resize(b64_len - 1);
+    return b64_str;
+}
+static std::vector<uint8_t> OldBase64Decode(const std::string &b64_str)
+{
+    if (b64_str.empty())
+        return {};
+    DWORD bin_len = 0;
+    if (!CryptStringToBinaryA(b64_str.c_str(), (DWORD)b64_str.length(), CRYPT_STRING_BASE64, NULL, &bin_len, NULL, NULL))
+        return {};
+    if (bin_len == 0)
+        return {};
+    std::vector<uint8_t> bin_data(bin_len);
+    if (!CryptStringToBinaryA(b64_str.c_str(), (DWORD)b64_str.length(), CRYPT_STRING_BASE64, bin_data.data(), &bin_len, NULL, NULL))
+        return {};
+    return bin_data;
+}
+#else
+static std::string OldBase64Encode(const uint8_t *data, size_t size)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string text;
+    for (size_t i = 0; i < size; i += 3)
+    {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < size)
+            v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < size)
+            v |= data[i + 2];
+        text += alphabet[v >> 18];
+        text += alphabet[(v >> 12) & 63];
+        text += i + 1 < size ? alphabet[(v >> 6) & 63] : '=';
+        text += i + 2 < size ? alphabet[v & 63] : '=';
+    }
+    return text;
+}
+static std::vector<uint8_t> OldBase64Decode(const std::string &text)
+{
+    std::vector<uint8_t> data;
+    uint32_t v = 0, n = 0;
+    for (char ch : text)
+    {
+        int value;
+        if (ch >= 'A' && ch <= 'Z')
+            value = ch - 'A';
+        else if (ch >= 'a' && ch <= 'z')
+            value = ch - 'a' + 26;
+        else if (ch >= '0' && ch <= '9')
+            value = ch - '0' + 52;
+        else if (ch == '+')
+            value = 62;
+        else if (ch == '/')
+            value = 63;
+        else if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '=')
+            continue;
+        else
+            return {};
+        v = (v << 6) | (uint32_t)value;
+        if (++n == 4)
+        {
+            data.push_back((uint8_t)(v >> 16));
+            data.push_back((uint8_t)(v >> 8));
+            data.push_back((uint8_t)v);
+            v = n = 0;
+        }
+    }
+    if (n == 2)
+        data.push_back((uint8_t)(v >> 4));
+    else if (n == 3)
+    {
+        data.push_back((uint8_t)(v >> 10));
+        data.push_back((uint8_t)(v >> 2));
+    }
+    return data;
+}
+#endif
+
+static const char *CompiledPath()
+{
+#if defined(VSTHOST_HAS_AVX2)
+    return "AVX2";
+#elif defined(VSTHOST_HAS_SSE4)
+    return "SSE4.1";
+#else
+    return "scalar";
+#endif
+}
+// ビルドした命令セットをこの CPU が実行できるか
+static bool CpuSupportsCompiledPath()
+{
+#if defined(VSTHOST_HAS_AVX2)
+#ifdef _WIN32
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+#elif defined(VSTHOST_HAS_SSE4)
+#ifdef _WIN32
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+#else
+    return true;
+#endif
+}
+
+static std::vector<uint8_t> RandomBytes(std::mt19937 &rng, size_t size)
+{
+    std::vector<uint8_t> data(size);
+    for (auto &b : data)
+        b = (uint8_t)rng();
+    return data;
+}
+static bool Decode(const std::string &text, std::vector<uint8_t> &out)
+{
+    out.assign(Base64DecodedMaxLength(text.size()), 0);
+    size_t written = 0;
+    if (!Base64Decode(text.data(), text.size(), out.data(), out.size(), written))
+        return false;
+    out.resize(written);
+    return true;
+}
+
+// SIMD の 1 回分 (12 / 16 / 24 / 32) の前後を含め、長さごとに以前の実装と同じ文字列になり、元に戻ること
+static void TestRoundTrip(std::mt19937 &rng)
+{
+    std::vector<size_t> sizes;
+    for (size_t size = 0; size <= 256; ++size)
+        sizes.push_back(size);
+    for (size_t size : {1000u, 4095u, 4096u, 65536u, 65537u, 1000003u})
+        sizes.push_back(size);
+    for (size_t size : sizes)
+    {
+        const std::vector<uint8_t> data = RandomBytes(rng, size);
+        const std::string text = base64_encode(data.data(), data.size());
+        CHECK(text == OldBase64Encode(data.data(), data.size()), "encode differs from the old codec at %zu bytes", size);
+        CHECK(text.size() == Base64EncodedLength(size), "encoded length %zu for %zu bytes", text.size(), size);
+        std::vector<uint8_t> decoded;
+        CHECK(Decode(text, decoded) && decoded == data, "round trip failed at %zu bytes", size);
+        CHECK(OldBase64Decode(text) == data, "the old codec cannot decode %zu bytes", size);
+    }
+}
+// 空白はどこにあっても読み飛ばし、末尾の '=' は省略できる
+static void TestWhitespace(std::mt19937 &rng)
+{
+    static const char spaces[] = {' ', '\t', '\r', '\n'};
+    for (int iteration = 0; iteration < 2000; ++iteration)
+    {
+        const std::vector<uint8_t> data = RandomBytes(rng, rng() % 300);
+        std::string text = base64_encode(data.data(), data.size());
+        const size_t inserts = rng() % 8;
+        for (size_t k = 0; k < inserts; ++k)
+            text.insert(text.begin() + rng() % (text.size() + 1), spaces[rng() % 4]);
+        std::vector<uint8_t> decoded;
+        CHECK(Decode(text, decoded) && decoded == data, "whitespace at %zu bytes (%zu inserted)", data.size(), inserts);
+        CHECK(OldBase64Decode(text) == data, "the old codec disagrees on whitespace at %zu bytes", data.size());
+
+        std::string unpadded = base64_encode(data.data(), data.size());
+        while (!unpadded.empty() && unpadded.back() == '=')
+            unpadded.pop_back();
+        CHECK(Decode(unpadded, decoded) && decoded == data, "missing padding at %zu bytes", data.size());
+    }
+    // 64KB の途中で 76 文字ごとに改行が入る (MIME の形)
+    const std::vector<uint8_t> data = RandomBytes(rng, 65536);
+    const std::string text = base64_encode(data.data(), data.size());
+    std::string wrapped;
+    for (size_t i = 0; i < text.size(); i += 76)
+        wrapped += text.substr(i, 76) + "\r\n";
+    std::vector<uint8_t> decoded;
+    CHECK(Decode(wrapped, decoded) && decoded == data, "wrapped lines");
+}
+// base64 の文字以外、'=' の後のデータ、1 文字だけ余ったものは失敗する
+static void TestInvalid(std::mt19937 &rng)
+{
+    static const char invalid[] = {'-', '_', '.', '*', '\0', '\x7f', '\x80', '\xff', '@', '['};
+    for (int iteration = 0; iteration < 4000; ++iteration)
+    {
+        const std::vector<uint8_t> data = RandomBytes(rng, 1 + rng() % 200);
+        std::string text = base64_encode(data.data(), data.size());
+        text[rng() % text.size()] = invalid[rng() % sizeof(invalid)];
+        std::vector<uint8_t> decoded;
+        CHECK(!Decode(text, decoded), "invalid character accepted at %zu bytes", data.size());
+    }
+    std::vector<uint8_t> decoded;
+    CHECK(!Decode("QQ==QUJD", decoded), "data after padding accepted");
+    CHECK(!Decode("QUJDR", decoded), "a single trailing character accepted");
+    CHECK(Decode("", decoded) && decoded.empty(), "empty input");
+    CHECK(Decode(" \r\n", decoded) && decoded.empty(), "whitespace only");
+    // 出力先が足りなければ失敗し、はみ出して書かない
+    const std::vector<uint8_t> data = RandomBytes(rng, 96);
+    const std::string text = base64_encode(data.data(), data.size());
+    std::vector<uint8_t> out(data.size() + 32, 0xAB);
+    size_t written = 0;
+    CHECK(!Base64Decode(text.data(), text.size(), out.data(), data.size() - 1, written), "short capacity accepted");
+    CHECK(out[data.size() - 1] == 0xAB, "wrote past the capacity");
+    CHECK(Base64Decode(text.data(), text.size(), out.data(), data.size(), written) && written == data.size(), "exact capacity");
+}
+
+// 1 回分の時間 (秒) を、合計が 0.2 秒を超えるまで繰り返した平均で測る
+template <typename F>
+static double Measure(F &&f)
+{
+    using Clock = std::chrono::steady_clock;
+    int iterations = 0;
+    const auto start = Clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        f();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < 0.2);
+    return elapsed / iterations;
+}
+static void RunBenchmark()
+{
+    std::mt19937 rng(1);
+    printf("path: %s\n", CompiledPath());
+    printf("%10s %14s %14s %14s %14s\n", "bytes", "encode MB/s", "old encode", "decode MB/s", "old decode");
+    for (size_t size : {4096u, 65536u, 1048576u, 16777216u})
+    {
+        const std::vector<uint8_t> data = RandomBytes(rng, size);
+        const std::string text = base64_encode(data.data(), data.size());
+        std::vector<uint8_t> out(Base64DecodedMaxLength(text.size()));
+        std::string encoded(Base64EncodedLength(size), '\0');
+        size_t sink = 0;
+        const double encode = Measure([&] { sink += Base64Encode(data.data(), data.size(), &encoded[0]); });
+        const double oldEncode = Measure([&] { sink += OldBase64Encode(data.data(), data.size()).size(); });
+        auto decodeOnce = [&]
+        {
+            size_t written = 0;
+            Base64Decode(text.data(), text.size(), out.data(), out.size(), written);
+            sink += written;
+        };
+        const double decode = Measure(decodeOnce);
+        const double oldDecode = Measure([&] { sink += OldBase64Decode(text).size(); });
+        const double mb = size / 1048576.0;
+        printf("%10zu %14.1f %14.1f %14.1f %14.1f\n", size, mb / encode, mb / oldEncode, mb / decode, mb / oldDecode);
+        if (sink == 0)
+            printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (!CpuSupportsCompiledPath())
+    {
+        printf("SKIP: this CPU cannot run the %s path\n", CompiledPath());
+        return SKIP_EXIT_CODE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "bench")
+    {
+        RunBenchmark();
+        return 0;
+    }
+    std::mt19937 rng(argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 20240101u);
+    TestRoundTrip(rng);
+    TestWhitespace(rng);
+    TestInvalid(rng);
+    printf("%s: %s\n", CompiledPath(), g_failures == 0 ? "OK" : "FAILED");
+    return g_failures == 0 ? 0 : 1;
+}
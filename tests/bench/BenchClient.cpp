@@ -0,0 +1,698 @@
+﻿// VSTHost のベンチマーク。ホストを起動してテスト用プラグイン (support/TestPlugin.cpp) を読み込み、
+// 共有メモリでブロックを往復させて 1 ブロックの往復時間を測る。結果は 1 行 1 件の JSON で標準出力に書く。
+//   BenchClient sweep [オプション]: ブロック長、チャンネル数、同時に動かすホストの数の組み合わせを順に測る
+//   BenchClient pingpong [オプション]: 小さなブロックで、ホストの起こし方 (-wake event / spin) ごとの往復時間を比べる
+//   BenchClient convert [オプション]: double のデータを渡すときの、64 ビット処理とホスト / クライアントでの変換を比べる
+//   BenchClient workers [オプション]: 幅の広いグラフを -graph_workers を変えて処理し、ワーカー数による伸びを測る
+// ホストかプラグインが見つからないときは 77 (ctest の SKIP) で終わる
+#include "../support/HostClient.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace HostClient;
+
+#ifndef VSTHOST_BENCH_HOST
+#define VSTHOST_BENCH_HOST ""
+#endif
+#ifndef VSTHOST_BENCH_PLUGIN_DIR
+#define VSTHOST_BENCH_PLUGIN_DIR ""
+#endif
+
+// ctest で飛ばしたことにする終了コード
+const int SKIP_EXIT_CODE = 77;
+const double SAMPLE_RATE = 48000.0;
+
+struct BenchOptions
+{
+    std::string host = VSTHOST_BENCH_HOST;
+    std::string pluginDir = VSTHOST_BENCH_PLUGIN_DIR;
+    std::string plugin = "VstHostTestPassthrough";
+    std::vector<int> blocks = {64, 256, 1024};
+    std::vector<int> channels = {2, 8};
+    std::vector<int> streams = {1, 4};
+    int iterations = 2000; // 1 つの組み合わせで測るブロック数 (ストリームごと)
+    int warmup = 200;
+    int points = -1;       // 1 ブロックあたりのオートメーションの点の数。負なら VstHostTestParamHeavy だけ 64
+    bool spinWake = false;
+    int spinMicros = 50;
+    int costMicros = 0;
+    bool sample64 = false;
+    int graphWorkers = 0;
+    std::vector<int> widths = {2, 4, 8}; // workers で並べる FixedCost のノード数
+    std::vector<int> workers;            // workers で試す -graph_workers。0 は必ず測る
+    std::vector<std::string> wakes = {"event", "spin", "block"}; // pingpong で比べる起こし方
+};
+
+static std::vector<int> ParseList(const std::string &text)
+{
+    std::vector<int> values;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos)
+            end = text.size();
+        int value = atoi(text.substr(pos, end - pos).c_str());
+        if (value > 0)
+            values.push_back(value);
+        pos = end + 1;
+    }
+    return values;
+}
+static std::vector<std::string> ParseNames(const std::string &text)
+{
+    std::vector<std::string> names;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos)
+            end = text.size();
+        if (end > pos)
+            names.push_back(text.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return names;
+}
+static bool FileExists(const std::string &path)
+{
+    return GetFileAttributesW(Widen(path).c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+static std::string PluginPath(const BenchOptions &options, const std::string &name)
+{
+    std::string dir = options.pluginDir;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+        dir += '/';
+    return dir + name + ".vst3";
+}
+static uint64_t NextUid()
+{
+    // ctest が並べて動かしても名前がぶつからないよう、プロセス ID を混ぜる
+    static uint64_t next = (uint64_t)GetCurrentProcessId() * 1000;
+    return ++next;
+}
+
+// --- 統計 ---
+struct LatencySummary
+{
+    size_t count = 0;
+    double p50 = 0, p99 = 0, p999 = 0, max = 0; // マイクロ秒
+};
+static double Percentile(const std::vector<uint64_t> &sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)ceil(fraction * sorted.size());
+    rank = std::min(std::max(rank, (size_t)1), sorted.size());
+    return sorted[rank - 1] / 1000.0;
+}
+static LatencySummary Summarize(std::vector<uint64_t> &latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    LatencySummary summary;
+    summary.count = latencies.size();
+    summary.p50 = Percentile(latencies, 0.50);
+    summary.p99 = Percentile(latencies, 0.99);
+    summary.p999 = Percentile(latencies, 0.999);
+    summary.max = latencies.empty() ? 0.0 : latencies.back() / 1000.0;
+    return summary;
+}
+
+// --- ホストの起動と読み込み ---
+static HostConfig MakeConfig(const BenchOptions &options, int numChannels)
+{
+    HostConfig config;
+    config.executable = options.host;
+    config.uid = NextUid();
+    config.spinWake = options.spinWake;
+    config.spinMicros = options.spinMicros;
+    config.sample64 = options.sample64;
+    config.graphWorkers = options.graphWorkers;
+    config.environment = {{"VSTHOST_TEST_CHANNELS", std::to_string(numChannels)}, {"VSTHOST_TEST_COST_US", std::to_string(options.costMicros)}};
+    return config;
+}
+static bool StartHosts(std::vector<std::unique_ptr<Host>> &hosts, const std::vector<HostConfig> &configs)
+{
+    hosts.clear();
+    for (const auto &config : configs)
+    {
+        hosts.emplace_back(new Host());
+        std::string error;
+        if (!hosts.back()->Start(config, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+static bool LoadPlugin(Host &host, const std::string &command, int blockSize, const std::string &suffix = std::string())
+{
+    std::string result;
+    char args[64];
+    snprintf(args, sizeof(args), " %.0f %d", SAMPLE_RATE, blockSize);
+    if (!host.Load(command + args + suffix, result))
+    {
+        fprintf(stderr, "%s failed: %s\n", command.c_str(), result.c_str());
+        return false;
+    }
+    if (!host.ReadLayout() || (int)host.BlockCapacity() < blockSize || host.NumInputs() == 0)
+    {
+        fprintf(stderr, "Unexpected shared memory layout after %s\n", command.c_str());
+        return false;
+    }
+    return true;
+}
+// 入力をチャンネルごとに異なる値で埋める。HostClient の SampleBytes に合わせて float か double で書く
+static void FillInputs(Host &host, int blockSize)
+{
+    for (size_t c = 0; c < host.NumInputs(); ++c)
+    {
+        for (int i = 0; i < blockSize; ++i)
+        {
+            const double value = 0.25 * sin(0.01 * i + (double)c);
+            if (host.SampleBytes() == sizeof(double))
+                ((double *)host.InputChannel(c))[i] = value;
+            else
+                ((float *)host.InputChannel(c))[i] = (float)value;
+        }
+    }
+}
+static void WriteAutomation(Host &host, int points, int blockSize, uint32_t block)
+{
+    AutomationBlock *automation = host.Automation();
+    if (!automation || points <= 0)
+        return;
+    const int count = std::min(points, (int)MAX_AUTOMATION_POINTS);
+    for (int i = 0; i < count; ++i)
+    {
+        // パラメータ 0 はゲインなので 1.0 に保ち、残りのパラメータに点を振る
+        automation->points[i].paramId = (uint32_t)(i % 1023) + 1;
+        automation->points[i].sampleOffset = (int32_t)((int64_t)i * blockSize / count);
+        automation->points[i].value = (double)((block + i) & 0xFF) / 255.0;
+    }
+    automation->numPoints = (uint32_t)count;
+}
+
+// --- 測定 ---
+struct RunResult
+{
+    bool ok = true;
+    LatencySummary latency;
+    double seconds = 0.0;
+    double cpuSeconds = 0.0; // 測定中にホストのプロセスが使った CPU 時間の合計
+    size_t blocks = 0;
+};
+// すべてのホストで同時にブロックを流し、往復時間をまとめる
+static RunResult RunStreams(std::vector<std::unique_ptr<Host>> &hosts, const BenchOptions &options, int blockSize)
+{
+    std::vector<std::vector<uint64_t>> latencies(hosts.size());
+    std::vector<char> failed(hosts.size(), 0);
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    uint64_t startNs = 0;
+    for (size_t s = 0; s < hosts.size(); ++s)
+    {
+        threads.emplace_back([&, s]() {
+            Host &host = *hosts[s];
+            std::vector<uint64_t> &samples = latencies[s];
+            samples.reserve((size_t)options.iterations);
+            FillInputs(host, blockSize);
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (int i = 0; i < options.warmup + options.iterations; ++i)
+            {
+                WriteAutomation(host, options.points, blockSize, (uint32_t)i);
+                const uint64_t t0 = MonotonicNanos();
+                if (!host.ProcessBlock(blockSize, SAMPLE_RATE))
+                {
+                    failed[s] = 1;
+                    return;
+                }
+                if (i >= options.warmup)
+                    samples.push_back(MonotonicNanos() - t0);
+            }
+        });
+    }
+    while (ready.load() < (int)hosts.size())
+        std::this_thread::yield();
+    double cpuStart = 0.0;
+    for (const auto &host : hosts)
+        cpuStart += host->CpuSeconds();
+    startNs = MonotonicNanos();
+    go.store(true, std::memory_order_release);
+    for (auto &thread : threads)
+        thread.join();
+    RunResult result;
+    result.seconds = (MonotonicNanos() - startNs) / 1e9;
+    for (const auto &host : hosts)
+        result.cpuSeconds += host->CpuSeconds();
+    result.cpuSeconds -= cpuStart;
+    std::vector<uint64_t> all;
+    for (size_t s = 0; s < hosts.size(); ++s)
+    {
+        result.ok = result.ok && !failed[s];
+        all.insert(all.end(), latencies[s].begin(), latencies[s].end());
+    }
+    result.blocks = (size_t)(options.warmup + options.iterations) * hosts.size();
+    result.latency = Summarize(all);
+    return result;
+}
+// パススルーのプラグインなら出力が入力と同じになっているはず
+static bool CheckPassthrough(Host &host, int blockSize)
+{
+    for (size_t c = 0; c < std::min(host.NumInputs(), host.NumOutputs()); ++c)
+    {
+        if (memcmp(host.InputChannel(c), host.OutputChannel(c), (size_t)blockSize * host.SampleBytes()) != 0)
+        {
+            fprintf(stderr, "Output channel %zu does not match the input\n", c);
+            return false;
+        }
+    }
+    return true;
+}
+// realtime_factor と cpu_per_stream はストリームあたりの値。cpu_per_stream は 1.0 で CPU 1 コア分
+static void PrintResult(const char *mode, const BenchOptions &options, int blockSize, int numChannels, size_t numStreams, const RunResult &run, const std::string &extra)
+{
+    const double blocksPerSec = run.seconds > 0 ? run.blocks / run.seconds : 0.0;
+    const double cpuPerStream = run.seconds > 0 ? run.cpuSeconds / run.seconds / numStreams : 0.0;
+    printf("{\"mode\":\"%s\",\"plugin\":\"%s\",\"wake\":\"%s\",\"spin_us\":%d,\"block\":%d,\"channels\":%d,\"streams\":%zu,\"samples\":%zu,"
+           "\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"max_us\":%.2f,\"blocks_per_sec\":%.1f,\"realtime_factor\":%.2f,\"cpu_per_stream\":%.3f%s}\n",
+           mode, options.plugin.c_str(), options.spinWake ? "spin" : "event", options.spinWake ? options.spinMicros : 0, blockSize, numChannels, numStreams, run.latency.count,
+           run.latency.p50, run.latency.p99, run.latency.p999, run.latency.max, blocksPerSec, blocksPerSec * blockSize / SAMPLE_RATE / numStreams, cpuPerStream,
+           extra.c_str());
+    fflush(stdout);
+}
+
+// ブロック長 × チャンネル数 × ストリーム数
+static int RunSweep(const BenchOptions &options)
+{
+    const std::string path = PluginPath(options, options.plugin);
+    const bool passthrough = options.plugin == "VstHostTestPassthrough";
+    for (int numChannels : options.channels)
+    {
+        for (int numStreams : options.streams)
+        {
+            std::vector<HostConfig> configs;
+            for (int s = 0; s < numStreams; ++s)
+                configs.push_back(MakeConfig(options, numChannels));
+            std::vector<std::unique_ptr<Host>> hosts;
+            if (!StartHosts(hosts, configs))
+                return 1;
+            for (int blockSize : options.blocks)
+            {
+                for (auto &host : hosts)
+                {
+                    if (!LoadPlugin(*host, "load_plugin \"" + path + "\"", blockSize))
+                        return 1;
+                }
+                RunResult run = RunStreams(hosts, options, blockSize);
+                if (!run.ok)
+                {
+                    fprintf(stderr, "Block round trip timed out (block %d, channels %d, streams %d)\n", blockSize, numChannels, numStreams);
+                    return 1;
+                }
+                if (passthrough && options.points == 0 && !CheckPassthrough(*hosts[0], blockSize))
+                    return 1;
+                PrintResult("sweep", options, blockSize, numChannels, hosts.size(), run, "");
+            }
+        }
+    }
+    return 0;
+}
+
+// 1 つのホストと小さなブロックで往復させ、起こし方ごとの遅延の分布を比べる。
+// "event" は従来の ClientReady / HostDone イベント、"spin" は -spin_us だけスピンしてから眠る方式、
+// "block" は -spin_us 0 (スピンせずにすぐ眠る) で、スピンの効果だけを切り分ける
+static int RunPingPong(const BenchOptions &options)
+{
+    const std::string path = PluginPath(options, options.plugin);
+    const int numChannels = options.channels.front();
+    for (const auto &wake : options.wakes)
+    {
+        BenchOptions variant = options;
+        if (wake == "event")
+        {
+            variant.spinWake = false;
+        }
+        else if (wake == "spin" || wake == "block")
+        {
+            variant.spinWake = true;
+            if (wake == "block")
+                variant.spinMicros = 0;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown wake mode '%s'\n", wake.c_str());
+            return 1;
+        }
+        std::vector<std::unique_ptr<Host>> hosts;
+        if (!StartHosts(hosts, {MakeConfig(variant, numChannels)}))
+            return 1;
+        for (int blockSize : options.blocks)
+        {
+            if (!LoadPlugin(*hosts[0], "load_plugin \"" + path + "\"", blockSize))
+                return 1;
+            RunResult run = RunStreams(hosts, variant, blockSize);
+            if (!run.ok)
+            {
+                fprintf(stderr, "Block round trip timed out (wake %s, block %d)\n", wake.c_str(), blockSize);
+                return 1;
+            }
+            PrintResult("pingpong", variant, blockSize, numChannels, 1, run, ",\"variant\":\"" + wake + "\"");
+        }
+    }
+    return 0;
+}
+
+// クライアントの処理が double で動いている場合に、1 ブロックを渡して受け取るまでの時間を比べる。
+//   direct64: -sample64 と 64 ビット対応のプラグイン。double のまま渡す
+//   host:     -sample64 と 32 ビットのみのプラグイン。ホストが double と float を変換する
+//   client:   32 ビットのホスト。クライアントが float に変換して渡し、出力を double に戻す
+// どれもクライアント側のバッファと共有メモリの間のコピー (または変換) を含めて測る
+struct ConvertVariant
+{
+    const char *name;
+    const char *plugin;
+    bool sample64;
+};
+static int RunConvert(const BenchOptions &options)
+{
+    const ConvertVariant variants[] = {{"direct64", "VstHostTestPassthrough", true},
+                                       {"host", "VstHostTestFixedCost", true},
+                                       {"client", "VstHostTestFixedCost", false}};
+    for (const auto &v : variants)
+    {
+        BenchOptions variant = options;
+        variant.plugin = v.plugin;
+        variant.sample64 = v.sample64;
+        variant.costMicros = 0;
+        const std::string path = PluginPath(variant, variant.plugin);
+        if (!FileExists(path))
+        {
+            printf("SKIP: test plugin not found (%s)\n", path.c_str());
+            return SKIP_EXIT_CODE;
+        }
+        for (int numChannels : options.channels)
+        {
+            std::vector<std::unique_ptr<Host>> hosts;
+            if (!StartHosts(hosts, {MakeConfig(variant, numChannels)}))
+                return 1;
+            Host &host = *hosts[0];
+            for (int blockSize : options.blocks)
+            {
+                if (!LoadPlugin(host, "load_plugin \"" + path + "\"", blockSize))
+                    return 1;
+                if (host.SampleBytes() != (v.sample64 ? sizeof(double) : sizeof(float)))
+                {
+                    fprintf(stderr, "Unexpected sample size %u for %s\n", host.SampleBytes(), v.name);
+                    return 1;
+                }
+                // クライアントの処理系が持っている double のバッファ
+                const size_t numInputs = host.NumInputs(), numOutputs = host.NumOutputs();
+                std::vector<std::vector<double>> inputs(numInputs, std::vector<double>((size_t)blockSize));
+                std::vector<std::vector<double>> outputs(numOutputs, std::vector<double>((size_t)blockSize));
+                for (size_t c = 0; c < numInputs; ++c)
+                {
+                    for (int i = 0; i < blockSize; ++i)
+                        inputs[c][i] = 0.25 * sin(0.01 * i + (double)c);
+                }
+                std::vector<uint64_t> latencies;
+                latencies.reserve((size_t)options.iterations);
+                const double cpuStart = host.CpuSeconds();
+                const uint64_t startNs = MonotonicNanos();
+                for (int n = 0; n < options.warmup + options.iterations; ++n)
+                {
+                    const uint64_t t0 = MonotonicNanos();
+                    for (size_t c = 0; c < numInputs; ++c)
+                    {
+                        if (v.sample64)
+                        {
+                            memcpy(host.InputChannel(c), inputs[c].data(), (size_t)blockSize * sizeof(double));
+                        }
+                        else
+                        {
+                            float *dst = (float *)host.InputChannel(c);
+                            for (int i = 0; i < blockSize; ++i)
+                                dst[i] = (float)inputs[c][i];
+                        }
+                    }
+                    if (!host.ProcessBlock(blockSize, SAMPLE_RATE))
+                    {
+                        fprintf(stderr, "Block round trip timed out (%s, block %d)\n", v.name, blockSize);
+                        return 1;
+                    }
+                    for (size_t c = 0; c < numOutputs; ++c)
+                    {
+                        if (v.sample64)
+                        {
+                            memcpy(outputs[c].data(), host.OutputChannel(c), (size_t)blockSize * sizeof(double));
+                        }
+                        else
+                        {
+                            const float *src = (const float *)host.OutputChannel(c);
+                            for (int i = 0; i < blockSize; ++i)
+                                outputs[c][i] = src[i];
+                        }
+                    }
+                    if (n >= options.warmup)
+                        latencies.push_back(MonotonicNanos() - t0);
+                }
+                RunResult run;
+                run.seconds = (MonotonicNanos() - startNs) / 1e9;
+                run.cpuSeconds = host.CpuSeconds() - cpuStart;
+                run.blocks = (size_t)(options.warmup + options.iterations);
+                run.latency = Summarize(latencies);
+                // 変換を通ると float の精度に落ちるので、差が float の丸め誤差を超えないことだけを確かめる
+                for (size_t c = 0; c < std::min(numInputs, numOutputs); ++c)
+                {
+                    for (int i = 0; i < blockSize; ++i)
+                    {
+                        if (fabs(outputs[c][i] - inputs[c][i]) > 1.0e-6)
+                        {
+                            fprintf(stderr, "Output of %s differs from the input (channel %zu, sample %d)\n", v.name, c, i);
+                            return 1;
+                        }
+                    }
+                }
+                PrintResult("convert", variant, blockSize, numChannels, 1, run, std::string(",\"variant\":\"") + v.name + "\"");
+            }
+        }
+    }
+    return 0;
+}
+
+// ノード 0 (Passthrough) から width 個の FixedCost に分岐し、最後の Passthrough で合流するグラフ。
+// 各ノードは 1 ブロックに -cost_us だけかかるので、理想的には -graph_workers を増やすと width 倍まで速くなる。
+// speedup は同じ幅の -graph_workers 0 (オーディオスレッドだけ) に対する p50 の比
+static int RunWorkers(const BenchOptions &options)
+{
+    const std::string source = PluginPath(options, "VstHostTestPassthrough");
+    const std::string node = PluginPath(options, "VstHostTestFixedCost");
+    if (!FileExists(node))
+    {
+        printf("SKIP: test plugin not found (%s)\n", node.c_str());
+        return SKIP_EXIT_CODE;
+    }
+    std::vector<int> workerCounts = options.workers;
+    workerCounts.erase(std::remove(workerCounts.begin(), workerCounts.end(), 0), workerCounts.end());
+    workerCounts.insert(workerCounts.begin(), 0);
+    const int numChannels = options.channels.front();
+    const int blockSize = options.blocks.front();
+    std::vector<double> baseline(options.widths.size(), 0.0);
+    for (int numWorkers : workerCounts)
+    {
+        BenchOptions variant = options;
+        variant.plugin = "VstHostTestFixedCost";
+        variant.graphWorkers = numWorkers;
+        std::vector<std::unique_ptr<Host>> hosts;
+        if (!StartHosts(hosts, {MakeConfig(variant, numChannels)}))
+            return 1;
+        for (size_t w = 0; w < options.widths.size(); ++w)
+        {
+            const int width = options.widths[w];
+            std::string command = "load_graph \"" + source + "\"";
+            std::string edges;
+            for (int n = 1; n <= width; ++n)
+            {
+                command += " \"" + node + "\"";
+                edges += (edges.empty() ? "" : ",") + std::string("0>") + std::to_string(n);
+            }
+            command += " \"" + source + "\"";
+            for (int n = 1; n <= width; ++n)
+                edges += "," + std::to_string(n) + ">" + std::to_string(width + 1);
+            if (!LoadPlugin(*hosts[0], command, blockSize, " " + edges))
+                return 1;
+            RunResult run = RunStreams(hosts, variant, blockSize);
+            if (!run.ok)
+            {
+                fprintf(stderr, "Block round trip timed out (width %d, workers %d)\n", width, numWorkers);
+                return 1;
+            }
+            if (numWorkers == 0)
+                baseline[w] = run.latency.p50;
+            char extra[128];
+            snprintf(extra, sizeof(extra), ",\"width\":%d,\"workers\":%d,\"cost_us\":%d,\"speedup\":%.2f", width, numWorkers, options.costMicros,
+                     run.latency.p50 > 0 ? baseline[w] / run.latency.p50 : 0.0);
+            PrintResult("workers", variant, blockSize, numChannels, 1, run, extra);
+        }
+    }
+    return 0;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: BenchClient <mode> [options]\n"
+           "Modes:\n"
+           "  sweep                 Sweep block size, channel count and stream count\n"
+           "  pingpong              Compare round-trip latency of the wake modes at small block sizes\n"
+           "  convert               Compare 64-bit processing with host-side and client-side double/float conversion\n"
+           "  workers               Measure graph scaling over -graph_workers for wide graphs\n"
+           "Options:\n"
+           "  -host <path>          VSTHost executable (default: %s)\n"
+           "  -plugins <dir>        Directory with the VstHostTest*.vst3 bundles (default: %s)\n"
+           "  -plugin <name>        VstHostTestPassthrough, VstHostTestFixedCost, VstHostTestAllocating or VstHostTestParamHeavy\n"
+           "  -blocks <list>        Block sizes, e.g. 64,256,1024\n"
+           "  -channels <list>      Channel counts, e.g. 2,8\n"
+           "  -streams <list>       Number of host processes run at once, e.g. 1,4\n"
+           "  -iterations <n>       Measured blocks per stream and point (default: 2000)\n"
+           "  -warmup <n>           Blocks run before measuring (default: 200)\n"
+           "  -points <n>           Automation points written per block (default: 64 for VstHostTestParamHeavy, else 0)\n"
+           "  -cost_us <n>          Work per block for VstHostTestFixedCost\n"
+           "  -wake <event|spin>    Host wake mode\n"
+           "  -spin_us <n>          Spin duration for -wake spin (default: 50)\n"
+           "  -wakes <list>         Wake modes for pingpong: event, spin, block (spin with -spin_us 0)\n"
+           "  -widths <list>        Parallel FixedCost nodes for workers (default: 2,4,8)\n"
+           "  -workers <list>       -graph_workers values for workers (0 is always included)\n"
+           "  -quick                Short run for smoke tests\n",
+           VSTHOST_BENCH_HOST, VSTHOST_BENCH_PLUGIN_DIR);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help")
+    {
+        PrintUsage();
+        return argc < 2 ? 1 : 0;
+    }
+    const std::string mode = argv[1];
+    if (mode != "sweep" && mode != "pingpong" && mode != "convert" && mode != "workers")
+    {
+        fprintf(stderr, "Unknown mode '%s'\n", mode.c_str());
+        return 1;
+    }
+    BenchOptions options;
+    if (mode == "pingpong")
+    {
+        options.blocks = {32, 64};
+        options.channels = {2};
+        options.iterations = 20000;
+        options.warmup = 1000;
+    }
+    else if (mode == "convert")
+    {
+        options.iterations = 5000;
+    }
+    else if (mode == "workers")
+    {
+        options.blocks = {256};
+        options.channels = {2};
+        options.iterations = 500;
+        options.warmup = 50;
+        options.costMicros = 200;
+        const int cores = (int)std::thread::hardware_concurrency();
+        for (int n = 1; n < cores && n <= 32; n *= 2)
+            options.workers.push_back(n);
+        if (options.workers.empty())
+            options.workers.push_back(1);
+    }
+    for (int i = 2; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-host" && hasValue)
+            options.host = argv[++i];
+        else if (arg == "-plugins" && hasValue)
+            options.pluginDir = argv[++i];
+        else if (arg == "-plugin" && hasValue)
+            options.plugin = argv[++i];
+        else if (arg == "-blocks" && hasValue)
+            options.blocks = ParseList(argv[++i]);
+        else if (arg == "-channels" && hasValue)
+            options.channels = ParseList(argv[++i]);
+        else if (arg == "-streams" && hasValue)
+            options.streams = ParseList(argv[++i]);
+        else if (arg == "-iterations" && hasValue)
+            options.iterations = std::max(1, atoi(argv[++i]));
+        else if (arg == "-warmup" && hasValue)
+            options.warmup = std::max(0, atoi(argv[++i]));
+        else if (arg == "-points" && hasValue)
+            options.points = std::max(0, atoi(argv[++i]));
+        else if (arg == "-cost_us" && hasValue)
+            options.costMicros = std::max(0, atoi(argv[++i]));
+        else if (arg == "-wake" && hasValue)
+            options.spinWake = std::string(argv[++i]) == "spin";
+        else if (arg == "-spin_us" && hasValue)
+            options.spinMicros = std::max(0, atoi(argv[++i]));
+        else if (arg == "-wakes" && hasValue)
+            options.wakes = ParseNames(argv[++i]);
+        else if (arg == "-widths" && hasValue)
+            options.widths = ParseList(argv[++i]);
+        else if (arg == "-workers" && hasValue)
+        {
+            // 0 も受け付ける
+            options.workers.clear();
+            for (const auto &value : ParseNames(argv[++i]))
+                options.workers.push_back(std::max(0, std::min(atoi(value.c_str()), 32)));
+        }
+        else if (arg == "-quick")
+        {
+            options.blocks = {mode == "pingpong" ? 32 : 256};
+            options.channels = {2};
+            options.streams = {1, 2};
+            options.widths = {2};
+            options.workers = {1};
+            options.iterations = 200;
+            options.warmup = 20;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (options.points < 0)
+        options.points = options.plugin == "VstHostTestParamHeavy" ? 64 : 0;
+    if (options.blocks.empty() || options.channels.empty() || options.streams.empty() || options.wakes.empty() || options.widths.empty())
+    {
+        fprintf(stderr, "Empty sweep list\n");
+        return 1;
+    }
+    if (options.host.empty() || !FileExists(options.host))
+    {
+        printf("SKIP: VSTHost executable not found (%s)\n", options.host.c_str());
+        return SKIP_EXIT_CODE;
+    }
+    if (!FileExists(PluginPath(options, options.plugin)))
+    {
+        printf("SKIP: test plugin not found (%s)\n", PluginPath(options, options.plugin).c_str());
+        return SKIP_EXIT_CODE;
+    }
+    if (mode == "sweep")
+        return RunSweep(options);
+    if (mode == "pingpong")
+        return RunPingPong(options);
+    if (mode == "convert")
+        return RunConvert(options);
+    return RunWorkers(options);
+}
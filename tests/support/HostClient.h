@@ -0,0 +1,506 @@
+﻿#pragma once
+// VSTHost をクライアントとして動かす。AllocationTest から使う。
+// BenchClient もこれでホストを起動して測る。
+// 制御パイプでコマンドを送り、共有メモリでブロックを往復させる。
+// 共有メモリの構造は VSTHost.cpp と README の「オーディオ処理」に合わせる
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace HostClient
+{
+// --- VSTHost.cpp と同じ共有メモリの構造 ---
+#pragma pack(push, 1)
+struct AudioSharedData
+{
+    double sampleRate;
+    int32_t numSamples;
+    int32_t numChannels;
+};
+#pragma pack(pop)
+// 従来のレイアウト: AudioSharedData の後ろに入力 L / R、出力 L / R の float が LEGACY_BLOCK_SIZE 個ずつ並ぶ
+const int LEGACY_BLOCK_SIZE = 2048;
+const size_t LEGACY_BUFFER_BYTES = LEGACY_BLOCK_SIZE * sizeof(float);
+const size_t CACHE_LINE_SIZE = 64;
+inline size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+const uint32_t SHARED_LAYOUT_MAGIC = 0x4C545356; // "VSTL"
+const int MAX_LAYOUT_BUSES = 16;
+const int MAX_LAYOUT_CHANNELS = 256;
+struct SharedBusLayout
+{
+    int32_t numChannels;
+    uint32_t firstChannel;
+};
+struct SharedLayoutHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerBytes;
+    std::atomic<uint32_t> generation;
+    uint64_t totalBytes;
+    uint32_t blockCapacity;
+    uint32_t sampleBytes;
+    uint32_t slotCount;
+    uint32_t slotBytes;
+    uint32_t slotsOffset;
+    uint32_t numInputBuses;
+    uint32_t numOutputBuses;
+    uint32_t numChannels;
+    SharedBusLayout inputBuses[MAX_LAYOUT_BUSES];
+    SharedBusLayout outputBuses[MAX_LAYOUT_BUSES];
+    uint32_t channelOffsets[MAX_LAYOUT_CHANNELS];
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail;
+};
+struct WakeSyncBlock
+{
+    uint32_t magic;
+    uint32_t spinMicros;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> clientSeq;
+    std::atomic<uint32_t> hostWaiting;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> hostSeq;
+    std::atomic<uint32_t> clientWaiting;
+};
+const uint32_t MAX_AUTOMATION_POINTS = 1024;
+struct AutomationPoint
+{
+    uint32_t paramId;
+    int32_t sampleOffset;
+    double value;
+};
+struct AutomationBlock
+{
+    uint32_t numPoints;
+    uint32_t reserved;
+    AutomationPoint points[MAX_AUTOMATION_POINTS];
+};
+struct AutomationHeader
+{
+    uint32_t magic;
+    uint32_t slotCount;
+    uint32_t maxPoints;
+    uint32_t blockBytes;
+};
+const size_t AUTOMATION_HEADER_BYTES = AlignUp(sizeof(AutomationHeader), CACHE_LINE_SIZE);
+
+inline uint64_t MonotonicNanos()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 動かすホストの設定。名前はすべて "<ベース名>_<uid>" になる
+struct HostConfig
+{
+    std::string executable;       // 空なら起動せず、同じ uid で動いているホストにつなぐ
+    uint64_t uid = 0;
+    int32_t layout = 2;           // -layout
+    int32_t shmMiB = 64;          // -shm_size
+    bool sample64 = false;        // -sample64
+    bool spinWake = false;        // -wake spin
+    int32_t spinMicros = 50;      // -spin_us
+    int32_t graphWorkers = 0;     // -graph_workers
+    std::vector<std::string> extraArgs;
+    // テスト用プラグインの設定 (VSTHOST_TEST_*) など、ホストに渡す環境変数
+    std::vector<std::pair<std::string, std::string>> environment;
+};
+const char PIPE_NAME_BASE[] = "\\\\.\\pipe\\VstHostTest";
+const char SHM_NAME_BASE[] = "Local\\VstHostTestAudio";
+const char READY_EVENT_NAME_BASE[] = "Local\\VstHostTestReady";
+const char DONE_EVENT_NAME_BASE[] = "Local\\VstHostTestDone";
+inline std::string UniqueName(const char *base, uint64_t uid) { return std::string(base) + "_" + std::to_string(uid); }
+// HostConfig からホストのコマンドライン引数を作る (HostOptions の既定値と違うものだけ)
+inline std::vector<std::string> HostArguments(const HostConfig &config)
+{
+    std::vector<std::string> args = {"-uid", std::to_string(config.uid), "-pipe", PIPE_NAME_BASE, "-shm", SHM_NAME_BASE,
+                                     "-event_ready", READY_EVENT_NAME_BASE, "-event_done", DONE_EVENT_NAME_BASE};
+    if (config.layout >= 2)
+        args.insert(args.end(), {"-layout", "2", "-shm_size", std::to_string(config.shmMiB)});
+    if (config.sample64)
+        args.push_back("-sample64");
+    if (config.spinWake)
+    {
+        args.insert(args.end(), {"-wake", "spin", "-spin_us", std::to_string(config.spinMicros)});
+    }
+    if (config.graphWorkers > 0)
+        args.insert(args.end(), {"-graph_workers", std::to_string(config.graphWorkers)});
+    args.insert(args.end(), config.extraArgs.begin(), config.extraArgs.end());
+    return args;
+}
+
+inline std::wstring Widen(const std::string &text)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0);
+    std::wstring wide(length > 0 ? length : 0, L'\0');
+    if (length > 0)
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), (int)text.size(), &wide[0], length);
+    return wide;
+}
+
+// 名前付き共有メモリを開く (作るのはホスト)
+class SharedMapping
+{
+public:
+    SharedMapping() {}
+    ~SharedMapping() { Close(); }
+    SharedMapping(const SharedMapping &) = delete;
+    SharedMapping &operator=(const SharedMapping &) = delete;
+    bool Open(const std::string &name)
+    {
+        Close();
+        m_hMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, Widen(name).c_str());
+        if (!m_hMapping)
+            return false;
+        m_pData = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (!m_pData)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+    void Close()
+    {
+        if (m_pData)
+            UnmapViewOfFile(m_pData);
+        if (m_hMapping)
+            CloseHandle(m_hMapping);
+        m_pData = nullptr;
+        m_hMapping = NULL;
+    }
+    void *data() const { return m_pData; }
+
+private:
+    HANDLE m_hMapping = NULL;
+    void *m_pData = nullptr;
+};
+
+// ホスト 1 つ分。コマンドを送り、共有メモリでブロックを処理させる
+class Host
+{
+public:
+    Host() {}
+    ~Host() { Stop(); }
+    Host(const Host &) = delete;
+    Host &operator=(const Host &) = delete;
+
+    // ホストを起動し (executable が空なら起動済みのものに)、制御パイプ、共有メモリ、イベントにつなぐ
+    bool Start(const HostConfig &config, std::string &error)
+    {
+        m_config = config;
+        if (!config.executable.empty() && !Launch(error))
+            return false;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+        while (!Connect())
+        {
+            if (std::chrono::steady_clock::now() > deadline || !Running())
+            {
+                error = "Cannot connect to " + UniqueName(PIPE_NAME_BASE, config.uid);
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        const std::string shmName = UniqueName(SHM_NAME_BASE, config.uid);
+        if (!m_audio.Open(shmName) || (config.layout >= 2 && !m_automation.Open(shmName + "_automation")))
+        {
+            error = "Cannot open the shared memory";
+            return false;
+        }
+        if (config.spinWake)
+        {
+            if (!m_wakeShm.Open(shmName + "_wake"))
+            {
+                error = "Cannot open the wake block";
+                return false;
+            }
+            m_pWake = (WakeSyncBlock *)m_wakeShm.data();
+        }
+        m_hReady = OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, Widen(UniqueName(READY_EVENT_NAME_BASE, config.uid)).c_str());
+        m_hDone = OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, Widen(UniqueName(DONE_EVENT_NAME_BASE, config.uid)).c_str());
+        if (!m_hReady || !m_hDone)
+        {
+            error = "Cannot open the events";
+            return false;
+        }
+        return true;
+    }
+    // exit を送ってホストの終了を待つ
+    void Stop()
+    {
+        if (m_hPipe != INVALID_HANDLE_VALUE)
+        {
+            std::string reply;
+            Command("exit", reply, 2000);
+            CloseHandle(m_hPipe);
+            m_hPipe = INVALID_HANDLE_VALUE;
+        }
+        m_inbound.clear();
+        WaitForExit(5000);
+        m_audio.Close();
+        m_automation.Close();
+        m_wakeShm.Close();
+        m_pWake = nullptr;
+        if (m_hReady)
+            CloseHandle(m_hReady);
+        if (m_hDone)
+            CloseHandle(m_hDone);
+        m_hReady = m_hDone = NULL;
+    }
+
+    // コマンドを 1 つ送り、応答の 1 行 (改行なし) を受け取る
+    bool Command(const std::string &command, std::string &reply, int timeoutMs = 10000)
+    {
+        return Send(command + "\n") && ReadLine(reply, timeoutMs);
+    }
+    // "@<id>" を付けて送り、DONE を待つ (load_plugin などメインスレッドで実行するコマンド用)。result は DONE の結果の部分
+    bool Load(const std::string &command, std::string &result, int timeoutMs = 60000)
+    {
+        const std::string id = "c" + std::to_string(++m_nextRequest);
+        if (!Send("@" + id + " " + command + "\n"))
+            return false;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        std::string line;
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            const int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (!ReadLine(line, std::max(remaining, 1)))
+                break;
+            // "DONE <id> OK|FAIL <queue ms> <run ms> [result]"
+            if (line.rfind("DONE " + id + " ", 0) != 0)
+                continue;
+            std::vector<std::string> fields;
+            size_t pos = 0;
+            while (fields.size() < 5 && pos <= line.size())
+            {
+                size_t end = line.find(' ', pos);
+                if (end == std::string::npos || fields.size() == 4)
+                    end = line.size();
+                fields.push_back(line.substr(pos, end - pos));
+                pos = end + 1;
+            }
+            result = fields.size() > 4 ? fields[4] : std::string();
+            return fields.size() > 2 && fields[2] == "OK";
+        }
+        result = "Timeout";
+        return false;
+    }
+    // 読み込みが終わった後に呼び、チャンネルの位置を読み直す
+    bool ReadLayout()
+    {
+        if (!m_audio.data())
+            return false;
+        if (m_config.layout >= 2)
+            return ReadSharedLayout();
+        // 従来のレイアウトはステレオ固定
+        m_inputOffsets = {sizeof(AudioSharedData), sizeof(AudioSharedData) + LEGACY_BUFFER_BYTES};
+        m_outputOffsets = {sizeof(AudioSharedData) + 2 * LEGACY_BUFFER_BYTES, sizeof(AudioSharedData) + 3 * LEGACY_BUFFER_BYTES};
+        m_sampleBytes = sizeof(float);
+        m_blockCapacity = LEGACY_BLOCK_SIZE;
+        return true;
+    }
+
+    // 入力を書いたスロットをホストに渡し、処理が終わるまで待つ
+    bool ProcessBlock(int32_t numSamples, double sampleRate, int timeoutMs = 5000)
+    {
+        AudioSharedData *block = Slot();
+        if (!block)
+            return false;
+        block->sampleRate = sampleRate;
+        block->numSamples = numSamples;
+        block->numChannels = (int32_t)m_inputOffsets.size();
+        if (m_pWake)
+            return SpinRoundTrip(timeoutMs);
+        SetEvent(m_hReady);
+        return WaitForSingleObject(m_hDone, (DWORD)timeoutMs) == WAIT_OBJECT_0;
+    }
+    void *InputChannel(size_t index) const { return (char *)Slot() + m_inputOffsets[index]; }
+    void *OutputChannel(size_t index) const { return (char *)Slot() + m_outputOffsets[index]; }
+    size_t NumInputs() const { return m_inputOffsets.size(); }
+    size_t NumOutputs() const { return m_outputOffsets.size(); }
+    uint32_t SampleBytes() const { return m_sampleBytes; }
+    uint32_t BlockCapacity() const { return m_blockCapacity; }
+    // 次のブロックのオートメーション (スロット 0)。レイアウト2のときだけ
+    AutomationBlock *Automation() const
+    {
+        return m_automation.data() ? (AutomationBlock *)((char *)m_automation.data() + AUTOMATION_HEADER_BYTES) : nullptr;
+    }
+    // 起動したホストのプロセスがこれまでに使った CPU 時間 (カーネル + ユーザー、秒)
+    double CpuSeconds() const
+    {
+        FILETIME creation, exit, kernel, user;
+        if (!m_hProcess || !GetProcessTimes(m_hProcess, &creation, &exit, &kernel, &user))
+            return 0.0;
+        const uint64_t kernel100ns = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+        const uint64_t user100ns = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+        return (kernel100ns + user100ns) * 1e-7;
+    }
+
+private:
+    SharedLayoutHeader *Layout() const { return (SharedLayoutHeader *)m_audio.data(); }
+    AudioSharedData *Slot() const
+    {
+        if (!m_audio.data())
+            return nullptr;
+        return m_config.layout >= 2 ? (AudioSharedData *)((char *)m_audio.data() + Layout()->slotsOffset) : (AudioSharedData *)m_audio.data();
+    }
+    // 書き換え中 (generation が奇数) でないときに読み、読んでいる間に変わっていなければ使う
+    bool ReadSharedLayout()
+    {
+        const SharedLayoutHeader *h = Layout();
+        if (h->magic != SHARED_LAYOUT_MAGIC)
+            return false;
+        for (int attempt = 0; attempt < 1000; ++attempt)
+        {
+            const uint32_t generation = h->generation.load(std::memory_order_acquire);
+            if (generation & 1)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            m_sampleBytes = h->sampleBytes;
+            m_blockCapacity = h->blockCapacity;
+            m_inputOffsets.clear();
+            m_outputOffsets.clear();
+            for (uint32_t b = 0; b < h->numInputBuses && b < (uint32_t)MAX_LAYOUT_BUSES; ++b)
+            {
+                for (int32_t c = 0; c < h->inputBuses[b].numChannels; ++c)
+                    m_inputOffsets.push_back(h->channelOffsets[h->inputBuses[b].firstChannel + c]);
+            }
+            for (uint32_t b = 0; b < h->numOutputBuses && b < (uint32_t)MAX_LAYOUT_BUSES; ++b)
+            {
+                for (int32_t c = 0; c < h->outputBuses[b].numChannels; ++c)
+                    m_outputOffsets.push_back(h->channelOffsets[h->outputBuses[b].firstChannel + c]);
+            }
+            if (h->generation.load(std::memory_order_acquire) == generation)
+                return true;
+        }
+        return false;
+    }
+    // README の「スピン待機」の手順。clientSeq を進め、ホストが眠っているときだけ起こす
+    bool SpinRoundTrip(int timeoutMs)
+    {
+        WakeSyncBlock *wake = m_pWake;
+        const uint32_t seq = wake->clientSeq.load(std::memory_order_relaxed) + 1;
+        wake->clientSeq.store(seq, std::memory_order_seq_cst);
+        if (wake->hostWaiting.load(std::memory_order_seq_cst))
+        {
+            SetEvent(m_hReady);
+        }
+        const uint64_t startNs = MonotonicNanos();
+        const uint64_t spinNs = (uint64_t)wake->spinMicros * 1000;
+        const uint64_t timeoutNs = (uint64_t)timeoutMs * 1000000;
+        while (wake->hostSeq.load(std::memory_order_acquire) != seq)
+        {
+            const uint64_t elapsed = MonotonicNanos() - startNs;
+            if (elapsed > timeoutNs)
+                return false;
+            if (elapsed < spinNs)
+                continue;
+            wake->clientWaiting.store(1, std::memory_order_seq_cst);
+            if (wake->hostSeq.load(std::memory_order_seq_cst) != seq)
+                WaitForSingleObject(m_hDone, 100);
+            wake->clientWaiting.store(0, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bool Launch(std::string &error)
+    {
+        std::wstring commandLine = L"\"" + Widen(m_config.executable) + L"\"";
+        for (const auto &arg : HostArguments(m_config))
+            commandLine += L" \"" + Widen(arg) + L"\"";
+        for (const auto &variable : m_config.environment)
+            SetEnvironmentVariableW(Widen(variable.first).c_str(), Widen(variable.second).c_str());
+        STARTUPINFOW si = {sizeof(si)};
+        PROCESS_INFORMATION pi = {};
+        if (!CreateProcessW(NULL, &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+        {
+            error = "Cannot start " + m_config.executable + " (" + std::to_string(GetLastError()) + ")";
+            return false;
+        }
+        CloseHandle(pi.hThread);
+        m_hProcess = pi.hProcess;
+        return true;
+    }
+    bool Running() const { return !m_hProcess || WaitForSingleObject(m_hProcess, 0) == WAIT_TIMEOUT; }
+    void WaitForExit(int timeoutMs)
+    {
+        if (!m_hProcess)
+            return;
+        if (WaitForSingleObject(m_hProcess, (DWORD)timeoutMs) != WAIT_OBJECT_0)
+            TerminateProcess(m_hProcess, 1);
+        CloseHandle(m_hProcess);
+        m_hProcess = NULL;
+    }
+    bool Connect()
+    {
+        HANDLE hPipe = CreateFileW(Widen(UniqueName(PIPE_NAME_BASE, m_config.uid)).c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (hPipe == INVALID_HANDLE_VALUE)
+            return false;
+        DWORD mode = PIPE_READMODE_MESSAGE;
+        SetNamedPipeHandleState(hPipe, &mode, NULL, NULL);
+        m_hPipe = hPipe;
+        return true;
+    }
+    bool Send(const std::string &message)
+    {
+        DWORD written = 0;
+        return m_hPipe != INVALID_HANDLE_VALUE && WriteFile(m_hPipe, message.data(), (DWORD)message.size(), &written, NULL) && written == message.size();
+    }
+    // 届いている分を m_inbound に足す。届いていなければ待たずに false
+    bool Receive()
+    {
+        DWORD available = 0;
+        if (!PeekNamedPipe(m_hPipe, NULL, 0, NULL, &available, NULL) || available == 0)
+            return false;
+        std::string buffer(available, '\0');
+        DWORD read = 0;
+        if (!ReadFile(m_hPipe, &buffer[0], available, &read, NULL) && GetLastError() != ERROR_MORE_DATA)
+            return false;
+        m_inbound.append(buffer, 0, read);
+        return true;
+    }
+    bool ReadLine(std::string &line, int timeoutMs)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (true)
+        {
+            size_t end = m_inbound.find('\n');
+            if (end != std::string::npos)
+            {
+                line = m_inbound.substr(0, end);
+                m_inbound.erase(0, end + 1);
+                return true;
+            }
+            if (m_hPipe == INVALID_HANDLE_VALUE || std::chrono::steady_clock::now() > deadline)
+                return false;
+            if (!Receive())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    HostConfig m_config;
+    SharedMapping m_audio, m_automation, m_wakeShm;
+    WakeSyncBlock *m_pWake = nullptr;
+    std::vector<size_t> m_inputOffsets, m_outputOffsets;
+    uint32_t m_sampleBytes = sizeof(float);
+    uint32_t m_blockCapacity = 0;
+    std::string m_inbound;
+    uint64_t m_nextRequest = 0;
+    HANDLE m_hProcess = NULL;
+    HANDLE m_hPipe = INVALID_HANDLE_VALUE;
+    HANDLE m_hReady = NULL, m_hDone = NULL;
+};
+} // namespace HostClient
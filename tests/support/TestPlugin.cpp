@@ -0,0 +1,197 @@
+﻿// テスト用の VST3 プラグイン。同じソースを VSTHOST_TEST_KIND を変えて別々のバンドルにする。
+//   0 = VstHostTestPassthrough: 入力をそのまま出力する (32 / 64 ビット)
+//   1 = VstHostTestFixedCost: 1 ブロックごとに VSTHOST_TEST_COST_US マイクロ秒だけ計算する (32 ビットのみ)
+//   2 = VstHostTestAllocating: 1 ブロックごとに VSTHOST_TEST_ALLOC_BYTES バイトを確保して解放する
+//   3 = VstHostTestParamHeavy: VSTHOST_TEST_PARAMS 個のパラメータを持ち、届いた変更をすべて読む
+// パラメータ 0 は出力のゲイン (既定 1.0)。チャンネル数と各値は環境変数 (ホストを起動するときに BenchClient が設定する) で変えられる
+#include "public.sdk/source/main/pluginfactory.h"
+#include "public.sdk/source/vst/vstsinglecomponenteffect.h"
+#include "pluginterfaces/base/ustring.h"
+#include "pluginterfaces/vst/ivstparameterchanges.h"
+#include "pluginterfaces/vst/vsttypes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+
+#ifndef VSTHOST_TEST_KIND
+#define VSTHOST_TEST_KIND 0
+#endif
+
+namespace
+{
+enum TestKind
+{
+    kPassthrough = 0,
+    kFixedCost,
+    kAllocating,
+    kParamHeavy
+};
+const int MAX_TEST_CHANNELS = 64;
+
+int32 EnvironmentValue(const char *name, int32 fallback, int32 minimum, int32 maximum)
+{
+    const char *text = getenv(name);
+    if (!text || !*text)
+        return fallback;
+    long value = strtol(text, nullptr, 10);
+    return value < minimum ? minimum : (value > maximum ? maximum : (int32)value);
+}
+// 先頭から numChannels 個のスピーカーを使う配置 (1 はモノラル)
+SpeakerArrangement ArrangementFor(int32 numChannels)
+{
+    if (numChannels == 1)
+        return SpeakerArr::kMono;
+    if (numChannels >= MAX_TEST_CHANNELS)
+        return ~0ull;
+    return (1ull << numChannels) - 1;
+}
+
+class TestEffect : public SingleComponentEffect
+{
+public:
+    static FUnknown *createInstance(void *) { return (IAudioProcessor *)new TestEffect(); }
+
+    tresult PLUGIN_API initialize(FUnknown *context) SMTG_OVERRIDE
+    {
+        tresult result = SingleComponentEffect::initialize(context);
+        if (result != kResultOk)
+            return result;
+        m_numChannels = EnvironmentValue("VSTHOST_TEST_CHANNELS", 2, 1, MAX_TEST_CHANNELS);
+        m_costMicros = EnvironmentValue("VSTHOST_TEST_COST_US", 0, 0, 1000000);
+        m_allocBytes = EnvironmentValue("VSTHOST_TEST_ALLOC_BYTES", 65536, 1, 1 << 30);
+        addAudioInput(STR16("Input"), ArrangementFor(m_numChannels));
+        addAudioOutput(STR16("Output"), ArrangementFor(m_numChannels));
+        const int32 numParams = VSTHOST_TEST_KIND == kParamHeavy ? EnvironmentValue("VSTHOST_TEST_PARAMS", 1024, 1, 65536) : 1;
+        for (int32 i = 0; i < numParams; ++i)
+        {
+            String128 title;
+            UString(title, 128).printInt(i);
+            parameters.addParameter(title, nullptr, 0, 1.0, ParameterInfo::kCanAutomate, (ParamID)i);
+        }
+        return kResultOk;
+    }
+    tresult PLUGIN_API setBusArrangements(SpeakerArrangement *inputs, int32 numIns, SpeakerArrangement *outputs, int32 numOuts) SMTG_OVERRIDE
+    {
+        // 初期化時の配置だけを受け付ける
+        const SpeakerArrangement arrangement = ArrangementFor(m_numChannels);
+        if (numIns != 1 || numOuts != 1 || inputs[0] != arrangement || outputs[0] != arrangement)
+            return kResultFalse;
+        return kResultTrue;
+    }
+    tresult PLUGIN_API canProcessSampleSize(int32 symbolicSampleSize) SMTG_OVERRIDE
+    {
+        if (symbolicSampleSize == kSample32)
+            return kResultTrue;
+        return symbolicSampleSize == kSample64 && VSTHOST_TEST_KIND == kPassthrough ? kResultTrue : kResultFalse;
+    }
+    tresult PLUGIN_API setupProcessing(ProcessSetup &setup) SMTG_OVERRIDE
+    {
+        m_sample64 = setup.symbolicSampleSize == kSample64;
+        return SingleComponentEffect::setupProcessing(setup);
+    }
+    tresult PLUGIN_API process(ProcessData &data) SMTG_OVERRIDE
+    {
+        ReadParameterChanges(data.inputParameterChanges);
+        if (data.numSamples <= 0 || data.numInputs < 1 || data.numOutputs < 1)
+            return kResultOk;
+        AudioBusBuffers &in = data.inputs[0];
+        AudioBusBuffers &out = data.outputs[0];
+        const int32 numChannels = in.numChannels < out.numChannels ? in.numChannels : out.numChannels;
+        const float gain = (float)m_gain;
+        for (int32 c = 0; c < numChannels; ++c)
+        {
+            if (m_sample64)
+            {
+                const Sample64 *src = in.channelBuffers64[c];
+                Sample64 *dst = out.channelBuffers64[c];
+                for (int32 i = 0; i < data.numSamples; ++i)
+                    dst[i] = src[i] * m_gain;
+            }
+            else
+            {
+                const Sample32 *src = in.channelBuffers32[c];
+                Sample32 *dst = out.channelBuffers32[c];
+                for (int32 i = 0; i < data.numSamples; ++i)
+                    dst[i] = src[i] * gain;
+            }
+        }
+        out.silenceFlags = in.silenceFlags;
+        if (VSTHOST_TEST_KIND == kFixedCost)
+            Burn(data);
+        else if (VSTHOST_TEST_KIND == kAllocating)
+            Allocate();
+        return kResultOk;
+    }
+
+private:
+    // パラメータ 0 は出力のゲイン。それ以外も最後の点まで読む
+    void ReadParameterChanges(IParameterChanges *changes)
+    {
+        if (!changes)
+            return;
+        const int32 numQueues = changes->getParameterCount();
+        for (int32 q = 0; q < numQueues; ++q)
+        {
+            IParamValueQueue *queue = changes->getParameterData(q);
+            if (!queue)
+                continue;
+            ParamValue value = 0;
+            int32 offset = 0;
+            const int32 numPoints = queue->getPointCount();
+            for (int32 p = 0; p < numPoints; ++p)
+                queue->getPoint(p, offset, value);
+            if (numPoints > 0 && queue->getParameterId() == 0)
+                m_gain = value;
+        }
+    }
+    // 時間で区切るので、ホストの変換やグラフの並列化と関係なく 1 ブロックの負荷が一定になる
+    void Burn(ProcessData &data)
+    {
+        if (m_costMicros <= 0 || m_sample64)
+            return;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_costMicros);
+        Sample32 *dst = data.outputs[0].channelBuffers32[0];
+        float acc = 0.0f;
+        do
+        {
+            for (int32 i = 0; i < data.numSamples; ++i)
+                acc = acc * 0.5f + dst[i] * 1.0e-9f;
+        } while (std::chrono::steady_clock::now() < deadline);
+        dst[0] += acc * 1.0e-30f;
+    }
+    // リアルタイムスレッドでの確保がホストの遅延にどう出るかを見るための、わざと行儀の悪い処理
+    void Allocate()
+    {
+        std::vector<char> scratch((size_t)m_allocBytes);
+        memset(scratch.data(), 0, scratch.size());
+        m_allocSink += scratch[scratch.size() / 2];
+    }
+
+    int32 m_numChannels = 2;
+    int32 m_costMicros = 0;
+    int32 m_allocBytes = 0;
+    bool m_sample64 = false;
+    ParamValue m_gain = 1.0;
+    volatile int32 m_allocSink = 0;
+};
+} // namespace
+
+#if VSTHOST_TEST_KIND == 0
+#define VSTHOST_TEST_NAME "VstHostTestPassthrough"
+#elif VSTHOST_TEST_KIND == 1
+#define VSTHOST_TEST_NAME "VstHostTestFixedCost"
+#elif VSTHOST_TEST_KIND == 2
+#define VSTHOST_TEST_NAME "VstHostTestAllocating"
+#else
+#define VSTHOST_TEST_NAME "VstHostTestParamHeavy"
+#endif
+
+BEGIN_FACTORY_DEF("VSTHost", "https://github.com/Book-0225/VST_host", "")
+DEF_CLASS2(INLINE_UID(0x56535448, 0x42656E63, 0x68546573, 0x74000000 + VSTHOST_TEST_KIND), PClassInfo::kManyInstances, kVstAudioEffectClass,
+           VSTHOST_TEST_NAME, 0, "Fx", "1.0.0", kVstVersionString, TestEffect::createInstance)
+END_FACTORY